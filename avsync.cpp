@@ -0,0 +1,251 @@
+#include "avsync.h"
+#include "metrics.h"
+#include <math.h>
+#include <string.h>
+#include <gst/base/gstbasesink.h>
+
+/* Smoothing of the presentation delays, per buffer */
+#define AV_SYNC_SMOOTHING 0.02
+/* One point of the drift regression per second */
+#define AV_SYNC_DRIFT_INTERVAL G_USEC_PER_SEC
+/* No buffer for that long: paused or seeking, the clocks are compared again from there */
+#define AV_SYNC_CLOCK_GAP (G_USEC_PER_SEC / 2)
+
+/* Upper bounds of the lateness buckets, in ms; the last one is open */
+static const gint bucket_limits[AV_SYNC_BUCKETS - 1] = { -100, -40, -20, -5, 5, 20, 40, 100 };
+static const gchar *const bucket_names[AV_SYNC_BUCKETS] = {
+  "..-100", "-100..-40", "-40..-20", "-20..-5", "-5..5", "5..20", "20..40", "40..100", "100.."
+};
+
+typedef struct _AvSyncSink {
+  guint64 buffers;
+  guint64 late[AV_SYNC_BUCKETS];
+  guint64 late_count;
+  gdouble late_sum_ms;
+  gdouble late_max_ms;
+  gboolean delay_valid;
+  gdouble delay_ms;               /* Smoothed presentation delay */
+} AvSyncSink;
+
+struct _AvSync {
+  GMutex lock;
+  AvSyncSink sinks[AV_SYNC_SINKS];
+
+  /* Least squares fit of the offset against the session time */
+  gint64 session_start;           /* Monotonic, in us */
+  gint64 next_drift_point;
+  gdouble n, sum_t, sum_y, sum_tt, sum_ty;
+
+  /* Pipeline clock against the monotonic clock, over the stretches without gaps */
+  GstClockTime clock_first, clock_last;
+  gint64 mono_first, mono_last;
+  gdouble clock_elapsed, mono_elapsed;    /* Of the previous stretches, in us */
+};
+
+typedef struct _AvSyncProbe {
+  AvSync *sync;
+  guint sink;
+  GstSegment segment;             /* Only touched by the streaming thread */
+} AvSyncProbe;
+
+AvSync *av_sync_new (void)
+{
+  AvSync *sync = g_new0 (AvSync, 1);
+  g_mutex_init (&sync->lock);
+  av_sync_reset (sync);
+  return sync;
+}
+
+void av_sync_free (AvSync *sync)
+{
+  g_mutex_clear (&sync->lock);
+  g_free (sync);
+}
+
+void av_sync_reset (AvSync *sync)
+{
+  g_mutex_lock (&sync->lock);
+  memset (sync->sinks, 0, sizeof (sync->sinks));
+  sync->session_start = g_get_monotonic_time ();
+  sync->next_drift_point = sync->session_start + AV_SYNC_DRIFT_INTERVAL;
+  sync->n = sync->sum_t = sync->sum_y = sync->sum_tt = sync->sum_ty = 0;
+  sync->clock_first = sync->clock_last = GST_CLOCK_TIME_NONE;
+  sync->mono_first = sync->mono_last = 0;
+  sync->clock_elapsed = sync->mono_elapsed = 0;
+  g_mutex_unlock (&sync->lock);
+}
+
+static guint av_sync_bucket (gdouble late_ms)
+{
+  guint i = 0;
+  while (i < AV_SYNC_BUCKETS - 1 && late_ms > bucket_limits[i])
+    i++;
+  return i;
+}
+
+const gchar *av_sync_bucket_name (guint bucket)
+{
+  return bucket < AV_SYNC_BUCKETS ? bucket_names[bucket] : "";
+}
+
+static void av_sync_add (AvSync *sync, guint index, GstClockTime clock_time, gint64 mono,
+    gdouble late_ms, gdouble delay_ms)
+{
+  AvSyncSink *sink = &sync->sinks[index];
+
+  g_mutex_lock (&sync->lock);
+  sink->buffers++;
+  sink->late[av_sync_bucket (late_ms)]++;
+  if (late_ms > 0)
+  {
+    sink->late_count++;
+    sink->late_sum_ms += late_ms;
+    if (late_ms > sink->late_max_ms)
+      sink->late_max_ms = late_ms;
+  }
+  if (sink->delay_valid)
+    sink->delay_ms += (delay_ms - sink->delay_ms) * AV_SYNC_SMOOTHING;
+  else
+    sink->delay_ms = delay_ms;
+  sink->delay_valid = TRUE;
+
+  if (GST_CLOCK_TIME_IS_VALID (sync->clock_first) && mono - sync->mono_last > AV_SYNC_CLOCK_GAP)
+  {
+    sync->clock_elapsed += (gdouble) (sync->clock_last - sync->clock_first) / GST_USECOND;
+    sync->mono_elapsed += sync->mono_last - sync->mono_first;
+    sync->clock_first = GST_CLOCK_TIME_NONE;
+  }
+  if (!GST_CLOCK_TIME_IS_VALID (sync->clock_first))
+  {
+    sync->clock_first = clock_time;
+    sync->mono_first = mono;
+  }
+  sync->clock_last = clock_time;
+  sync->mono_last = mono;
+
+  if (mono >= sync->next_drift_point && sync->sinks[AV_SYNC_AUDIO].delay_valid &&
+      sync->sinks[AV_SYNC_VIDEO].delay_valid)
+  {
+    gdouble t = (mono - sync->session_start) / 1e6;
+    gdouble y = sync->sinks[AV_SYNC_VIDEO].delay_ms - sync->sinks[AV_SYNC_AUDIO].delay_ms;
+    sync->n++;
+    sync->sum_t += t;
+    sync->sum_y += y;
+    sync->sum_tt += t * t;
+    sync->sum_ty += t * y;
+    sync->next_drift_point = mono + AV_SYNC_DRIFT_INTERVAL;
+  }
+  g_mutex_unlock (&sync->lock);
+}
+
+static GstPadProbeReturn av_sync_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AvSyncProbe *probe = (AvSyncProbe *) user_data;
+  GstElement *sink;
+  GstBuffer *buffer;
+  GstClock *clock;
+  GstClockTime running_time, clock_time, latency, base_time;
+  gint64 ts_offset = 0, now, target, presented, mono;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+  {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT)
+      gst_event_copy_segment (event, &probe->segment);
+    else if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP)
+      gst_segment_init (&probe->segment, GST_FORMAT_UNDEFINED);
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  if (!GST_BUFFER_PTS_IS_VALID (buffer) || probe->segment.format != GST_FORMAT_TIME)
+    return GST_PAD_PROBE_OK;
+  running_time = gst_segment_to_running_time (&probe->segment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+  if (!GST_CLOCK_TIME_IS_VALID (running_time))
+    return GST_PAD_PROBE_OK;
+
+  /* Only measured while PLAYING, when the sink synchronises on the clock */
+  sink = GST_PAD_PARENT (pad);
+  if (GST_STATE (sink) != GST_STATE_PLAYING || (clock = gst_element_get_clock (sink)) == NULL)
+    return GST_PAD_PROBE_OK;
+  clock_time = gst_clock_get_time (clock);
+  gst_object_unref (clock);
+  mono = g_get_monotonic_time ();
+  base_time = gst_element_get_base_time (sink);
+  if (clock_time < base_time)
+    return GST_PAD_PROBE_OK;
+
+  latency = gst_base_sink_get_latency (GST_BASE_SINK (sink));
+  g_object_get (sink, "ts-offset", &ts_offset, NULL);
+
+  now = (gint64) (clock_time - base_time);
+  target = (gint64) (running_time + latency) + ts_offset;
+  presented = MAX (now, target);
+
+  av_sync_add (probe->sync, probe->sink, clock_time, mono,
+      (now - target) / 1e6, (presented - (gint64) (running_time + latency)) / 1e6);
+  return GST_PAD_PROBE_OK;
+}
+
+void av_sync_element_setup (AvSync *sync, GstElement *element)
+{
+  AvSyncProbe *probe;
+  GstPad *pad;
+  guint index;
+
+  if (!element_is_sink (element) || !GST_IS_BASE_SINK (element))
+    return;
+  if (element_has_klass (element, "Video"))
+    index = AV_SYNC_VIDEO;
+  else if (element_has_klass (element, "Audio"))
+    index = AV_SYNC_AUDIO;
+  else
+    return;
+
+  pad = gst_element_get_static_pad (element, "sink");
+  if (pad == NULL)
+    return;
+  probe = g_new0 (AvSyncProbe, 1);
+  probe->sync = sync;
+  probe->sink = index;
+  gst_segment_init (&probe->segment, GST_FORMAT_UNDEFINED);
+  gst_pad_add_probe (pad, GstPadProbeType (GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+      av_sync_probe_cb, probe, g_free);
+  gst_object_unref (pad);
+}
+
+void av_sync_get_report (AvSync *sync, AvSyncReport *report)
+{
+  memset (report, 0, sizeof (*report));
+
+  g_mutex_lock (&sync->lock);
+  for (guint i = 0; i < AV_SYNC_SINKS; i++)
+  {
+    AvSyncSink *sink = &sync->sinks[i];
+    report->buffers[i] = sink->buffers;
+    memcpy (report->late[i], sink->late, sizeof (sink->late));
+    report->late_mean_ms[i] = sink->late_count ? sink->late_sum_ms / sink->late_count : 0;
+    report->late_max_ms[i] = sink->late_max_ms;
+  }
+
+  report->offset_valid = sync->sinks[AV_SYNC_AUDIO].delay_valid && sync->sinks[AV_SYNC_VIDEO].delay_valid;
+  if (report->offset_valid)
+    report->offset_ms = sync->sinks[AV_SYNC_VIDEO].delay_ms - sync->sinks[AV_SYNC_AUDIO].delay_ms;
+
+  /* ms per second, from at least a minute of points */
+  gdouble denominator = sync->n * sync->sum_tt - sync->sum_t * sync->sum_t;
+  if (sync->n >= 60 && fabs (denominator) > 1e-9)
+    report->drift_ms_per_hour = (sync->n * sync->sum_ty - sync->sum_t * sync->sum_y) / denominator * 3600;
+
+  gdouble mono_elapsed = sync->mono_elapsed;
+  gdouble clock_elapsed = sync->clock_elapsed;
+  if (GST_CLOCK_TIME_IS_VALID (sync->clock_first))
+  {
+    mono_elapsed += sync->mono_last - sync->mono_first;
+    clock_elapsed += (gdouble) (sync->clock_last - sync->clock_first) / GST_USECOND;
+  }
+  if (mono_elapsed > 10 * G_USEC_PER_SEC)
+    report->clock_drift_ppm = (clock_elapsed - mono_elapsed) / mono_elapsed * 1e6;
+  report->session_seconds = (g_get_monotonic_time () - sync->session_start) / 1e6;
+  g_mutex_unlock (&sync->lock);
+}
@@ -0,0 +1,57 @@
+#ifndef AVSYNC_H
+#define AVSYNC_H
+
+#include <gst/gst.h>
+
+/* A/V synchronisation measurements taken at the sink pads.
+ *
+ * For every buffer reaching an audio or video sink the running time of the
+ * buffer is compared with the pipeline clock. The sink presents the buffer at
+ *
+ *   target = running time + latency + ts-offset
+ *
+ * or right away when it arrives later than that. How late a buffer arrives
+ * against its target goes into a histogram per sink; how long after its
+ * running time (plus latency) it is actually presented is smoothed per sink,
+ * and the difference between video and audio is the A/V offset: positive
+ * when the picture is behind the sound. Its slope over the session is the
+ * drift, and the pipeline clock is also compared with the monotonic system
+ * clock, since an audio device clock running off is a common cause. */
+
+#define AV_SYNC_BUCKETS 9
+
+enum {
+  AV_SYNC_AUDIO,
+  AV_SYNC_VIDEO,
+  AV_SYNC_SINKS
+};
+
+typedef struct _AvSync AvSync;
+
+typedef struct _AvSyncReport {
+  guint64 buffers[AV_SYNC_SINKS];
+  guint64 late[AV_SYNC_SINKS][AV_SYNC_BUCKETS];   /* Arrival against target, see av_sync_bucket_name() */
+  gdouble late_mean_ms[AV_SYNC_SINKS];             /* Of the buffers that arrived after their target */
+  gdouble late_max_ms[AV_SYNC_SINKS];
+  gboolean offset_valid;                           /* Both sinks got data */
+  gdouble offset_ms;                               /* Video presented after audio by */
+  gdouble drift_ms_per_hour;                       /* Slope of the offset over the session */
+  gdouble clock_drift_ppm;                         /* Pipeline clock against CLOCK_MONOTONIC */
+  gdouble session_seconds;
+} AvSyncReport;
+
+AvSync *av_sync_new (void);
+void av_sync_free (AvSync *sync);
+
+/* Starts a new session */
+void av_sync_reset (AvSync *sync);
+
+/* Called from playbin's element-setup signal; installs the probes on the sinks */
+void av_sync_element_setup (AvSync *sync, GstElement *element);
+
+void av_sync_get_report (AvSync *sync, AvSyncReport *report);
+
+/* Range of a lateness bucket, e.g. "-20..-5" (ms, negative is early) */
+const gchar *av_sync_bucket_name (guint bucket);
+
+#endif // AVSYNC_H
@@ -0,0 +1,132 @@
+#include "backgroundworker.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QUrl>
+#include <sched.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* From linux/ioprio.h, which the C library does not wrap */
+#define IOPRIO_CLASS_IDLE   3
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_WHO_PROCESS  1
+
+bool background_idle_io()
+{
+    return syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) == 0;
+}
+
+void background_idle_cpu()
+{
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    sched_setscheduler(0, SCHED_IDLE, &param);
+}
+
+GstBusSyncReply background_bus_sync_handler(GstBus *bus, GstMessage *msg, gpointer user_data)
+{
+    Q_UNUSED(bus);
+    Q_UNUSED(user_data);
+
+    switch (GST_MESSAGE_TYPE(msg)) {
+    case GST_MESSAGE_STREAM_STATUS: {
+        GstStreamStatusType type;
+        GstElement *owner;
+        gst_message_parse_stream_status(msg, &type, &owner);
+        if (type == GST_STREAM_STATUS_TYPE_ENTER) {
+            background_idle_cpu();
+            background_idle_io();
+        }
+        break;
+    }
+    case GST_MESSAGE_ERROR:
+    case GST_MESSAGE_ASYNC_DONE:
+        return GST_BUS_PASS;
+    default:
+        break;
+    }
+    gst_message_unref(msg);
+    return GST_BUS_DROP;
+}
+
+QString background_local_file(const QString &fileName)
+{
+    QUrl url(fileName);
+    if (url.scheme().isEmpty())
+        return fileName;
+    return url.isLocalFile() ? url.toLocalFile() : QString();
+}
+
+BackgroundFileWorker::BackgroundFileWorker(const QString &cacheDir, const QString &cacheSuffix, QObject *parent)
+    : QThread(parent)
+    , generation(0)
+    , cacheDir(cacheDir)
+    , cacheSuffix(cacheSuffix)
+    , hasPending(false)
+    , quitting(false)
+{
+    QDir().mkpath(cacheDir);
+}
+
+BackgroundFileWorker::~BackgroundFileWorker()
+{
+    stop();
+}
+
+void BackgroundFileWorker::stop()
+{
+    mutex.lock();
+    quitting = true;
+    generation++;
+    wakeUp.wakeAll();
+    mutex.unlock();
+    wait();
+}
+
+void BackgroundFileWorker::request(const QString &fileName)
+{
+    QString localFile = background_local_file(fileName);
+
+    QMutexLocker locker(&mutex);
+    pending = localFile;
+    hasPending = true;
+    clear();
+    generation++;
+    wakeUp.wakeAll();
+}
+
+QString BackgroundFileWorker::cachePath(const QString &fileName) const
+{
+    QByteArray hash = QCryptographicHash::hash(QFileInfo(fileName).absoluteFilePath().toUtf8(),
+                                               QCryptographicHash::Sha1);
+    return QDir(cacheDir).filePath(QString::fromLatin1(hash.toHex()) + cacheSuffix);
+}
+
+void BackgroundFileWorker::run()
+{
+    background_idle_cpu();
+    if (!background_idle_io())
+        qWarning() << metaObject()->className() << ": cannot use the idle I/O class, reading at normal priority";
+
+    mutex.lock();
+    while (!quitting) {
+        if (!hasPending) {
+            wakeUp.wait(&mutex);
+            continue;
+        }
+        QString fileName = pending;
+        hasPending = false;
+        int seenGeneration = generation;
+        mutex.unlock();
+
+        if (!fileName.isEmpty() && QFileInfo(fileName).isFile())
+            process(fileName, seenGeneration);
+
+        mutex.lock();
+    }
+    mutex.unlock();
+}
@@ -0,0 +1,85 @@
+#ifndef BACKGROUNDWORKER_H
+#define BACKGROUNDWORKER_H
+
+#include <atomic>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+#include <gst/gst.h>
+
+/* Moves the calling thread to the idle I/O scheduling class, or to SCHED_IDLE
+ * for the CPU. The I/O one returns false when the kernel refuses it. */
+bool background_idle_io();
+void background_idle_cpu();
+
+/* Sync handler for the bus of a background pipeline: each of its streaming
+ * threads moves to both idle classes as it starts. Only errors and ASYNC_DONE
+ * are left on the bus. */
+GstBusSyncReply background_bus_sync_handler(GstBus *bus, GstMessage *msg, gpointer user_data);
+
+/* The file of a plain path or a file:// URI, empty for any other URI */
+QString background_local_file(const QString &fileName);
+
+/* A thread that works on one local file at a time, always the last one
+ * requested, in the idle CPU and I/O scheduling classes. Results are
+ * cached per file in cacheDir.
+ *
+ * Subclasses implement process() and clear(). process() checks abandoned()
+ * often and hands out its results with publish(). A subclass destructor
+ * calls stop() first, so that process() is never left running on a
+ * half-destroyed object. */
+class BackgroundFileWorker : public QThread
+{
+    Q_OBJECT
+
+public:
+    ~BackgroundFileWorker();
+
+signals:
+    void updated();
+
+protected:
+    BackgroundFileWorker(const QString &cacheDir, const QString &cacheSuffix, QObject *parent);
+
+    /* Abandons the current file for this one; an empty name or a URI that is
+     * not a local file just stops */
+    void request(const QString &fileName);
+    void stop();
+
+    /* Works on a file that exists, until done or abandoned */
+    virtual void process(const QString &fileName, int seenGeneration) = 0;
+    /* Forgets the results of the previous file, called with mutex held */
+    virtual void clear() = 0;
+
+    bool abandoned(int seenGeneration) const { return generation != seenGeneration; }
+    QString cachePath(const QString &fileName) const;
+
+    /* Unless request() moved on to another file in the meantime */
+    template <typename T>
+    void publish(T *current, const T &result, int seenGeneration)
+    {
+        mutex.lock();
+        bool latest = generation == seenGeneration;
+        if (latest)
+            *current = result;
+        mutex.unlock();
+        if (latest)
+            emit updated();
+    }
+
+    void run();
+
+    QMutex mutex;                   /* Also guards the results of the subclass */
+    std::atomic<int> generation;    /* Bumped by request() to abandon the current file */
+
+private:
+    QString cacheDir;
+    QString cacheSuffix;
+    QWaitCondition wakeUp;
+    QString pending;
+    bool hasPending;
+    bool quitting;
+};
+
+#endif // BACKGROUNDWORKER_H
@@ -0,0 +1,485 @@
+#include "decoderthreads.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DECODER_THREADS_GRANT         "qtgsplayer-decoder-threads"
+
+/* The default rule: one thread per this many pixels of picture */
+#define DECODER_THREADS_PIXELS        (960 * 540)
+
+/* Benchmark: stream seconds decoded per run, and how long a run may take */
+#define DECODER_BENCH_SECONDS         20
+#define DECODER_BENCH_TIMEOUT         (300 * GST_SECOND)
+
+/* Benchmark: a faster configuration must be this much faster to win over a cheaper one */
+#define DECODER_BENCH_MARGIN          0.97
+
+static GMutex threads_lock;
+static guint threads_budget;
+static guint threads_in_use;
+static guint threads_decoders;          /* Decoders holding a grant */
+static GKeyFile *threads_store;         /* Benchmark results, or NULL */
+static gchar *threads_store_path;
+static DecoderThreadsChoice threads_choice;
+static gboolean threads_choice_set;
+
+/* Handed to a decoder with its threads, given back when it goes away */
+typedef struct _DecoderGrant {
+  guint threads;
+} DecoderGrant;
+
+static const gchar *decoder_threads_size_class (gint height)
+{
+  if (height <= 576)
+    return "sd";
+  if (height <= 720)
+    return "hd";
+  if (height <= 1088)
+    return "fullhd";
+  return "uhd";
+}
+
+static guint decoder_threads_cpus (void)
+{
+  return MAX (g_get_num_processors (), 1);
+}
+
+void decoder_threads_init (const gchar *store_path)
+{
+  const gchar *budget = g_getenv ("QTGSPLAYER_DECODER_THREADS");
+  GKeyFile *store = g_key_file_new ();
+
+  threads_budget = budget != NULL && atoi (budget) > 0 ? (guint) atoi (budget) : decoder_threads_cpus ();
+  g_free (threads_store_path);
+  threads_store_path = g_strdup (store_path);
+  if (threads_store != NULL)
+    g_key_file_unref (threads_store);
+  threads_store = NULL;
+  if (store_path != NULL && g_key_file_load_from_file (store, store_path, G_KEY_FILE_NONE, NULL))
+    threads_store = store;
+  else
+    g_key_file_unref (store);
+}
+
+static void decoder_threads_release (gpointer data)
+{
+  DecoderGrant *grant = (DecoderGrant *) data;
+
+  g_mutex_lock (&threads_lock);
+  threads_in_use -= grant->threads;
+  threads_decoders--;
+  g_mutex_unlock (&threads_lock);
+  g_free (grant);
+}
+
+/* The stored configuration for this decoder and size, if the benchmark measured one */
+static gboolean decoder_threads_lookup (const gchar *decoder, const gchar *size_class, guint *threads, gchar **type)
+{
+  gchar *key;
+  gint stored;
+
+  if (threads_store == NULL)
+    return FALSE;
+  key = g_strdup_printf ("%s-threads", size_class);
+  stored = g_key_file_get_integer (threads_store, decoder, key, NULL);
+  g_free (key);
+  key = g_strdup_printf ("%s-type", size_class);
+  *type = g_key_file_get_string (threads_store, decoder, key, NULL);
+  g_free (key);
+  if (stored <= 0 || *type == NULL)
+  {
+    g_free (*type);
+    return FALSE;
+  }
+  *threads = (guint) stored;
+  return TRUE;
+}
+
+/* The caps event has not reached the decoder yet, so this applies before the codec is opened */
+static GstPadProbeReturn decoder_threads_caps_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  gboolean low_latency = GPOINTER_TO_INT (user_data);
+  GstElement *decoder;
+  GstStructure *structure;
+  GstCaps *caps;
+  DecoderGrant *grant;
+  const gchar *factory, *size_class;
+  gchar *type = NULL;
+  gint width = 0, height = 0;
+  guint wanted, share, available, threads;
+  gboolean measured;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+    return GST_PAD_PROBE_OK;
+  decoder = gst_pad_get_parent_element (pad);
+  if (decoder == NULL)
+    return GST_PAD_PROBE_OK;
+
+  gst_event_parse_caps (event, &caps);
+  structure = gst_caps_get_structure (caps, 0);
+  gst_structure_get_int (structure, "width", &width);
+  gst_structure_get_int (structure, "height", &height);
+  factory = GST_OBJECT_NAME (gst_element_get_factory (decoder));
+  size_class = decoder_threads_size_class (height);
+
+  measured = decoder_threads_lookup (factory, size_class, &wanted, &type);
+  if (!measured)
+  {
+    /* Without a size from the parser, assume the largest picture the CPUs may be asked for */
+    wanted = width > 0 && height > 0 ?
+        (guint) (((gint64) width * height + DECODER_THREADS_PIXELS - 1) / DECODER_THREADS_PIXELS) : decoder_threads_cpus ();
+    wanted = CLAMP (wanted, 1, decoder_threads_cpus ());
+    type = g_strdup ("frame+slice");
+  }
+  if (low_latency)
+  {
+    g_free (type);
+    type = g_strdup ("slice");
+  }
+
+  /* New caps on the same decoder: its previous grant goes back first */
+  g_object_set_data (G_OBJECT (decoder), DECODER_THREADS_GRANT, NULL);
+
+  /* The share counts the decoders running now. Those already open keep their
+   * threads, the codec cannot take fewer without being reopened, so a decoder
+   * that started alone keeps the whole budget until its caps change. */
+  g_mutex_lock (&threads_lock);
+  share = MAX (threads_budget / (threads_decoders + 1), 1);
+  available = threads_budget > threads_in_use ? threads_budget - threads_in_use : 0;
+  threads = MAX (MIN (wanted, MIN (share, available)), 1);
+  threads_in_use += threads;
+  threads_decoders++;
+
+  g_strlcpy (threads_choice.decoder, factory, sizeof (threads_choice.decoder));
+  threads_choice.width = width;
+  threads_choice.height = height;
+  threads_choice.threads = threads;
+  threads_choice.wanted = wanted;
+  g_strlcpy (threads_choice.type, type, sizeof (threads_choice.type));
+  threads_choice.measured = measured;
+  threads_choice.in_use = threads_in_use;
+  threads_choice.budget = threads_budget;
+  threads_choice_set = TRUE;
+  g_mutex_unlock (&threads_lock);
+
+  grant = g_new0 (DecoderGrant, 1);
+  grant->threads = threads;
+  g_object_set_data_full (G_OBJECT (decoder), DECODER_THREADS_GRANT, grant, decoder_threads_release);
+
+  g_object_set (decoder, "max-threads", (gint) threads, NULL);
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (decoder), "thread-type"))
+    gst_util_set_object_arg (G_OBJECT (decoder), "thread-type", type);
+  g_free (type);
+  gst_object_unref (decoder);
+  return GST_PAD_PROBE_OK;
+}
+
+void decoder_threads_element_setup (GstElement *element, gboolean low_latency)
+{
+  GstPad *pad;
+
+  if (!element_has_klass (element, "Decoder") || !element_has_klass (element, "Video") ||
+      !g_object_class_find_property (G_OBJECT_GET_CLASS (element), "max-threads"))
+    return;
+
+  pad = gst_element_get_static_pad (element, "sink");
+  if (pad == NULL)
+    return;
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, decoder_threads_caps_probe,
+      GINT_TO_POINTER (low_latency), NULL);
+  gst_object_unref (pad);
+}
+
+gboolean decoder_threads_take_choice (DecoderThreadsChoice *choice)
+{
+  gboolean set;
+
+  g_mutex_lock (&threads_lock);
+  set = threads_choice_set;
+  if (set)
+    *choice = threads_choice;
+  threads_choice_set = FALSE;
+  g_mutex_unlock (&threads_lock);
+  return set;
+}
+
+guint decoder_threads_in_use (void)
+{
+  guint in_use;
+
+  g_mutex_lock (&threads_lock);
+  in_use = threads_in_use;
+  g_mutex_unlock (&threads_lock);
+  return in_use;
+}
+
+/* One benchmark run: a decoder configuration on one file */
+typedef struct _BenchRun {
+  guint threads;
+  const gchar *type;
+  gchar decoder[32];
+  gint width;
+  gint height;
+  guint64 frames;
+} BenchRun;
+
+/* Accumulated over the files, per decoder, size class and configuration */
+typedef struct _BenchResult {
+  gchar decoder[32];
+  const gchar *size_class;
+  guint threads;
+  const gchar *type;
+  gdouble wall;
+  guint64 frames;
+} BenchResult;
+
+static void decoder_bench_element_setup (GstElement *playbin, GstElement *element, BenchRun *run)
+{
+  (void) playbin;
+
+  if (!element_has_klass (element, "Decoder") || !element_has_klass (element, "Video") ||
+      !g_object_class_find_property (G_OBJECT_GET_CLASS (element), "max-threads"))
+    return;
+  g_strlcpy (run->decoder, GST_OBJECT_NAME (gst_element_get_factory (element)), sizeof (run->decoder));
+  g_object_set (element, "max-threads", (gint) run->threads, NULL);
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (element), "thread-type"))
+    gst_util_set_object_arg (G_OBJECT (element), "thread-type", run->type);
+}
+
+static GstPadProbeReturn decoder_bench_sink_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  BenchRun *run = (BenchRun *) user_data;
+  (void) pad;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER)
+  {
+    run->frames++;
+  }
+  else if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) == GST_EVENT_CAPS)
+  {
+    GstCaps *caps;
+    gst_event_parse_caps (GST_PAD_PROBE_INFO_EVENT (info), &caps);
+    gst_structure_get_int (gst_caps_get_structure (caps, 0), "width", &run->width);
+    gst_structure_get_int (gst_caps_get_structure (caps, 0), "height", &run->height);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* Waits for one of the types, FALSE on an error or after the timeout */
+static gboolean decoder_bench_wait (GstElement *pipeline, GstMessageType type)
+{
+  GstBus *bus = gst_element_get_bus (pipeline);
+  GstMessage *msg = gst_bus_timed_pop_filtered (bus, DECODER_BENCH_TIMEOUT,
+      (GstMessageType) (type | GST_MESSAGE_ERROR));
+  gboolean ok = msg != NULL && GST_MESSAGE_TYPE (msg) != GST_MESSAGE_ERROR;
+
+  if (msg != NULL && !ok)
+  {
+    GError *err;
+    gst_message_parse_error (msg, &err, NULL);
+    g_printerr ("Decoder benchmark: %s\n", err->message);
+    g_error_free (err);
+  }
+  if (msg != NULL)
+    gst_message_unref (msg);
+  gst_object_unref (bus);
+  return ok;
+}
+
+/* Decodes the first DECODER_BENCH_SECONDS of uri as fast as possible, video only */
+static gboolean decoder_bench_run (const gchar *uri, BenchRun *run, gdouble *wall, gdouble *cpu)
+{
+  GstElement *playbin = gst_element_factory_make ("playbin", NULL);
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  GstPad *pad;
+  gint64 start;
+  guint64 cpu_start;
+  gboolean ok;
+
+  if (playbin == NULL || sink == NULL)
+  {
+    if (playbin) gst_object_unref (playbin);
+    if (sink) gst_object_unref (sink);
+    return FALSE;
+  }
+
+  g_object_set (sink, "sync", FALSE, NULL);
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, GstPadProbeType (GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+      decoder_bench_sink_probe, run, NULL);
+  gst_object_unref (pad);
+  /* flags 1: video only */
+  g_object_set (playbin, "uri", uri, "video-sink", sink, "flags", 1, NULL);
+  g_signal_connect (playbin, "element-setup", G_CALLBACK (decoder_bench_element_setup), run);
+
+  gst_element_set_state (playbin, GST_STATE_PAUSED);
+  ok = decoder_bench_wait (playbin, GST_MESSAGE_ASYNC_DONE);
+  if (ok)
+  {
+    ok = gst_element_seek (playbin, 1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH,
+        GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_SET, DECODER_BENCH_SECONDS * GST_SECOND) &&
+        decoder_bench_wait (playbin, GST_MESSAGE_ASYNC_DONE);
+  }
+  if (ok)
+  {
+    run->frames = 0;
+    start = g_get_monotonic_time ();
+    cpu_start = metrics_cpu_time ();
+    gst_element_set_state (playbin, GST_STATE_PLAYING);
+    ok = decoder_bench_wait (playbin, GST_MESSAGE_EOS);
+    *wall = (g_get_monotonic_time () - start) / 1e6;
+    *cpu = (metrics_cpu_time () - cpu_start) / 1e9;
+  }
+  gst_element_set_state (playbin, GST_STATE_NULL);
+  gst_object_unref (playbin);
+  return ok && run->frames > 0;
+}
+
+static BenchResult *decoder_bench_result (GArray *results, const BenchRun *run)
+{
+  const gchar *size_class = decoder_threads_size_class (run->height);
+  BenchResult result;
+
+  for (guint i = 0; i < results->len; i++)
+  {
+    BenchResult *r = &g_array_index (results, BenchResult, i);
+    if (strcmp (r->decoder, run->decoder) == 0 && r->size_class == size_class &&
+        r->threads == run->threads && r->type == run->type)
+      return r;
+  }
+  memset (&result, 0, sizeof (result));
+  g_strlcpy (result.decoder, run->decoder, sizeof (result.decoder));
+  result.size_class = size_class;
+  result.threads = run->threads;
+  result.type = run->type;
+  g_array_append_val (results, result);
+  return &g_array_index (results, BenchResult, results->len - 1);
+}
+
+/* Results are in sweep order, cheapest first within a type */
+static void decoder_bench_store (GArray *results)
+{
+  GKeyFile *store;
+  GError *err = NULL;
+
+  if (threads_store_path == NULL)
+    return;
+  store = g_key_file_new ();
+  g_key_file_load_from_file (store, threads_store_path, G_KEY_FILE_KEEP_COMMENTS, NULL);
+  for (guint i = 0; i < results->len; i++)
+  {
+    BenchResult *candidate = &g_array_index (results, BenchResult, i);
+    BenchResult *best = candidate;
+    gboolean first = TRUE;
+
+    /* Handle each decoder and size class once, at its first result */
+    for (guint j = 0; j < i && first; j++)
+    {
+      BenchResult *r = &g_array_index (results, BenchResult, j);
+      first = strcmp (r->decoder, candidate->decoder) != 0 || r->size_class != candidate->size_class;
+    }
+    if (!first)
+      continue;
+
+    for (guint j = i + 1; j < results->len; j++)
+    {
+      BenchResult *r = &g_array_index (results, BenchResult, j);
+      if (strcmp (r->decoder, best->decoder) == 0 && r->size_class == best->size_class &&
+          r->frames / r->wall * DECODER_BENCH_MARGIN > best->frames / best->wall)
+        best = r;
+    }
+
+    gchar *key = g_strdup_printf ("%s-threads", best->size_class);
+    g_key_file_set_integer (store, best->decoder, key, best->threads);
+    g_free (key);
+    key = g_strdup_printf ("%s-type", best->size_class);
+    g_key_file_set_string (store, best->decoder, key, best->type);
+    g_free (key);
+    key = g_strdup_printf ("%s-fps", best->size_class);
+    g_key_file_set_double (store, best->decoder, key, best->frames / best->wall);
+    g_free (key);
+    g_printerr ("Best for %s %s: %u threads, %s, %.1f fps\n", best->decoder, best->size_class,
+        best->threads, best->type, best->frames / best->wall);
+  }
+
+  if (!g_key_file_save_to_file (store, threads_store_path, &err))
+  {
+    g_printerr ("Decoder benchmark: %s\n", err->message);
+    g_error_free (err);
+  }
+  g_key_file_unref (store);
+}
+
+/* 1, 2, 4, ... and the number of CPUs */
+static guint decoder_bench_next_threads (guint threads, guint cpus)
+{
+  if (threads < cpus && threads * 2 > cpus)
+    return cpus;
+  return threads * 2;
+}
+
+int decoder_threads_benchmark (const gchar *const *files, guint n_files, const gchar *csv_path)
+{
+  static const gchar *const types[] = { "slice", "frame", "frame+slice" };
+  GArray *results = g_array_new (FALSE, TRUE, sizeof (BenchResult));
+  guint cpus = decoder_threads_cpus ();
+  FILE *csv = csv_path != NULL ? fopen (csv_path, "w") : stdout;
+  int status = 0;
+
+  if (csv == NULL)
+  {
+    g_printerr ("Decoder benchmark: cannot write %s\n", csv_path);
+    g_array_unref (results);
+    return 1;
+  }
+  fprintf (csv, "file,decoder,width,height,threads,thread_type,frames,wall_ms,fps,cpu_ms\n");
+
+  for (guint f = 0; f < n_files; f++)
+  {
+    gchar *uri = gst_uri_is_valid (files[f]) ? g_strdup (files[f]) : gst_filename_to_uri (files[f], NULL);
+    gboolean software = TRUE;
+
+    for (guint t = 0; t < G_N_ELEMENTS (types) && software && uri != NULL; t++)
+    {
+      for (guint threads = 1; threads <= cpus && software; threads = decoder_bench_next_threads (threads, cpus))
+      {
+        BenchRun run;
+        gdouble wall = 0, cpu = 0;
+
+        memset (&run, 0, sizeof (run));
+        run.threads = threads;
+        run.type = types[t];
+        if (!decoder_bench_run (uri, &run, &wall, &cpu))
+        {
+          status = 1;
+          software = run.decoder[0] != '\0';
+          break;
+        }
+        if (run.decoder[0] == '\0')
+        {
+          g_printerr ("Decoder benchmark: %s is not decoded in software, skipped\n", files[f]);
+          software = FALSE;
+          break;
+        }
+
+        fprintf (csv, "%s,%s,%d,%d,%u,%s,%llu,%.1f,%.1f,%.1f\n", files[f], run.decoder, run.width, run.height,
+            threads, types[t], (unsigned long long) run.frames, wall * 1000, run.frames / wall, cpu * 1000);
+        fflush (csv);
+
+        BenchResult *result = decoder_bench_result (results, &run);
+        result->wall += wall;
+        result->frames += run.frames;
+      }
+    }
+    g_free (uri);
+  }
+
+  if (csv != stdout)
+    fclose (csv);
+  decoder_bench_store (results);
+  g_array_unref (results);
+  return status;
+}
@@ -0,0 +1,57 @@
+#ifndef DECODERTHREADS_H
+#define DECODERTHREADS_H
+
+#include <gst/gst.h>
+
+/* Threading of the software video decoders (avdec_* "max-threads" and
+ * "thread-type").
+ *
+ * The threads are chosen when the stream caps reach the decoder, before the
+ * codec is opened: the configuration measured by the benchmark for that
+ * decoder and size class if there is one, otherwise one thread per 960x540
+ * pixels of picture. Frame and slice threading are both allowed, except for
+ * live sources where frame threading would add a frame of delay per thread.
+ *
+ * All the decoders of the process, whatever their pipeline, share a budget of
+ * QTGSPLAYER_DECODER_THREADS threads (default: the number of CPUs), so that a
+ * recovery pipeline or several tiles on one box do not oversubscribe the
+ * CPUs; each decoder gets at most its fair share of it, and at least one.
+ * The share is taken when a decoder starts, among the decoders running then,
+ * and is not rebalanced: max-threads only applies when the codec opens. So
+ * only the decoders started later are capped, and the first keeps what it
+ * was given until its stream changes caps. What it gives back when it stops
+ * goes to the next decoders that start. */
+
+/* Budget and stored configurations, read once at start-up */
+void decoder_threads_init (const gchar *store_path);
+
+/* Called from playbin's element-setup signal */
+void decoder_threads_element_setup (GstElement *element, gboolean low_latency);
+
+/* The last choice made */
+typedef struct _DecoderThreadsChoice {
+  gchar decoder[32];              /* Factory name */
+  gint width;
+  gint height;
+  guint threads;
+  guint wanted;                   /* Before the budget */
+  gchar type[16];                 /* "thread-type" flags */
+  gboolean measured;              /* From the benchmark, not the default rule */
+  guint in_use;                   /* Threads granted to all decoders, this one included */
+  guint budget;
+} DecoderThreadsChoice;
+
+/* Copies the choice made since the last call. Returns FALSE when there was none. */
+gboolean decoder_threads_take_choice (DecoderThreadsChoice *choice);
+
+/* Threads currently granted to decoders */
+guint decoder_threads_in_use (void);
+
+/* Decodes the first seconds of each file as fast as possible with every
+ * thread count up to the number of CPUs and every thread type, writes one
+ * CSV line per run to csv_path (stdout if NULL) and stores the fastest
+ * configuration per decoder and size class; within 3 % the cheaper one wins.
+ * Returns the exit status. */
+int decoder_threads_benchmark (const gchar *const *files, guint n_files, const gchar *csv_path);
+
+#endif // DECODERTHREADS_H
@@ -0,0 +1,141 @@
+#include "framepool.h"
+#include <gst/video/video.h>
+#include <gst/video/gstvideopool.h>
+#include <unistd.h>
+
+typedef struct _FramePool {
+  GstVideoBufferPool parent;
+
+  GMutex lock;
+  gboolean starting;            /* Preallocating in start() */
+  guint64 allocations;
+  guint64 allocations_on_demand;
+  guint64 acquisitions;
+  guint64 bytes;
+  guint64 peak_bytes;
+} FramePool;
+
+typedef struct _FramePoolClass {
+  GstVideoBufferPoolClass parent_class;
+} FramePoolClass;
+
+static GType frame_pool_get_type (void);
+
+G_DEFINE_TYPE (FramePool, frame_pool, GST_TYPE_VIDEO_BUFFER_POOL);
+
+#define FRAME_POOL(obj) ((FramePool *) (obj))
+
+/* Whatever the decoder asked for, frames start on a page */
+static gboolean frame_pool_set_config (GstBufferPool *pool, GstStructure *config)
+{
+  GstAllocator *allocator = NULL;
+  GstAllocationParams params;
+  gsize page_mask = sysconf (_SC_PAGESIZE) - 1;
+
+  gst_allocation_params_init (&params);
+  gst_buffer_pool_config_get_allocator (config, &allocator, &params);
+  params.align |= page_mask;
+  gst_buffer_pool_config_set_allocator (config, allocator, &params);
+
+  return GST_BUFFER_POOL_CLASS (frame_pool_parent_class)->set_config (pool, config);
+}
+
+static gboolean frame_pool_start (GstBufferPool *pool)
+{
+  FramePool *self = FRAME_POOL (pool);
+  gboolean ret;
+
+  self->starting = TRUE;
+  ret = GST_BUFFER_POOL_CLASS (frame_pool_parent_class)->start (pool);
+  self->starting = FALSE;
+  return ret;
+}
+
+static GstFlowReturn frame_pool_alloc_buffer (GstBufferPool *pool, GstBuffer **buffer,
+    GstBufferPoolAcquireParams *params)
+{
+  FramePool *self = FRAME_POOL (pool);
+  GstFlowReturn ret = GST_BUFFER_POOL_CLASS (frame_pool_parent_class)->alloc_buffer (pool, buffer, params);
+
+  if (ret != GST_FLOW_OK)
+    return ret;
+  g_mutex_lock (&self->lock);
+  self->allocations++;
+  if (!self->starting)
+    self->allocations_on_demand++;
+  self->bytes += gst_buffer_get_size (*buffer);
+  self->peak_bytes = MAX (self->peak_bytes, self->bytes);
+  g_mutex_unlock (&self->lock);
+  return ret;
+}
+
+static void frame_pool_free_buffer (GstBufferPool *pool, GstBuffer *buffer)
+{
+  FramePool *self = FRAME_POOL (pool);
+
+  g_mutex_lock (&self->lock);
+  self->bytes -= MIN (self->bytes, (guint64) gst_buffer_get_size (buffer));
+  g_mutex_unlock (&self->lock);
+  GST_BUFFER_POOL_CLASS (frame_pool_parent_class)->free_buffer (pool, buffer);
+}
+
+static GstFlowReturn frame_pool_acquire_buffer (GstBufferPool *pool, GstBuffer **buffer,
+    GstBufferPoolAcquireParams *params)
+{
+  FramePool *self = FRAME_POOL (pool);
+  GstFlowReturn ret = GST_BUFFER_POOL_CLASS (frame_pool_parent_class)->acquire_buffer (pool, buffer, params);
+
+  if (ret == GST_FLOW_OK)
+  {
+    g_mutex_lock (&self->lock);
+    self->acquisitions++;
+    g_mutex_unlock (&self->lock);
+  }
+  return ret;
+}
+
+static void frame_pool_finalize (GObject *object)
+{
+  g_mutex_clear (&FRAME_POOL (object)->lock);
+  G_OBJECT_CLASS (frame_pool_parent_class)->finalize (object);
+}
+
+static void frame_pool_class_init (FramePoolClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstBufferPoolClass *pool_class = GST_BUFFER_POOL_CLASS (klass);
+
+  gobject_class->finalize = frame_pool_finalize;
+  pool_class->set_config = frame_pool_set_config;
+  pool_class->start = frame_pool_start;
+  pool_class->alloc_buffer = frame_pool_alloc_buffer;
+  pool_class->free_buffer = frame_pool_free_buffer;
+  pool_class->acquire_buffer = frame_pool_acquire_buffer;
+}
+
+static void frame_pool_init (FramePool *self)
+{
+  g_mutex_init (&self->lock);
+}
+
+GstBufferPool *frame_pool_new (void)
+{
+  GstBufferPool *pool = GST_BUFFER_POOL (g_object_new (frame_pool_get_type (), NULL));
+  gst_object_ref_sink (pool);
+  return pool;
+}
+
+void frame_pool_take_stats (GstBufferPool *pool, FramePoolStats *stats)
+{
+  FramePool *self = FRAME_POOL (pool);
+
+  g_mutex_lock (&self->lock);
+  stats->allocations += self->allocations;
+  stats->reuses += self->acquisitions - MIN (self->acquisitions, self->allocations_on_demand);
+  stats->peak_bytes = MAX (stats->peak_bytes, self->peak_bytes);
+  self->allocations = 0;
+  self->allocations_on_demand = 0;
+  self->acquisitions = 0;
+  self->peak_bytes = self->bytes;
+  g_mutex_unlock (&self->lock);
+}
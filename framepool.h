@@ -0,0 +1,22 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <gst/gst.h>
+
+/* The pool the video sink bin offers decoders when nothing downstream offers
+ * one: a GstVideoBufferPool whose frames are page aligned and preallocated
+ * when the pool is activated at preroll, so that steady state decoding only
+ * recycles them instead of allocating and freeing a frame per frame. */
+GstBufferPool *frame_pool_new (void);
+
+typedef struct _FramePoolStats {
+  guint64 allocations;          /* Frames allocated, preallocation included */
+  guint64 reuses;               /* Frames handed out without allocating */
+  guint64 peak_bytes;           /* Most memory held by the pool at once */
+} FramePoolStats;
+
+/* Adds what happened since the last call to stats (peak_bytes takes the
+ * maximum) and starts over */
+void frame_pool_take_stats (GstBufferPool *pool, FramePoolStats *stats);
+
+#endif // FRAMEPOOL_H
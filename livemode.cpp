@@ -0,0 +1,168 @@
+#include "livemode.h"
+#include "metrics.h"
+#include <string.h>
+#include <stdlib.h>
+
+#define LIVE_LATENCY_DEFAULT  50
+
+/* Seconds between the NTP epoch (1900) and the Unix one */
+#define NTP_UNIX_OFFSET       G_GUINT64_CONSTANT (2208988800)
+
+struct _LiveMode {
+  GMutex lock;
+  gint active;
+  gint latency_ms;
+  gboolean sync;
+  GstCaps *ntp_caps;
+  GstCaps *unix_caps;
+
+  guint64 frames;
+  GstClockTimeDiff latency_last;
+  GstClockTimeDiff latency_sum;
+  GstClockTimeDiff latency_max;
+};
+
+static gboolean live_mode_has_property (GstElement *element, const gchar *name)
+{
+  return g_object_class_find_property (G_OBJECT_GET_CLASS (element), name) != NULL;
+}
+
+static void live_mode_tune (LiveMode *live, GstElement *element)
+{
+  /* Elements made with g_object_new(), e.g. playsink and its children, have no factory */
+  GstElementFactory *element_factory = gst_element_get_factory (element);
+  const gchar *factory = element_factory ? gst_plugin_feature_get_name (element_factory) : "";
+
+  if (strcmp (factory, "rtspsrc") == 0 || strcmp (factory, "rtpbin") == 0 ||
+      strcmp (factory, "rtpjitterbuffer") == 0)
+  {
+    g_object_set (element, "latency", (guint) live->latency_ms, NULL);
+    if (live_mode_has_property (element, "drop-on-latency"))
+      g_object_set (element, "drop-on-latency", TRUE, NULL);
+    if (live_mode_has_property (element, "add-reference-timestamp-meta"))
+      g_object_set (element, "add-reference-timestamp-meta", TRUE, NULL);
+  }
+  else if (strcmp (factory, "queue") == 0)
+  {
+    /* 2: leak downstream, i.e. drop the oldest buffers */
+    g_object_set (element, "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0,
+        "max-size-time", (guint64) 4 * live->latency_ms * GST_MSECOND, NULL);
+  }
+  else if (!live->sync && element_is_sink (element) && live_mode_has_property (element, "sync"))
+  {
+    g_object_set (element, "sync", FALSE, NULL);
+  }
+}
+
+static GstPadProbeReturn live_mode_sink_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  LiveMode *live = (LiveMode *) user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstReferenceTimestampMeta *meta;
+  GstClockTime now;
+  GstClockTimeDiff latency;
+  (void) pad;
+
+  if (!g_atomic_int_get (&live->active))
+    return GST_PAD_PROBE_OK;
+
+  if ((meta = gst_buffer_get_reference_timestamp_meta (buffer, live->ntp_caps)) != NULL)
+    now = g_get_real_time () * GST_USECOND + NTP_UNIX_OFFSET * GST_SECOND;
+  else if ((meta = gst_buffer_get_reference_timestamp_meta (buffer, live->unix_caps)) != NULL)
+    now = g_get_real_time () * GST_USECOND;
+  else
+    return GST_PAD_PROBE_OK;
+
+  /* Not rendered yet, but with sync off or a late frame it is right away,
+   * and otherwise the sink waits for at most the configured latency */
+  latency = GST_CLOCK_DIFF (meta->timestamp, now);
+  g_mutex_lock (&live->lock);
+  live->frames++;
+  live->latency_last = latency;
+  live->latency_sum += latency;
+  live->latency_max = MAX (live->latency_max, latency);
+  g_mutex_unlock (&live->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+LiveMode *live_mode_new (void)
+{
+  LiveMode *live = g_new0 (LiveMode, 1);
+  const gchar *latency = g_getenv ("QTGSPLAYER_LIVE_LATENCY");
+  const gchar *sync = g_getenv ("QTGSPLAYER_LIVE_SYNC");
+
+  g_mutex_init (&live->lock);
+  live->latency_ms = latency != NULL && atoi (latency) >= 0 ? atoi (latency) : LIVE_LATENCY_DEFAULT;
+  live->sync = sync == NULL || strcmp (sync, "0") != 0;
+  live->ntp_caps = gst_caps_new_empty_simple ("timestamp/x-ntp");
+  live->unix_caps = gst_caps_new_empty_simple ("timestamp/x-unix");
+  return live;
+}
+
+void live_mode_free (LiveMode *live)
+{
+  g_mutex_clear (&live->lock);
+  gst_caps_unref (live->ntp_caps);
+  gst_caps_unref (live->unix_caps);
+  g_free (live);
+}
+
+void live_mode_reset (LiveMode *live)
+{
+  g_atomic_int_set (&live->active, FALSE);
+  g_mutex_lock (&live->lock);
+  live->frames = 0;
+  live->latency_last = live->latency_sum = live->latency_max = 0;
+  g_mutex_unlock (&live->lock);
+}
+
+void live_mode_element_setup (LiveMode *live, GstElement *element)
+{
+  if (element_is_sink (element) && element_has_klass (element, "Video"))
+  {
+    GstPad *pad = gst_element_get_static_pad (element, "sink");
+    if (pad != NULL)
+    {
+      gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, live_mode_sink_probe, live, NULL);
+      gst_object_unref (pad);
+    }
+  }
+  if (g_atomic_int_get (&live->active))
+    live_mode_tune (live, element);
+}
+
+static void live_mode_tune_item (const GValue *item, gpointer user_data)
+{
+  live_mode_tune ((LiveMode *) user_data, GST_ELEMENT (g_value_get_object (item)));
+}
+
+void live_mode_enable (LiveMode *live, GstElement *pipeline)
+{
+  GstIterator *it;
+
+  if (g_atomic_int_get (&live->active))
+    return;
+  g_atomic_int_set (&live->active, TRUE);
+
+  it = gst_bin_iterate_recurse (GST_BIN (pipeline));
+  while (gst_iterator_foreach (it, live_mode_tune_item, live) == GST_ITERATOR_RESYNC)
+    gst_iterator_resync (it);
+  gst_iterator_free (it);
+}
+
+gboolean live_mode_is_active (LiveMode *live)
+{
+  return g_atomic_int_get (&live->active);
+}
+
+void live_mode_get_report (LiveMode *live, LiveModeReport *report)
+{
+  report->active = g_atomic_int_get (&live->active);
+  report->configured_ms = live->latency_ms;
+  g_mutex_lock (&live->lock);
+  report->frames = live->frames;
+  report->latency_last_ms = live->latency_last / 1e6;
+  report->latency_mean_ms = live->frames ? (gdouble) live->latency_sum / live->frames / 1e6 : 0;
+  report->latency_max_ms = live->latency_max / 1e6;
+  g_mutex_unlock (&live->lock);
+}
@@ -0,0 +1,48 @@
+#ifndef LIVEMODE_H
+#define LIVEMODE_H
+
+#include <gst/gst.h>
+
+/* Low latency settings for live sources (RTSP and RTP cameras, udpsrc).
+ *
+ * A pipeline is live when going to PAUSED answers NO_PREROLL. From then on,
+ * and for the elements created afterwards:
+ *
+ *   - rtspsrc, rtpbin and rtpjitterbuffer get "latency" lowered to
+ *     QTGSPLAYER_LIVE_LATENCY ms (default 50) and "drop-on-latency" set, so
+ *     that late packets are dropped instead of building up delay; they also
+ *     attach the sender's NTP time to the buffers where supported;
+ *   - queues leak their oldest data instead of blocking;
+ *   - with QTGSPLAYER_LIVE_SYNC=0 the sinks render as soon as frames arrive.
+ *
+ * Glass to glass latency is measured at the video sink from the reference
+ * timestamp (NTP or Unix time of capture) the buffers carry, against the
+ * wall clock, so it is only meaningful when sender and player share it. */
+typedef struct _LiveMode LiveMode;
+
+typedef struct _LiveModeReport {
+  gboolean active;
+  gint configured_ms;             /* Jitterbuffer latency asked for */
+  guint64 frames;                 /* Frames with a capture time */
+  gdouble latency_last_ms;        /* Capture to rendering */
+  gdouble latency_mean_ms;
+  gdouble latency_max_ms;
+} LiveModeReport;
+
+LiveMode *live_mode_new (void);
+void live_mode_free (LiveMode *live);
+
+/* A new URI: back to the normal settings until it turns out to be live */
+void live_mode_reset (LiveMode *live);
+
+/* Called from playbin's element-setup signal */
+void live_mode_element_setup (LiveMode *live, GstElement *element);
+
+/* The pipeline answered NO_PREROLL: tune the elements it already holds */
+void live_mode_enable (LiveMode *live, GstElement *pipeline);
+
+gboolean live_mode_is_active (LiveMode *live);
+
+void live_mode_get_report (LiveMode *live, LiveModeReport *report);
+
+#endif // LIVEMODE_H
@@ -1,14 +1,85 @@
 #include "widget.h"
+#include "seekbenchmark.h"
+#include "mmapsrc.h"
+#include "decoderthreads.h"
+#include "taskpool.h"
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QStandardPaths>
+#include <QVector>
 #include <gst/gst.h>
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
     gst_init (&argc, &argv);
+
+    /* Zero-copy local files, unless QTGSPLAYER_MMAPSRC=0 asks for filesrc */
+    if (qgetenv("QTGSPLAYER_MMAPSRC") != "0")
+        mmap_src_register ();
+
+    QCommandLineParser parser;
+    QCommandLineOption benchmarkOption("seek-benchmark", "Measure seek latency on the given files and quit.");
+    QCommandLineOption seeksOption("seeks", "Seeks per file and seek flag set.", "count", "50");
+    QCommandLineOption seedOption("seed", "Seed of the seek positions.", "seed", "1");
+    QCommandLineOption csvOption("csv", "Write the results there instead of stdout.", "path");
+    QCommandLineOption corpusOption("corpus", "Without files, encode a test corpus there.", "dir",
+                                    QDir(QDir::tempPath()).filePath("qtgsplayer-seekbench"));
+    QCommandLineOption decoderBenchmarkOption("decoder-benchmark",
+                                              "Find the fastest decoder threading on the given files, store it and quit.");
+    QCommandLineOption threadBenchmarkOption("thread-benchmark",
+                                             "Compare playback jitter with and without thread placement and quit.");
+    QCommandLineOption threadsOption("threads", "Thread placement to compare, as QTGSPLAYER_THREADS.", "spec");
+    parser.addOptions(QList<QCommandLineOption>() << benchmarkOption << seeksOption << seedOption
+                      << csvOption << corpusOption << decoderBenchmarkOption
+                      << threadBenchmarkOption << threadsOption);
+    /* GStreamer options are already handled, don't fail on them */
+    parser.parse(a.arguments());
+
+    /* Decoder threading measured by --decoder-benchmark, next to the resume positions */
+    QString dataDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(dataDir);
+    decoder_threads_init(QDir(dataDir).filePath("decoder-threads.ini").toLocal8Bit().constData());
+
+    if (parser.isSet(decoderBenchmarkOption) || parser.isSet(threadBenchmarkOption)) {
+        QStringList files = parser.positionalArguments();
+        if (files.isEmpty())
+            files = SeekBenchmark::generateCorpus(parser.value(corpusOption));
+        QList<QByteArray> encoded;
+        QVector<const gchar *> paths;
+        foreach (const QString &file, files) {
+            encoded << file.toLocal8Bit();
+            paths << encoded.last().constData();
+        }
+        QByteArray csv = parser.value(csvOption).toLocal8Bit();
+        if (parser.isSet(threadBenchmarkOption)) {
+            QByteArray spec = parser.value(threadsOption).toLocal8Bit();
+            if (spec.isEmpty())
+                spec = qgetenv("QTGSPLAYER_THREADS");
+            return task_pools_benchmark(paths.constData(), paths.size(), spec.isEmpty() ? NULL : spec.constData(),
+                                        csv.isEmpty() ? NULL : csv.constData());
+        }
+        return decoder_threads_benchmark(paths.constData(), paths.size(), csv.isEmpty() ? NULL : csv.constData());
+    }
+
     Widget w;
     w.show();
 
+    SeekBenchmark *benchmark = 0;
+    if (parser.isSet(benchmarkOption)) {
+        QStringList files = parser.positionalArguments();
+        if (files.isEmpty())
+            files = SeekBenchmark::generateCorpus(parser.value(corpusOption));
+        benchmark = new SeekBenchmark(&w, &w);
+        benchmark->setFiles(files);
+        benchmark->setSeeks(parser.value(seeksOption).toInt());
+        benchmark->setSeed(parser.value(seedOption).toUInt());
+        benchmark->setOutput(parser.value(csvOption));
+        QObject::connect(benchmark, &SeekBenchmark::finished, &a, &QApplication::exit, Qt::QueuedConnection);
+        QTimer::singleShot(0, benchmark, SLOT(start()));
+    }
+
     return a.exec();
 }
 
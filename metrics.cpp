@@ -0,0 +1,291 @@
+#include "metrics.h"
+#include "mmapsrc.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Per-pad state of a counting probe; only touched by the pad's streaming thread */
+typedef struct _SinkProbe {
+  PlayerMetrics *metrics;
+  gboolean video;
+  GstSegment segment;
+} SinkProbe;
+
+void metrics_reset (PlayerMetrics *metrics)
+{
+  metrics->state = GST_STATE_VOID_PENDING;
+  metrics->position = -1;
+  metrics->duration = -1;
+  metrics->bufferingPercent = 100;
+  metrics->videoFrames = 0;
+  metrics->droppedFrames = 0;
+  metrics->audioBuffers = 0;
+  metrics->inputBytes = 0;
+  metrics->inputBytesCopied = 0;
+  metrics->lastSinkActivity = 0;
+  for (int i = 0; i < METRICS_MESSAGE_TYPES; i++)
+    metrics->busMessages[i] = 0;
+  for (int i = 0; i < METRICS_EXTENDED_MESSAGE_TYPES; i++)
+    metrics->busMessagesExtended[i] = 0;
+  metrics->uiLatencyLast = 0;
+  metrics->uiLatencyMax = 0;
+  metrics->uiLatencySum = 0;
+  metrics->uiLatencyCount = 0;
+  metrics->remoteCommands = 0;
+  metrics->remoteLatencySum = 0;
+  metrics->remoteLatencyMax = 0;
+  metrics->errorsTransient = 0;
+  metrics->errorsFatal = 0;
+  metrics->recoveries = 0;
+  metrics->recoveriesSucceeded = 0;
+  metrics->recoveriesFailed = 0;
+  metrics->recoveryTimeLast = 0;
+  for (int i = 0; i < 3; i++)
+    metrics->stallActions[i] = 0;
+  metrics->refreshCount = 0;
+  metrics->refreshCpuSum = 0;
+  metrics->refreshCpuMax = 0;
+  metrics->busDispatchCount = 0;
+  metrics->busDispatchCpuSum = 0;
+  metrics->busDispatchCpuMax = 0;
+  metrics->prefetchFiles = 0;
+  metrics->prefetchBytes = 0;
+  for (int i = 0; i < 2; i++)
+  {
+    metrics->opens[i] = 0;
+    metrics->openLatencySum[i] = 0;
+  }
+  metrics->openLatencyLast = 0;
+  metrics->syncFollowers = 0;
+  metrics->syncSkewLast = 0;
+  metrics->syncSkewMax = 0;
+  metrics->syncAlignments = 0;
+  metrics->syncNudges = 0;
+  metrics->liveLatencyLast = 0;
+  for (int i = 0; i < 4; i++)
+    metrics->threadCpu[i] = 0;
+  metrics->qosLevel = 0;
+  metrics->qosStepsDown = 0;
+  metrics->qosStepsUp = 0;
+  metrics->decoderThreads = 0;
+  metrics->trackSwitches = 0;
+  metrics->trackSwitchesSlow = 0;
+  metrics->trackSwitchLatencyLast = 0;
+  metrics->trackSwitchVideoGapLast = 0;
+}
+
+gboolean element_has_klass (GstElement *element, const gchar *klass)
+{
+  const gchar *element_klass = gst_element_class_get_metadata (GST_ELEMENT_GET_CLASS (element),
+      GST_ELEMENT_METADATA_KLASS);
+  return element_klass != NULL && strstr (element_klass, klass) != NULL;
+}
+
+/* Bins such as autovideosink carry the flag too; only count the real element inside */
+gboolean element_is_sink (GstElement *element)
+{
+  return !GST_IS_BIN (element) && GST_OBJECT_FLAG_IS_SET (element, GST_ELEMENT_FLAG_SINK);
+}
+
+gboolean element_is_source (GstElement *element)
+{
+  return !GST_IS_BIN (element) && GST_OBJECT_FLAG_IS_SET (element, GST_ELEMENT_FLAG_SOURCE);
+}
+
+void metrics_count_message (PlayerMetrics *metrics, GstElement *pipeline, GstMessage *msg)
+{
+  guint type = GST_MESSAGE_TYPE (msg);
+  int index = 0;
+
+  /* Extended types are a sequence, not bits: STREAM_COLLECTION is not a warning */
+  if (type & GST_MESSAGE_EXTENDED)
+  {
+    guint extended = type - GST_MESSAGE_EXTENDED;
+    metrics->busMessagesExtended[extended < METRICS_EXTENDED_MESSAGE_TYPES ? extended : 0]++;
+  }
+  else
+  {
+    while (index < METRICS_MESSAGE_TYPES - 1 && !(type & (1u << index)))
+      index++;
+    metrics->busMessages[index]++;
+  }
+
+  switch (GST_MESSAGE_TYPE (msg))
+  {
+    case GST_MESSAGE_STATE_CHANGED:
+      if (GST_MESSAGE_SRC (msg) == GST_OBJECT (pipeline))
+      {
+        GstState new_state;
+        gst_message_parse_state_changed (msg, NULL, &new_state, NULL);
+        metrics->state = new_state;
+      }
+      break;
+    case GST_MESSAGE_BUFFERING:
+    {
+      gint percent;
+      gst_message_parse_buffering (msg, &percent);
+      metrics->bufferingPercent = percent;
+    } break;
+    case GST_MESSAGE_QOS:
+    {
+      GstFormat format;
+      guint64 processed, dropped;
+      if (GST_IS_ELEMENT (GST_MESSAGE_SRC (msg)) &&
+          element_has_klass (GST_ELEMENT (GST_MESSAGE_SRC (msg)), "Video"))
+      {
+        gst_message_parse_qos_stats (msg, &format, &processed, &dropped);
+        if (format == GST_FORMAT_BUFFERS && dropped != (guint64) -1)
+          metrics->droppedFrames = dropped;
+      }
+    } break;
+    default:
+      break;
+  }
+}
+
+static GstPadProbeReturn sink_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  SinkProbe *probe = (SinkProbe *) user_data;
+  (void) pad;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+  {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT)
+      gst_event_copy_segment (event, &probe->segment);
+    else if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP)
+      gst_segment_init (&probe->segment, GST_FORMAT_UNDEFINED);
+    else if (GST_EVENT_TYPE (event) == GST_EVENT_GAP)
+      probe->metrics->lastSinkActivity = g_get_monotonic_time ();
+    return GST_PAD_PROBE_OK;
+  }
+
+  probe->metrics->lastSinkActivity = g_get_monotonic_time ();
+
+  guint n_buffers = 1;
+  GstBuffer *buffer = NULL;
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+  {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+    n_buffers = gst_buffer_list_length (list);
+    if (n_buffers > 0)
+      buffer = gst_buffer_list_get (list, n_buffers - 1);
+  }
+  else
+  {
+    buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  }
+
+  if (probe->video)
+    probe->metrics->videoFrames += n_buffers;
+  else
+    probe->metrics->audioBuffers += n_buffers;
+
+  if (buffer != NULL && GST_BUFFER_PTS_IS_VALID (buffer) && probe->segment.format == GST_FORMAT_TIME)
+  {
+    guint64 position = gst_segment_to_stream_time (&probe->segment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+    if (GST_CLOCK_TIME_IS_VALID (position))
+      probe->metrics->position = position;
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+static gsize probe_info_size (GstPadProbeInfo *info)
+{
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    return gst_buffer_list_calculate_size (GST_PAD_PROBE_INFO_BUFFER_LIST (info));
+  return gst_buffer_get_size (GST_PAD_PROBE_INFO_BUFFER (info));
+}
+
+static GstPadProbeReturn source_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  PlayerMetrics *metrics = (PlayerMetrics *) user_data;
+  (void) pad;
+
+  metrics->inputBytes += probe_info_size (info);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Sources other than the mmap one read() into their buffers: everything is a copy */
+static GstPadProbeReturn copying_source_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  PlayerMetrics *metrics = (PlayerMetrics *) user_data;
+  gsize size = probe_info_size (info);
+  (void) pad;
+
+  metrics->inputBytes += size;
+  metrics->inputBytesCopied += size;
+  return GST_PAD_PROBE_OK;
+}
+
+void metrics_element_setup (PlayerMetrics *metrics, GstElement *element)
+{
+  if (element_is_sink (element))
+  {
+    gboolean video = element_has_klass (element, "Video");
+    if (!video && !element_has_klass (element, "Audio"))
+      return;
+
+    GstPad *pad = gst_element_get_static_pad (element, "sink");
+    if (pad == NULL)
+      return;
+    SinkProbe *probe = g_new0 (SinkProbe, 1);
+    probe->metrics = metrics;
+    probe->video = video;
+    gst_segment_init (&probe->segment, GST_FORMAT_UNDEFINED);
+    gst_pad_add_probe (pad, GstPadProbeType (GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST |
+        GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM), sink_probe_cb, probe, g_free);
+    gst_object_unref (pad);
+  }
+  else if (element_is_source (element))
+  {
+    GstPad *pad = gst_element_get_static_pad (element, "src");
+    if (pad == NULL)
+      return;
+    gboolean mapped = mmap_src_is_mmap_src (element);
+    if (mapped)
+      mmap_src_count_copies (element, &metrics->inputBytesCopied);
+    gst_pad_add_probe (pad, GstPadProbeType (GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+        mapped ? source_probe_cb : copying_source_probe_cb, metrics, NULL);
+    gst_object_unref (pad);
+  }
+}
+
+guint64 metrics_resident_bytes ()
+{
+  unsigned long size, resident;
+  FILE *file = fopen ("/proc/self/statm", "r");
+
+  if (file == NULL)
+    return 0;
+  if (fscanf (file, "%lu %lu", &size, &resident) != 2)
+    resident = 0;
+  fclose (file);
+  return (guint64) resident * sysconf (_SC_PAGESIZE);
+}
+
+guint64 metrics_cpu_time ()
+{
+  struct timespec ts;
+  if (clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts) != 0)
+    return 0;
+  return (guint64) ts.tv_sec * GST_SECOND + ts.tv_nsec;
+}
+
+guint64 metrics_thread_cpu_time ()
+{
+  struct timespec ts;
+  if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    return 0;
+  return (guint64) ts.tv_sec * GST_SECOND + ts.tv_nsec;
+}
+
+void metrics_add_cost (std::atomic<guint64> &count, std::atomic<guint64> &sum, std::atomic<guint64> &max,
+    guint64 ns)
+{
+  count++;
+  sum += ns;
+  if (ns > max.load ())
+    max = ns;
+}
@@ -0,0 +1,111 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <gst/gst.h>
+
+#define METRICS_MESSAGE_TYPES 32
+#define METRICS_EXTENDED_MESSAGE_TYPES 16
+
+/* Playback and pipeline counters.
+ *
+ * Every field is written by whichever thread observes the event (streaming
+ * threads through pad probes, the bus sync handler, the GUI thread) and read
+ * lock-free by the exporter, so serving a scrape never touches the pipeline. */
+struct PlayerMetrics {
+    std::atomic<int> state;                 /* GstState of the pipeline */
+    std::atomic<gint64> position;           /* Stream time of the last rendered buffer, in ns */
+    std::atomic<gint64> duration;           /* In ns, or -1 */
+    std::atomic<int> bufferingPercent;
+
+    std::atomic<guint64> videoFrames;       /* Buffers that reached the video sink */
+    std::atomic<guint64> droppedFrames;     /* As reported by the video sink QoS messages */
+    std::atomic<guint64> audioBuffers;      /* Buffers that reached the audio sink */
+    std::atomic<guint64> inputBytes;        /* Bytes produced by the source element */
+    std::atomic<guint64> inputBytesCopied;  /* Of which copied out of the page cache */
+    std::atomic<gint64> lastSinkActivity;   /* Monotonic time of the last buffer or gap at a sink, in us */
+
+    std::atomic<guint64> busMessages[METRICS_MESSAGE_TYPES];    /* Indexed by message type bit */
+    /* GST_MESSAGE_EXTENDED types, indexed by type - GST_MESSAGE_EXTENDED; 0 for the unknown ones */
+    std::atomic<guint64> busMessagesExtended[METRICS_EXTENDED_MESSAGE_TYPES];
+
+    std::atomic<gint64> uiLatencyLast;      /* GUI event loop latency, in us */
+    std::atomic<gint64> uiLatencyMax;
+    std::atomic<guint64> uiLatencySum;
+    std::atomic<guint64> uiLatencyCount;
+
+    std::atomic<guint64> remoteCommands;    /* Commands applied through the remote control */
+    std::atomic<guint64> remoteLatencySum;  /* Command to effect, in us */
+    std::atomic<gint64> remoteLatencyMax;
+
+    std::atomic<guint64> errorsTransient;   /* Bus errors worth a pipeline rebuild */
+    std::atomic<guint64> errorsFatal;
+    std::atomic<guint64> recoveries;        /* Rebuild attempts */
+    std::atomic<guint64> recoveriesSucceeded;
+    std::atomic<guint64> recoveriesFailed;  /* Gave up after the last attempt */
+    std::atomic<gint64> recoveryTimeLast;   /* First error to PLAYING again, in us */
+
+    std::atomic<guint64> stallActions[3];   /* Watchdog escalations: flush seek, rebuild, skip */
+
+    std::atomic<guint64> refreshCount;      /* GUI refresh ticks */
+    std::atomic<guint64> refreshCpuSum;     /* GUI thread CPU time spent in them, in ns */
+    std::atomic<guint64> refreshCpuMax;
+    std::atomic<guint64> busDispatchCount;  /* Bus messages handled on the GUI thread */
+    std::atomic<guint64> busDispatchCpuSum; /* In ns */
+    std::atomic<guint64> busDispatchCpuMax;
+
+    std::atomic<guint64> prefetchFiles;     /* Upcoming files read ahead into the page cache */
+    std::atomic<guint64> prefetchBytes;
+    std::atomic<guint64> opens[2];          /* Opened files, by whether they had been prefetched */
+    std::atomic<guint64> openLatencySum[2]; /* Open to first frame, in us */
+    std::atomic<gint64> openLatencyLast;
+
+    std::atomic<int> syncFollowers;         /* Video wall leader: followers heard from */
+    std::atomic<gint64> syncSkewLast;       /* Follower: position minus the leader's, in us */
+    std::atomic<gint64> syncSkewMax;        /* Leader: largest absolute skew among followers, in us */
+    std::atomic<guint64> syncAlignments;    /* Follower: seeks to the leader's mapping */
+    std::atomic<guint64> syncNudges;        /* Follower: base time moves to take out a small skew */
+
+    std::atomic<gint64> liveLatencyLast;    /* Live sources: capture to display, in us */
+
+    std::atomic<guint64> threadCpu[4];      /* Streaming threads by role (see taskpool.h), in ns */
+
+    std::atomic<int> qosLevel;              /* Decoding quality level, 0 is full (see qoscontrol.h) */
+    std::atomic<guint64> qosStepsDown;      /* Level changes under overload */
+    std::atomic<guint64> qosStepsUp;
+
+    std::atomic<int> decoderThreads;        /* Granted to software video decoders (see decoderthreads.h) */
+
+    std::atomic<guint64> trackSwitches;     /* Audio and subtitle switches measured (see trackswitch.h) */
+    std::atomic<guint64> trackSwitchesSlow; /* Over the latency target, or never seen at the sinks */
+    std::atomic<gint64> trackSwitchLatencyLast;     /* Request to the new track, in us, of the last one that got there */
+    std::atomic<gint64> trackSwitchVideoGapLast;    /* Longest time without a video frame meanwhile, in us */
+};
+
+void metrics_reset (PlayerMetrics *metrics);
+
+/* Called from the bus sync handler for every message */
+void metrics_count_message (PlayerMetrics *metrics, GstElement *pipeline, GstMessage *msg);
+
+/* Called from playbin's element-setup signal; installs the counting probes */
+void metrics_element_setup (PlayerMetrics *metrics, GstElement *element);
+
+/* Helpers shared with the other pipeline instrumentation */
+gboolean element_has_klass (GstElement *element, const gchar *klass);
+gboolean element_is_sink (GstElement *element);
+gboolean element_is_source (GstElement *element);
+
+/* Resident set size of this process, in bytes */
+guint64 metrics_resident_bytes ();
+
+/* CPU time used by all the threads of this process, in ns */
+guint64 metrics_cpu_time ();
+
+/* CPU time used by the calling thread, in ns */
+guint64 metrics_thread_cpu_time ();
+
+/* Adds one sample of a control path cost to a count/sum/max triple */
+void metrics_add_cost (std::atomic<guint64> &count, std::atomic<guint64> &sum, std::atomic<guint64> &max,
+    guint64 ns);
+
+#endif // METRICS_H
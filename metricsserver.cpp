@@ -0,0 +1,316 @@
+#include "metricsserver.h"
+#include <QDebug>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#define SAMPLE_INTERVAL_MS  100
+#define RATE_INTERVAL_MS    1000
+
+MetricsServer::MetricsServer(PlayerMetrics *metrics, QObject *parent)
+    : QObject(parent)
+    , metrics(metrics)
+    , tcpServer(0)
+    , localServer(0)
+    , lastTick(0)
+    , lastRate(0)
+    , lastFrames(0)
+    , lastBytes(0)
+    , lastCopied(0)
+    , fps(0)
+    , bitrate(0)
+    , copyRate(0)
+{
+    connect(&sampleTimer, SIGNAL(timeout()), this, SLOT(slotSample()));
+    sampleClock.start();
+    sampleTimer.start(SAMPLE_INTERVAL_MS);
+}
+
+/* address is "PORT", "HOST:PORT" or "unix:PATH" */
+bool MetricsServer::listen(const QString &address)
+{
+    if (address.startsWith("unix:")) {
+        QString path = address.mid(5);
+        QLocalServer::removeServer(path);
+        localServer = new QLocalServer(this);
+        connect(localServer, SIGNAL(newConnection()), this, SLOT(slotNewLocalConnection()));
+        if (!localServer->listen(path)) {
+            qWarning() << "Metrics: could not listen on" << path << ":" << localServer->errorString();
+            return false;
+        }
+        return true;
+    }
+
+    QHostAddress host(QHostAddress::LocalHost);
+    QString port = address;
+    int colon = address.lastIndexOf(':');
+    if (colon >= 0) {
+        host = QHostAddress(address.left(colon));
+        port = address.mid(colon + 1);
+    }
+    tcpServer = new QTcpServer(this);
+    connect(tcpServer, SIGNAL(newConnection()), this, SLOT(slotNewTcpConnection()));
+    if (!tcpServer->listen(host, port.toUShort())) {
+        qWarning() << "Metrics: could not listen on" << address << ":" << tcpServer->errorString();
+        return false;
+    }
+    return true;
+}
+
+void MetricsServer::slotNewTcpConnection()
+{
+    while (QTcpSocket *socket = tcpServer->nextPendingConnection()) {
+        connect(socket, SIGNAL(readyRead()), this, SLOT(slotReadRequest()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    }
+}
+
+void MetricsServer::slotNewLocalConnection()
+{
+    while (QLocalSocket *socket = localServer->nextPendingConnection()) {
+        connect(socket, SIGNAL(readyRead()), this, SLOT(slotReadRequest()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    }
+}
+
+void MetricsServer::slotReadRequest()
+{
+    QIODevice *socket = qobject_cast<QIODevice *>(sender());
+    if (!socket || !socket->canReadLine())
+        return;
+    serve(socket);
+}
+
+void MetricsServer::serve(QIODevice *socket)
+{
+    /* Only the request line matters; the headers are ignored */
+    QList<QByteArray> request = socket->readLine().trimmed().split(' ');
+    socket->readAll();
+
+    QByteArray body;
+    QByteArray status = "200 OK";
+    if (request.size() < 2 || request.at(0) != "GET") {
+        status = "405 Method Not Allowed";
+    } else if (request.at(1) != "/metrics" && request.at(1) != "/") {
+        status = "404 Not Found";
+    } else {
+        body = render();
+    }
+
+    socket->write("HTTP/1.0 " + status + "\r\n"
+                  "Content-Type: text/plain; version=0.0.4\r\n"
+                  "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                  "Connection: close\r\n\r\n");
+    socket->write(body);
+
+    if (QTcpSocket *tcp = qobject_cast<QTcpSocket *>(socket))
+        tcp->disconnectFromHost();
+    else if (QLocalSocket *local = qobject_cast<QLocalSocket *>(socket))
+        local->disconnectFromServer();
+}
+
+/* Runs on the GUI thread: how late this timer fires is the event loop latency */
+void MetricsServer::slotSample()
+{
+    qint64 now = sampleClock.nsecsElapsed();
+    if (lastTick != 0) {
+        gint64 latency = (now - lastTick) / 1000 - SAMPLE_INTERVAL_MS * 1000;
+        if (latency < 0)
+            latency = 0;
+        metrics->uiLatencyLast = latency;
+        if (latency > metrics->uiLatencyMax.load())
+            metrics->uiLatencyMax = latency;
+        metrics->uiLatencySum += latency;
+        metrics->uiLatencyCount++;
+    }
+    lastTick = now;
+
+    if (now - lastRate >= qint64(RATE_INTERVAL_MS) * 1000000) {
+        guint64 frames = metrics->videoFrames;
+        guint64 bytes = metrics->inputBytes;
+        guint64 copied = metrics->inputBytesCopied;
+        double seconds = (now - lastRate) / 1e9;
+        fps = frames >= lastFrames ? (frames - lastFrames) / seconds : 0;
+        bitrate = bytes >= lastBytes ? (bytes - lastBytes) * 8 / seconds : 0;
+        lastFrames = frames;
+        copyRate = copied >= lastCopied ? (copied - lastCopied) / seconds : 0;
+        lastBytes = bytes;
+        lastCopied = copied;
+        lastRate = now;
+    }
+}
+
+static void metric(QByteArray &out, const char *name, const char *type, const char *help, double value)
+{
+    out += QByteArray("# HELP ") + name + " " + help + "\n";
+    out += QByteArray("# TYPE ") + name + " " + type + "\n";
+    out += QByteArray(name) + " " + QByteArray::number(value, 'g', 15) + "\n";
+}
+
+QByteArray MetricsServer::render() const
+{
+    QByteArray out;
+    gint64 position = metrics->position;
+    gint64 duration = metrics->duration;
+
+    metric(out, "qtgsplayer_state", "gauge",
+           "Pipeline state (0 void pending, 1 null, 2 ready, 3 paused, 4 playing).", double(metrics->state));
+    metric(out, "qtgsplayer_position_seconds", "gauge",
+           "Stream time of the last buffer that reached a sink.", position < 0 ? -1 : position / 1e9);
+    metric(out, "qtgsplayer_duration_seconds", "gauge",
+           "Duration of the current clip, -1 when unknown.", duration < 0 ? -1 : duration / 1e9);
+    metric(out, "qtgsplayer_buffering_percent", "gauge",
+           "Last reported buffering level.", double(metrics->bufferingPercent));
+    metric(out, "qtgsplayer_video_frames_total", "counter",
+           "Video frames that reached the video sink.", double(metrics->videoFrames));
+    metric(out, "qtgsplayer_video_frames_dropped_total", "counter",
+           "Video frames dropped by the video sink.", double(metrics->droppedFrames));
+    metric(out, "qtgsplayer_decode_fps", "gauge",
+           "Video frames per second over the last second.", fps);
+    metric(out, "qtgsplayer_audio_buffers_total", "counter",
+           "Audio buffers that reached the audio sink.", double(metrics->audioBuffers));
+    metric(out, "qtgsplayer_input_bytes_total", "counter",
+           "Bytes produced by the source element.", double(metrics->inputBytes));
+    metric(out, "qtgsplayer_input_bitrate_bps", "gauge",
+           "Source bitrate over the last second.", bitrate);
+    metric(out, "qtgsplayer_input_bytes_copied_total", "counter",
+           "Source bytes copied out of the page cache into new buffers.", double(metrics->inputBytesCopied));
+    metric(out, "qtgsplayer_input_copy_bytes_per_second", "gauge",
+           "Source bytes copied over the last second.", copyRate);
+
+    out += "# HELP qtgsplayer_bus_messages_total Messages posted on the pipeline bus.\n";
+    out += "# TYPE qtgsplayer_bus_messages_total counter\n";
+    for (int i = 0; i < METRICS_MESSAGE_TYPES; i++) {
+        guint64 count = metrics->busMessages[i];
+        if (count == 0)
+            continue;
+        out += QByteArray("qtgsplayer_bus_messages_total{type=\"") +
+               gst_message_type_get_name(GstMessageType(1u << i)) + "\"} " +
+               QByteArray::number(qulonglong(count)) + "\n";
+    }
+    for (int i = 0; i < METRICS_EXTENDED_MESSAGE_TYPES; i++) {
+        guint64 count = metrics->busMessagesExtended[i];
+        if (count == 0)
+            continue;
+        out += QByteArray("qtgsplayer_bus_messages_total{type=\"") +
+               (i == 0 ? "extended" : gst_message_type_get_name(GstMessageType(GST_MESSAGE_EXTENDED + i))) + "\"} " +
+               QByteArray::number(qulonglong(count)) + "\n";
+    }
+
+    metric(out, "qtgsplayer_resident_memory_bytes", "gauge",
+           "Resident set size of the player process.", double(metrics_resident_bytes()));
+
+    guint64 count = metrics->uiLatencyCount;
+    out += "# HELP qtgsplayer_ui_event_loop_latency_seconds Lateness of a 100 ms timer on the GUI thread.\n";
+    out += "# TYPE qtgsplayer_ui_event_loop_latency_seconds summary\n";
+    out += "qtgsplayer_ui_event_loop_latency_seconds_sum " +
+           QByteArray::number(double(metrics->uiLatencySum) / 1e6, 'g', 15) + "\n";
+    out += "qtgsplayer_ui_event_loop_latency_seconds_count " + QByteArray::number(qulonglong(count)) + "\n";
+    metric(out, "qtgsplayer_ui_event_loop_latency_last_seconds", "gauge",
+           "Most recent GUI event loop latency sample.", double(metrics->uiLatencyLast) / 1e6);
+    metric(out, "qtgsplayer_ui_event_loop_latency_max_seconds", "gauge",
+           "Largest GUI event loop latency seen.", double(metrics->uiLatencyMax) / 1e6);
+
+    out += "# HELP qtgsplayer_remote_command_latency_seconds Remote control command to effect latency.\n";
+    out += "# TYPE qtgsplayer_remote_command_latency_seconds summary\n";
+    out += "qtgsplayer_remote_command_latency_seconds_sum " +
+           QByteArray::number(double(metrics->remoteLatencySum) / 1e6, 'g', 15) + "\n";
+    out += "qtgsplayer_remote_command_latency_seconds_count " +
+           QByteArray::number(qulonglong(metrics->remoteCommands)) + "\n";
+    metric(out, "qtgsplayer_remote_command_latency_max_seconds", "gauge",
+           "Largest remote control command latency seen.", double(metrics->remoteLatencyMax) / 1e6);
+
+    out += "# HELP qtgsplayer_errors_total Errors posted on the pipeline bus, by class.\n";
+    out += "# TYPE qtgsplayer_errors_total counter\n";
+    out += "qtgsplayer_errors_total{class=\"transient\"} " + QByteArray::number(qulonglong(metrics->errorsTransient)) + "\n";
+    out += "qtgsplayer_errors_total{class=\"fatal\"} " + QByteArray::number(qulonglong(metrics->errorsFatal)) + "\n";
+    out += "# HELP qtgsplayer_recoveries_total Pipeline rebuilds after a transient error, by outcome.\n";
+    out += "# TYPE qtgsplayer_recoveries_total counter\n";
+    out += "qtgsplayer_recoveries_total{outcome=\"attempted\"} " + QByteArray::number(qulonglong(metrics->recoveries)) + "\n";
+    out += "qtgsplayer_recoveries_total{outcome=\"succeeded\"} " +
+           QByteArray::number(qulonglong(metrics->recoveriesSucceeded)) + "\n";
+    out += "qtgsplayer_recoveries_total{outcome=\"failed\"} " + QByteArray::number(qulonglong(metrics->recoveriesFailed)) + "\n";
+    metric(out, "qtgsplayer_recovery_last_seconds", "gauge",
+           "Time from the error to playing again for the last recovery.", double(metrics->recoveryTimeLast) / 1e6);
+
+    out += "# HELP qtgsplayer_refresh_cpu_seconds GUI thread CPU time of one refresh tick.\n";
+    out += "# TYPE qtgsplayer_refresh_cpu_seconds summary\n";
+    out += "qtgsplayer_refresh_cpu_seconds_sum " + QByteArray::number(double(metrics->refreshCpuSum) / 1e9, 'g', 15) + "\n";
+    out += "qtgsplayer_refresh_cpu_seconds_count " + QByteArray::number(qulonglong(metrics->refreshCount)) + "\n";
+    metric(out, "qtgsplayer_refresh_cpu_max_seconds", "gauge",
+           "Most expensive refresh tick seen.", double(metrics->refreshCpuMax) / 1e9);
+    out += "# HELP qtgsplayer_bus_dispatch_cpu_seconds GUI thread CPU time of handling one bus message.\n";
+    out += "# TYPE qtgsplayer_bus_dispatch_cpu_seconds summary\n";
+    out += "qtgsplayer_bus_dispatch_cpu_seconds_sum " +
+           QByteArray::number(double(metrics->busDispatchCpuSum) / 1e9, 'g', 15) + "\n";
+    out += "qtgsplayer_bus_dispatch_cpu_seconds_count " + QByteArray::number(qulonglong(metrics->busDispatchCount)) + "\n";
+    metric(out, "qtgsplayer_bus_dispatch_cpu_max_seconds", "gauge",
+           "Most expensive bus message handling seen.", double(metrics->busDispatchCpuMax) / 1e9);
+
+    static const char *const stallActions[] = { "flush-seek", "rebuild", "skip" };
+    out += "# HELP qtgsplayer_stall_actions_total Stalled playback escalations taken by the watchdog.\n";
+    out += "# TYPE qtgsplayer_stall_actions_total counter\n";
+    for (int i = 0; i < 3; i++) {
+        out += QByteArray("qtgsplayer_stall_actions_total{action=\"") + stallActions[i] + "\"} " +
+               QByteArray::number(qulonglong(metrics->stallActions[i])) + "\n";
+    }
+
+    metric(out, "qtgsplayer_prefetch_files_total", "counter",
+           "Upcoming files read ahead into the page cache.", double(metrics->prefetchFiles));
+    metric(out, "qtgsplayer_prefetch_bytes_total", "counter",
+           "Bytes read ahead into the page cache.", double(metrics->prefetchBytes));
+    static const char *const prefetched[] = { "false", "true" };
+    out += "# HELP qtgsplayer_open_latency_seconds Time from opening a file to its first frame, by whether it was prefetched.\n";
+    out += "# TYPE qtgsplayer_open_latency_seconds summary\n";
+    for (int i = 0; i < 2; i++) {
+        out += QByteArray("qtgsplayer_open_latency_seconds_sum{prefetched=\"") + prefetched[i] + "\"} " +
+               QByteArray::number(double(metrics->openLatencySum[i]) / 1e6, 'g', 15) + "\n";
+        out += QByteArray("qtgsplayer_open_latency_seconds_count{prefetched=\"") + prefetched[i] + "\"} " +
+               QByteArray::number(qulonglong(metrics->opens[i])) + "\n";
+    }
+    metric(out, "qtgsplayer_open_latency_last_seconds", "gauge",
+           "Time from opening the current file to its first frame.", double(metrics->openLatencyLast) / 1e6);
+
+    metric(out, "qtgsplayer_sync_followers", "gauge",
+           "Video wall followers heard from by this leader.", double(metrics->syncFollowers));
+    metric(out, "qtgsplayer_sync_skew_seconds", "gauge",
+           "Video wall follower: own position minus the leader's at the same clock time.",
+           double(metrics->syncSkewLast) / 1e6);
+    metric(out, "qtgsplayer_sync_skew_max_seconds", "gauge",
+           "Video wall leader: largest skew reported by a follower.", double(metrics->syncSkewMax) / 1e6);
+    metric(out, "qtgsplayer_sync_alignments_total", "counter",
+           "Video wall follower: times playback was aligned on the leader.", double(metrics->syncAlignments));
+    metric(out, "qtgsplayer_sync_nudges_total", "counter",
+           "Video wall follower: small skews taken out without a flush.", double(metrics->syncNudges));
+    metric(out, "qtgsplayer_live_latency_seconds", "gauge",
+           "Live sources: capture time carried by the frames to their display.", double(metrics->liveLatencyLast) / 1e6);
+
+    static const char *const threadRoles[] = { "streaming", "video", "audio", "gui" };
+    out += "# HELP qtgsplayer_thread_cpu_seconds_total CPU time of the streaming threads and the GUI thread, by role.\n";
+    out += "# TYPE qtgsplayer_thread_cpu_seconds_total counter\n";
+    for (int i = 0; i < 4; i++) {
+        out += QByteArray("qtgsplayer_thread_cpu_seconds_total{role=\"") + threadRoles[i] + "\"} " +
+               QByteArray::number(double(metrics->threadCpu[i]) / 1e9, 'g', 15) + "\n";
+    }
+    metric(out, "qtgsplayer_qos_level", "gauge",
+           "Decoding quality level, 0 is full quality, higher sheds more load.", double(metrics->qosLevel));
+    metric(out, "qtgsplayer_qos_steps_down_total", "counter",
+           "Decoding quality lowered because frames came late.", double(metrics->qosStepsDown));
+    metric(out, "qtgsplayer_qos_steps_up_total", "counter",
+           "Decoding quality raised again once frames were on time.", double(metrics->qosStepsUp));
+    metric(out, "qtgsplayer_decoder_threads", "gauge",
+           "Threads granted to software video decoders, out of the decoder thread budget.",
+           double(metrics->decoderThreads));
+    metric(out, "qtgsplayer_track_switches_total", "counter",
+           "Audio and subtitle track switches while playing.", double(metrics->trackSwitches));
+    metric(out, "qtgsplayer_track_switches_slow_total", "counter",
+           "Track switches over the latency target, or never seen at the sinks.", double(metrics->trackSwitchesSlow));
+    metric(out, "qtgsplayer_track_switch_latency_seconds", "gauge",
+           "Last track switch: request to the new track being heard or reaching the overlay.",
+           double(metrics->trackSwitchLatencyLast) / 1e6);
+    metric(out, "qtgsplayer_track_switch_video_gap_seconds", "gauge",
+           "Last track switch: longest time between two video frames meanwhile.",
+           double(metrics->trackSwitchVideoGapLast) / 1e6);
+    return out;
+}
@@ -0,0 +1,58 @@
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QTimer>
+#include "metrics.h"
+
+QT_BEGIN_NAMESPACE
+class QIODevice;
+class QLocalServer;
+class QTcpServer;
+QT_END_NAMESPACE
+
+/* Serves PlayerMetrics in the Prometheus text format over HTTP, on a local
+ * TCP port or a Unix socket:
+ *
+ *   QTGSPLAYER_METRICS=9101                  curl http://127.0.0.1:9101/metrics
+ *   QTGSPLAYER_METRICS=unix:/tmp/player.sock curl --unix-socket /tmp/player.sock http://localhost/metrics
+ *
+ * It also samples the GUI event loop latency and turns the frame and byte
+ * counters into per second rates, once a second, from the atomics only. */
+class MetricsServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    MetricsServer(PlayerMetrics *metrics, QObject *parent = 0);
+
+    bool listen(const QString &address);
+
+private slots:
+    void slotNewTcpConnection();
+    void slotNewLocalConnection();
+    void slotReadRequest();
+    void slotSample();
+
+private:
+    void serve(QIODevice *socket);
+    QByteArray render() const;
+
+    PlayerMetrics *metrics;
+    QTcpServer *tcpServer;
+    QLocalServer *localServer;
+
+    QTimer sampleTimer;
+    QElapsedTimer sampleClock;
+    qint64 lastTick;
+    qint64 lastRate;
+    guint64 lastFrames;
+    guint64 lastBytes;
+    guint64 lastCopied;
+    double fps;
+    double bitrate;
+    double copyRate;
+};
+
+#endif // METRICSSERVER_H
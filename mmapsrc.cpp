@@ -0,0 +1,521 @@
+#include "mmapsrc.h"
+#include <gst/base/gstbasesrc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* How far ahead of (or behind, in reverse) the last read the kernel is asked to read */
+#define MMAP_SRC_WILLNEED (2 * 1024 * 1024)
+
+/* A read this far behind the previous one means the reader goes backward */
+#define MMAP_SRC_BACKWARD (64 * 1024)
+
+/* How often the size of the file is checked, in us */
+#define MMAP_SRC_CHECK_INTERVAL (250 * G_TIME_SPAN_MILLISECOND)
+
+/* Mappings the SIGBUS guard covers at once; beyond that files are read */
+#define MMAP_SRC_GUARDED 16
+
+/* Outlives the element's session while buffers still point into it */
+typedef struct _MmapSrcMapping {
+  gint refcount;
+  guint8 *data;
+  gsize size;
+  gint slot;                      /* In mmap_src_guarded */
+  gint truncated;                 /* Set by the SIGBUS guard */
+} MmapSrcMapping;
+
+/* The ranges the SIGBUS guard covers. The handler only looks at start and
+ * size, and only follows mapping when the fault is in its range: a buffer
+ * is touching it then, so it is still alive. */
+typedef struct _MmapSrcGuarded {
+  std::atomic<guintptr> start;
+  std::atomic<gsize> size;
+  std::atomic<MmapSrcMapping *> mapping;
+} MmapSrcGuarded;
+
+static MmapSrcGuarded mmap_src_guarded[MMAP_SRC_GUARDED];
+static struct sigaction mmap_src_previous_sigbus;
+static gsize mmap_src_page_size;
+
+typedef struct _MmapSrc {
+  GstBaseSrc parent;
+
+  gchar *location;
+  gint fd;
+  guint64 size;
+  MmapSrcMapping *mapping;        /* NULL when falling back to pread() */
+  guint64 last_offset;
+  gboolean backward;
+  gint64 checked;                 /* Monotonic time the size was last checked */
+  std::atomic<guint64> *copied;
+} MmapSrc;
+
+typedef struct _MmapSrcClass {
+  GstBaseSrcClass parent_class;
+} MmapSrcClass;
+
+enum {
+  PROP_0,
+  PROP_LOCATION
+};
+
+static GstStaticPadTemplate mmap_src_src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+static GType mmap_src_get_type (void);
+static void mmap_src_uri_handler_init (gpointer g_iface, gpointer iface_data);
+
+G_DEFINE_TYPE_WITH_CODE (MmapSrc, mmap_src, GST_TYPE_BASE_SRC,
+    G_IMPLEMENT_INTERFACE (GST_TYPE_URI_HANDLER, mmap_src_uri_handler_init));
+
+#define MMAP_SRC(obj) ((MmapSrc *) (obj))
+
+/* A page of a truncated file was touched: zeros are mapped in its place and
+ * the source fails its next read, instead of the process being killed */
+static void mmap_src_sigbus (int sig, siginfo_t *info, void *context)
+{
+  guintptr address = (guintptr) info->si_addr;
+
+  for (gint i = 0; i < MMAP_SRC_GUARDED; i++)
+  {
+    guintptr start = mmap_src_guarded[i].start;
+    if (start == 0 || address < start || address - start >= mmap_src_guarded[i].size)
+      continue;
+    void *page = (void *) (address & ~((guintptr) mmap_src_page_size - 1));
+    if (mmap (page, mmap_src_page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+      break;
+    g_atomic_int_set (&mmap_src_guarded[i].mapping.load ()->truncated, 1);
+    return;
+  }
+
+  /* Not one of ours */
+  if (mmap_src_previous_sigbus.sa_flags & SA_SIGINFO)
+  {
+    mmap_src_previous_sigbus.sa_sigaction (sig, info, context);
+  }
+  else if (mmap_src_previous_sigbus.sa_handler != SIG_DFL && mmap_src_previous_sigbus.sa_handler != SIG_IGN)
+  {
+    mmap_src_previous_sigbus.sa_handler (sig);
+  }
+  else
+  {
+    /* Faults again on return, without the guard */
+    sigaction (SIGBUS, &mmap_src_previous_sigbus, NULL);
+  }
+}
+
+static gboolean mmap_src_guard (MmapSrcMapping *mapping)
+{
+  for (gint i = 0; i < MMAP_SRC_GUARDED; i++)
+  {
+    MmapSrcMapping *expected = NULL;
+    if (!mmap_src_guarded[i].mapping.compare_exchange_strong (expected, mapping))
+      continue;
+    mapping->slot = i;
+    mmap_src_guarded[i].size = mapping->size;
+    mmap_src_guarded[i].start = (guintptr) mapping->data;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+static MmapSrcMapping *mmap_src_mapping_ref (MmapSrcMapping *mapping)
+{
+  g_atomic_int_inc (&mapping->refcount);
+  return mapping;
+}
+
+static void mmap_src_mapping_unref (gpointer user_data)
+{
+  MmapSrcMapping *mapping = (MmapSrcMapping *) user_data;
+  if (g_atomic_int_dec_and_test (&mapping->refcount))
+  {
+    mmap_src_guarded[mapping->slot].start = 0;
+    munmap (mapping->data, mapping->size);
+    mmap_src_guarded[mapping->slot].mapping = NULL;
+    g_free (mapping);
+  }
+}
+
+static void mmap_src_advise (MmapSrcMapping *mapping, guint64 offset, guint64 length, int advice)
+{
+  static gsize page_size = sysconf (_SC_PAGESIZE);
+  guint64 start = offset & ~((guint64) page_size - 1);
+
+  if (start >= mapping->size)
+    return;
+  length = MIN (length + (offset - start), mapping->size - start);
+  madvise (mapping->data + start, length, advice);
+}
+
+static gboolean mmap_src_set_location (MmapSrc *src, const gchar *location, GError **error)
+{
+  GstState state;
+
+  GST_OBJECT_LOCK (src);
+  state = GST_STATE (src);
+  if (state != GST_STATE_READY && state != GST_STATE_NULL)
+  {
+    GST_OBJECT_UNLOCK (src);
+    g_set_error (error, GST_URI_ERROR, GST_URI_ERROR_BAD_STATE,
+        "Changing the location of an open file is not supported");
+    return FALSE;
+  }
+  g_free (src->location);
+  src->location = g_strdup (location);
+  GST_OBJECT_UNLOCK (src);
+  return TRUE;
+}
+
+static void mmap_src_set_property (GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec)
+{
+  switch (prop_id)
+  {
+    case PROP_LOCATION:
+      mmap_src_set_location (MMAP_SRC (object), g_value_get_string (value), NULL);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void mmap_src_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec *pspec)
+{
+  MmapSrc *src = MMAP_SRC (object);
+
+  switch (prop_id)
+  {
+    case PROP_LOCATION:
+      GST_OBJECT_LOCK (src);
+      g_value_set_string (value, src->location);
+      GST_OBJECT_UNLOCK (src);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void mmap_src_finalize (GObject *object)
+{
+  g_free (MMAP_SRC (object)->location);
+  G_OBJECT_CLASS (mmap_src_parent_class)->finalize (object);
+}
+
+static gboolean mmap_src_start (GstBaseSrc *basesrc)
+{
+  MmapSrc *src = MMAP_SRC (basesrc);
+  struct stat st;
+
+  if (src->location == NULL)
+  {
+    GST_ELEMENT_ERROR (src, RESOURCE, NOT_FOUND, ("No file name specified for reading."), (NULL));
+    return FALSE;
+  }
+
+  src->fd = open (src->location, O_RDONLY | O_CLOEXEC);
+  if (src->fd < 0)
+  {
+    if (errno == ENOENT)
+      GST_ELEMENT_ERROR (src, RESOURCE, NOT_FOUND, ("No such file \"%s\".", src->location), (NULL));
+    else
+      GST_ELEMENT_ERROR (src, RESOURCE, OPEN_READ, ("Could not open file \"%s\" for reading.", src->location),
+          GST_ERROR_SYSTEM);
+    return FALSE;
+  }
+  if (fstat (src->fd, &st) != 0 || !S_ISREG (st.st_mode))
+  {
+    GST_ELEMENT_ERROR (src, RESOURCE, OPEN_READ, ("\"%s\" is not a regular file.", src->location), (NULL));
+    close (src->fd);
+    src->fd = -1;
+    return FALSE;
+  }
+
+  src->size = st.st_size;
+  src->mapping = NULL;
+  src->last_offset = 0;
+  src->backward = FALSE;
+  src->checked = g_get_monotonic_time ();
+
+  if (src->size > 0 && src->size <= G_MAXSIZE)
+  {
+    /* Private: nothing ever written through it, and nothing of it shared back */
+    void *data = mmap (NULL, src->size, PROT_READ, MAP_PRIVATE, src->fd, 0);
+    if (data != MAP_FAILED)
+    {
+      src->mapping = g_new0 (MmapSrcMapping, 1);
+      src->mapping->refcount = 1;
+      src->mapping->data = (guint8 *) data;
+      src->mapping->size = src->size;
+      if (mmap_src_guard (src->mapping))
+      {
+        madvise (data, src->size, MADV_SEQUENTIAL);
+      }
+      else
+      {
+        /* Unguarded, a truncation would kill the process */
+        GST_WARNING_OBJECT (src, "Too many mapped files, reading \"%s\" instead", src->location);
+        munmap (data, src->size);
+        g_free (src->mapping);
+        src->mapping = NULL;
+      }
+    }
+    else
+    {
+      GST_WARNING_OBJECT (src, "Cannot map \"%s\" (%s), reading it instead", src->location, g_strerror (errno));
+    }
+  }
+  return TRUE;
+}
+
+static gboolean mmap_src_stop (GstBaseSrc *basesrc)
+{
+  MmapSrc *src = MMAP_SRC (basesrc);
+
+  /* Buffers still downstream keep their pages mapped */
+  if (src->mapping != NULL)
+  {
+    mmap_src_mapping_unref (src->mapping);
+    src->mapping = NULL;
+  }
+  if (src->fd >= 0)
+  {
+    close (src->fd);
+    src->fd = -1;
+  }
+  return TRUE;
+}
+
+static gboolean mmap_src_get_size (GstBaseSrc *basesrc, guint64 *size)
+{
+  MmapSrc *src = MMAP_SRC (basesrc);
+
+  if (src->fd < 0)
+    return FALSE;
+  *size = src->size;
+  return TRUE;
+}
+
+static gboolean mmap_src_is_seekable (GstBaseSrc *basesrc)
+{
+  (void) basesrc;
+  return TRUE;
+}
+
+/* Switches the kernel read-ahead to the direction the reader is going */
+static void mmap_src_follow (MmapSrc *src, guint64 offset, guint length)
+{
+  MmapSrcMapping *mapping = src->mapping;
+  gboolean backward = offset + MMAP_SRC_BACKWARD < src->last_offset;
+  gboolean forward = offset >= src->last_offset;
+
+  if (backward && !src->backward)
+  {
+    src->backward = TRUE;
+    madvise (mapping->data, mapping->size, MADV_RANDOM);
+  }
+  else if (forward && src->backward)
+  {
+    src->backward = FALSE;
+    madvise (mapping->data, mapping->size, MADV_SEQUENTIAL);
+  }
+
+  if (src->backward)
+  {
+    guint64 start = offset > MMAP_SRC_WILLNEED ? offset - MMAP_SRC_WILLNEED : 0;
+    mmap_src_advise (mapping, start, offset - start + length, MADV_WILLNEED);
+  }
+  else if (!forward)
+  {
+    /* A seek: the sequential read-ahead starts over from here on its own,
+     * but the first range is needed right now */
+    mmap_src_advise (mapping, offset, length, MADV_WILLNEED);
+  }
+  src->last_offset = offset + length;
+}
+
+static GstFlowReturn mmap_src_create (GstBaseSrc *basesrc, guint64 offset, guint length, GstBuffer **buffer)
+{
+  MmapSrc *src = MMAP_SRC (basesrc);
+  GstBuffer *buf;
+  struct stat st;
+  gint64 now;
+
+  if (offset >= src->size)
+    return GST_FLOW_EOS;
+  length = (guint) MIN ((guint64) length, src->size - offset);
+
+  if (src->mapping != NULL)
+  {
+    /* Once truncated, the pages past the new end read as zeros at best: fail
+     * the read instead of handing them out, and let recovery reopen the file.
+     * The guard notices when a page is touched, the size check a little
+     * earlier, without a system call per buffer. */
+    gboolean truncated = g_atomic_int_get (&src->mapping->truncated);
+    now = g_get_monotonic_time ();
+    if (!truncated && now - src->checked >= MMAP_SRC_CHECK_INTERVAL)
+    {
+      src->checked = now;
+      truncated = fstat (src->fd, &st) != 0 || (guint64) st.st_size < src->size;
+    }
+    if (truncated)
+    {
+      GST_ELEMENT_ERROR (src, RESOURCE, READ, ("\"%s\" was truncated while being read.", src->location),
+          (NULL));
+      return GST_FLOW_ERROR;
+    }
+    mmap_src_follow (src, offset, length);
+    buf = gst_buffer_new ();
+    gst_buffer_append_memory (buf, gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY,
+        src->mapping->data, src->mapping->size, offset, length,
+        mmap_src_mapping_ref (src->mapping), mmap_src_mapping_unref));
+  }
+  else
+  {
+    GstMapInfo info;
+    ssize_t done = 0;
+
+    buf = gst_buffer_new_allocate (NULL, length, NULL);
+    gst_buffer_map (buf, &info, GST_MAP_WRITE);
+    while (done < (ssize_t) length)
+    {
+      ssize_t ret = pread (src->fd, info.data + done, length - done, offset + done);
+      if (ret < 0 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        break;
+      done += ret;
+    }
+    gst_buffer_unmap (buf, &info);
+    if (done <= 0)
+    {
+      gst_buffer_unref (buf);
+      if (done == 0)
+        return GST_FLOW_EOS;
+      GST_ELEMENT_ERROR (src, RESOURCE, READ, (NULL), GST_ERROR_SYSTEM);
+      return GST_FLOW_ERROR;
+    }
+    gst_buffer_set_size (buf, done);
+    length = done;
+    if (src->copied != NULL)
+      *src->copied += length;
+  }
+
+  GST_BUFFER_OFFSET (buf) = offset;
+  GST_BUFFER_OFFSET_END (buf) = offset + length;
+  *buffer = buf;
+  return GST_FLOW_OK;
+}
+
+static void mmap_src_class_init (MmapSrcClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSrcClass *basesrc_class = GST_BASE_SRC_CLASS (klass);
+
+  gobject_class->set_property = mmap_src_set_property;
+  gobject_class->get_property = mmap_src_get_property;
+  gobject_class->finalize = mmap_src_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_LOCATION,
+      g_param_spec_string ("location", "File Location", "Location of the file to read", NULL,
+          GParamFlags (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+  gst_element_class_set_static_metadata (element_class, "Memory mapped file source", "Source/File",
+      "Hands out the pages of a memory mapped file without copying them", "QtGsPlayer");
+  gst_element_class_add_static_pad_template (element_class, &mmap_src_src_template);
+
+  basesrc_class->start = mmap_src_start;
+  basesrc_class->stop = mmap_src_stop;
+  basesrc_class->get_size = mmap_src_get_size;
+  basesrc_class->is_seekable = mmap_src_is_seekable;
+  basesrc_class->create = mmap_src_create;
+}
+
+static void mmap_src_init (MmapSrc *src)
+{
+  src->fd = -1;
+  src->copied = NULL;
+}
+
+static GstURIType mmap_src_uri_get_type (GType type)
+{
+  (void) type;
+  return GST_URI_SRC;
+}
+
+static const gchar *const *mmap_src_uri_get_protocols (GType type)
+{
+  static const gchar *protocols[] = { "file", NULL };
+  (void) type;
+  return protocols;
+}
+
+static gchar *mmap_src_uri_get_uri (GstURIHandler *handler)
+{
+  MmapSrc *src = MMAP_SRC (handler);
+  gchar *uri = NULL;
+
+  GST_OBJECT_LOCK (src);
+  if (src->location != NULL)
+    uri = gst_filename_to_uri (src->location, NULL);
+  GST_OBJECT_UNLOCK (src);
+  return uri;
+}
+
+static gboolean mmap_src_uri_set_uri (GstURIHandler *handler, const gchar *uri, GError **error)
+{
+  gchar *location = gst_uri_get_location (uri);
+  gboolean ret;
+
+  if (location == NULL)
+  {
+    g_set_error (error, GST_URI_ERROR, GST_URI_ERROR_BAD_URI, "Invalid file URI \"%s\"", uri);
+    return FALSE;
+  }
+  ret = mmap_src_set_location (MMAP_SRC (handler), location, error);
+  g_free (location);
+  return ret;
+}
+
+static void mmap_src_uri_handler_init (gpointer g_iface, gpointer iface_data)
+{
+  GstURIHandlerInterface *iface = (GstURIHandlerInterface *) g_iface;
+  (void) iface_data;
+
+  iface->get_type = mmap_src_uri_get_type;
+  iface->get_protocols = mmap_src_uri_get_protocols;
+  iface->get_uri = mmap_src_uri_get_uri;
+  iface->set_uri = mmap_src_uri_set_uri;
+}
+
+gboolean mmap_src_register (void)
+{
+  struct sigaction action;
+
+  mmap_src_page_size = sysconf (_SC_PAGESIZE);
+  memset (&action, 0, sizeof (action));
+  action.sa_sigaction = mmap_src_sigbus;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset (&action.sa_mask);
+  if (sigaction (SIGBUS, &action, &mmap_src_previous_sigbus) != 0)
+    return FALSE;
+
+  return gst_element_register (NULL, MMAP_SRC_NAME, GST_RANK_PRIMARY + 1, mmap_src_get_type ());
+}
+
+gboolean mmap_src_is_mmap_src (GstElement *element)
+{
+  return G_TYPE_CHECK_INSTANCE_TYPE (element, mmap_src_get_type ());
+}
+
+void mmap_src_count_copies (GstElement *element, std::atomic<guint64> *counter)
+{
+  MMAP_SRC (element)->copied = counter;
+}
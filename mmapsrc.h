@@ -0,0 +1,40 @@
+#ifndef MMAPSRC_H
+#define MMAPSRC_H
+
+#include <atomic>
+#include <gst/gst.h>
+
+/* A file source that does not copy: the file is mmap()ed and the buffers
+ * handed downstream wrap the mapped pages, so demuxers read straight from
+ * the page cache instead of from a copy filesrc made with read(). It handles
+ * file:// URIs with a rank above filesrc, so playbin picks it, and works in
+ * pull mode for the demuxers that want random access.
+ *
+ * The mapping follows the reading direction with madvise(): sequential
+ * read-ahead while going forward, explicit WILLNEED hints for the range
+ * before the current one while going backward (reverse playback).
+ *
+ * Should the file not be mappable (too large for the address space, a file
+ * system without mmap) it falls back to pread() into new buffers, which is
+ * counted as copied.
+ *
+ * Truncating a mapped file makes its pages past the new end raise SIGBUS
+ * in whatever thread touches them, a demuxer reading a buffer queued long
+ * ago included. A SIGBUS handler, installed by mmap_src_register(), maps
+ * zeros over such pages of the files it maps, and the element then posts a
+ * read error; it also checks the size of the file a few times a second.
+ * This is best effort: what the demuxer makes of the zeros before the error
+ * arrives is up to it. */
+#define MMAP_SRC_NAME "qtgsplayermmapsrc"
+
+/* Registers the element for this process only, and the SIGBUS handler; call
+ * after gst_init(). A SIGBUS handler installed before is called for faults
+ * outside the mapped files. */
+gboolean mmap_src_register (void);
+
+gboolean mmap_src_is_mmap_src (GstElement *element);
+
+/* Where to add the bytes the element had to copy after all */
+void mmap_src_count_copies (GstElement *element, std::atomic<guint64> *counter);
+
+#endif // MMAPSRC_H
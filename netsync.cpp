@@ -0,0 +1,342 @@
+#include "netsync.h"
+#include "widget.h"
+#include <QDebug>
+#include <QUdpSocket>
+#include <gst/net/gstnet.h>
+
+#define SYNC_TICK_MS        250
+#define SYNC_HELLO_MS       1000
+#define SYNC_FOLLOWER_GONE  5000
+
+/* Followers start this far ahead of the leader's current position, to have
+ * prerolled by the time the leader gets there */
+#define SYNC_LEAD           (500 * GST_MSECOND)
+
+/* Once settled for SYNC_SETTLE_MS, a skew beyond SYNC_NUDGE is taken out by
+ * moving the base time, and one beyond SYNC_TOLERANCE by aligning again */
+#define SYNC_NUDGE          (4 * GST_MSECOND)
+#define SYNC_TOLERANCE      (40 * GST_MSECOND)
+#define SYNC_SETTLE_MS      2000
+
+/* A position and a clock time read further apart than this are not used */
+#define SYNC_SAMPLE_SPREAD  (2 * GST_MSECOND)
+
+/* The mapping of the leader moved: a seek, a pause, another item. Well above
+ * what sampling and the sinks' latencies account for; smaller moves show up
+ * as skew and are nudged away. */
+#define SYNC_MAPPING_MOVED  (50 * GST_MSECOND)
+
+/* An alignment whose preroll never came is given up after this long */
+#define SYNC_ALIGN_TIMEOUT_MS 10000
+
+enum { AlignIdle, AlignOpening, AlignSeeking };
+
+/* The position and the clock time at which it was, read as close together as
+ * possible; false when the thread was held up in between */
+static bool sync_sample(GstElement *pipeline, GstClock *clock, gint64 *position, GstClockTime *now)
+{
+    GstClockTime before = gst_clock_get_time(clock);
+    if (!gst_element_query_position(pipeline, GST_FORMAT_TIME, position))
+        return false;
+    GstClockTime after = gst_clock_get_time(clock);
+    if (after - before > SYNC_SAMPLE_SPREAD)
+        return false;
+    *now = before + (after - before) / 2;
+    return true;
+}
+
+static void sync_set_base_time(const GValue *value, gpointer user_data)
+{
+    GstElement *element = GST_ELEMENT(g_value_get_object(value));
+    gst_element_set_base_time(element, *static_cast<GstClockTime *>(user_data));
+}
+
+/* Sinks wait on the clock against their own copy of the base time, so a
+ * playing pipeline shifts without a flush once every element has it */
+static void sync_shift_base_time(GstElement *pipeline, GstClockTime base)
+{
+    gst_element_set_base_time(pipeline, base);
+    GstIterator *it = gst_bin_iterate_recurse(GST_BIN(pipeline));
+    gst_iterator_foreach(it, sync_set_base_time, &base);
+    gst_iterator_free(it);
+}
+
+NetSync::NetSync(Widget *player, PlayerMetrics *metrics, Role role, const QString &host, quint16 port,
+                 QObject *parent)
+    : QObject(parent)
+    , player(player)
+    , metrics(metrics)
+    , role(role)
+    , leaderAddress(host)
+    , port(port)
+    , clock(NULL)
+    , provider(NULL)
+    , socket(NULL)
+    , alignStep(AlignIdle)
+    , targetPlaying(false)
+    , targetBase(0)
+    , targetP0(0)
+    , targetStart(0)
+    , alignedPlaying(false)
+    , alignedMapping(0)
+    , warnedUnsynced(false)
+{
+    connect(&tick, SIGNAL(timeout()), this, SLOT(slotTick()));
+    connect(player, SIGNAL(asyncDone()), this, SLOT(slotAsyncDone()));
+}
+
+NetSync::~NetSync()
+{
+    if (provider != NULL)
+        gst_object_unref(provider);
+    if (clock != NULL)
+        gst_object_unref(clock);
+}
+
+bool NetSync::start()
+{
+    socket = new QUdpSocket(this);
+    connect(socket, SIGNAL(readyRead()), this, SLOT(slotReadyRead()));
+
+    if (role == Leader) {
+        clock = gst_system_clock_obtain();
+        provider = GST_OBJECT(gst_net_time_provider_new(clock, NULL, port));
+        if (provider == NULL) {
+            qWarning() << "Sync: cannot publish the clock on port" << port;
+            return false;
+        }
+        if (!socket->bind(QHostAddress::Any, port + 1)) {
+            qWarning() << "Sync: cannot listen on port" << port + 1 << ":" << socket->errorString();
+            return false;
+        }
+        qInfo() << "Sync: leading on ports" << port << "and" << port + 1;
+    } else {
+        if (leaderAddress.isNull()) {
+            qWarning() << "Sync: no leader address";
+            return false;
+        }
+        clock = gst_net_client_clock_new("netsync-clock", leaderAddress.toString().toUtf8().constData(), port, 0);
+        if (clock == NULL || !socket->bind(QHostAddress::Any, 0)) {
+            qWarning() << "Sync: cannot follow" << leaderAddress.toString();
+            return false;
+        }
+        qInfo() << "Sync: following" << leaderAddress.toString() << "port" << port;
+    }
+
+    player->setPipelineClock(clock);
+    tick.start(SYNC_TICK_MS);
+    return true;
+}
+
+void NetSync::slotTick()
+{
+    if (role == Leader) {
+        QMutableHashIterator<QString, FollowerInfo> it(followers);
+        while (it.hasNext()) {
+            if (it.next().value().seen.elapsed() > SYNC_FOLLOWER_GONE) {
+                qInfo() << "Sync: follower" << it.key() << "gone";
+                it.remove();
+            }
+        }
+        metrics->syncFollowers = followers.size();
+        publish();
+        return;
+    }
+
+    if (alignStep != AlignIdle && alignClock.elapsed() > SYNC_ALIGN_TIMEOUT_MS) {
+        qWarning() << "Sync: no preroll while aligning, trying again";
+        alignStep = AlignIdle;
+    }
+    if (!helloClock.isValid() || helloClock.elapsed() >= SYNC_HELLO_MS) {
+        helloClock.start();
+        socket->writeDatagram("hello", leaderAddress, port + 1);
+    }
+}
+
+/* What running time 0 of the leader is in stream time, and when it was */
+void NetSync::publish()
+{
+    GstElement *pipeline = player->pipeline();
+    QByteArray uri = player->currentUri().toUtf8();
+    gint64 position;
+    GstClockTime now;
+    QByteArray line;
+
+    /* A late sample would look like a seek to the followers: skip this tick */
+    if (followers.isEmpty() || pipeline == NULL || uri.isEmpty() || !sync_sample(pipeline, clock, &position, &now))
+        return;
+
+    if (GST_STATE(pipeline) == GST_STATE_PLAYING && GST_STATE_PENDING(pipeline) == GST_STATE_VOID_PENDING) {
+        GstClockTime base = gst_element_get_base_time(pipeline);
+        gint64 p0 = position - gint64(now - base);
+        line = "sync play " + QByteArray::number(quint64(base)) + " " + QByteArray::number(p0) + " " + uri;
+    } else if (GST_STATE(pipeline) == GST_STATE_PAUSED) {
+        line = "sync pause " + QByteArray::number(position) + " " + uri;
+    } else {
+        return;
+    }
+
+    for (QHash<QString, FollowerInfo>::const_iterator it = followers.constBegin(); it != followers.constEnd(); ++it) {
+        int colon = it.key().lastIndexOf(':');
+        socket->writeDatagram(line, QHostAddress(it.key().left(colon)), it.key().mid(colon + 1).toUShort());
+    }
+}
+
+void NetSync::slotReadyRead()
+{
+    while (socket->hasPendingDatagrams()) {
+        QByteArray datagram;
+        QHostAddress sender;
+        quint16 senderPort;
+        datagram.resize(int(socket->pendingDatagramSize()));
+        socket->readDatagram(datagram.data(), datagram.size(), &sender, &senderPort);
+
+        if (role == Follower) {
+            if (sender.isEqual(leaderAddress, QHostAddress::TolerantConversion) && datagram.startsWith("sync "))
+                follow(datagram);
+            continue;
+        }
+
+        QString key = sender.toString() + ":" + QString::number(senderPort);
+        if (!followers.contains(key))
+            qInfo() << "Sync: follower" << key << "joined";
+        FollowerInfo &follower = followers[key];
+        follower.seen.start();
+        if (datagram.startsWith("skew ")) {
+            follower.skew = datagram.mid(5).toLongLong();
+            gint64 worst = 0;
+            foreach (const FollowerInfo &info, followers)
+                worst = qMax(worst, qAbs(info.skew));
+            metrics->syncSkewMax = worst / 1000;
+        }
+    }
+}
+
+/* sync play <base> <p0> <uri> | sync pause <position> <uri>; the uri may hold spaces */
+void NetSync::follow(const QByteArray &line)
+{
+    bool playing = line.startsWith("sync play ");
+    int fields = playing ? 4 : 3;
+    int start = 0;
+    QList<QByteArray> values;
+    for (int i = 0; i < fields; i++) {
+        int space = line.indexOf(' ', start);
+        if (space < 0)
+            return;
+        values.append(line.mid(start, space - start));
+        start = space + 1;
+    }
+    QString uri = QString::fromUtf8(line.mid(start));
+    GstClockTime base = playing ? values.at(2).toULongLong() : 0;
+    gint64 p0 = values.at(fields - 1).toLongLong();
+
+    if (!gst_clock_is_synced(clock)) {
+        if (!warnedUnsynced)
+            qInfo() << "Sync: waiting for the network clock";
+        warnedUnsynced = true;
+        return;
+    }
+    warnedUnsynced = false;
+    if (alignStep != AlignIdle)
+        return;
+
+    GstElement *pipeline = player->pipeline();
+    if (uri != player->currentUri() || pipeline == NULL) {
+        align(uri, playing, base, p0);
+        return;
+    }
+
+    /* Stream time = clock time + mapping, on both sides once aligned */
+    gint64 mapping = p0 - gint64(base);
+    if (!playing) {
+        if (alignedPlaying || qAbs(alignedMapping - p0) > SYNC_MAPPING_MOVED || GST_STATE(pipeline) == GST_STATE_PLAYING)
+            align(uri, false, 0, p0);
+        return;
+    }
+    if (!alignedPlaying || qAbs(alignedMapping - mapping) > SYNC_MAPPING_MOVED ||
+        GST_STATE(pipeline) != GST_STATE_PLAYING) {
+        align(uri, true, base, p0);
+        return;
+    }
+
+    gint64 position;
+    GstClockTime now;
+    if (!sync_sample(pipeline, clock, &position, &now))
+        return;
+    gint64 skew = position - (gint64(now) + mapping);
+    metrics->syncSkewLast = skew / 1000;
+    socket->writeDatagram("skew " + QByteArray::number(skew), leaderAddress, port + 1);
+    if (!settled.isValid() || settled.elapsed() < SYNC_SETTLE_MS)
+        return;
+    if (qAbs(skew) > SYNC_TOLERANCE) {
+        qWarning("Sync: %.1f ms off the leader, aligning again", skew / 1e6);
+        align(uri, true, base, p0);
+    } else if (qAbs(skew) > SYNC_NUDGE) {
+        /* Ahead: a later base time holds it back by as much, and the other way round */
+        qInfo("Sync: %.1f ms off the leader, moving the base time", skew / 1e6);
+        sync_shift_base_time(pipeline, GstClockTime(gint64(gst_element_get_base_time(pipeline)) + skew));
+        metrics->syncNudges++;
+        settled.start();
+    }
+}
+
+/* Preroll at the leader's position, plus a lead when it plays, then play with the
+ * base time that maps that position to the same clock time as on the leader */
+void NetSync::align(const QString &uri, bool playing, GstClockTime base, gint64 p0)
+{
+    targetPlaying = playing;
+    targetBase = base;
+    targetP0 = p0;
+    settled.invalidate();
+    alignClock.start();
+    metrics->syncAlignments++;
+
+    if (uri != player->currentUri() || player->pipeline() == NULL) {
+        alignStep = AlignOpening;
+        player->openPausedUri(uri);
+        return;
+    }
+    seek();
+}
+
+void NetSync::seek()
+{
+    GstElement *pipeline = player->pipeline();
+    targetStart = targetP0;
+    if (targetPlaying)
+        targetStart = targetP0 + gint64(gst_clock_get_time(clock) - targetBase) + SYNC_LEAD;
+
+    alignStep = AlignSeeking;
+    gst_element_set_state(pipeline, GST_STATE_PAUSED);
+    if (!player->seekLikeSlider(qMax(targetStart, gint64(0)), GstSeekFlags(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE))) {
+        qWarning() << "Sync: seek failed";
+        alignStep = AlignIdle;
+    }
+}
+
+void NetSync::slotAsyncDone()
+{
+    if (role != Follower)
+        return;
+    if (alignStep == AlignOpening) {
+        seek();
+        return;
+    }
+    if (alignStep != AlignSeeking)
+        return;
+
+    alignStep = AlignIdle;
+    alignedPlaying = targetPlaying;
+    if (!targetPlaying) {
+        alignedMapping = targetP0;
+        return;
+    }
+
+    /* No base time of its own: the pipeline keeps the one given */
+    GstElement *pipeline = player->pipeline();
+    alignedMapping = targetP0 - gint64(targetBase);
+    gst_element_set_start_time(pipeline, GST_CLOCK_TIME_NONE);
+    gst_element_set_base_time(pipeline, targetBase + (targetStart - targetP0));
+    player->slotPlay();
+    settled.start();
+}
@@ -0,0 +1,95 @@
+#ifndef NETSYNC_H
+#define NETSYNC_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QHostAddress>
+#include <QObject>
+#include <QTimer>
+#include <gst/gst.h>
+#include "metrics.h"
+
+QT_BEGIN_NAMESPACE
+class QUdpSocket;
+QT_END_NAMESPACE
+
+class Widget;
+
+/* Video wall mode: several players, usually on several boxes, showing the
+ * same frame at the same time.
+ *
+ * The leader runs its pipeline on the system clock and publishes that clock
+ * on UDP port with a GstNetTimeProvider. Followers run theirs on a
+ * GstNetClientClock locked to it, so that the clock time is the same
+ * everywhere. On port + 1 the leader sends every follower, four times per
+ * second, how stream time maps to clock time:
+ *
+ *   sync play <base time> <position at running time 0> <uri>
+ *   sync pause <position> <uri>
+ *
+ * A follower opens the same uri, seeks to where the leader will be and
+ * uses a base time that gives the same mapping. It then keeps comparing its
+ * own position with the leader's at the same clock time. That difference
+ * is the skew reported to the leader ("skew <ns>"). A small skew, such as
+ * the one left by sinks of different latencies, is taken out by moving the
+ * base time of the playing pipeline, without a flush; a large one, or seeks
+ * and moves to another item on the leader, which change the mapping by more
+ * than sampling it can, make the follower align again with a flushing seek.
+ * Playback rates other than 1 are not followed. */
+class NetSync : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Role { Leader, Follower };
+
+    /* host is the leader's address; ignored for the leader */
+    NetSync(Widget *player, PlayerMetrics *metrics, Role role, const QString &host, quint16 port,
+            QObject *parent = 0);
+    ~NetSync();
+
+    bool start();
+
+private slots:
+    void slotTick();
+    void slotReadyRead();
+    void slotAsyncDone();
+
+private:
+    void publish();
+    void follow(const QByteArray &line);
+    void align(const QString &uri, bool playing, GstClockTime base, gint64 p0);
+    void seek();
+
+    Widget *player;
+    PlayerMetrics *metrics;
+    Role role;
+    QHostAddress leaderAddress;
+    quint16 port;
+    GstClock *clock;
+    GstObject *provider;            /* GstNetTimeProvider of the leader */
+    QUdpSocket *socket;
+    QTimer tick;
+
+    /* Leader: followers seen within the last seconds, and their last skew */
+    struct FollowerInfo {
+        QElapsedTimer seen;
+        gint64 skew = 0;
+    };
+    QHash<QString, FollowerInfo> followers;
+
+    /* Follower: the mapping being applied, and the one applied */
+    int alignStep;
+    QElapsedTimer alignClock;       /* Since the current alignment started */
+    bool targetPlaying;
+    GstClockTime targetBase;
+    gint64 targetP0;
+    gint64 targetStart;             /* Where the follower prerolls */
+    bool alignedPlaying;
+    gint64 alignedMapping;          /* Stream time minus clock time, or the paused position */
+    QElapsedTimer settled;          /* Since the last alignment completed */
+    QElapsedTimer helloClock;
+    bool warnedUnsynced;
+};
+
+#endif // NETSYNC_H
@@ -0,0 +1,20 @@
+#include "playbackstate.h"
+
+gboolean playback_reached_end (gint64 position, gint64 duration)
+{
+  if (position < 0 || duration <= 0 || !GST_CLOCK_TIME_IS_VALID (duration))
+    return FALSE;
+  return position >= duration;
+}
+
+gint playback_slider_range (gint64 duration)
+{
+  if (duration <= 0 || !GST_CLOCK_TIME_IS_VALID (duration))
+    return 0;
+  return (gint) (duration / GST_SECOND);
+}
+
+gint playback_slider_value (gint64 position)
+{
+  return position > 0 ? (gint) (position / GST_SECOND) : 0;
+}
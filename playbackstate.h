@@ -0,0 +1,19 @@
+#ifndef PLAYBACKSTATE_H
+#define PLAYBACKSTATE_H
+
+#include <gst/gst.h>
+
+/* Decisions taken by the periodic refresh, kept apart from Qt and from the
+ * pipeline queries so that they can be driven with synthetic positions, e.g.
+ * from a pipeline running on a GstTestClock (see Widget::setPipelineClock()). */
+
+/* The position reported by the pipeline has reached the end of the clip. Some
+ * demuxers report positions a little past the duration, so this is not an
+ * exact match; the EOS message stays the normal way playback ends. */
+gboolean playback_reached_end (gint64 position, gint64 duration);
+
+/* Slider range and value, in seconds */
+gint playback_slider_range (gint64 duration);
+gint playback_slider_value (gint64 position);
+
+#endif // PLAYBACKSTATE_H
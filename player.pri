@@ -0,0 +1,71 @@
+# The player engine and widgets, shared by the application and the tests (tests/)
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/widget.cpp \
+    $$PWD/videowidget.cpp \
+    $$PWD/playercontrols.cpp \
+    $$PWD/resumestore.cpp \
+    $$PWD/trace.cpp \
+    $$PWD/metrics.cpp \
+    $$PWD/metricsserver.cpp \
+    $$PWD/playlist.cpp \
+    $$PWD/remotecontrol.cpp \
+    $$PWD/videosinkbin.cpp \
+    $$PWD/recovery.cpp \
+    $$PWD/watchdog.cpp \
+    $$PWD/avsync.cpp \
+    $$PWD/playbackstate.cpp \
+    $$PWD/seekbenchmark.cpp \
+    $$PWD/prefetcher.cpp \
+    $$PWD/mmapsrc.cpp \
+    $$PWD/framepool.cpp \
+    $$PWD/netsync.cpp \
+    $$PWD/livemode.cpp \
+    $$PWD/taskpool.cpp \
+    $$PWD/qoscontrol.cpp \
+    $$PWD/decoderthreads.cpp \
+    $$PWD/waveform.cpp \
+    $$PWD/timelineslider.cpp \
+    $$PWD/videoanalytics.cpp \
+    $$PWD/trackswitch.cpp \
+    $$PWD/backgroundworker.cpp
+
+HEADERS += \
+    $$PWD/widget.h \
+    $$PWD/videowidget.h \
+    $$PWD/playercontrols.h \
+    $$PWD/resumestore.h \
+    $$PWD/trace.h \
+    $$PWD/metrics.h \
+    $$PWD/metricsserver.h \
+    $$PWD/playlist.h \
+    $$PWD/remotecontrol.h \
+    $$PWD/videosinkbin.h \
+    $$PWD/recovery.h \
+    $$PWD/watchdog.h \
+    $$PWD/avsync.h \
+    $$PWD/playbackstate.h \
+    $$PWD/seekbenchmark.h \
+    $$PWD/prefetcher.h \
+    $$PWD/mmapsrc.h \
+    $$PWD/framepool.h \
+    $$PWD/netsync.h \
+    $$PWD/livemode.h \
+    $$PWD/taskpool.h \
+    $$PWD/qoscontrol.h \
+    $$PWD/decoderthreads.h \
+    $$PWD/waveform.h \
+    $$PWD/timelineslider.h \
+    $$PWD/videoanalytics.h \
+    $$PWD/trackswitch.h \
+    $$PWD/backgroundworker.h
+
+INCLUDEPATH += \
+    /home/clivelau/Programs/fsl-imx-x11/4.9.11-1.0.0/sysroots/cortexa9hf-neon-poky-linux-gnueabi/usr/include/gstreamer-1.0 \
+    /home/clivelau/Programs/fsl-imx-x11/4.9.11-1.0.0/sysroots/cortexa9hf-neon-poky-linux-gnueabi/usr/include/glib-2.0 \
+    /home/clivelau/Programs/fsl-imx-x11/4.9.11-1.0.0/sysroots/cortexa9hf-neon-poky-linux-gnueabi/usr/include/libxml2 \
+    /home/clivelau/Programs/fsl-imx-x11/4.9.11-1.0.0/sysroots/cortexa9hf-neon-poky-linux-gnueabi/usr/include
+
+LIBS += -lgstreamer-1.0 -lgobject-2.0 -lglib-2.0 -lgstvideo-1.0 -lgstbase-1.0 -lgstnet-1.0 -lgstapp-1.0
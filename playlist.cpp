@@ -0,0 +1,84 @@
+#include "playlist.h"
+#include <QCollator>
+#include <QDir>
+#include <QFileInfo>
+#include <algorithm>
+
+static const char *const mediaSuffixes[] = {
+    "3gp", "aac", "avi", "flac", "flv", "m2ts", "m4a", "m4v", "mkv", "mov", "mp3",
+    "mp4", "mpeg", "mpg", "oga", "ogg", "ogv", "opus", "ts", "wav", "webm", "wma", "wmv"
+};
+
+Playlist::Playlist()
+    : index(-1)
+    , audioOnly(false)
+{
+}
+
+bool Playlist::isMediaFile(const QString &fileName)
+{
+    QString suffix = QFileInfo(fileName).suffix().toLower();
+    for (size_t i = 0; i < sizeof(mediaSuffixes) / sizeof(mediaSuffixes[0]); i++) {
+        if (suffix == mediaSuffixes[i])
+            return true;
+    }
+    return false;
+}
+
+void Playlist::setCurrent(const QString &fileName)
+{
+    QFileInfo info(fileName);
+    QString path = info.absoluteFilePath();
+
+    if (index >= 0 && files.at(index) == path)
+        return;
+    if (index < 0 || QFileInfo(files.at(index)).absolutePath() != info.absolutePath()) {
+        files.clear();
+        audioOnly = QFileInfo(info.absoluteDir(), ".audio-only").exists();
+        foreach (const QFileInfo &entry, info.absoluteDir().entryInfoList(QDir::Files | QDir::Readable)) {
+            if (isMediaFile(entry.fileName()))
+                files.append(entry.absoluteFilePath());
+        }
+
+        /* "clip2" sorts before "clip10" */
+        QCollator collator;
+        collator.setNumericMode(true);
+        std::sort(files.begin(), files.end(), collator);
+    }
+
+    index = files.indexOf(path);
+    if (index < 0) {
+        files.append(path);
+        index = files.size() - 1;
+    }
+}
+
+QString Playlist::current() const
+{
+    return index >= 0 ? files.at(index) : QString();
+}
+
+QString Playlist::next() const
+{
+    return index >= 0 ? files.at((index + 1) % files.size()) : QString();
+}
+
+QString Playlist::previous() const
+{
+    return index >= 0 ? files.at((index + files.size() - 1) % files.size()) : QString();
+}
+
+bool Playlist::isAudioOnly() const
+{
+    return audioOnly;
+}
+
+QStringList Playlist::upcoming(int count) const
+{
+    QStringList result;
+    if (index < 0)
+        return result;
+    for (int i = 1; i <= count && i < files.size(); i++)
+        result.append(files.at((index + i) % files.size()));
+    return result;
+}
@@ -0,0 +1,34 @@
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+#include <QString>
+#include <QStringList>
+
+/* The media files of the directory holding the current file, in name order.
+ * This is what next/previous step through. */
+class Playlist
+{
+public:
+    Playlist();
+
+    void setCurrent(const QString &fileName);
+    QString current() const;
+
+    QString next() const;
+    QString previous() const;
+
+    /* Up to count files following the current one, wrapping around */
+    QStringList upcoming(int count) const;
+
+    /* The directory holds a ".audio-only" marker: play its files without video */
+    bool isAudioOnly() const;
+
+    static bool isMediaFile(const QString &fileName);
+
+private:
+    QStringList files;
+    int index;
+    bool audioOnly;
+};
+
+#endif // PLAYLIST_H
@@ -0,0 +1,193 @@
+#include "prefetcher.h"
+#include "backgroundworker.h"
+#include <QDebug>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QDateTime>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Read ahead in chunks so that a new request does not wait for a whole file */
+#define PREFETCH_CHUNK      (1024 * 1024)
+
+/* Of the other containers, the tail read ahead in case the index is there */
+#define PREFETCH_TAIL       (256 * 1024)
+
+static QString file_identity(const QFileInfo &info)
+{
+    return QString::number(info.size()) + ":" + QString::number(info.lastModified().toMSecsSinceEpoch());
+}
+
+static bool is_isobmff(const QString &fileName)
+{
+    QString suffix = QFileInfo(fileName).suffix().toLower();
+    return suffix == "mp4" || suffix == "m4v" || suffix == "m4a" || suffix == "mov" || suffix == "3gp";
+}
+
+/* Walks the top level boxes for the moov atom; only the 8 or 16 byte headers are read */
+static bool find_moov(int fd, qint64 size, qint64 *offset, qint64 *length)
+{
+    qint64 position = 0;
+    while (position + 8 <= size) {
+        unsigned char header[16];
+        if (pread(fd, header, 8, position) != 8)
+            return false;
+        quint64 boxSize = (quint64(header[0]) << 24) | (header[1] << 16) | (header[2] << 8) | header[3];
+        if (boxSize == 1) {
+            if (pread(fd, header + 8, 8, position + 8) != 8)
+                return false;
+            boxSize = 0;
+            for (int i = 8; i < 16; i++)
+                boxSize = (boxSize << 8) | header[i];
+        } else if (boxSize == 0) {
+            boxSize = size - position;
+        }
+        if (boxSize < 8)
+            return false;
+        if (memcmp(header + 4, "moov", 4) == 0) {
+            *offset = position;
+            *length = qMin(qint64(boxSize), size - position);
+            return true;
+        }
+        position += boxSize;
+    }
+    return false;
+}
+
+Prefetcher::Prefetcher(PlayerMetrics *metrics, qint64 budgetBytes, QObject *parent)
+    : QThread(parent)
+    , metrics(metrics)
+    , budgetBytes(budgetBytes)
+    , generation(0)
+    , quitting(false)
+{
+}
+
+Prefetcher::~Prefetcher()
+{
+    mutex.lock();
+    quitting = true;
+    generation++;
+    wakeUp.wakeAll();
+    mutex.unlock();
+    wait();
+}
+
+void Prefetcher::prefetch(const QStringList &files)
+{
+    QMutexLocker locker(&mutex);
+    queue = files;
+    generation++;
+    wakeUp.wakeAll();
+}
+
+bool Prefetcher::isWarm(const QString &fileName)
+{
+    QFileInfo info(fileName);
+    QMutexLocker locker(&mutex);
+    QHash<QString, QString>::const_iterator it = warmed.constFind(info.absoluteFilePath());
+    return it != warmed.constEnd() && it.value() == file_identity(info);
+}
+
+void Prefetcher::run()
+{
+    /* Only use the disk when nobody else does */
+    if (!background_idle_io())
+        qWarning() << "Prefetch: cannot use the idle I/O class, reading at normal priority";
+
+    mutex.lock();
+    while (!quitting) {
+        if (queue.isEmpty()) {
+            wakeUp.wait(&mutex);
+            continue;
+        }
+        QStringList files = queue;
+        queue.clear();
+        int seenGeneration = generation;
+        mutex.unlock();
+
+        qint64 remaining = budgetBytes;
+        for (int i = 0; i < files.size() && remaining > 0 && generation == seenGeneration; i++) {
+            QFileInfo info(files.at(i));
+            if (!info.isFile() || isWarm(info.absoluteFilePath()))
+                continue;
+
+            /* Files further away are less likely to be opened: the budget goes
+             * in equal shares, and what a small file leaves goes to the next */
+            qint64 share = remaining / (files.size() - i);
+            qint64 used = qMin(share, info.size());
+            if (warm(info.absoluteFilePath(), used)) {
+                QMutexLocker locker(&mutex);
+                warmed.insert(info.absoluteFilePath(), file_identity(info));
+            }
+            remaining -= used;
+        }
+        mutex.lock();
+    }
+    mutex.unlock();
+}
+
+bool Prefetcher::warm(const QString &fileName, qint64 budget)
+{
+    int fd = open(fileName.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    qint64 size = st.st_size;
+
+    /* The index first: without it the demuxer cannot even start */
+    qint64 tailOffset = size, tailLength = 0;
+    if (is_isobmff(fileName)) {
+        if (find_moov(fd, size, &tailOffset, &tailLength) && tailOffset < budget)
+            tailLength = 0;         /* Faststart: part of the head anyway */
+        tailLength = qMin(tailLength, budget / 2);
+    } else if (size > budget) {
+        tailLength = qMin(qint64(PREFETCH_TAIL), budget / 4);
+        tailOffset = size - tailLength;
+    }
+    qint64 headLength = qMin(budget - tailLength, size);
+
+    gint64 start = g_get_monotonic_time();
+    qint64 queued = 0;
+    bool done = readAhead(fd, tailOffset, tailLength, &queued) && readAhead(fd, 0, headLength, &queued);
+    close(fd);
+
+    /* Neither readahead() nor fadvise() took any of it: not warm */
+    if (done && queued == 0 && headLength + tailLength > 0) {
+        qWarning() << "Prefetch: cannot read ahead" << fileName;
+        return false;
+    }
+    if (done) {
+        metrics->prefetchFiles++;
+        qInfo() << "Prefetched" << fileName << ":" << queued / 1024 << "KiB in"
+                << (g_get_monotonic_time() - start) / 1000 << "ms";
+    }
+    return done;
+}
+
+/* Adds the bytes queued for reading to queued. Returns false when abandoned for a newer request. */
+bool Prefetcher::readAhead(int fd, qint64 offset, qint64 length, qint64 *queued)
+{
+    int seenGeneration = generation;
+    while (length > 0) {
+        if (generation != seenGeneration)
+            return false;
+        qint64 chunk = qMin(length, qint64(PREFETCH_CHUNK));
+        /* readahead() reads on this thread, so the idle I/O class applies; fadvise is
+         * the fallback for file systems that do not support it. Only what either
+         * queued counts as prefetched. */
+        if (readahead(fd, offset, chunk) == 0 || posix_fadvise(fd, offset, chunk, POSIX_FADV_WILLNEED) == 0) {
+            metrics->prefetchBytes += chunk;
+            *queued += chunk;
+        }
+        offset += chunk;
+        length -= chunk;
+    }
+    return true;
+}
@@ -0,0 +1,53 @@
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include <atomic>
+#include <QHash>
+#include <QMutex>
+#include <QStringList>
+#include <QThread>
+#include <QWaitCondition>
+#include "metrics.h"
+
+/* Warms the page cache with the files likely to be opened next, so that
+ * opening them from slow SD/eMMC storage does not wait on cold reads for the
+ * container header and the first GOP.
+ *
+ * Of every file, the head is read ahead and so is its index when it lives at
+ * the tail: the moov atom of MP4/MOV files written without faststart, or the
+ * last bytes of the others (Matroska cues, AVI idx1). The files share
+ * budgetBytes. Reading happens with readahead(2) on a thread in the idle I/O
+ * scheduling class, so playback of the current file always goes first. */
+class Prefetcher : public QThread
+{
+    Q_OBJECT
+
+public:
+    Prefetcher(PlayerMetrics *metrics, qint64 budgetBytes, QObject *parent = 0);
+    ~Prefetcher();
+
+    /* Replaces whatever was still waiting; files already warm are skipped */
+    void prefetch(const QStringList &files);
+
+    /* The file was prefetched and has not changed since. The kernel may have
+     * evicted it again under memory pressure. */
+    bool isWarm(const QString &fileName);
+
+protected:
+    void run();
+
+private:
+    bool warm(const QString &fileName, qint64 budget);
+    bool readAhead(int fd, qint64 offset, qint64 length, qint64 *queued);
+
+    PlayerMetrics *metrics;
+    qint64 budgetBytes;
+    QMutex mutex;
+    QWaitCondition wakeUp;
+    QStringList queue;
+    QHash<QString, QString> warmed;     /* File name to its size and mtime when warmed */
+    std::atomic<int> generation;        /* Bumped by prefetch() to abandon the current file */
+    bool quitting;
+};
+
+#endif // PREFETCHER_H
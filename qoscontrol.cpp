@@ -0,0 +1,293 @@
+#include "qoscontrol.h"
+#include "metrics.h"
+#include "videosinkbin.h"
+#include <string.h>
+
+/* Seconds of QoS messages looked at together */
+#define QOS_WINDOW            1
+
+/* Overloaded: this many late frames in a window, or a proportion this high */
+#define QOS_LATE_FRAMES       3
+#define QOS_PROPORTION_HIGH   1.25
+
+/* Seconds given to a lower level to take effect before going further down */
+#define QOS_SETTLE            2
+
+/* Seconds without a late frame before going back up, initially and at most */
+#define QOS_HOLD              10
+#define QOS_HOLD_MAX          120
+
+struct _QosControl {
+  gboolean enabled;
+  gint level;                     /* QosLevel, read from the streaming threads */
+
+  GMutex lock;
+  GPtrArray *decoders;            /* GWeakRef to the video decoders */
+  guint late;
+  gdouble proportion;
+  GstClockTimeDiff jitter;
+
+  /* Only touched by the GUI thread */
+  gint64 window_start;
+  gint64 calm_since;
+  gint64 last_change;
+  gboolean last_change_up;
+  guint hold;
+};
+
+static const struct {
+  const gchar *name;
+  const gchar *property;          /* Decoder property turned on from this level */
+} qos_levels[QOS_LEVELS] = {
+  { "full quality", NULL },
+  { "loop filter skipped", "skip-loop-filter" },
+  { "non-reference frames skipped", "skip-frame" },
+  { "half size", NULL },
+  { "half frame rate", NULL },
+};
+
+const gchar *qos_control_level_name (QosLevel level)
+{
+  return qos_levels[level].name;
+}
+
+static void qos_control_weak_ref_free (gpointer data)
+{
+  GWeakRef *ref = (GWeakRef *) data;
+  g_weak_ref_clear (ref);
+  g_free (ref);
+}
+
+QosControl *qos_control_new (void)
+{
+  QosControl *qos = g_new0 (QosControl, 1);
+  const gchar *enabled = g_getenv ("QTGSPLAYER_QOS");
+
+  g_mutex_init (&qos->lock);
+  qos->enabled = enabled == NULL || strcmp (enabled, "0") != 0;
+  qos->decoders = g_ptr_array_new_with_free_func (qos_control_weak_ref_free);
+  qos->hold = QOS_HOLD;
+  return qos;
+}
+
+void qos_control_free (QosControl *qos)
+{
+  g_ptr_array_unref (qos->decoders);
+  g_mutex_clear (&qos->lock);
+  g_free (qos);
+}
+
+void qos_control_reset (QosControl *qos, GstElement *video_sink)
+{
+  g_atomic_int_set (&qos->level, QOS_LEVEL_FULL);
+  g_mutex_lock (&qos->lock);
+  g_ptr_array_set_size (qos->decoders, 0);
+  qos->late = 0;
+  qos->proportion = 0;
+  qos->jitter = 0;
+  g_mutex_unlock (&qos->lock);
+  qos->window_start = 0;
+  qos->last_change = 0;
+  qos->last_change_up = FALSE;
+  qos->hold = QOS_HOLD;
+  video_sink_bin_set_load_shedding (video_sink, 0, 1);
+}
+
+/* Turns a decoder setting on, or back to its default. On is TRUE for a
+ * boolean and the first value past the default for an enumeration or an
+ * integer, e.g. "Skip B-frames" (non-reference frames) for avdec's "skip-frame". */
+static void qos_control_set_property (GstElement *decoder, const gchar *name, gboolean on)
+{
+  GParamSpec *pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (decoder), name);
+  GValue value = G_VALUE_INIT;
+
+  if (pspec == NULL || !(pspec->flags & G_PARAM_WRITABLE))
+    return;
+
+  g_value_init (&value, pspec->value_type);
+  g_param_value_set_default (pspec, &value);
+  if (on && G_IS_PARAM_SPEC_BOOLEAN (pspec))
+  {
+    g_value_set_boolean (&value, TRUE);
+  }
+  else if (on && G_IS_PARAM_SPEC_ENUM (pspec))
+  {
+    GEnumClass *klass = G_PARAM_SPEC_ENUM (pspec)->enum_class;
+    gint current = g_value_get_enum (&value), next = current;
+    for (guint i = 0; i < klass->n_values; i++)
+      if (klass->values[i].value > current && (next == current || klass->values[i].value < next))
+        next = klass->values[i].value;
+    g_value_set_enum (&value, next);
+  }
+  else if (on && G_IS_PARAM_SPEC_INT (pspec))
+  {
+    g_value_set_int (&value, MIN (g_value_get_int (&value) + 1, G_PARAM_SPEC_INT (pspec)->maximum));
+  }
+  g_object_set_property (G_OBJECT (decoder), name, &value);
+  g_value_unset (&value);
+}
+
+static void qos_control_apply_decoder (GstElement *decoder, gint level)
+{
+  for (gint i = QOS_LEVEL_FULL + 1; i < QOS_LEVELS; i++)
+    if (qos_levels[i].property != NULL)
+      qos_control_set_property (decoder, qos_levels[i].property, level >= i);
+}
+
+static void qos_control_apply_sink (GstElement *video_sink, gint level)
+{
+  video_sink_bin_set_load_shedding (video_sink, level >= QOS_LEVEL_HALF_SIZE ? 1 : 0,
+      level >= QOS_LEVEL_HALF_RATE ? 2 : 1);
+}
+
+void qos_control_element_setup (QosControl *qos, GstElement *element)
+{
+  GWeakRef *ref;
+  gint level = g_atomic_int_get (&qos->level);
+
+  if (!qos->enabled || !element_has_klass (element, "Decoder") || !element_has_klass (element, "Video"))
+    return;
+
+  ref = g_new0 (GWeakRef, 1);
+  g_weak_ref_init (ref, element);
+  g_mutex_lock (&qos->lock);
+  g_ptr_array_add (qos->decoders, ref);
+  g_mutex_unlock (&qos->lock);
+  if (level > QOS_LEVEL_FULL)
+    qos_control_apply_decoder (element, level);
+}
+
+void qos_control_message (QosControl *qos, GstMessage *msg)
+{
+  GstObject *src = GST_MESSAGE_SRC (msg);
+  GstClockTimeDiff jitter;
+  gdouble proportion;
+
+  if (!qos->enabled || GST_MESSAGE_TYPE (msg) != GST_MESSAGE_QOS ||
+      !GST_IS_ELEMENT (src) || !element_has_klass (GST_ELEMENT (src), "Video"))
+    return;
+
+  gst_message_parse_qos_values (msg, &jitter, &proportion, NULL);
+  g_mutex_lock (&qos->lock);
+  qos->late++;
+  qos->proportion = MAX (qos->proportion, proportion);
+  qos->jitter = MAX (qos->jitter, jitter);
+  g_mutex_unlock (&qos->lock);
+}
+
+/* The decoders still alive; dead references are dropped on the way */
+static GList *qos_control_ref_decoders (QosControl *qos)
+{
+  GList *decoders = NULL;
+
+  g_mutex_lock (&qos->lock);
+  for (guint i = 0; i < qos->decoders->len;)
+  {
+    GstElement *decoder = (GstElement *) g_weak_ref_get ((GWeakRef *) g_ptr_array_index (qos->decoders, i));
+    if (decoder == NULL)
+    {
+      g_ptr_array_remove_index_fast (qos->decoders, i);
+      continue;
+    }
+    decoders = g_list_prepend (decoders, decoder);
+    i++;
+  }
+  g_mutex_unlock (&qos->lock);
+  return decoders;
+}
+
+static gboolean qos_control_level_available (gint level, GList *decoders, GstElement *video_sink)
+{
+  if (qos_levels[level].property == NULL)
+    return video_sink != NULL;
+  for (GList *l = decoders; l != NULL; l = l->next)
+    if (g_object_class_find_property (G_OBJECT_GET_CLASS (l->data), qos_levels[level].property) != NULL)
+      return TRUE;
+  return FALSE;
+}
+
+gboolean qos_control_update (QosControl *qos, GstElement *video_sink, QosStep *step)
+{
+  gint64 now = g_get_monotonic_time ();
+  gint level = g_atomic_int_get (&qos->level), target = level;
+  guint late;
+  gdouble proportion;
+  GstClockTimeDiff jitter;
+  GList *decoders;
+
+  if (!qos->enabled)
+    return FALSE;
+
+  /* Cheap when nothing changes, and covers a sink bin rebuilt by a recovery */
+  qos_control_apply_sink (video_sink, level);
+
+  if (qos->window_start == 0)
+  {
+    qos->window_start = qos->calm_since = now;
+    return FALSE;
+  }
+  if (now - qos->window_start < QOS_WINDOW * G_USEC_PER_SEC)
+    return FALSE;
+  qos->window_start = now;
+
+  g_mutex_lock (&qos->lock);
+  late = qos->late;
+  proportion = qos->proportion;
+  jitter = qos->jitter;
+  qos->late = 0;
+  qos->proportion = 0;
+  qos->jitter = 0;
+  g_mutex_unlock (&qos->lock);
+
+  decoders = qos_control_ref_decoders (qos);
+  if (late >= QOS_LATE_FRAMES || proportion >= QOS_PROPORTION_HIGH)
+  {
+    qos->calm_since = now;
+    if (now - qos->last_change >= QOS_SETTLE * G_USEC_PER_SEC)
+    {
+      for (target = level + 1; target < QOS_LEVELS; target++)
+        if (qos_control_level_available (target, decoders, video_sink))
+          break;
+      if (target == QOS_LEVELS)
+        target = level;
+    }
+    /* Overloaded again soon after going up: that level was too much for now */
+    if (target > level && qos->last_change_up && now - qos->last_change < (gint64) qos->hold * G_USEC_PER_SEC)
+      qos->hold = MIN (qos->hold * 2, QOS_HOLD_MAX);
+  }
+  else if (late > 0)
+  {
+    qos->calm_since = now;
+  }
+  else if (level > QOS_LEVEL_FULL && now - qos->calm_since >= (gint64) qos->hold * G_USEC_PER_SEC)
+  {
+    for (target = level - 1; target > QOS_LEVEL_FULL; target--)
+      if (qos_control_level_available (target, decoders, video_sink))
+        break;
+    qos->calm_since = now;
+  }
+
+  if (target != level)
+  {
+    for (GList *l = decoders; l != NULL; l = l->next)
+      qos_control_apply_decoder (GST_ELEMENT (l->data), target);
+    qos_control_apply_sink (video_sink, target);
+    g_atomic_int_set (&qos->level, target);
+    qos->last_change = now;
+    qos->last_change_up = target < level;
+
+    step->from = (QosLevel) level;
+    step->to = (QosLevel) target;
+    step->late = late;
+    step->proportion = proportion;
+    step->jitter = jitter;
+    step->hold_s = qos->hold;
+  }
+  g_list_free_full (decoders, gst_object_unref);
+  return target != level;
+}
+
+QosLevel qos_control_get_level (QosControl *qos)
+{
+  return (QosLevel) g_atomic_int_get (&qos->level);
+}
@@ -0,0 +1,67 @@
+#ifndef QOSCONTROL_H
+#define QOSCONTROL_H
+
+#include <gst/gst.h>
+
+/* Adaptive decoding quality under CPU overload.
+ *
+ * Sinks post a QoS message for every frame they drop for being late, and
+ * decoders for every frame they skip because of it; each one carries the
+ * jitter and the proportion asked from upstream. Without help the frames are
+ * decoded in full only to be thrown away. Once a second the controller looks
+ * at what came in: several late frames, or a proportion well above 1, and it
+ * steps the quality down one level, the levels adding up:
+ *
+ *   1. the decoders skip the loop filter ("skip-loop-filter");
+ *   2. they skip the non-reference frames ("skip-frame");
+ *   3. the video sink bin scales to half the window, and asks the decoders
+ *      for half resolution ("lowres") from the next stream on;
+ *   4. it passes only every other frame on to conversion and display.
+ *
+ * Levels nothing in the pipeline can apply are skipped. After a step it waits
+ * for the new level to show its effect before going further down; quality
+ * goes back up one level after QOS_HOLD seconds without a late frame, and
+ * that wait doubles each time a step up has to be taken back right away.
+ * QTGSPLAYER_QOS=0 turns it off. */
+typedef struct _QosControl QosControl;
+
+typedef enum {
+  QOS_LEVEL_FULL,
+  QOS_LEVEL_SKIP_LOOP_FILTER,
+  QOS_LEVEL_SKIP_NONREF,
+  QOS_LEVEL_HALF_SIZE,
+  QOS_LEVEL_HALF_RATE,
+  QOS_LEVELS
+} QosLevel;
+
+/* A level change, as returned by qos_control_update() */
+typedef struct _QosStep {
+  QosLevel from;
+  QosLevel to;
+  guint late;                     /* QoS messages in the last window */
+  gdouble proportion;             /* Largest one asked for in the window */
+  GstClockTimeDiff jitter;        /* Largest lateness in the window */
+  guint hold_s;                   /* Calm time now needed before stepping up */
+} QosStep;
+
+QosControl *qos_control_new (void);
+void qos_control_free (QosControl *qos);
+
+/* A new URI: back to full quality, and the decoders of the old one forgotten */
+void qos_control_reset (QosControl *qos, GstElement *video_sink);
+
+/* Called from playbin's element-setup signal; video decoders start at the current level */
+void qos_control_element_setup (QosControl *qos, GstElement *element);
+
+/* Called from the bus sync handler for every message */
+void qos_control_message (QosControl *qos, GstMessage *msg);
+
+/* Called periodically from the GUI thread with the video sink bin. Returns
+ * TRUE and fills step when the level changed. */
+gboolean qos_control_update (QosControl *qos, GstElement *video_sink, QosStep *step);
+
+QosLevel qos_control_get_level (QosControl *qos);
+
+const gchar *qos_control_level_name (QosLevel level);
+
+#endif // QOSCONTROL_H
@@ -0,0 +1,99 @@
+#include "recovery.h"
+#include <QThread>
+
+#define RECOVERY_BACKOFF_FIRST_MS   250
+
+RecoveryClass recovery_classify (const GError *error)
+{
+  if (error == NULL)
+    return RecoveryTransient;
+
+  if (error->domain == GST_CORE_ERROR)
+  {
+    switch (error->code)
+    {
+      case GST_CORE_ERROR_MISSING_PLUGIN:
+      case GST_CORE_ERROR_NOT_IMPLEMENTED:
+      case GST_CORE_ERROR_DISABLED:
+        return RecoveryFatal;
+      default:
+        /* Negotiation, state change, clock and pad errors depend on the run */
+        return RecoveryTransient;
+    }
+  }
+  if (error->domain == GST_LIBRARY_ERROR)
+    return RecoveryFatal;
+  if (error->domain == GST_RESOURCE_ERROR)
+  {
+    switch (error->code)
+    {
+      case GST_RESOURCE_ERROR_NOT_FOUND:
+      case GST_RESOURCE_ERROR_NOT_AUTHORIZED:
+      case GST_RESOURCE_ERROR_NO_SPACE_LEFT:
+        return RecoveryFatal;
+      default:
+        /* Read, seek, busy device, network share going away for a moment */
+        return RecoveryTransient;
+    }
+  }
+  if (error->domain == GST_STREAM_ERROR)
+  {
+    switch (error->code)
+    {
+      case GST_STREAM_ERROR_NOT_IMPLEMENTED:
+      case GST_STREAM_ERROR_TYPE_NOT_FOUND:
+      case GST_STREAM_ERROR_WRONG_TYPE:
+      case GST_STREAM_ERROR_CODEC_NOT_FOUND:
+      case GST_STREAM_ERROR_FORMAT:
+      case GST_STREAM_ERROR_DECRYPT:
+      case GST_STREAM_ERROR_DECRYPT_NOKEY:
+        return RecoveryFatal;
+      default:
+        /* Decode and demux errors are usually a damaged spot; resuming skips past it */
+        return RecoveryTransient;
+    }
+  }
+  return RecoveryTransient;
+}
+
+int recovery_backoff_ms (int attempt)
+{
+  if (attempt <= 0)
+    return 0;
+  return RECOVERY_BACKOFF_FIRST_MS << (attempt - 1);
+}
+
+PipelineRebuild::PipelineRebuild(QObject *receiver, int delayMs, const std::function<GstElement *()> &build)
+    : receiver(receiver)
+    , delayMs(delayMs)
+    , build(build)
+{
+}
+
+void PipelineRebuild::run()
+{
+    if (delayMs > 0)
+        QThread::msleep(delayMs);
+
+    GstElement *pipeline = build();
+    if (receiver.isNull()) {
+        if (pipeline) {
+            gst_element_set_state(pipeline, GST_STATE_NULL);
+            gst_object_unref(pipeline);
+        }
+        return;
+    }
+    QMetaObject::invokeMethod(receiver.data(), "slotRecoveryReady", Qt::QueuedConnection,
+                              Q_ARG(void *, pipeline));
+}
+
+PipelineDisposal::PipelineDisposal(GstElement *pipeline)
+    : pipeline(pipeline)
+{
+}
+
+void PipelineDisposal::run()
+{
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+}
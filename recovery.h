@@ -0,0 +1,48 @@
+#ifndef RECOVERY_H
+#define RECOVERY_H
+
+#include <functional>
+#include <QPointer>
+#include <QRunnable>
+#include <gst/gst.h>
+
+/* What to do about an error posted on the bus */
+enum RecoveryClass {
+    RecoveryTransient,  /* Worth rebuilding the pipeline and trying again */
+    RecoveryFatal       /* Will fail the same way again: missing plugin, file, codec, rights */
+};
+
+RecoveryClass recovery_classify (const GError *error);
+
+/* Delay before the given rebuild attempt (0 based), in ms: none for the first,
+ * then doubling from 250 ms. Uncapped, the caller bounds the attempts. */
+int recovery_backoff_ms (int attempt);
+
+/* Builds the replacement pipeline on a pool thread, so that plugin loading and
+ * opening the devices never stall the GUI. build() returns the new pipeline
+ * already in READY, or NULL; the result is handed to receiver's
+ * slotRecoveryReady(void *) through a queued call. */
+class PipelineRebuild : public QRunnable
+{
+public:
+    PipelineRebuild(QObject *receiver, int delayMs, const std::function<GstElement *()> &build);
+    void run();
+
+private:
+    QPointer<QObject> receiver;
+    int delayMs;
+    std::function<GstElement *()> build;
+};
+
+/* Takes ownership of a pipeline and shuts it down on a pool thread */
+class PipelineDisposal : public QRunnable
+{
+public:
+    explicit PipelineDisposal(GstElement *pipeline);
+    void run();
+
+private:
+    GstElement *pipeline;
+};
+
+#endif // RECOVERY_H
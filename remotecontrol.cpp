@@ -0,0 +1,160 @@
+#include "remotecontrol.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+RemoteControl::RemoteControl(PlayerMetrics *metrics, QObject *parent)
+    : QObject(parent)
+    , metrics(metrics)
+    , server(0)
+{
+}
+
+bool RemoteControl::listen(const QString &path)
+{
+    QLocalServer::removeServer(path);
+    server = new QLocalServer(this);
+    connect(server, SIGNAL(newConnection()), this, SLOT(slotNewConnection()));
+    if (!server->listen(path)) {
+        qWarning() << "Remote control: could not listen on" << path << ":" << server->errorString();
+        return false;
+    }
+    return true;
+}
+
+void RemoteControl::slotNewConnection()
+{
+    while (QLocalSocket *socket = server->nextPendingConnection()) {
+        socket->setProperty("seq", qulonglong(0));
+        clients.append(socket);
+        connect(socket, SIGNAL(readyRead()), this, SLOT(slotReadyRead()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(slotDisconnected()));
+    }
+}
+
+void RemoteControl::slotDisconnected()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket *>(sender());
+    clients.removeAll(socket);
+    socket->deleteLater();
+}
+
+void RemoteControl::slotReadyRead()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket *>(sender());
+    QElapsedTimer received;
+    QByteArray replies;
+
+    /* Everything already received is executed in order, the replies go out in one write */
+    received.start();
+    quint64 seq = socket->property("seq").toULongLong();
+    while (socket->canReadLine()) {
+        QByteArray line = socket->readLine().trimmed();
+        if (line.isEmpty())
+            continue;
+        QByteArray reply = execute(line, ++seq);
+
+        gint64 latency = received.nsecsElapsed() / 1000;
+        if (reply.startsWith("ok")) {
+            metrics->remoteCommands++;
+            metrics->remoteLatencySum += latency;
+            if (latency > metrics->remoteLatencyMax.load())
+                metrics->remoteLatencyMax = latency;
+            reply.replace("$LATENCY", QByteArray::number(qlonglong(latency)));
+        }
+        replies += reply;
+    }
+    socket->setProperty("seq", qulonglong(seq));
+    socket->write(replies);
+    socket->flush();
+}
+
+/* Returns the reply line; "$LATENCY" is filled in once the command has taken effect */
+QByteArray RemoteControl::execute(const QByteArray &line, quint64 seq)
+{
+    int space = line.indexOf(' ');
+    QByteArray command = space < 0 ? line : line.left(space);
+    QByteArray argument = space < 0 ? QByteArray() : line.mid(space + 1).trimmed();
+    QByteArray ok = "ok " + QByteArray::number(qulonglong(seq)) + " $LATENCY\n";
+    QByteArray err = "err " + QByteArray::number(qulonglong(seq)) + " ";
+    bool valid = true;
+
+    if (command == "play") {
+        emit play();
+    } else if (command == "pause") {
+        emit pause();
+    } else if (command == "stop") {
+        emit stop();
+    } else if (command == "next") {
+        emit next();
+    } else if (command == "previous") {
+        emit previous();
+    } else if (command == "volume") {
+        int volume = argument.toInt(&valid);
+        if (!valid || volume < 0 || volume > 100)
+            return err + "volume must be 0-100\n";
+        emit changeVolume(volume);
+    } else if (command == "mute") {
+        int muted = argument.toInt(&valid);
+        if (!valid)
+            return err + "mute takes 0 or 1\n";
+        emit changeMuting(muted != 0);
+    } else if (command == "rate") {
+        double rate = argument.toDouble(&valid);
+        if (!valid || rate == 0)
+            return err + "rate must be a non-zero number\n";
+        emit changeRate(rate);
+    } else if (command == "seek") {
+        double seconds = argument.toDouble(&valid);
+        if (!valid || seconds < 0)
+            return err + "seek takes a position in seconds\n";
+        emit seek(qint64(seconds * GST_SECOND));
+    } else if (command == "open") {
+        if (argument.isEmpty())
+            return err + "open takes a path or uri\n";
+        emit open(QString::fromUtf8(argument));
+    } else if (command == "audio-only") {
+        int audioOnly = argument.toInt(&valid);
+        if (!valid)
+            return err + "audio-only takes 0 or 1\n";
+        emit changeAudioOnly(audioOnly != 0);
+    } else if (command == "audio-track") {
+        int index = argument.toInt(&valid);
+        if (!valid || index < 0)
+            return err + "audio-track takes a track number from 0\n";
+        emit selectAudioTrack(index);
+    } else if (command == "subtitle-track") {
+        int index = argument.toInt(&valid);
+        if (!valid || index < -1)
+            return err + "subtitle-track takes a track number from 0, or -1 for off\n";
+        emit selectSubtitleTrack(index);
+    } else if (command != "ping") {
+        return err + "unknown command\n";
+    }
+    return ok;
+}
+
+void RemoteControl::notify(const QByteArray &event)
+{
+    QByteArray line = "event " + event + "\n";
+    foreach (QLocalSocket *socket, clients) {
+        socket->write(line);
+        socket->flush();
+    }
+}
+
+void RemoteControl::notifyState(int state)
+{
+    notify(QByteArray("state ") + gst_element_state_get_name(GstState(state)));
+}
+
+void RemoteControl::notifyEndOfStream()
+{
+    notify("eos");
+}
+
+void RemoteControl::notifyError(const QString &message)
+{
+    notify("error " + message.toUtf8());
+}
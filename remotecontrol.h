@@ -0,0 +1,69 @@
+#ifndef REMOTECONTROL_H
+#define REMOTECONTROL_H
+
+#include <QObject>
+#include <QList>
+#include "metrics.h"
+
+QT_BEGIN_NAMESPACE
+class QLocalServer;
+class QLocalSocket;
+QT_END_NAMESPACE
+
+/* Line based command interface on a Unix domain socket, for supervisors
+ * driving the player without a keyboard. It mirrors PlayerControls' signals:
+ *
+ *   play | pause | stop | next | previous
+ *   volume <0-100> | mute <0|1> | rate <factor>
+ *   seek <seconds> | open <path or uri> | audio-only <0|1>
+ *   audio-track <n> | subtitle-track <n, or -1 for off> | ping
+ *
+ * Each command line is answered in order with "ok <seq> <latency_us>" or
+ * "err <seq> <reason>", where seq counts the commands of the connection, so
+ * clients may pipeline requests. Latency is measured from reading the command
+ * to the player having applied it. State changes are pushed to every client
+ * as "event ..." lines as soon as the bus reports them. */
+class RemoteControl : public QObject
+{
+    Q_OBJECT
+
+public:
+    RemoteControl(PlayerMetrics *metrics, QObject *parent = 0);
+
+    bool listen(const QString &path);
+
+signals:
+    void play();
+    void pause();
+    void stop();
+    void next();
+    void previous();
+    void changeVolume(int volume);
+    void changeMuting(bool muting);
+    void changeRate(qreal rate);
+    void seek(qint64 position);
+    void open(const QString &location);
+    void changeAudioOnly(bool audioOnly);
+    void selectAudioTrack(int index);
+    void selectSubtitleTrack(int index);
+
+public slots:
+    void notifyState(int state);
+    void notifyEndOfStream();
+    void notifyError(const QString &message);
+    void notify(const QByteArray &event);
+
+private slots:
+    void slotNewConnection();
+    void slotReadyRead();
+    void slotDisconnected();
+
+private:
+    QByteArray execute(const QByteArray &line, quint64 seq);
+
+    PlayerMetrics *metrics;
+    QLocalServer *server;
+    QList<QLocalSocket *> clients;
+};
+
+#endif // REMOTECONTROL_H
@@ -0,0 +1,204 @@
+#include "resumestore.h"
+#include <QDebug>
+#include <QDir>
+#include <QStandardPaths>
+#include <string.h>
+
+#define RESUME_STORE_MAGIC    0x51475253u   /* "QGRS" */
+#define RESUME_STORE_VERSION  1u
+#define RESUME_STORE_SLOTS    4096u         /* Must be a power of two */
+#define RESUME_STORE_PROBES   8u            /* Longest probe sequence */
+
+struct ResumeStore::Header {
+    quint32 magic;
+    quint32 version;
+    quint32 capacity;
+    quint32 stamp;
+};
+
+/* A key of 0 marks an empty slot. The key is written last and cleared first,
+ * so a slot interrupted half way through an update simply reads as empty. */
+struct ResumeStore::Slot {
+    quint64 key;
+    qint64  position;
+    qint64  duration;
+    qint32  audio;
+    qint32  text;
+    qint32  volume;
+    quint32 flags;
+    quint32 stamp;
+    quint32 reserved;
+};
+
+ResumeStore::ResumeStore()
+    : map(NULL)
+    , capacity(0)
+    , stamp(0)
+{
+}
+
+ResumeStore::~ResumeStore()
+{
+    close();
+}
+
+QString ResumeStore::defaultPath()
+{
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(dir);
+    return dir + "/resume.db";
+}
+
+bool ResumeStore::open(const QString &path)
+{
+    const qint64 size = sizeof(Header) + qint64(RESUME_STORE_SLOTS) * sizeof(Slot);
+
+    close();
+    file.setFileName(path);
+    if(!file.open(QIODevice::ReadWrite))
+    {
+        qWarning() << "Could not open resume store" << path << ":" << file.errorString();
+        return false;
+    }
+
+    bool fresh = file.size() != size;
+    if(fresh && !file.resize(size))
+    {
+        qWarning() << "Could not size resume store" << path << ":" << file.errorString();
+        file.close();
+        return false;
+    }
+
+    map = file.map(0, size);
+    if(map == NULL)
+    {
+        qWarning() << "Could not map resume store" << path << ":" << file.errorString();
+        file.close();
+        return false;
+    }
+
+    Header *header = (Header *)map;
+    if(fresh || header->magic != RESUME_STORE_MAGIC || header->version != RESUME_STORE_VERSION ||
+       header->capacity != RESUME_STORE_SLOTS)
+    {
+        memset(map, 0, size);
+        header->magic = RESUME_STORE_MAGIC;
+        header->version = RESUME_STORE_VERSION;
+        header->capacity = RESUME_STORE_SLOTS;
+    }
+    capacity = header->capacity;
+    stamp = header->stamp;
+    return true;
+}
+
+void ResumeStore::close()
+{
+    if(map != NULL)
+    {
+        file.unmap(map);
+        map = NULL;
+    }
+    if(file.isOpen())
+    {
+        file.close();
+    }
+    capacity = 0;
+}
+
+bool ResumeStore::isOpen() const
+{
+    return map != NULL;
+}
+
+/* 64-bit FNV-1a over the UTF-8 encoded URI. 0 is reserved for empty slots. */
+quint64 ResumeStore::hashUri(const QString &uri)
+{
+    QByteArray bytes = uri.toUtf8();
+    quint64 hash = 14695981039346656037ULL;
+    for(int i = 0; i < bytes.size(); i++)
+    {
+        hash ^= (uchar)bytes.at(i);
+        hash *= 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+ResumeStore::Slot *ResumeStore::slotAt(quint64 index) const
+{
+    return (Slot *)(map + sizeof(Header)) + (index & (capacity - 1));
+}
+
+bool ResumeStore::lookup(const QString &uri, Entry *entry) const
+{
+    if(map == NULL || uri.isEmpty())
+    {
+        return false;
+    }
+
+    quint64 key = hashUri(uri);
+    for(quint32 i = 0; i < RESUME_STORE_PROBES; i++)
+    {
+        const Slot *slot = slotAt(key + i);
+        if(slot->key == key)
+        {
+            entry->position = slot->position;
+            entry->duration = slot->duration;
+            entry->audio = slot->audio;
+            entry->text = slot->text;
+            entry->volume = slot->volume;
+            entry->flags = slot->flags;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ResumeStore::store(const QString &uri, const Entry &entry)
+{
+    if(map == NULL || uri.isEmpty())
+    {
+        return;
+    }
+
+    /* Reuse the slot already holding this URI, otherwise the first empty one,
+     * otherwise evict the least recently written slot of the probe window. */
+    quint64 key = hashUri(uri);
+    Slot *target = NULL;
+    Slot *oldest = NULL;
+    for(quint32 i = 0; i < RESUME_STORE_PROBES; i++)
+    {
+        Slot *slot = slotAt(key + i);
+        if(slot->key == key)
+        {
+            target = slot;
+            break;
+        }
+        if(slot->key == 0)
+        {
+            if(target == NULL)
+            {
+                target = slot;
+            }
+            continue;
+        }
+        if(oldest == NULL || (qint32)(slot->stamp - oldest->stamp) < 0)
+        {
+            oldest = slot;
+        }
+    }
+    if(target == NULL)
+    {
+        target = oldest;
+    }
+
+    target->key = 0;
+    target->position = entry.position;
+    target->duration = entry.duration;
+    target->audio = entry.audio;
+    target->text = entry.text;
+    target->volume = entry.volume;
+    target->flags = entry.flags;
+    target->stamp = ++stamp;
+    target->key = key;
+    ((Header *)map)->stamp = stamp;
+}
@@ -0,0 +1,55 @@
+#ifndef RESUMESTORE_H
+#define RESUMESTORE_H
+
+#include <QFile>
+#include <QString>
+
+/* Persistent per-URI playback state (last position, selected tracks, volume).
+ *
+ * The store is a fixed size open addressing hash table living in a memory
+ * mapped file. A lookup touches at most a handful of slots, and an update is
+ * a plain write into the shared mapping: the kernel writes the dirty page back
+ * on its own, so nothing here ever waits for the disk on the UI thread. */
+class ResumeStore
+{
+public:
+    struct Entry {
+        qint64 position;    /* Last position, in nanoseconds */
+        qint64 duration;    /* Duration of the clip, in nanoseconds, or -1 */
+        qint32 audio;       /* Selected audio stream, or -1 */
+        qint32 text;        /* Selected subtitle stream, or -1 */
+        qint32 volume;      /* Volume, 0..100 */
+        quint32 flags;      /* Flag* below */
+    };
+
+    enum {
+        FlagAudioOnly = 1 << 0,     /* Play without ever building the video branch */
+        FlagSubtitlesOff = 1 << 1   /* The file has subtitles, turned off */
+    };
+
+    ResumeStore();
+    ~ResumeStore();
+
+    bool open(const QString &path);
+    void close();
+    bool isOpen() const;
+
+    bool lookup(const QString &uri, Entry *entry) const;
+    void store(const QString &uri, const Entry &entry);
+
+    static QString defaultPath();
+
+private:
+    struct Slot;
+    struct Header;
+
+    static quint64 hashUri(const QString &uri);
+    Slot *slotAt(quint64 index) const;
+
+    QFile file;
+    uchar *map;
+    quint32 capacity;
+    quint32 stamp;
+};
+
+#endif // RESUMESTORE_H
@@ -0,0 +1,350 @@
+#include "seekbenchmark.h"
+#include "widget.h"
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+
+#define SEEK_TIMEOUT_MS     5000
+#define OPEN_TIMEOUT_MS     15000
+
+/* The flag sets compared; all of them flush, like the slider */
+static const struct {
+    const char *name;
+    int flags;
+} seekFlagSets[] = {
+    { "key-unit",    GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT },
+    { "accurate",    GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE },
+    { "snap-before", GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE },
+    { "snap-after",  GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_AFTER },
+    { "trickmode",   GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_TRICKMODE },
+};
+static const int seekFlagSetCount = sizeof(seekFlagSets) / sizeof(seekFlagSets[0]);
+
+/* Corpus: 60 s of 640x360 at 25 fps per file */
+static const struct {
+    const char *suffix;
+    const char *encode;
+} corpusFormats[] = {
+    { "mp4",  "x264enc key-int-max=%1 speed-preset=ultrafast ! h264parse ! mp4mux" },
+    { "mkv",  "x264enc key-int-max=%1 speed-preset=ultrafast ! h264parse ! matroskamux" },
+    { "ts",   "x264enc key-int-max=%1 speed-preset=ultrafast ! h264parse ! mpegtsmux" },
+    { "webm", "vp8enc keyframe-max-dist=%1 deadline=1 ! webmmux" },
+};
+static const int corpusGops[] = { 12, 50, 250 };
+
+SeekBenchmark::SeekBenchmark(Widget *player, QObject *parent)
+    : QObject(parent)
+    , player(player)
+    , seeks(50)
+    , random(1)
+    , phase(Idle)
+    , fileIndex(-1)
+    , flagIndex(0)
+    , seekIndex(0)
+    , duration(-1)
+    , probePad(0)
+    , probeId(0)
+    , armed(false)
+    , frameTime(0)
+    , frameCpu(0)
+    , pending(false)
+    , frameSeen(false)
+    , asyncDoneSeen(false)
+    , seekTime(0)
+    , seekCpu(0)
+    , failures(0)
+{
+    timeout.setSingleShot(true);
+    connect(&timeout, SIGNAL(timeout()), this, SLOT(slotTimeout()));
+    connect(player, SIGNAL(asyncDone()), this, SLOT(slotAsyncDone()));
+}
+
+SeekBenchmark::~SeekBenchmark()
+{
+    removeProbe();
+}
+
+void SeekBenchmark::setFiles(const QStringList &files)
+{
+    this->files = files;
+}
+
+void SeekBenchmark::setSeeks(int seeks)
+{
+    this->seeks = qMax(seeks, 1);
+}
+
+void SeekBenchmark::setSeed(quint32 seed)
+{
+    random.seed(seed);
+}
+
+void SeekBenchmark::setOutput(const QString &path)
+{
+    outputPath = path;
+}
+
+QStringList SeekBenchmark::generateCorpus(const QString &dir)
+{
+    QStringList result;
+    QDir().mkpath(dir);
+
+    for (size_t f = 0; f < sizeof(corpusFormats) / sizeof(corpusFormats[0]); f++) {
+        for (size_t g = 0; g < sizeof(corpusGops) / sizeof(corpusGops[0]); g++) {
+            QString path = QDir(dir).filePath(QString("seekbench-gop%1.%2").arg(corpusGops[g]).arg(corpusFormats[f].suffix));
+            if (QFileInfo(path).size() > 0) {
+                result.append(path);
+                continue;
+            }
+
+            QString description = QString("videotestsrc num-buffers=1500 pattern=smpte ! "
+                                          "video/x-raw,width=640,height=360,framerate=25/1 ! %1 ! filesink location=\"%2\"")
+                                      .arg(QString(corpusFormats[f].encode).arg(corpusGops[g])).arg(path);
+            GError *error = NULL;
+            GstElement *pipeline = gst_parse_launch(description.toUtf8().constData(), &error);
+            if (pipeline == NULL) {
+                qWarning() << "Seek benchmark: cannot encode" << path << ":" << (error ? error->message : "");
+                g_clear_error(&error);
+                continue;
+            }
+            g_clear_error(&error);
+
+            qInfo() << "Seek benchmark: encoding" << path;
+            GstBus *bus = gst_element_get_bus(pipeline);
+            gst_element_set_state(pipeline, GST_STATE_PLAYING);
+            GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+                                                         GstMessageType(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+            bool ok = msg != NULL && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+            if (msg)
+                gst_message_unref(msg);
+            gst_object_unref(bus);
+            gst_element_set_state(pipeline, GST_STATE_NULL);
+            gst_object_unref(pipeline);
+
+            if (ok) {
+                result.append(path);
+            } else {
+                qWarning() << "Seek benchmark: encoding" << path << "failed";
+                QFile::remove(path);
+            }
+        }
+    }
+    return result;
+}
+
+void SeekBenchmark::start()
+{
+    if (files.isEmpty()) {
+        qWarning() << "Seek benchmark: no files";
+        emit finished(1);
+        return;
+    }
+    csv = "file,container,gop,flags,seeks,failures,p50_ms,p95_ms,p99_ms,mean_ms,cpu_ms\n";
+    openNextFile();
+}
+
+void SeekBenchmark::openNextFile()
+{
+    removeProbe();
+    fileIndex++;
+    if (fileIndex >= files.size()) {
+        phase = Idle;
+        if (outputPath.isEmpty()) {
+            fputs(csv.constData(), stdout);
+            fflush(stdout);
+        } else {
+            QFile file(outputPath);
+            if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                qWarning() << "Seek benchmark: cannot write" << outputPath;
+                emit finished(1);
+                return;
+            }
+            file.write(csv);
+        }
+        emit finished(0);
+        return;
+    }
+
+    phase = Opening;
+    qInfo() << "Seek benchmark:" << files.at(fileIndex);
+    player->openPaused(files.at(fileIndex));
+    timeout.start(OPEN_TIMEOUT_MS);
+}
+
+GstPadProbeReturn SeekBenchmark::probeCallback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    SeekBenchmark *self = static_cast<SeekBenchmark *>(user_data);
+    Q_UNUSED(pad);
+
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_FLUSH) {
+        if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_FLUSH_STOP)
+            self->armed = true;
+        return GST_PAD_PROBE_OK;
+    }
+    if (self->armed.exchange(false)) {
+        self->frameTime = g_get_monotonic_time();
+        self->frameCpu = metrics_cpu_time();
+        QMetaObject::invokeMethod(self, "slotFrameRendered", Qt::QueuedConnection);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+/* On the real sink inside the sink bin, so that scaling and conversion are included */
+void SeekBenchmark::installProbe()
+{
+    GstElement *bin = player->videoSink();
+    GstElement *sink = bin ? gst_bin_get_by_name(GST_BIN(bin), "videosink") : NULL;
+    if (sink == NULL)
+        return;
+    probePad = gst_element_get_static_pad(sink, "sink");
+    gst_object_unref(sink);
+    if (probePad == NULL)
+        return;
+    probeId = gst_pad_add_probe(probePad, GstPadProbeType(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_FLUSH),
+                                probeCallback, this, NULL);
+}
+
+void SeekBenchmark::removeProbe()
+{
+    if (probePad != NULL) {
+        gst_pad_remove_probe(probePad, probeId);
+        gst_object_unref(probePad);
+        probePad = NULL;
+        probeId = 0;
+    }
+}
+
+void SeekBenchmark::slotAsyncDone()
+{
+    if (phase == Opening) {
+        timeout.stop();
+        duration = player->queryDuration();
+        installProbe();
+        if (duration < 2 * GST_SECOND || probePad == NULL) {
+            qWarning() << "Seek benchmark: skipping" << files.at(fileIndex) << "(no duration or no video sink)";
+            QTimer::singleShot(0, this, SLOT(openNextFile()));
+            return;
+        }
+        phase = Seeking;
+        flagIndex = 0;
+        seekIndex = 0;
+        latencies.clear();
+        cpuTimes.clear();
+        failures = 0;
+        QTimer::singleShot(0, this, SLOT(slotNextSeek()));
+    } else if (phase == Seeking && pending) {
+        asyncDoneSeen = true;
+        seekDone();
+    }
+}
+
+void SeekBenchmark::slotNextSeek()
+{
+    if (seekIndex >= seeks) {
+        writeCase();
+        flagIndex++;
+        seekIndex = 0;
+        latencies.clear();
+        cpuTimes.clear();
+        failures = 0;
+        if (flagIndex >= seekFlagSetCount) {
+            openNextFile();
+            return;
+        }
+    }
+
+    /* Anywhere but the last second, so that there is always a frame to land on */
+    std::uniform_int_distribution<qint64> positions(0, duration - GST_SECOND);
+    qint64 position = positions(random);
+
+    pending = true;
+    frameSeen = false;
+    asyncDoneSeen = false;
+    armed = false;
+    seekCpu = metrics_cpu_time();
+    seekTime = g_get_monotonic_time();
+    timeout.start(SEEK_TIMEOUT_MS);
+    if (!player->seekLikeSlider(position, GstSeekFlags(seekFlagSets[flagIndex].flags))) {
+        timeout.stop();
+        pending = false;
+        failures++;
+        seekIndex++;
+        QTimer::singleShot(0, this, SLOT(slotNextSeek()));
+    }
+}
+
+void SeekBenchmark::slotFrameRendered()
+{
+    if (!pending || frameSeen)
+        return;
+    frameSeen = true;
+    latencies.append((frameTime - seekTime) / 1000.0);
+    cpuTimes.append((frameCpu - seekCpu) / 1e6);
+    seekDone();
+}
+
+/* The next seek waits for both the frame and the end of the preroll */
+void SeekBenchmark::seekDone()
+{
+    if (!frameSeen || !asyncDoneSeen)
+        return;
+    timeout.stop();
+    pending = false;
+    seekIndex++;
+    QTimer::singleShot(0, this, SLOT(slotNextSeek()));
+}
+
+void SeekBenchmark::slotTimeout()
+{
+    if (phase == Opening) {
+        qWarning() << "Seek benchmark: could not preroll" << files.at(fileIndex);
+        openNextFile();
+        return;
+    }
+    pending = false;
+    failures++;
+    seekIndex++;
+    slotNextSeek();
+}
+
+static double percentile(const QVector<double> &sorted, double p)
+{
+    if (sorted.isEmpty())
+        return 0;
+    int rank = qBound(0, int(std::ceil(p / 100 * sorted.size())) - 1, sorted.size() - 1);
+    return sorted.at(rank);
+}
+
+void SeekBenchmark::writeCase()
+{
+    QFileInfo info(files.at(fileIndex));
+    QRegularExpressionMatch gop = QRegularExpression("gop(\\d+)").match(info.fileName());
+    QVector<double> sorted = latencies;
+    std::sort(sorted.begin(), sorted.end());
+
+    double sum = 0, cpu = 0;
+    foreach (double latency, latencies)
+        sum += latency;
+    foreach (double time, cpuTimes)
+        cpu += time;
+    int measured = latencies.size();
+
+    csv += QString("%1,%2,%3,%4,%5,%6,%7,%8,%9,%10,%11\n")
+               .arg(info.fileName())
+               .arg(info.suffix().toLower())
+               .arg(gop.hasMatch() ? gop.captured(1) : QString())
+               .arg(seekFlagSets[flagIndex].name)
+               .arg(measured)
+               .arg(failures)
+               .arg(percentile(sorted, 50), 0, 'f', 2)
+               .arg(percentile(sorted, 95), 0, 'f', 2)
+               .arg(percentile(sorted, 99), 0, 'f', 2)
+               .arg(measured ? sum / measured : 0, 0, 'f', 2)
+               .arg(measured ? cpu / measured : 0, 0, 'f', 2)
+               .toUtf8();
+}
@@ -0,0 +1,91 @@
+#ifndef SEEKBENCHMARK_H
+#define SEEKBENCHMARK_H
+
+#include <atomic>
+#include <random>
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+#include <gst/gst.h>
+
+class Widget;
+
+/* Seek latency benchmark, started with --seek-benchmark.
+ *
+ * Every file is opened paused, then seeked to random positions with each of
+ * the seek flag sets below, through Widget::seek_to() like the slider does.
+ * A seek is timed from the call to the first buffer reaching the video sink
+ * after the flush, which in PAUSED is the frame being shown; the process CPU
+ * time over the same interval is recorded too. One CSV line per file and flag
+ * set gives p50/p95/p99 of the latency. */
+class SeekBenchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    SeekBenchmark(Widget *player, QObject *parent = 0);
+    ~SeekBenchmark();
+
+    void setFiles(const QStringList &files);
+    void setSeeks(int seeks);
+    void setSeed(quint32 seed);
+    void setOutput(const QString &path);
+
+    /* Encodes MP4, MKV and TS (H.264) and WebM (VP8) clips at several GOP
+     * lengths into dir, keeping the ones already there. Returns the files. */
+    static QStringList generateCorpus(const QString &dir);
+
+public slots:
+    void start();
+
+signals:
+    void finished(int status);
+
+private slots:
+    void slotAsyncDone();
+    void slotFrameRendered();
+    void slotTimeout();
+    void slotNextSeek();
+    void openNextFile();
+
+private:
+    enum Phase { Idle, Opening, Seeking };
+
+    static GstPadProbeReturn probeCallback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    void installProbe();
+    void removeProbe();
+    void seekDone();
+    void writeCase();
+
+    Widget *player;
+    QStringList files;
+    int seeks;
+    std::mt19937 random;
+    QString outputPath;
+    QByteArray csv;
+
+    Phase phase;
+    int fileIndex;
+    int flagIndex;
+    int seekIndex;
+    qint64 duration;
+    QTimer timeout;
+
+    GstPad *probePad;
+    gulong probeId;
+    std::atomic<bool> armed;        /* Between a seek's flush and its first frame */
+    std::atomic<gint64> frameTime;
+    std::atomic<guint64> frameCpu;
+
+    bool pending;
+    bool frameSeen;
+    bool asyncDoneSeen;
+    gint64 seekTime;                /* Monotonic, in us */
+    guint64 seekCpu;
+    QVector<double> latencies;      /* ms */
+    QVector<double> cpuTimes;       /* ms */
+    int failures;
+};
+
+#endif // SEEKBENCHMARK_H
@@ -0,0 +1,736 @@
+#include "taskpool.h"
+#include "metrics.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef struct _RoleConfig {
+  gboolean set_cpus;
+  cpu_set_t cpus;
+  gboolean set_policy;
+  int policy;
+  int priority;                   /* Real-time priority, or nice value for SCHED_OTHER */
+} RoleConfig;
+
+typedef struct _TaskThread {
+  pthread_t thread;
+  pid_t tid;                      /* Unlike pthread_t, not reused as soon as the thread is gone */
+  clockid_t clock;
+  TaskThreadInfo info;
+  gboolean from_enter;            /* Not started by our pools: ended by its LEAVE */
+  gpointer task;                  /* Of from_enter threads, only compared */
+} TaskThread;
+
+/* A task pool handing out one thread per task, started in the role of the pool */
+typedef struct _RoleTaskPool {
+  GstTaskPool parent;
+  TaskPools *pools;
+  TaskRole role;
+} RoleTaskPool;
+
+typedef struct _RoleTaskPoolClass {
+  GstTaskPoolClass parent_class;
+} RoleTaskPoolClass;
+
+struct _TaskPools {
+  RoleConfig roles[TASK_ROLES];
+  RoleConfig original;            /* CPUs and scheduling of the process before any role was applied */
+  gboolean configured;            /* Some role was given: the others get the original settings */
+  GstTaskPool *pools[TASK_ROLE_GUI];
+  GMutex lock;
+  GList *threads;                 /* TaskThread */
+  guint64 ended_cpu[TASK_ROLES];
+  gint warned;
+};
+
+typedef struct _RoleThreadStart {
+  TaskPools *pools;
+  TaskRole role;
+  GstTaskPoolFunction func;
+  gpointer user_data;
+} RoleThreadStart;
+
+static const gchar *const role_names[TASK_ROLES] = { "streaming", "video", "audio", "gui" };
+
+/* Benchmark: playback time per file and placement, and the GUI load, a
+ * frame of THREAD_BENCH_BUSY_MS of work every THREAD_BENCH_TICK_MS */
+#define THREAD_BENCH_SECONDS    15
+#define THREAD_BENCH_TICK_MS    16
+#define THREAD_BENCH_BUSY_MS    10
+#define THREAD_BENCH_TIMEOUT    (10 * GST_SECOND)
+
+static GType role_task_pool_get_type (void);
+
+G_DEFINE_TYPE (RoleTaskPool, role_task_pool, GST_TYPE_TASK_POOL);
+
+const gchar *task_pools_role_name (TaskRole role)
+{
+  return role_names[role];
+}
+
+/* "0-1,3" */
+static gboolean task_pools_parse_cpus (const gchar *text, cpu_set_t *cpus)
+{
+  gchar **ranges = g_strsplit (text, ",", -1);
+  gboolean any = FALSE;
+
+  CPU_ZERO (cpus);
+  for (gchar **range = ranges; *range != NULL; range++)
+  {
+    gchar *end;
+    long first = strtol (*range, &end, 10), last = first;
+    if (end == *range)
+      continue;
+    if (*end == '-')
+      last = strtol (end + 1, NULL, 10);
+    for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+    {
+      CPU_SET (cpu, cpus);
+      any = TRUE;
+    }
+  }
+  g_strfreev (ranges);
+  return any;
+}
+
+/* ROLE=CPUS[:POLICY[:PRIORITY]], separated by spaces or semicolons */
+static void task_pools_configure (TaskPools *pools, const gchar *spec)
+{
+  gchar **entries = g_strsplit_set (spec, " ;", -1);
+
+  for (gchar **entry = entries; *entry != NULL; entry++)
+  {
+    gchar **parts = g_strsplit_set (*entry, "=:", 4);
+    int role;
+
+    if (parts[0] == NULL || parts[1] == NULL)
+    {
+      g_strfreev (parts);
+      continue;
+    }
+    for (role = 0; role < TASK_ROLES && strcmp (parts[0], role_names[role]) != 0; role++)
+      ;
+    if (role == TASK_ROLES)
+    {
+      g_printerr ("QTGSPLAYER_THREADS: unknown role \"%s\"\n", parts[0]);
+      g_strfreev (parts);
+      continue;
+    }
+
+    RoleConfig *config = &pools->roles[role];
+    pools->configured = TRUE;
+    config->set_cpus = task_pools_parse_cpus (parts[1], &config->cpus);
+    if (parts[2] != NULL)
+    {
+      config->set_policy = TRUE;
+      config->priority = parts[3] != NULL ? atoi (parts[3]) : 0;
+      if (strcmp (parts[2], "fifo") == 0)
+        config->policy = SCHED_FIFO;
+      else if (strcmp (parts[2], "rr") == 0)
+        config->policy = SCHED_RR;
+      else
+        config->policy = SCHED_OTHER;
+      if (config->policy != SCHED_OTHER && config->priority < 1)
+        config->priority = 1;
+    }
+    g_strfreev (parts);
+  }
+  g_strfreev (entries);
+}
+
+/* Threads inherit the affinity and policy of the thread creating them, e.g. the
+ * GUI's: the parts of a role that are not configured go back to the original */
+static void task_pools_apply_config (TaskPools *pools, const RoleConfig *config, const gchar *name)
+{
+  const RoleConfig *original = &pools->original;
+  int ret;
+
+  if (!config->set_cpus && original->set_cpus)
+    config = original;
+  if (config->set_cpus && (ret = pthread_setaffinity_np (pthread_self (), sizeof (cpu_set_t), &config->cpus)) != 0)
+    g_printerr ("Cannot set the CPUs of a %s thread: %s\n", name, g_strerror (ret));
+  if (!config->set_policy)
+    config = original;
+  if (!config->set_policy)
+    return;
+
+  struct sched_param param;
+  memset (&param, 0, sizeof (param));
+  if (config->policy == SCHED_OTHER)
+  {
+    pthread_setschedparam (pthread_self (), SCHED_OTHER, &param);
+    setpriority (PRIO_PROCESS, syscall (SYS_gettid), config->priority);
+    return;
+  }
+  param.sched_priority = config->priority;
+  ret = pthread_setschedparam (pthread_self (), config->policy, &param);
+  /* Typically EPERM without CAP_SYS_NICE or an rtprio limit: say it once */
+  if (ret != 0 && g_atomic_int_compare_and_exchange (&pools->warned, FALSE, TRUE))
+    g_printerr ("Cannot use real-time scheduling for %s threads: %s\n", name, g_strerror (ret));
+}
+
+static void task_pools_apply (TaskPools *pools, TaskRole role)
+{
+  task_pools_apply_config (pools, &pools->roles[role], role_names[role]);
+}
+
+/* What the main thread runs with when the pools are created, before any role is applied */
+static void task_pools_save_original (TaskPools *pools)
+{
+  RoleConfig *original = &pools->original;
+  struct sched_param param;
+
+  original->set_cpus = sched_getaffinity (0, sizeof (cpu_set_t), &original->cpus) == 0;
+  if (pthread_getschedparam (pthread_self (), &original->policy, &param) == 0)
+  {
+    original->set_policy = TRUE;
+    errno = 0;
+    original->priority = original->policy == SCHED_OTHER ? getpriority (PRIO_PROCESS, syscall (SYS_gettid))
+                                                         : param.sched_priority;
+    if (errno != 0)
+      original->priority = 0;
+  }
+}
+
+static guint64 task_thread_cpu (TaskThread *thread)
+{
+  struct timespec ts;
+  if (!thread->info.running)
+    return thread->info.cpu_time;
+  if (clock_gettime (thread->clock, &ts) != 0)
+    return thread->info.cpu_time;
+  return (guint64) ts.tv_sec * GST_SECOND + ts.tv_nsec;
+}
+
+/* Called with the lock held, from the thread itself */
+static TaskThread *task_pools_find_self (TaskPools *pools)
+{
+  pthread_t self = pthread_self ();
+  pid_t tid = syscall (SYS_gettid);
+  for (GList *l = pools->threads; l != NULL; l = l->next)
+  {
+    TaskThread *thread = (TaskThread *) l->data;
+    if (thread->info.running && pthread_equal (thread->thread, self) && thread->tid == tid)
+      return thread;
+  }
+  return NULL;
+}
+
+/* A task runs on one thread at a time: a from_enter thread that entered the
+ * same task before without posting LEAVE is gone. Called with the lock held. */
+static void task_pools_end_stale (TaskPools *pools, gpointer task)
+{
+  for (GList *l = pools->threads; l != NULL && task != NULL; l = l->next)
+  {
+    TaskThread *thread = (TaskThread *) l->data;
+    if (!thread->info.running || !thread->from_enter || thread->task != task)
+      continue;
+    /* Its CPU clock went with it, or is another thread's by now: what was
+     * last read is all there is */
+    thread->info.running = FALSE;
+    pools->ended_cpu[thread->info.role] += thread->info.cpu_time;
+  }
+}
+
+static TaskThread *task_pools_register_self (TaskPools *pools, TaskRole role, const gchar *name)
+{
+  TaskThread *thread = g_new0 (TaskThread, 1);
+
+  thread->thread = pthread_self ();
+  thread->tid = syscall (SYS_gettid);
+  if (pthread_getcpuclockid (thread->thread, &thread->clock) != 0)
+    thread->clock = CLOCK_THREAD_CPUTIME_ID;
+  thread->info.role = role;
+  thread->info.running = TRUE;
+  g_strlcpy (thread->info.name, name, sizeof (thread->info.name));
+  g_mutex_lock (&pools->lock);
+  pools->threads = g_list_append (pools->threads, thread);
+  g_mutex_unlock (&pools->lock);
+  return thread;
+}
+
+static void task_pools_end_self (TaskPools *pools, TaskThread *thread)
+{
+  guint64 cpu = metrics_thread_cpu_time ();
+
+  g_mutex_lock (&pools->lock);
+  thread->info.cpu_time = cpu;
+  thread->info.running = FALSE;
+  pools->ended_cpu[thread->info.role] += cpu;
+  g_mutex_unlock (&pools->lock);
+}
+
+static gpointer role_thread_main (gpointer user_data)
+{
+  RoleThreadStart *start = (RoleThreadStart *) user_data;
+  TaskThread *thread;
+
+  task_pools_apply (start->pools, start->role);
+  thread = task_pools_register_self (start->pools, start->role, "task");
+  start->func (start->user_data);
+  task_pools_end_self (start->pools, thread);
+  g_free (start);
+  return NULL;
+}
+
+static void role_task_pool_prepare (GstTaskPool *pool, GError **error)
+{
+  (void) pool;
+  (void) error;
+}
+
+static void role_task_pool_cleanup (GstTaskPool *pool)
+{
+  (void) pool;
+}
+
+static gpointer role_task_pool_push (GstTaskPool *pool, GstTaskPoolFunction func, gpointer user_data,
+    GError **error)
+{
+  RoleTaskPool *self = (RoleTaskPool *) pool;
+  RoleThreadStart *start = g_new (RoleThreadStart, 1);
+  pthread_t *id = g_new (pthread_t, 1);
+  int ret;
+
+  start->pools = self->pools;
+  start->role = self->role;
+  start->func = func;
+  start->user_data = user_data;
+  ret = pthread_create (id, NULL, role_thread_main, start);
+  if (ret != 0)
+  {
+    g_set_error (error, G_THREAD_ERROR, G_THREAD_ERROR_AGAIN, "Cannot create a %s thread: %s",
+        role_names[self->role], g_strerror (ret));
+    g_free (start);
+    g_free (id);
+    return NULL;
+  }
+  return id;
+}
+
+static void role_task_pool_join (GstTaskPool *pool, gpointer id)
+{
+  (void) pool;
+  pthread_join (*(pthread_t *) id, NULL);
+  g_free (id);
+}
+
+static void role_task_pool_class_init (RoleTaskPoolClass *klass)
+{
+  GstTaskPoolClass *pool_class = GST_TASK_POOL_CLASS (klass);
+
+  pool_class->prepare = role_task_pool_prepare;
+  pool_class->cleanup = role_task_pool_cleanup;
+  pool_class->push = role_task_pool_push;
+  pool_class->join = role_task_pool_join;
+}
+
+static void role_task_pool_init (RoleTaskPool *self)
+{
+  (void) self;
+}
+
+static TaskPools *task_pools_new_for_spec (const gchar *spec)
+{
+  TaskPools *pools = g_new0 (TaskPools, 1);
+
+  g_mutex_init (&pools->lock);
+  if (spec != NULL)
+    task_pools_configure (pools, spec);
+  if (pools->configured)
+    task_pools_save_original (pools);
+  for (int role = 0; role < TASK_ROLE_GUI; role++)
+  {
+    RoleTaskPool *pool = (RoleTaskPool *) g_object_new (role_task_pool_get_type (), NULL);
+    gst_object_ref_sink (pool);
+    pool->pools = pools;
+    pool->role = (TaskRole) role;
+    pools->pools[role] = GST_TASK_POOL (pool);
+  }
+  return pools;
+}
+
+TaskPools *task_pools_new (void)
+{
+  return task_pools_new_for_spec (g_getenv ("QTGSPLAYER_THREADS"));
+}
+
+/* Only once no pipeline is left: tasks hold their pool */
+void task_pools_free (TaskPools *pools)
+{
+  for (int role = 0; role < TASK_ROLE_GUI; role++)
+    gst_object_unref (pools->pools[role]);
+  g_list_free_full (pools->threads, g_free);
+  g_mutex_clear (&pools->lock);
+  g_free (pools);
+}
+
+void task_pools_isolate_gui (TaskPools *pools)
+{
+  task_pools_apply (pools, TASK_ROLE_GUI);
+  task_pools_register_self (pools, TASK_ROLE_GUI, "gui");
+}
+
+void task_pools_release_self (TaskPools *pools)
+{
+  if (pools->configured)
+    task_pools_apply_config (pools, &pools->original, "helper");
+}
+
+/* Audio sink threads are audio, threads pushing into a video decoder are video */
+static TaskRole task_pools_classify (GstMessage *msg, GstElement *owner)
+{
+  TaskRole role = TASK_ROLE_STREAMING;
+
+  if (owner != NULL && element_is_sink (owner))
+  {
+    if (element_has_klass (owner, "Audio"))
+      return TASK_ROLE_AUDIO;
+    if (element_has_klass (owner, "Video"))
+      return TASK_ROLE_VIDEO;
+  }
+  if (GST_IS_PAD (GST_MESSAGE_SRC (msg)))
+  {
+    GstPad *peer = gst_pad_get_peer (GST_PAD (GST_MESSAGE_SRC (msg)));
+    if (peer != NULL)
+    {
+      GstElement *next = gst_pad_get_parent_element (peer);
+      if (next != NULL)
+      {
+        if (element_has_klass (next, "Decoder") && element_has_klass (next, "Video"))
+          role = TASK_ROLE_VIDEO;
+        gst_object_unref (next);
+      }
+      gst_object_unref (peer);
+    }
+  }
+  return role;
+}
+
+void task_pools_stream_status (TaskPools *pools, GstMessage *msg)
+{
+  GstStreamStatusType type;
+  GstElement *owner;
+  TaskThread *thread;
+
+  gst_message_parse_stream_status (msg, &type, &owner);
+  switch (type)
+  {
+    case GST_STREAM_STATUS_TYPE_CREATE:
+    {
+      const GValue *value = gst_message_get_stream_status_object (msg);
+      if (value != NULL && G_VALUE_HOLDS (value, GST_TYPE_TASK))
+      {
+        TaskRole role = task_pools_classify (msg, owner);
+        gst_task_set_pool (GST_TASK (g_value_get_object (value)), pools->pools[role]);
+      }
+    } break;
+    case GST_STREAM_STATUS_TYPE_ENTER:
+    {
+      /* Posted from the thread that starts running */
+      TaskRole role = task_pools_classify (msg, owner);
+      const GValue *value = gst_message_get_stream_status_object (msg);
+      gpointer task = value != NULL && G_VALUE_HOLDS (value, GST_TYPE_TASK) ? g_value_get_object (value) : NULL;
+      gchar *name = g_strdup_printf ("%s:%s", owner != NULL ? GST_ELEMENT_NAME (owner) : "?",
+          GST_OBJECT_NAME (GST_MESSAGE_SRC (msg)));
+
+      g_mutex_lock (&pools->lock);
+      thread = task_pools_find_self (pools);
+      if (thread == NULL)
+        task_pools_end_stale (pools, task);
+      if (thread != NULL)
+      {
+        g_strlcpy (thread->info.name, name, sizeof (thread->info.name));
+        if (role == thread->info.role || role == TASK_ROLE_STREAMING)
+          role = TASK_ROLES;
+        else
+          thread->info.role = role;
+      }
+      g_mutex_unlock (&pools->lock);
+
+      if (thread == NULL)
+      {
+        task_pools_apply (pools, role);
+        thread = task_pools_register_self (pools, role, name);
+        g_mutex_lock (&pools->lock);
+        thread->from_enter = TRUE;
+        thread->task = task;
+        g_mutex_unlock (&pools->lock);
+      }
+      else if (role != TASK_ROLES)
+      {
+        task_pools_apply (pools, role);
+      }
+      g_free (name);
+    } break;
+    case GST_STREAM_STATUS_TYPE_LEAVE:
+      g_mutex_lock (&pools->lock);
+      thread = task_pools_find_self (pools);
+      g_mutex_unlock (&pools->lock);
+      if (thread != NULL && thread->from_enter)
+        task_pools_end_self (pools, thread);
+      break;
+    default:
+      break;
+  }
+}
+
+void task_pools_get_role_cpu (TaskPools *pools, guint64 cpu_time[TASK_ROLES])
+{
+  g_mutex_lock (&pools->lock);
+  for (int role = 0; role < TASK_ROLES; role++)
+    cpu_time[role] = pools->ended_cpu[role];
+  for (GList *l = pools->threads; l != NULL; l = l->next)
+  {
+    TaskThread *thread = (TaskThread *) l->data;
+    if (thread->info.running)
+      cpu_time[thread->info.role] += task_thread_cpu (thread);
+  }
+  g_mutex_unlock (&pools->lock);
+}
+
+guint task_pools_take_threads (TaskPools *pools, TaskThreadInfo *info, guint max)
+{
+  guint count = 0;
+
+  g_mutex_lock (&pools->lock);
+  for (GList *l = pools->threads; l != NULL;)
+  {
+    GList *next = l->next;
+    TaskThread *thread = (TaskThread *) l->data;
+    if (count < max)
+    {
+      info[count] = thread->info;
+      info[count].cpu_time = task_thread_cpu (thread);
+      count++;
+    }
+    if (!thread->info.running)
+    {
+      g_free (thread);
+      pools->threads = g_list_delete_link (pools->threads, l);
+    }
+    l = next;
+  }
+  g_mutex_unlock (&pools->lock);
+  return count;
+}
+
+/* Lateness of the frames at the video sink and of the GUI ticks, in ns */
+typedef struct _ThreadBenchRun {
+  GArray *render;
+  GArray *ui;
+} ThreadBenchRun;
+
+/* Clock time the frame is shown at against the one it was due at */
+static void thread_bench_handoff (GstElement *sink, GstBuffer *buffer, GstPad *pad, ThreadBenchRun *run)
+{
+  GstEvent *event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+  GstClock *clock = gst_element_get_clock (sink);
+  const GstSegment *segment;
+
+  if (event != NULL && clock != NULL && GST_BUFFER_PTS_IS_VALID (buffer))
+  {
+    gst_event_parse_segment (event, &segment);
+    guint64 running = gst_segment_to_running_time (segment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+    if (GST_CLOCK_TIME_IS_VALID (running))
+    {
+      gint64 late = (gint64) (gst_clock_get_time (clock) - gst_element_get_base_time (sink)) - (gint64) running;
+      g_array_append_val (run->render, late);
+    }
+  }
+  if (clock != NULL)
+    gst_object_unref (clock);
+  if (event != NULL)
+    gst_event_unref (event);
+}
+
+static GstBusSyncReply thread_bench_bus_sync_handler (GstBus *bus, GstMessage *msg, gpointer user_data)
+{
+  (void) bus;
+
+  if (GST_MESSAGE_TYPE (msg) != GST_MESSAGE_STREAM_STATUS)
+    return GST_BUS_PASS;
+  task_pools_stream_status ((TaskPools *) user_data, msg);
+  gst_message_unref (msg);
+  return GST_BUS_DROP;
+}
+
+static gint thread_bench_compare (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* In ms, of a sorted array */
+static gdouble thread_bench_percentile (GArray *values, gdouble share)
+{
+  if (values->len == 0)
+    return 0;
+  return g_array_index (values, gint64, MIN ((guint) (share * values->len), values->len - 1)) / 1e6;
+}
+
+/* Plays uri with the GUI load on the calling thread, placed by spec, or left where it is without one */
+static gboolean thread_bench_run (const gchar *uri, const gchar *spec, ThreadBenchRun *run)
+{
+  TaskPools *pools = task_pools_new_for_spec (spec);
+  GstElement *playbin = gst_element_factory_make ("playbin", NULL);
+  GstElement *video = gst_element_factory_make ("fakesink", NULL);
+  GstElement *audio = gst_element_factory_make ("fakesink", NULL);
+  GstBus *bus;
+  GstMessage *msg;
+  gboolean ok;
+
+  if (playbin == NULL || video == NULL || audio == NULL)
+  {
+    if (playbin) gst_object_unref (playbin);
+    if (video) gst_object_unref (video);
+    if (audio) gst_object_unref (audio);
+    task_pools_free (pools);
+    return FALSE;
+  }
+
+  /* Both rendered on the clock, like the real sinks */
+  g_object_set (video, "sync", TRUE, "signal-handoffs", TRUE, NULL);
+  g_object_set (audio, "sync", TRUE, NULL);
+  g_signal_connect (video, "handoff", G_CALLBACK (thread_bench_handoff), run);
+  g_object_set (playbin, "uri", uri, "video-sink", video, "audio-sink", audio, NULL);
+  bus = gst_element_get_bus (playbin);
+  gst_bus_set_sync_handler (bus, thread_bench_bus_sync_handler, pools, NULL);
+
+  gst_element_set_state (playbin, GST_STATE_PAUSED);
+  msg = gst_bus_timed_pop_filtered (bus, THREAD_BENCH_TIMEOUT,
+      (GstMessageType) (GST_MESSAGE_ASYNC_DONE | GST_MESSAGE_ERROR));
+  ok = msg != NULL && GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ASYNC_DONE;
+  if (msg != NULL)
+    gst_message_unref (msg);
+
+  if (ok)
+  {
+    /* Like the player: the GUI is placed once the streaming threads exist */
+    if (spec != NULL)
+      task_pools_isolate_gui (pools);
+    gst_element_set_state (playbin, GST_STATE_PLAYING);
+
+    gint64 start = g_get_monotonic_time ();
+    gint64 due = start;
+    while (g_get_monotonic_time () - start < THREAD_BENCH_SECONDS * G_USEC_PER_SEC)
+    {
+      msg = gst_bus_pop_filtered (bus, (GstMessageType) (GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+      if (msg != NULL)
+      {
+        ok = GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS;
+        gst_message_unref (msg);
+        break;
+      }
+
+      /* A GUI frame: wait for its tick, note how late it came, then keep the CPU busy */
+      due += THREAD_BENCH_TICK_MS * 1000;
+      gint64 now = g_get_monotonic_time ();
+      if (due > now)
+        g_usleep (due - now);
+      now = g_get_monotonic_time ();
+      gint64 late = (now - due) * 1000;
+      g_array_append_val (run->ui, late);
+      while (g_get_monotonic_time () - now < THREAD_BENCH_BUSY_MS * 1000)
+        ;
+      /* Ticks that were missed altogether are not made up */
+      if (now - due > THREAD_BENCH_TICK_MS * 1000)
+        due = now;
+    }
+    if (spec != NULL)
+      task_pools_release_self (pools);
+  }
+
+  gst_element_set_state (playbin, GST_STATE_NULL);
+  gst_bus_set_sync_handler (bus, NULL, NULL, NULL);
+  gst_object_unref (bus);
+  gst_object_unref (playbin);
+  task_pools_free (pools);
+  return ok && run->render->len > 0;
+}
+
+/* Pinned placement for the benchmark without one given: the GUI alone on
+ * CPU 0, audio on 1, video decoding on the others */
+static gchar *thread_bench_default_spec (void)
+{
+  guint cpus = g_get_num_processors ();
+
+  if (cpus >= 4)
+    return g_strdup_printf ("gui=0 audio=1 video=2-%u streaming=1-%u", cpus - 1, cpus - 1);
+  if (cpus >= 2)
+    return g_strdup ("gui=0 audio=1 video=1 streaming=1");
+  return NULL;
+}
+
+int task_pools_benchmark (const gchar *const *files, guint n_files, const gchar *spec, const gchar *csv_path)
+{
+  gchar *pinned = spec != NULL ? g_strdup (spec) : thread_bench_default_spec ();
+  FILE *csv;
+  int status = 0;
+
+  if (pinned == NULL)
+  {
+    g_printerr ("Thread benchmark: one CPU, nothing to place\n");
+    return 1;
+  }
+  csv = csv_path != NULL ? fopen (csv_path, "w") : stdout;
+  if (csv == NULL)
+  {
+    g_printerr ("Thread benchmark: cannot write %s\n", csv_path);
+    g_free (pinned);
+    return 1;
+  }
+  g_printerr ("Thread benchmark: \"%s\" against no placement\n", pinned);
+  fprintf (csv, "file,placement,frames,render_late_p50_ms,render_jitter_ms,render_late_max_ms,"
+      "ui_late_p50_ms,ui_jitter_ms,ui_late_max_ms\n");
+
+  for (guint f = 0; f < n_files; f++)
+  {
+    gchar *uri = gst_uri_is_valid (files[f]) ? g_strdup (files[f]) : gst_filename_to_uri (files[f], NULL);
+    gdouble jitter[2][2];
+
+    /* Unpinned first: the pinned run moves this thread */
+    for (guint pin = 0; pin < 2 && uri != NULL; pin++)
+    {
+      ThreadBenchRun run;
+      run.render = g_array_new (FALSE, FALSE, sizeof (gint64));
+      run.ui = g_array_new (FALSE, FALSE, sizeof (gint64));
+      if (!thread_bench_run (uri, pin ? pinned : NULL, &run))
+      {
+        g_printerr ("Thread benchmark: %s could not be played\n", files[f]);
+        g_array_unref (run.render);
+        g_array_unref (run.ui);
+        status = 1;
+        break;
+      }
+      g_array_sort (run.render, thread_bench_compare);
+      g_array_sort (run.ui, thread_bench_compare);
+
+      /* Jitter: p99 of the lateness over its median, the constant part being latency */
+      jitter[pin][0] = thread_bench_percentile (run.render, 0.99) - thread_bench_percentile (run.render, 0.5);
+      jitter[pin][1] = thread_bench_percentile (run.ui, 0.99) - thread_bench_percentile (run.ui, 0.5);
+      fprintf (csv, "%s,%s,%u,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n", files[f], pin ? "pinned" : "none", run.render->len,
+          thread_bench_percentile (run.render, 0.5), jitter[pin][0], thread_bench_percentile (run.render, 1),
+          thread_bench_percentile (run.ui, 0.5), jitter[pin][1], thread_bench_percentile (run.ui, 1));
+      fflush (csv);
+      g_array_unref (run.render);
+      g_array_unref (run.ui);
+      if (pin)
+        g_printerr ("%s: frame jitter %.2f -> %.2f ms, GUI tick jitter %.2f -> %.2f ms\n", files[f],
+            jitter[0][0], jitter[1][0], jitter[0][1], jitter[1][1]);
+    }
+    g_free (uri);
+  }
+
+  if (csv != stdout)
+    fclose (csv);
+  g_free (pinned);
+  return status;
+}
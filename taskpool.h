@@ -0,0 +1,74 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <gst/gst.h>
+
+/* Places the streaming threads on CPUs and scheduling classes by role, so
+ * that decoding, audio output and the GUI do not compete for the same cores
+ * of the i.MX6.
+ *
+ * The bus sync handler passes STREAM_STATUS messages here. On CREATE every
+ * GstTask gets the task pool of its role, whose threads start with the
+ * affinity and policy of the role. On ENTER, which is posted from the new
+ * thread itself, threads GStreamer did not create through a task pool (the
+ * audio ring buffer) get them applied, and a queue thread found to feed a
+ * video decoder moves to the video role. Roles are configured with
+ *
+ *   QTGSPLAYER_THREADS="gui=0 audio=1:fifo:60 video=2-3 streaming=0-3"
+ *
+ * as ROLE=CPUS[:POLICY[:PRIORITY]], POLICY being other, fifo or rr (with a
+ * priority) or other with a nice value. Roles that are not given, or not
+ * given a CPU set or a policy, get those of the process when it started
+ * rather than the GUI's, which threads would otherwise inherit. Without the
+ * variable nothing changes, but the CPU time of every streaming thread is
+ * still accounted per role. */
+typedef enum {
+  TASK_ROLE_STREAMING,            /* Sources, demuxers, queues */
+  TASK_ROLE_VIDEO,                /* Threads feeding a video decoder */
+  TASK_ROLE_AUDIO,                /* Audio sink output */
+  TASK_ROLE_GUI,                  /* The Qt main thread */
+  TASK_ROLES
+} TaskRole;
+
+typedef struct _TaskPools TaskPools;
+
+typedef struct _TaskThreadInfo {
+  gchar name[48];                 /* Pad or element owning the thread */
+  TaskRole role;
+  guint64 cpu_time;               /* In ns */
+  gboolean running;
+} TaskThreadInfo;
+
+TaskPools *task_pools_new (void);
+void task_pools_free (TaskPools *pools);
+
+/* Applies the GUI role to the calling thread. Threads it creates afterwards
+ * inherit it, so call this once the player's own threads are started. */
+void task_pools_isolate_gui (TaskPools *pools);
+
+/* Gives the calling thread the CPUs and scheduling the process had when the
+ * pools were created, e.g. a worker the GUI thread started after isolating itself */
+void task_pools_release_self (TaskPools *pools);
+
+/* Called from the bus sync handler for STREAM_STATUS messages */
+void task_pools_stream_status (TaskPools *pools, GstMessage *msg);
+
+/* CPU time per role, of the running threads and of the ones that ended */
+void task_pools_get_role_cpu (TaskPools *pools, guint64 cpu_time[TASK_ROLES]);
+
+/* The threads seen since the last call, running or not; those that ended are
+ * forgotten afterwards. Returns how many were copied into info. */
+guint task_pools_take_threads (TaskPools *pools, TaskThreadInfo *info, guint max);
+
+const gchar *task_pools_role_name (TaskRole role);
+
+/* Plays each file for 15 seconds to fakesinks synchronised on the clock,
+ * with a busy GUI simulated on the calling thread, once without placement
+ * and once placed by spec (QTGSPLAYER_THREADS syntax; NULL: the GUI on CPU
+ * 0, audio on 1, video on the others). Writes one CSV line per run to
+ * csv_path (stdout if NULL) with the lateness of the frames and of the GUI
+ * ticks, and their jitter, p99 over the median; the comparison goes to
+ * stderr. Returns the exit status. */
+int task_pools_benchmark (const gchar *const *files, guint n_files, const gchar *spec, const gchar *csv_path);
+
+#endif // TASKPOOL_H
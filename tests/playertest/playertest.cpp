@@ -0,0 +1,245 @@
+#include <QtTest>
+#include <QApplication>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QUrl>
+#include <gst/gst.h>
+#include <gst/check/gsttestclock.h>
+#include "widget.h"
+#include "metrics.h"
+#include "playbackstate.h"
+
+/* The synthetic clip: raw frames in Matroska, so that no decoder is needed */
+#define CLIP_FRAMES     75
+#define CLIP_DURATION   (3 * GST_SECOND)
+#define CLIP_FRAME      (GST_SECOND / 25)
+
+/* GUI thread CPU time allowed per refresh tick and per bus message, in us */
+#define REFRESH_BUDGET_US       2000
+#define BUS_MESSAGE_BUDGET_US   500
+#define COST_ROUNDS             200
+
+/* Wall time allowed for the pipeline to react; the test clock never moves by itself */
+#define WAIT_MS                 5000
+
+/* Drives the player engine against a GstTestClock: time only passes when the
+ * test advances it, so positions, the slider and the end of the clip can be
+ * checked exactly, whatever the load of the machine running the tests. */
+class PlayerTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void endOfClipDecision();
+    void sliderMapping();
+    void clockDrivesPosition();
+    void refreshCost();
+    void busMessageCost();
+
+private:
+    void openClip();
+    bool waitForState(GstState state);
+    void advance(GstClockTime delta);
+    void refresh();
+    gint64 position();
+
+    QTemporaryDir dir;
+    QString clip;
+    Widget *widget;
+    GstClock *clock;
+};
+
+void PlayerTest::initTestCase()
+{
+    QVERIFY(dir.isValid());
+    clip = dir.filePath("clip.mkv");
+    QByteArray description = QString("videotestsrc num-buffers=%1 ! video/x-raw,format=I420,width=160,height=120,"
+                                     "framerate=25/1 ! matroskamux ! filesink location=\"%2\"")
+                                 .arg(CLIP_FRAMES).arg(clip).toUtf8();
+    GError *error = NULL;
+    GstElement *encoder = gst_parse_launch(description.constData(), &error);
+    QVERIFY2(encoder != NULL, error ? error->message : "no pipeline");
+    gst_element_set_state(encoder, GST_STATE_PLAYING);
+    GstBus *bus = gst_element_get_bus(encoder);
+    GstMessage *msg = gst_bus_timed_pop_filtered(bus, 10 * GST_SECOND,
+                                                 GstMessageType(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+    bool done = msg != NULL && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+    if(msg != NULL)
+    {
+        gst_message_unref(msg);
+    }
+    gst_object_unref(bus);
+    gst_element_set_state(encoder, GST_STATE_NULL);
+    gst_object_unref(encoder);
+    QVERIFY2(done, "the test clip could not be written");
+
+    widget = new Widget;
+    clock = gst_test_clock_new();
+    widget->setPipelineClock(clock);
+}
+
+void PlayerTest::cleanupTestCase()
+{
+    widget->close();
+    delete widget;
+    gst_object_unref(clock);
+}
+
+void PlayerTest::endOfClipDecision()
+{
+    QVERIFY(!playback_reached_end(CLIP_DURATION - CLIP_FRAME, CLIP_DURATION));
+    QVERIFY(playback_reached_end(CLIP_DURATION, CLIP_DURATION));
+    /* Demuxers may report a little past the end */
+    QVERIFY(playback_reached_end(CLIP_DURATION + GST_MSECOND, CLIP_DURATION));
+    QVERIFY(!playback_reached_end(-1, CLIP_DURATION));
+    QVERIFY(!playback_reached_end(GST_SECOND, GST_CLOCK_TIME_NONE));
+    QVERIFY(!playback_reached_end(GST_SECOND, 0));
+}
+
+void PlayerTest::sliderMapping()
+{
+    QCOMPARE(playback_slider_range(CLIP_DURATION), 3);
+    QCOMPARE(playback_slider_range(GST_CLOCK_TIME_NONE), 0);
+    QCOMPARE(playback_slider_value(-1), 0);
+    QCOMPARE(playback_slider_value(GST_SECOND - 1), 0);
+    QCOMPARE(playback_slider_value(90 * GST_SECOND), 90);
+}
+
+/* Nothing moves until the clock does, then position, slider and the auto-stop follow it */
+void PlayerTest::clockDrivesPosition()
+{
+    openClip();
+    TimelineSlider *slider = widget->findChild<TimelineSlider *>();
+    QVERIFY(slider != NULL);
+
+    QMetaObject::invokeMethod(widget, "slotPlay");
+    QVERIFY(waitForState(GST_STATE_PLAYING));
+    gint64 start = position();
+    QTest::qWait(100);
+    QCOMPARE(position(), start);
+
+    advance(GST_SECOND);
+    QTRY_VERIFY_WITH_TIMEOUT(position() >= start + GST_SECOND - CLIP_FRAME, WAIT_MS);
+    QVERIFY(qAbs(position() - (start + GST_SECOND)) <= CLIP_FRAME);
+    refresh();
+    QCOMPARE(slider->maximum(), 3);
+    QCOMPARE(slider->value(), 1);
+
+    /* Frozen clock, frozen player, however long the test waits */
+    gint64 frozen = position();
+    QTest::qWait(100);
+    refresh();
+    QCOMPARE(position(), frozen);
+    QCOMPARE(slider->value(), 1);
+
+    QSignalSpy endOfStream(widget, SIGNAL(endOfStream()));
+    advance(CLIP_DURATION);
+    QVERIFY(endOfStream.count() > 0 || endOfStream.wait(WAIT_MS));
+    refresh();
+    QVERIFY(waitForState(GST_STATE_READY));
+}
+
+/* GUI thread CPU time of one refresh tick, on a prerolled pipeline */
+void PlayerTest::refreshCost()
+{
+    openClip();
+    refresh();
+    guint64 cpu = metrics_thread_cpu_time();
+    for(int i = 0; i < COST_ROUNDS; i++)
+    {
+        refresh();
+    }
+    double us = (metrics_thread_cpu_time() - cpu) / 1e3 / COST_ROUNDS;
+    qInfo("Refresh tick: %.1f us of CPU time", us);
+    QVERIFY2(us < REFRESH_BUDGET_US, qPrintable(QString("%1 us per refresh tick").arg(us)));
+}
+
+/* GUI thread CPU time of handling one bus message, from the bus to the handler */
+void PlayerTest::busMessageCost()
+{
+    openClip();
+    GstElement *pipeline = widget->pipeline();
+    GstBus *bus = gst_element_get_bus(pipeline);
+    for(int i = 0; i < COST_ROUNDS; i++)
+    {
+        gst_bus_post(bus, gst_message_new_duration_changed(GST_OBJECT(pipeline)));
+    }
+    gst_object_unref(bus);
+
+    guint64 cpu = metrics_thread_cpu_time();
+    QMetaObject::invokeMethod(widget, "slotBusMessage", Qt::DirectConnection);
+    double us = (metrics_thread_cpu_time() - cpu) / 1e3 / COST_ROUNDS;
+    qInfo("Bus message: %.1f us of CPU time", us);
+    QVERIFY2(us < BUS_MESSAGE_BUDGET_US, qPrintable(QString("%1 us per bus message").arg(us)));
+}
+
+/* Prerolled in PAUSED, with the sink synchronising on the test clock */
+void PlayerTest::openClip()
+{
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(widget->videoSink()), "videosink");
+    QVERIFY(sink != NULL);
+    g_object_set(sink, "sync", TRUE, NULL);
+    gst_object_unref(sink);
+
+    widget->openPausedUri(QUrl::fromLocalFile(clip).toString());
+    QVERIFY(waitForState(GST_STATE_PAUSED));
+    /* Let the queued bus messages of the preroll through */
+    QTest::qWait(50);
+}
+
+bool PlayerTest::waitForState(GstState state)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while(timer.elapsed() < WAIT_MS)
+    {
+        GstState current = GST_STATE_VOID_PENDING;
+        gst_element_get_state(widget->pipeline(), &current, NULL, 0);
+        if(current == state)
+        {
+            return true;
+        }
+        QTest::qWait(5);
+    }
+    return false;
+}
+
+void PlayerTest::advance(GstClockTime delta)
+{
+    gst_test_clock_advance_time(GST_TEST_CLOCK(clock), delta);
+}
+
+void PlayerTest::refresh()
+{
+    QMetaObject::invokeMethod(widget, "slotTimerout", Qt::DirectConnection);
+}
+
+gint64 PlayerTest::position()
+{
+    gint64 position = -1;
+    gst_element_query_position(widget->pipeline(), GST_FORMAT_TIME, &position);
+    return position;
+}
+
+int main(int argc, char *argv[])
+{
+    /* Runs without a display; the video goes to a fakesink and nothing is cached across runs */
+    if(qgetenv("QT_QPA_PLATFORM").isEmpty())
+    {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    qputenv("QTGSPLAYER_VIDEOSINK", "fakesink");
+    qputenv("QTGSPLAYER_STALL_TIMEOUT", "0");
+    qputenv("QTGSPLAYER_IDLE_TIMEOUT", "0");
+    qputenv("QTGSPLAYER_PREFETCH_BYTES", "0");
+    QStandardPaths::setTestModeEnabled(true);
+
+    QApplication app(argc, argv);
+    gst_init(&argc, &argv);
+    PlayerTest test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "playertest.moc"
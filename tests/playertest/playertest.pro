@@ -0,0 +1,20 @@
+# Engine tests on a GstTestClock: refresh logic, end of clip and the cost of
+# the control path. Run with qmake && make check.
+
+QT       += core gui widgets multimediawidgets network testlib
+
+TARGET = playertest
+CONFIG += console c++11 testcase
+CONFIG -= app_bundle
+
+DEFINES += QTGSPLAYER_TRACE_LEVEL=3
+
+include(../../player.pri)
+
+LIBS += -lgstcheck-1.0
+
+SOURCES += \
+    playertest.cpp
+
+RESOURCES += \
+    ../../image.qrc
@@ -0,0 +1,102 @@
+#include "timelineslider.h"
+#include <QPainter>
+#include <QStyleOptionSlider>
+
+TimelineSlider::TimelineSlider(Qt::Orientation orientation, QWidget *parent)
+    : QSlider(orientation, parent)
+{
+}
+
+void TimelineSlider::setWaveform(const WaveformPeaks &peaks)
+{
+    waveform = peaks;
+    renderWaveform();
+    update();
+}
+
+void TimelineSlider::setMarkers(const QVector<TimelineMarker> &newMarkers)
+{
+    markers = newMarkers;
+    update();
+}
+
+/* The span of the groove the handle travels, which is what the time axis maps to */
+QRect TimelineSlider::grooveRect() const
+{
+    QStyleOptionSlider option;
+    initStyleOption(&option);
+    QRect groove = style()->subControlRect(QStyle::CC_Slider, &option, QStyle::SC_SliderGroove, this);
+    QRect handle = style()->subControlRect(QStyle::CC_Slider, &option, QStyle::SC_SliderHandle, this);
+    return QRect(groove.left() + handle.width() / 2, rect().top(),
+                 groove.width() - handle.width(), rect().height());
+}
+
+void TimelineSlider::renderWaveform()
+{
+    QRect area = grooveRect();
+    if (waveform.isEmpty() || area.width() <= 0 || area.height() <= 0) {
+        waveformPixmap = QPixmap();
+        return;
+    }
+
+    waveformPixmap = QPixmap(area.size());
+    waveformPixmap.fill(Qt::transparent);
+    QPainter painter(&waveformPixmap);
+    int width = area.width();
+    float middle = area.height() / 2.0f;
+    QColor peakColor(palette().color(QPalette::Highlight));
+    QColor rmsColor(peakColor.darker(150));
+    peakColor.setAlpha(110);
+
+    for (int x = 0; x < width; x++) {
+        int first = x * WAVEFORM_BUCKETS / width;
+        int last = qMax(first + 1, (x + 1) * WAVEFORM_BUCKETS / width);
+        if (first >= waveform.filled)
+            break;
+        last = qMin(last, waveform.filled);
+
+        float lo = waveform.min[first], hi = waveform.max[first], rms = waveform.rms[first];
+        for (int b = first + 1; b < last; b++) {
+            lo = qMin(lo, waveform.min[b]);
+            hi = qMax(hi, waveform.max[b]);
+            rms = qMax(rms, waveform.rms[b]);
+        }
+        painter.setPen(peakColor);
+        painter.drawLine(QPointF(x, middle - qBound(-1.0f, hi, 1.0f) * middle),
+                         QPointF(x, middle - qBound(-1.0f, lo, 1.0f) * middle));
+        painter.setPen(rmsColor);
+        painter.drawLine(QPointF(x, middle - qMin(rms, 1.0f) * middle),
+                         QPointF(x, middle + qMin(rms, 1.0f) * middle));
+    }
+}
+
+void TimelineSlider::paintEvent(QPaintEvent *event)
+{
+    QRect area = grooveRect();
+    if (!waveformPixmap.isNull()) {
+        QPainter painter(this);
+        painter.drawPixmap(area.topLeft(), waveformPixmap);
+    }
+    QSlider::paintEvent(event);
+
+    /* Scene changes in blue, black pictures in black, frozen ones in red */
+    if (!markers.isEmpty() && maximum() > minimum()) {
+        static const QColor colors[] = { QColor(40, 120, 255), QColor(0, 0, 0), QColor(230, 40, 40) };
+        QPainter painter(this);
+        double span = maximum() - minimum();
+        foreach (const TimelineMarker &marker, markers) {
+            double seconds = marker.position / 1e9 - minimum();
+            if (seconds < 0 || seconds > span)
+                continue;
+            int x = area.left() + int(seconds / span * area.width());
+            painter.setPen(colors[marker.type]);
+            painter.drawLine(x, area.top(), x, area.top() + area.height() / 3);
+        }
+    }
+}
+
+void TimelineSlider::resizeEvent(QResizeEvent *event)
+{
+    QSlider::resizeEvent(event);
+    renderWaveform();
+}
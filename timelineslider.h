@@ -0,0 +1,43 @@
+#ifndef TIMELINESLIDER_H
+#define TIMELINESLIDER_H
+
+#include <QPixmap>
+#include <QSlider>
+#include "waveform.h"
+#include "videoanalytics.h"
+
+/* The position slider, drawn over an optional overview of the audio and
+ * with optional markers (see videoanalytics.h) ticked on it.
+ *
+ * The waveform is rendered once into a pixmap of the groove size, when it
+ * changes or the slider is resized, one column per pixel from the buckets
+ * falling into it; a repaint only blits that pixmap, so its cost depends on
+ * neither the length of the file nor the number of buckets. */
+class TimelineSlider : public QSlider
+{
+    Q_OBJECT
+
+public:
+    TimelineSlider(Qt::Orientation orientation, QWidget *parent = 0);
+
+    /* Empty peaks remove the waveform */
+    void setWaveform(const WaveformPeaks &peaks);
+
+    /* Drawn against the slider range, which is in seconds */
+    void setMarkers(const QVector<TimelineMarker> &markers);
+    const QVector<TimelineMarker> &timelineMarkers() const { return markers; }
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+
+private:
+    QRect grooveRect() const;
+    void renderWaveform();
+
+    WaveformPeaks waveform;
+    QPixmap waveformPixmap;
+    QVector<TimelineMarker> markers;
+};
+
+#endif // TIMELINESLIDER_H
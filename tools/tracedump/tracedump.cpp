@@ -0,0 +1,161 @@
+/* Renders a QtGsPlayer trace dump (see trace.h) as text or as Chrome trace JSON.
+ *
+ *   tracedump [--chrome] qtgsplayer-1234.trace > out
+ *
+ * The JSON output loads in chrome://tracing and in Perfetto. */
+
+#include "trace.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct Site {
+    TraceFileSite info;
+    std::string name;
+    std::string file;
+};
+
+static const char *level_name (int level)
+{
+    switch (level) {
+    case TRACE_LEVEL_ERROR:
+        return "ERROR";
+    case TRACE_LEVEL_WARNING:
+        return "WARN";
+    case TRACE_LEVEL_INFO:
+        return "INFO";
+    case TRACE_LEVEL_DEBUG:
+        return "DEBUG";
+    default:
+        return "?";
+    }
+}
+
+static std::string json_escape (const std::string &in)
+{
+    std::string out;
+    for (size_t i = 0; i < in.size (); i++) {
+        char c = in[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char) c < 0x20) {
+            char buffer[8];
+            snprintf (buffer, sizeof (buffer), "\\u%04x", c);
+            out += buffer;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+static bool read_exact (FILE *file, void *data, size_t size)
+{
+    return size == 0 || fread (data, size, 1, file) == 1;
+}
+
+int main (int argc, char *argv[])
+{
+    bool chrome = false;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp (argv[i], "--chrome") == 0)
+            chrome = true;
+        else
+            path = argv[i];
+    }
+    if (path == NULL) {
+        fprintf (stderr, "usage: %s [--chrome] FILE\n", argv[0]);
+        return 2;
+    }
+
+    FILE *file = fopen (path, "rb");
+    if (file == NULL) {
+        perror (path);
+        return 1;
+    }
+
+    TraceFileHeader header;
+    if (!read_exact (file, &header, sizeof (header)) ||
+        memcmp (header.magic, TRACE_FILE_MAGIC, sizeof (header.magic)) != 0) {
+        fprintf (stderr, "%s: not a trace dump\n", path);
+        return 1;
+    }
+    if (header.byte_order != 0x01020304) {
+        fprintf (stderr, "%s: written on a host with a different byte order\n", path);
+        return 1;
+    }
+
+    std::vector<Site> sites (header.n_sites);
+    for (uint32_t i = 0; i < header.n_sites; i++) {
+        if (!read_exact (file, &sites[i].info, sizeof (sites[i].info)))
+            goto truncated;
+        sites[i].name.resize (sites[i].info.name_len);
+        sites[i].file.resize (sites[i].info.file_len);
+        if (!read_exact (file, &sites[i].name[0], sites[i].info.name_len) ||
+            !read_exact (file, &sites[i].file[0], sites[i].info.file_len))
+            goto truncated;
+    }
+
+    {
+        std::vector<TraceFileThread> threads (header.n_threads);
+        std::vector<TraceFileEvent> events (header.n_events);
+        if (!read_exact (file, threads.data (), threads.size () * sizeof (TraceFileThread)) ||
+            !read_exact (file, events.data (), events.size () * sizeof (TraceFileEvent)))
+            goto truncated;
+        fclose (file);
+
+        std::stable_sort (events.begin (), events.end (),
+            [] (const TraceFileEvent &x, const TraceFileEvent &y) { return x.timestamp < y.timestamp; });
+
+        uint64_t origin = events.empty () ? 0 : events.front ().timestamp;
+        if (chrome)
+            printf ("{\"traceEvents\":[\n");
+
+        for (size_t i = 0; i < events.size (); i++) {
+            const TraceFileEvent &event = events[i];
+            if (event.site >= sites.size () || event.thread >= threads.size ()) {
+                fprintf (stderr, "%s: corrupt event %zu\n", path, i);
+                return 1;
+            }
+            const Site &site = sites[event.site];
+            const TraceFileThread &thread = threads[event.thread];
+            std::string thread_name (thread.name, strnlen (thread.name, sizeof (thread.name)));
+
+            if (chrome) {
+                printf ("%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,",
+                        i ? "," : "", json_escape (site.name).c_str (), level_name (site.info.level),
+                        site.info.phase, event.timestamp / 1000.0, thread.tid);
+                if (site.info.phase == TRACE_PHASE_INSTANT)
+                    printf ("\"s\":\"t\",");
+                printf ("\"args\":{\"a\":%lld,\"b\":%lld,\"src\":\"%s:%u\"}}\n",
+                        (long long) event.a, (long long) event.b,
+                        json_escape (site.file).c_str (), site.info.line);
+            } else {
+                printf ("%12.6f %-5s %6u %-15s %c %s a=%lld b=%lld (%s:%u)\n",
+                        (event.timestamp - origin) / 1e9, level_name (site.info.level),
+                        thread.tid, thread_name.c_str (), site.info.phase, site.name.c_str (),
+                        (long long) event.a, (long long) event.b, site.file.c_str (), site.info.line);
+            }
+        }
+
+        if (chrome) {
+            /* Thread names as metadata events */
+            for (size_t i = 0; i < threads.size (); i++) {
+                std::string thread_name (threads[i].name, strnlen (threads[i].name, sizeof (threads[i].name)));
+                printf ("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}\n",
+                        events.empty () && i == 0 ? "" : ",", threads[i].tid, json_escape (thread_name).c_str ());
+            }
+            printf ("]}\n");
+        }
+        return 0;
+    }
+
+truncated:
+    fprintf (stderr, "%s: truncated trace dump\n", path);
+    return 1;
+}
@@ -0,0 +1,11 @@
+# Offline renderer for the player's trace dumps (see ../../trace.h)
+
+TEMPLATE = app
+TARGET = tracedump
+CONFIG += console c++11
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    tracedump.cpp
@@ -0,0 +1,249 @@
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#define TRACE_RING_EVENTS 4096u     /* Per thread, must be a power of two */
+
+struct TraceEvent {
+    uint64_t timestamp;
+    const TraceSite *site;
+    int64_t a;
+    int64_t b;
+};
+
+/* Single writer (the owning thread), any number of readers. A ring whose
+ * thread has exited is handed to the next new thread instead of being freed,
+ * so the registry only ever grows to the peak number of live threads. */
+struct TraceRing {
+    TraceEvent events[TRACE_RING_EVENTS];
+    std::atomic<uint64_t> head;
+    std::atomic<bool> in_use;
+    uint32_t tid;
+    char name[16];
+    TraceRing *next;
+};
+
+static std::atomic<TraceRing *> rings (NULL);
+static int signal_pipe[2] = { -1, -1 };
+
+static bool trace_default_enabled ()
+{
+    const char *env = getenv ("QTGSPLAYER_TRACE");
+    return env == NULL || strcmp (env, "0") != 0;
+}
+
+std::atomic<bool> trace_active (trace_default_enabled ());
+
+static TraceRing *trace_ring_acquire ()
+{
+    TraceRing *ring;
+
+    for (ring = rings.load (std::memory_order_acquire); ring != NULL; ring = ring->next) {
+        bool expected = false;
+        if (ring->in_use.compare_exchange_strong (expected, true))
+            break;
+    }
+
+    if (ring == NULL) {
+        ring = new TraceRing;
+        ring->in_use.store (true);
+        ring->next = rings.load (std::memory_order_relaxed);
+        while (!rings.compare_exchange_weak (ring->next, ring))
+            ;
+    }
+
+    ring->head.store (0, std::memory_order_release);
+    ring->tid = (uint32_t) syscall (SYS_gettid);
+    memset (ring->name, 0, sizeof (ring->name));
+    pthread_getname_np (pthread_self (), ring->name, sizeof (ring->name));
+    return ring;
+}
+
+class TraceRingHolder
+{
+public:
+    TraceRingHolder () : ring (NULL) { }
+    ~TraceRingHolder ()
+    {
+        if (ring)
+            ring->in_use.store (false, std::memory_order_release);
+    }
+    TraceRing *ring;
+};
+
+static thread_local TraceRingHolder holder;
+
+uint64_t trace_now ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t trace_realtime ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void trace_set_enabled (bool enabled)
+{
+    trace_active.store (enabled, std::memory_order_relaxed);
+}
+
+void trace_emit (const TraceSite *site, int64_t a, int64_t b)
+{
+    TraceRing *ring = holder.ring;
+    if (ring == NULL)
+        ring = holder.ring = trace_ring_acquire ();
+
+    uint64_t head = ring->head.load (std::memory_order_relaxed);
+    TraceEvent *event = &ring->events[head & (TRACE_RING_EVENTS - 1)];
+    event->timestamp = trace_now ();
+    event->site = site;
+    event->a = a;
+    event->b = b;
+    ring->head.store (head + 1, std::memory_order_release);
+}
+
+long trace_dump (const char *path)
+{
+    struct Snapshot {
+        uint32_t tid;
+        char name[16];
+        std::vector<TraceEvent> events;
+    };
+    std::vector<Snapshot> snapshots;
+    std::vector<const TraceSite *> sites;
+    std::unordered_map<const TraceSite *, uint32_t> site_index;
+    uint64_t n_events = 0;
+
+    /* Copy each ring, then drop whatever its writer may have overwritten meanwhile */
+    for (TraceRing *ring = rings.load (std::memory_order_acquire); ring != NULL; ring = ring->next) {
+        Snapshot snapshot;
+        uint64_t end = ring->head.load (std::memory_order_acquire);
+        uint64_t begin = end > TRACE_RING_EVENTS ? end - TRACE_RING_EVENTS : 0;
+
+        snapshot.tid = ring->tid;
+        memcpy (snapshot.name, ring->name, sizeof (snapshot.name));
+        for (uint64_t i = begin; i < end; i++)
+            snapshot.events.push_back (ring->events[i & (TRACE_RING_EVENTS - 1)]);
+
+        /* The slot at the current head may be half written as well */
+        uint64_t overwritten = ring->head.load (std::memory_order_acquire) + 1;
+        if (overwritten > TRACE_RING_EVENTS + begin) {
+            uint64_t lost = overwritten - TRACE_RING_EVENTS - begin;
+            snapshot.events.erase (snapshot.events.begin (),
+                snapshot.events.begin () + (lost < snapshot.events.size () ? lost : snapshot.events.size ()));
+        }
+        if (snapshot.events.empty ())
+            continue;
+
+        for (size_t i = 0; i < snapshot.events.size (); i++) {
+            const TraceSite *site = snapshot.events[i].site;
+            if (site_index.find (site) == site_index.end ()) {
+                site_index[site] = sites.size ();
+                sites.push_back (site);
+            }
+        }
+        n_events += snapshot.events.size ();
+        snapshots.push_back (snapshot);
+    }
+
+    FILE *file = fopen (path, "wb");
+    if (file == NULL)
+        return -1;
+
+    TraceFileHeader header;
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, TRACE_FILE_MAGIC, sizeof (header.magic));
+    header.byte_order = 0x01020304;
+    header.n_sites = sites.size ();
+    header.n_threads = snapshots.size ();
+    header.n_events = n_events;
+    header.dump_monotonic = trace_now ();
+    header.dump_realtime = trace_realtime ();
+    fwrite (&header, sizeof (header), 1, file);
+
+    for (size_t i = 0; i < sites.size (); i++) {
+        TraceFileSite site;
+        memset (&site, 0, sizeof (site));
+        site.line = sites[i]->line;
+        site.name_len = strlen (sites[i]->name);
+        site.file_len = strlen (sites[i]->file);
+        site.level = sites[i]->level;
+        site.phase = sites[i]->phase;
+        fwrite (&site, sizeof (site), 1, file);
+        fwrite (sites[i]->name, site.name_len, 1, file);
+        fwrite (sites[i]->file, site.file_len, 1, file);
+    }
+
+    for (size_t i = 0; i < snapshots.size (); i++) {
+        TraceFileThread thread;
+        thread.tid = snapshots[i].tid;
+        memcpy (thread.name, snapshots[i].name, sizeof (thread.name));
+        fwrite (&thread, sizeof (thread), 1, file);
+    }
+
+    for (size_t i = 0; i < snapshots.size (); i++) {
+        for (size_t j = 0; j < snapshots[i].events.size (); j++) {
+            const TraceEvent &source = snapshots[i].events[j];
+            TraceFileEvent event;
+            event.timestamp = source.timestamp;
+            event.thread = i;
+            event.site = site_index[source.site];
+            event.a = source.a;
+            event.b = source.b;
+            fwrite (&event, sizeof (event), 1, file);
+        }
+    }
+
+    if (fclose (file) != 0)
+        return -1;
+    return (long) n_events;
+}
+
+static void trace_signal_handler (int signum)
+{
+    char byte = (char) signum;
+    int saved_errno = errno;
+    if (write (signal_pipe[1], &byte, 1) < 0) {
+        /* The pipe is full, a dump is already pending */
+    }
+    errno = saved_errno;
+}
+
+int trace_install_signal_handler ()
+{
+    struct sigaction action;
+
+    if (signal_pipe[0] >= 0)
+        return signal_pipe[0];
+    if (pipe2 (signal_pipe, O_CLOEXEC | O_NONBLOCK) != 0)
+        return -1;
+
+    memset (&action, 0, sizeof (action));
+    action.sa_handler = trace_signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset (&action.sa_mask);
+    sigaction (SIGUSR1, &action, NULL);
+    return signal_pipe[0];
+}
+
+void trace_acknowledge_signal ()
+{
+    char buffer[16];
+    while (read (signal_pipe[0], buffer, sizeof (buffer)) > 0)
+        ;
+}
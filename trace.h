@@ -0,0 +1,144 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <atomic>
+
+/* Structured, low overhead tracing.
+ *
+ * Every thread records fixed size binary events into its own ring buffer, so
+ * emitting an event is a clock read and a handful of stores: no lock, no
+ * formatting, no I/O. The rings are written out on demand (SIGUSR1 or F12 in
+ * the player) and rendered offline by tools/tracedump.
+ *
+ * Levels above QTGSPLAYER_TRACE_LEVEL are removed at compile time; the rest
+ * can be switched off at run time with QTGSPLAYER_TRACE=0. */
+
+#define TRACE_LEVEL_NONE    0
+#define TRACE_LEVEL_ERROR   1
+#define TRACE_LEVEL_WARNING 2
+#define TRACE_LEVEL_INFO    3
+#define TRACE_LEVEL_DEBUG   4
+
+#ifndef QTGSPLAYER_TRACE_LEVEL
+#define QTGSPLAYER_TRACE_LEVEL TRACE_LEVEL_INFO
+#endif
+
+#define TRACE_PHASE_INSTANT 'i'
+#define TRACE_PHASE_BEGIN   'B'
+#define TRACE_PHASE_END     'E'
+
+/* One per call site, in static storage; events only carry a pointer to it */
+struct TraceSite {
+    const char *name;
+    const char *file;
+    int line;
+    int level;
+    char phase;
+};
+
+/* On-disk layout written by trace_dump() and read by tools/tracedump. All the
+ * fields are in host byte order; the header's byte_order field tells them apart. */
+#define TRACE_FILE_MAGIC "QGTRACE1"
+
+struct TraceFileHeader {
+    char magic[8];
+    uint32_t byte_order;        /* 0x01020304 */
+    uint32_t n_sites;
+    uint32_t n_threads;
+    uint32_t reserved;
+    uint64_t n_events;
+    uint64_t dump_monotonic;    /* CLOCK_MONOTONIC at dump time, in ns */
+    uint64_t dump_realtime;     /* CLOCK_REALTIME at dump time, in ns */
+};
+
+/* Followed by name_len bytes of name and file_len bytes of file, no terminators */
+struct TraceFileSite {
+    uint32_t line;
+    uint16_t name_len;
+    uint16_t file_len;
+    uint8_t level;
+    uint8_t phase;
+    uint8_t reserved[6];
+};
+
+struct TraceFileThread {
+    uint32_t tid;
+    char name[16];
+};
+
+struct TraceFileEvent {
+    uint64_t timestamp;         /* CLOCK_MONOTONIC, in ns */
+    uint32_t thread;            /* Index into the thread table */
+    uint32_t site;              /* Index into the site table */
+    int64_t a;
+    int64_t b;
+};
+
+extern std::atomic<bool> trace_active;
+
+static inline bool trace_enabled ()
+{
+    return trace_active.load (std::memory_order_relaxed);
+}
+
+void trace_set_enabled (bool enabled);
+void trace_emit (const TraceSite *site, int64_t a, int64_t b);
+uint64_t trace_now ();
+
+/* Writes every ring to path. Returns the number of events written, or -1 */
+long trace_dump (const char *path);
+
+/* Installs a SIGUSR1 handler; the returned descriptor becomes readable when a dump was requested */
+int trace_install_signal_handler ();
+void trace_acknowledge_signal ();
+
+#define TRACE_EVENT_PHASE(lvl, ph, ev, a, b) \
+    do { \
+        if ((lvl) <= QTGSPLAYER_TRACE_LEVEL) { \
+            static const TraceSite _trace_site = { ev, __FILE__, __LINE__, lvl, ph }; \
+            if (trace_enabled ()) \
+                trace_emit (&_trace_site, (int64_t)(a), (int64_t)(b)); \
+        } \
+    } while (0)
+
+#define TRACE_EVENT(lvl, ev, a, b) TRACE_EVENT_PHASE(lvl, TRACE_PHASE_INSTANT, ev, a, b)
+
+#define TRACE_ERROR(ev, a, b)   TRACE_EVENT(TRACE_LEVEL_ERROR, ev, a, b)
+#define TRACE_WARNING(ev, a, b) TRACE_EVENT(TRACE_LEVEL_WARNING, ev, a, b)
+#define TRACE_INFO(ev, a, b)    TRACE_EVENT(TRACE_LEVEL_INFO, ev, a, b)
+#define TRACE_DEBUG(ev, a, b)   TRACE_EVENT(TRACE_LEVEL_DEBUG, ev, a, b)
+
+/* Begin/end pair around the rest of the enclosing scope */
+class TraceScope
+{
+public:
+    TraceScope (const TraceSite *begin, const TraceSite *end)
+        : endSite (trace_enabled () ? end : 0)
+    {
+        if (endSite)
+            trace_emit (begin, 0, 0);
+    }
+    ~TraceScope ()
+    {
+        if (endSite)
+            trace_emit (endSite, 0, 0);
+    }
+
+private:
+    const TraceSite *endSite;
+};
+
+#define TRACE_CONCAT_(x, y) x##y
+#define TRACE_CONCAT(x, y) TRACE_CONCAT_(x, y)
+
+#if QTGSPLAYER_TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TRACE_SCOPE(ev) \
+    static const TraceSite TRACE_CONCAT(_trace_begin_, __LINE__) = { ev, __FILE__, __LINE__, TRACE_LEVEL_INFO, TRACE_PHASE_BEGIN }; \
+    static const TraceSite TRACE_CONCAT(_trace_end_, __LINE__) = { ev, __FILE__, __LINE__, TRACE_LEVEL_INFO, TRACE_PHASE_END }; \
+    TraceScope TRACE_CONCAT(_trace_scope_, __LINE__) (&TRACE_CONCAT(_trace_begin_, __LINE__), &TRACE_CONCAT(_trace_end_, __LINE__))
+#else
+#define TRACE_SCOPE(ev) do { } while (0)
+#endif
+
+#endif // TRACE_H
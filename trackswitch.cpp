@@ -0,0 +1,530 @@
+#include "trackswitch.h"
+#include "metrics.h"
+#include <string.h>
+#include <gst/base/gstbasesink.h>
+
+/* playbin's GST_PLAY_FLAG_TEXT (see widget.h) */
+#define TRACK_SWITCH_FLAG_TEXT  (1 << 2)
+
+/* A switch not seen at the sinks by then is reported as such, in us */
+#define TRACK_SWITCH_TIMEOUT    (3 * G_USEC_PER_SEC)
+/* Video still watched after the new track showed up, for a gap caused by the switch, in us */
+#define TRACK_SWITCH_TAIL       (G_USEC_PER_SEC / 4)
+/* Longer than this between two frames is a pause, not the frame rate, in us */
+#define TRACK_SWITCH_MAX_FRAME  G_USEC_PER_SEC
+
+/* What a probe looks at: TRACK_AUDIO, TRACK_TEXT or the video frames */
+#define TRACK_SWITCH_VIDEO      2
+
+struct _TrackSwitch {
+  gboolean subtitles;             /* Shown when a file starts */
+  gint awaiting_sample;           /* The audio sink probe has a switch to complete */
+
+  GMutex lock;
+  GstStreamCollection *collection;  /* Of playbin3 */
+  GPtrArray *selected;            /* Stream ids playbin3 reported selected */
+  gchar *stream_ids[2];           /* Last seen at the audio sink and the subtitle overlay */
+
+  /* The switch being measured */
+  gboolean pending;
+  TrackSwitchResult result;
+  gchar *old_stream_id;           /* NULL: any new stream completes it */
+  gint64 requested;               /* Monotonic, in us */
+  gint64 arrived;
+  gint64 completed;               /* Or 0 */
+
+  /* Video frames at the sink */
+  gint64 last_frame;
+  gint64 frame_interval;          /* Smoothed */
+  gint64 gap_max;
+};
+
+typedef struct _TrackSwitchProbe {
+  TrackSwitch *ts;
+  guint kind;
+  GstSegment segment;             /* Only touched by the streaming thread */
+} TrackSwitchProbe;
+
+TrackSwitch *track_switch_new (void)
+{
+  TrackSwitch *ts = g_new0 (TrackSwitch, 1);
+  const gchar *subtitles = g_getenv ("QTGSPLAYER_SUBTITLES");
+
+  g_mutex_init (&ts->lock);
+  ts->subtitles = subtitles == NULL || strcmp (subtitles, "0") != 0;
+  ts->selected = g_ptr_array_new_with_free_func (g_free);
+  return ts;
+}
+
+void track_switch_free (TrackSwitch *ts)
+{
+  track_switch_reset (ts);
+  g_ptr_array_unref (ts->selected);
+  g_mutex_clear (&ts->lock);
+  g_free (ts);
+}
+
+void track_switch_reset (TrackSwitch *ts)
+{
+  g_mutex_lock (&ts->lock);
+  if (ts->collection)
+    gst_object_unref (ts->collection);
+  ts->collection = NULL;
+  g_ptr_array_set_size (ts->selected, 0);
+  for (guint i = 0; i < G_N_ELEMENTS (ts->stream_ids); i++)
+  {
+    g_free (ts->stream_ids[i]);
+    ts->stream_ids[i] = NULL;
+  }
+  g_free (ts->old_stream_id);
+  ts->old_stream_id = NULL;
+  ts->pending = FALSE;
+  ts->last_frame = 0;
+  ts->frame_interval = 0;
+  g_mutex_unlock (&ts->lock);
+  g_atomic_int_set (&ts->awaiting_sample, FALSE);
+}
+
+gboolean track_switch_subtitles_default (TrackSwitch *ts)
+{
+  return ts->subtitles;
+}
+
+/* A new stream at the audio sink or the subtitle overlay */
+static void track_switch_stream_start (TrackSwitch *ts, guint kind, const gchar *stream_id)
+{
+  g_mutex_lock (&ts->lock);
+  g_free (ts->stream_ids[kind]);
+  ts->stream_ids[kind] = g_strdup (stream_id);
+  if (ts->pending && ts->result.type == kind && ts->arrived == 0 &&
+      (ts->old_stream_id == NULL || g_strcmp0 (stream_id, ts->old_stream_id) != 0))
+  {
+    ts->arrived = g_get_monotonic_time ();
+    /* Subtitles are sparse: the switch is done once the overlay has the stream */
+    if (kind == TRACK_TEXT)
+    {
+      ts->result.latency_us = ts->arrived - ts->requested;
+      ts->completed = ts->arrived;
+    }
+  }
+  g_mutex_unlock (&ts->lock);
+}
+
+/* First buffer of the new audio stream: heard once the clock reaches its running time */
+static void track_switch_first_sample (TrackSwitchProbe *probe, GstPad *pad, GstBuffer *buffer)
+{
+  TrackSwitch *ts = probe->ts;
+  GstElement *sink = GST_PAD_PARENT (pad);
+  GstClockTime running_time, clock_time, base_time;
+  GstClock *clock;
+  gint64 wait = 0;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer) || probe->segment.format != GST_FORMAT_TIME)
+    return;
+  running_time = gst_segment_to_running_time (&probe->segment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+  if (GST_CLOCK_TIME_IS_VALID (running_time) && GST_IS_BASE_SINK (sink) &&
+      (clock = gst_element_get_clock (sink)) != NULL)
+  {
+    clock_time = gst_clock_get_time (clock);
+    gst_object_unref (clock);
+    base_time = gst_element_get_base_time (sink);
+    running_time += gst_base_sink_get_latency (GST_BASE_SINK (sink));
+    if (clock_time >= base_time && running_time > clock_time - base_time)
+      wait = (running_time - (clock_time - base_time)) / GST_USECOND;
+  }
+
+  g_mutex_lock (&ts->lock);
+  if (ts->pending && ts->result.type == TRACK_AUDIO && ts->arrived != 0 && ts->completed == 0)
+  {
+    ts->completed = g_get_monotonic_time ();
+    ts->result.latency_us = ts->arrived - ts->requested + wait;
+    g_atomic_int_set (&ts->awaiting_sample, FALSE);
+  }
+  g_mutex_unlock (&ts->lock);
+}
+
+static void track_switch_video_frame (TrackSwitch *ts)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  g_mutex_lock (&ts->lock);
+  if (ts->last_frame != 0)
+  {
+    gint64 interval = now - ts->last_frame;
+    if (ts->pending && now > ts->requested)
+      ts->gap_max = MAX (ts->gap_max, interval);
+    else if (interval < TRACK_SWITCH_MAX_FRAME)
+      ts->frame_interval = ts->frame_interval ? ts->frame_interval + (interval - ts->frame_interval) / 8 : interval;
+  }
+  ts->last_frame = now;
+  g_mutex_unlock (&ts->lock);
+}
+
+static GstPadProbeReturn track_switch_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  TrackSwitchProbe *probe = (TrackSwitchProbe *) user_data;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+  {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    const gchar *stream_id;
+    if (GST_EVENT_TYPE (event) == GST_EVENT_STREAM_START && probe->kind != TRACK_SWITCH_VIDEO)
+    {
+      gst_event_parse_stream_start (event, &stream_id);
+      track_switch_stream_start (probe->ts, probe->kind, stream_id);
+    }
+    else if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT)
+      gst_event_copy_segment (event, &probe->segment);
+    else if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP)
+      gst_segment_init (&probe->segment, GST_FORMAT_UNDEFINED);
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (probe->kind == TRACK_SWITCH_VIDEO)
+    track_switch_video_frame (probe->ts);
+  else if (probe->kind == TRACK_AUDIO && g_atomic_int_get (&probe->ts->awaiting_sample))
+    track_switch_first_sample (probe, pad, GST_PAD_PROBE_INFO_BUFFER (info));
+  return GST_PAD_PROBE_OK;
+}
+
+void track_switch_element_setup (TrackSwitch *ts, GstElement *element)
+{
+  TrackSwitchProbe *probe;
+  const gchar *pad_name = "sink";
+  GstPad *pad;
+  guint kind;
+
+  if (element_is_sink (element) && element_has_klass (element, "Video"))
+    kind = TRACK_SWITCH_VIDEO;
+  else if (element_is_sink (element) && element_has_klass (element, "Audio"))
+    kind = TRACK_AUDIO;
+  else if (element_has_klass (element, "Overlay") && element_has_klass (element, "Subtitle"))
+  {
+    kind = TRACK_TEXT;
+    pad_name = "subtitle_sink";
+  }
+  else
+    return;
+
+  pad = gst_element_get_static_pad (element, pad_name);
+  if (pad == NULL)
+    return;
+  probe = g_new0 (TrackSwitchProbe, 1);
+  probe->ts = ts;
+  probe->kind = kind;
+  gst_segment_init (&probe->segment, GST_FORMAT_UNDEFINED);
+  gst_pad_add_probe (pad, GstPadProbeType (GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+      track_switch_probe_cb, probe, g_free);
+  gst_object_unref (pad);
+}
+
+void track_switch_message (TrackSwitch *ts, GstMessage *msg)
+{
+  GstStreamCollection *collection = NULL;
+
+  switch (GST_MESSAGE_TYPE (msg))
+  {
+    case GST_MESSAGE_STREAM_COLLECTION:
+      gst_message_parse_stream_collection (msg, &collection);
+      g_mutex_lock (&ts->lock);
+      if (ts->collection)
+        gst_object_unref (ts->collection);
+      ts->collection = collection;
+      g_mutex_unlock (&ts->lock);
+      break;
+    case GST_MESSAGE_STREAMS_SELECTED:
+      gst_message_parse_streams_selected (msg, &collection);
+      g_mutex_lock (&ts->lock);
+      if (ts->collection)
+        gst_object_unref (ts->collection);
+      ts->collection = collection;
+      g_ptr_array_set_size (ts->selected, 0);
+      for (guint i = 0; i < gst_message_streams_selected_get_size (msg); i++)
+      {
+        GstStream *stream = gst_message_streams_selected_get_stream (msg, i);
+        g_ptr_array_add (ts->selected, g_strdup (gst_stream_get_stream_id (stream)));
+        gst_object_unref (stream);
+      }
+      g_mutex_unlock (&ts->lock);
+      break;
+    default:
+      break;
+  }
+}
+
+/* The collection to select from, or NULL to go through playbin's properties */
+static GstStreamCollection *track_switch_collection (TrackSwitch *ts, GstElement *playbin)
+{
+  GstStreamCollection *collection = NULL;
+
+  if (g_strcmp0 (G_OBJECT_TYPE_NAME (playbin), "GstPlayBin3") != 0)
+    return NULL;
+  g_mutex_lock (&ts->lock);
+  if (ts->collection && ts->selected->len > 0)
+    collection = (GstStreamCollection *) gst_object_ref (ts->collection);
+  g_mutex_unlock (&ts->lock);
+  return collection;
+}
+
+static GstStreamType track_switch_stream_type (TrackType type)
+{
+  return type == TRACK_AUDIO ? GST_STREAM_TYPE_AUDIO : GST_STREAM_TYPE_TEXT;
+}
+
+/* The index-th stream of a type in the collection, or NULL */
+static GstStream *track_switch_nth_stream (GstStreamCollection *collection, TrackType type, gint index)
+{
+  for (guint i = 0; i < gst_stream_collection_get_size (collection); i++)
+  {
+    GstStream *stream = gst_stream_collection_get_stream (collection, i);
+    if (gst_stream_get_stream_type (stream) & track_switch_stream_type (type))
+      if (index-- == 0)
+        return stream;
+  }
+  return NULL;
+}
+
+static gboolean track_switch_is_selected (TrackSwitch *ts, const gchar *stream_id)
+{
+  gboolean selected = FALSE;
+
+  g_mutex_lock (&ts->lock);
+  for (guint i = 0; i < ts->selected->len && !selected; i++)
+    selected = g_strcmp0 ((const gchar *) g_ptr_array_index (ts->selected, i), stream_id) == 0;
+  g_mutex_unlock (&ts->lock);
+  return selected;
+}
+
+static gboolean track_switch_text_shown (GstElement *playbin)
+{
+  gint flags;
+  g_object_get (playbin, "flags", &flags, NULL);
+  return (flags & TRACK_SWITCH_FLAG_TEXT) != 0;
+}
+
+gint track_switch_count (TrackSwitch *ts, GstElement *playbin, TrackType type)
+{
+  GstStreamCollection *collection = track_switch_collection (ts, playbin);
+  gint count = 0;
+
+  if (collection)
+  {
+    while (track_switch_nth_stream (collection, type, count))
+      count++;
+    gst_object_unref (collection);
+    return count;
+  }
+  g_object_get (playbin, type == TRACK_AUDIO ? "n-audio" : "n-text", &count, NULL);
+  return count;
+}
+
+gint track_switch_current (TrackSwitch *ts, GstElement *playbin, TrackType type)
+{
+  GstStreamCollection *collection;
+  GstStream *stream;
+  gint current = -1;
+
+  if (type == TRACK_TEXT && !track_switch_text_shown (playbin))
+    return -1;
+  collection = track_switch_collection (ts, playbin);
+  if (collection == NULL)
+  {
+    g_object_get (playbin, type == TRACK_AUDIO ? "current-audio" : "current-text", &current, NULL);
+    return current;
+  }
+  for (gint i = 0; (stream = track_switch_nth_stream (collection, type, i)) != NULL; i++)
+  {
+    if (track_switch_is_selected (ts, gst_stream_get_stream_id (stream)))
+    {
+      current = i;
+      break;
+    }
+  }
+  gst_object_unref (collection);
+  return current;
+}
+
+static GstTagList *track_switch_tags (TrackSwitch *ts, GstElement *playbin, TrackType type, gint index)
+{
+  GstStreamCollection *collection = track_switch_collection (ts, playbin);
+  GstTagList *tags = NULL;
+
+  if (collection)
+  {
+    GstStream *stream = track_switch_nth_stream (collection, type, index);
+    if (stream)
+      tags = gst_stream_get_tags (stream);
+    gst_object_unref (collection);
+    return tags;
+  }
+  g_signal_emit_by_name (playbin, type == TRACK_AUDIO ? "get-audio-tags" : "get-text-tags", index, &tags);
+  return tags;
+}
+
+gchar *track_switch_describe (TrackSwitch *ts, GstElement *playbin, TrackType type, gint index)
+{
+  const gchar *fields[] = {
+    GST_TAG_LANGUAGE_CODE, GST_TAG_TITLE, type == TRACK_AUDIO ? GST_TAG_AUDIO_CODEC : GST_TAG_SUBTITLE_CODEC
+  };
+  GstTagList *tags;
+  GString *text;
+  gchar *str;
+
+  if (index < 0)
+    return g_strdup ("off");
+  text = g_string_new (NULL);
+  tags = track_switch_tags (ts, playbin, type, index);
+  for (guint i = 0; tags && i < G_N_ELEMENTS (fields); i++)
+  {
+    if (gst_tag_list_get_string (tags, fields[i], &str))
+    {
+      g_string_append_printf (text, "%s%s", text->len ? ", " : "", str);
+      g_free (str);
+    }
+  }
+  if (tags)
+    gst_tag_list_unref (tags);
+  if (text->len == 0)
+    g_string_append_printf (text, "track %d", index + 1);
+  return g_string_free (text, FALSE);
+}
+
+gint track_switch_find_language (TrackSwitch *ts, GstElement *playbin, TrackType type,
+    const gchar *language)
+{
+  gint count = track_switch_count (ts, playbin, type);
+  gint found = -1;
+  gchar *code;
+
+  for (gint i = 0; i < count && found < 0; i++)
+  {
+    GstTagList *tags = track_switch_tags (ts, playbin, type, i);
+    if (tags && gst_tag_list_get_string (tags, GST_TAG_LANGUAGE_CODE, &code))
+    {
+      if (g_ascii_strncasecmp (code, language, strlen (language)) == 0)
+        found = i;
+      g_free (code);
+    }
+    if (tags)
+      gst_tag_list_unref (tags);
+  }
+  return found;
+}
+
+/* Everything selected stays, but for the streams of that type, replaced with stream */
+static gboolean track_switch_send_select (TrackSwitch *ts, GstElement *playbin,
+    GstStreamCollection *collection, TrackType type, GstStream *stream)
+{
+  GList *ids = NULL;
+  gboolean sent;
+
+  for (guint i = 0; i < gst_stream_collection_get_size (collection); i++)
+  {
+    GstStream *other = gst_stream_collection_get_stream (collection, i);
+    const gchar *id = gst_stream_get_stream_id (other);
+    if (!(gst_stream_get_stream_type (other) & track_switch_stream_type (type)) &&
+        track_switch_is_selected (ts, id))
+      ids = g_list_append (ids, (gpointer) id);
+  }
+  if (stream)
+    ids = g_list_append (ids, (gpointer) gst_stream_get_stream_id (stream));
+  sent = gst_element_send_event (playbin, gst_event_new_select_streams (ids));
+  g_list_free (ids);
+  return sent;
+}
+
+gboolean track_switch_select (TrackSwitch *ts, GstElement *playbin, TrackType type, gint index)
+{
+  GstStreamCollection *collection = track_switch_collection (ts, playbin);
+  GstStream *stream = NULL;
+  gboolean text_shown = track_switch_text_shown (playbin);
+  gboolean switched = TRUE, pending;
+  gint flags;
+
+  if (index >= track_switch_count (ts, playbin, type) || (index < 0 && type == TRACK_AUDIO) ||
+      (collection && index >= 0 && (stream = track_switch_nth_stream (collection, type, index)) == NULL))
+  {
+    if (collection)
+      gst_object_unref (collection);
+    return FALSE;
+  }
+
+  /* Armed first: the new stream may reach the sink before the call returns */
+  g_mutex_lock (&ts->lock);
+  ts->pending = GST_STATE (playbin) == GST_STATE_PLAYING;
+  memset (&ts->result, 0, sizeof (ts->result));
+  ts->result.type = type;
+  ts->result.index = index;
+  ts->result.select_streams = collection != NULL;
+  ts->result.latency_us = -1;
+  g_free (ts->old_stream_id);
+  ts->old_stream_id = type == TRACK_TEXT && !text_shown ? NULL : g_strdup (ts->stream_ids[type]);
+  ts->requested = g_get_monotonic_time ();
+  ts->arrived = ts->completed = 0;
+  ts->gap_max = 0;
+  if (index < 0)
+  {
+    /* Nothing to wait for, only the video path to watch */
+    ts->result.latency_us = 0;
+    ts->completed = ts->requested;
+  }
+  pending = ts->pending;
+  g_mutex_unlock (&ts->lock);
+  g_atomic_int_set (&ts->awaiting_sample, pending && type == TRACK_AUDIO);
+
+  if (collection)
+  {
+    switched = track_switch_send_select (ts, playbin, collection, type, stream);
+    gst_object_unref (collection);
+  }
+  else if (index >= 0)
+  {
+    g_object_set (playbin, type == TRACK_AUDIO ? "current-audio" : "current-text", index, NULL);
+  }
+
+  /* The overlay only stays in the video path while subtitles are shown */
+  if (type == TRACK_TEXT && (index >= 0) != text_shown)
+  {
+    g_object_get (playbin, "flags", &flags, NULL);
+    flags = index >= 0 ? flags | TRACK_SWITCH_FLAG_TEXT : flags & ~TRACK_SWITCH_FLAG_TEXT;
+    g_object_set (playbin, "flags", flags, NULL);
+  }
+
+  if (!switched)
+  {
+    g_mutex_lock (&ts->lock);
+    ts->pending = FALSE;
+    g_mutex_unlock (&ts->lock);
+    g_atomic_int_set (&ts->awaiting_sample, FALSE);
+  }
+  return switched;
+}
+
+gboolean track_switch_take_result (TrackSwitch *ts, TrackSwitchResult *result)
+{
+  gint64 now = g_get_monotonic_time ();
+  gboolean done;
+
+  g_mutex_lock (&ts->lock);
+  done = ts->pending && ((ts->completed != 0 && now - ts->completed >= TRACK_SWITCH_TAIL) ||
+                         now - ts->requested >= TRACK_SWITCH_TIMEOUT);
+  if (done)
+  {
+    *result = ts->result;
+    /* Video that was flowing and has not come back counts up to now */
+    if (ts->last_frame != 0 && ts->frame_interval != 0 && ts->requested - ts->last_frame < TRACK_SWITCH_MAX_FRAME)
+    {
+      result->video_gap_us = MAX (ts->gap_max, now - ts->last_frame);
+      result->frame_interval_us = ts->frame_interval;
+    }
+    else
+    {
+      result->video_gap_us = -1;
+    }
+    ts->pending = FALSE;
+  }
+  g_mutex_unlock (&ts->lock);
+  if (done)
+    g_atomic_int_set (&ts->awaiting_sample, FALSE);
+  return done;
+}
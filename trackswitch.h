@@ -0,0 +1,76 @@
+#ifndef TRACKSWITCH_H
+#define TRACKSWITCH_H
+
+#include <gst/gst.h>
+
+/* Audio and subtitle track selection while playing, without a flushing seek.
+ *
+ * The tracks are listed from the stream metadata: the tags of each stream as
+ * playbin reports them, or the stream collection with playbin3. A switch
+ * then only changes which stream flows on:
+ *
+ *   - with playbin3 (GST_PLAY_USE_PLAYBIN3=1), a select-streams event with
+ *     the streams selected so far, the one of that type replaced;
+ *   - with playbin, "current-audio" / "current-text", which switches the
+ *     active pad of its input-selector; the inactive pads are kept in sync
+ *     with the running time, so the new track starts where the old one stops.
+ *
+ * Neither flushes, so video keeps flowing and the pipeline does not preroll
+ * again. Each switch is measured: from the request to the first sample of
+ * the new audio stream being heard (its running time at the sink, on the
+ * pipeline clock), or to the new subtitle stream reaching the overlay, along
+ * with the longest gap between two video frames meanwhile.
+ *
+ * Subtitles off clears playbin's text flag, which takes the overlay out of
+ * the video path altogether instead of blending an empty picture into every
+ * frame; QTGSPLAYER_SUBTITLES=0 starts every file that way. */
+typedef struct _TrackSwitch TrackSwitch;
+
+typedef enum {
+  TRACK_AUDIO,
+  TRACK_TEXT
+} TrackType;
+
+/* A completed switch, as returned by track_switch_take_result() */
+typedef struct _TrackSwitchResult {
+  TrackType type;
+  gint index;                     /* -1: subtitles off */
+  gboolean select_streams;        /* Through a select-streams event, else playbin's pad switch */
+  gint64 latency_us;              /* To the new track, or -1 if it never showed up */
+  gint64 video_gap_us;            /* Longest time between video frames during the switch */
+  gint64 frame_interval_us;       /* Usual time between video frames, for comparison */
+} TrackSwitchResult;
+
+TrackSwitch *track_switch_new (void);
+void track_switch_free (TrackSwitch *ts);
+
+/* A new URI: forget the stream collection of the old one */
+void track_switch_reset (TrackSwitch *ts);
+
+/* Whether files start with subtitles shown (QTGSPLAYER_SUBTITLES) */
+gboolean track_switch_subtitles_default (TrackSwitch *ts);
+
+/* Called from playbin's element-setup signal; probes the sinks and the subtitle overlay */
+void track_switch_element_setup (TrackSwitch *ts, GstElement *element);
+
+/* Called from the bus sync handler for every message */
+void track_switch_message (TrackSwitch *ts, GstMessage *msg);
+
+/* Tracks of a type, the current one (-1 when subtitles are off), and a
+ * description from the tags, e.g. "eng, AC-3"; free it with g_free() */
+gint track_switch_count (TrackSwitch *ts, GstElement *playbin, TrackType type);
+gint track_switch_current (TrackSwitch *ts, GstElement *playbin, TrackType type);
+gchar *track_switch_describe (TrackSwitch *ts, GstElement *playbin, TrackType type, gint index);
+
+/* First track whose language tag starts with language, or -1 */
+gint track_switch_find_language (TrackSwitch *ts, GstElement *playbin, TrackType type,
+    const gchar *language);
+
+/* Switches to a track, or subtitles off with index -1. Only measured while PLAYING. */
+gboolean track_switch_select (TrackSwitch *ts, GstElement *playbin, TrackType type, gint index);
+
+/* Called periodically from the GUI thread. Returns TRUE and fills result once
+ * the last switch has completed or timed out. */
+gboolean track_switch_take_result (TrackSwitch *ts, TrackSwitchResult *result);
+
+#endif // TRACKSWITCH_H
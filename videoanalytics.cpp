@@ -0,0 +1,415 @@
+#include "videoanalytics.h"
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QTextStream>
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+#include <string.h>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define ANALYTICS_MAGIC     "qtgsplayer-markers 1"
+
+/* Size the frames are analysed at, and bins of the luma histogram */
+#define ANALYTICS_WIDTH     160
+#define ANALYTICS_HEIGHT    90
+#define ANALYTICS_BINS      32
+
+/* Frames handed to the workers at once, per worker */
+#define ANALYTICS_BATCH     8
+
+/* Scene change: histogram distance (0 to 1) and mean absolute difference above these */
+#define ANALYTICS_SCENE_HISTOGRAM   0.4
+#define ANALYTICS_SCENE_DIFFERENCE  12.0
+#define ANALYTICS_SCENE_MIN_GAP     GST_SECOND
+
+/* Black: this share of the pixels below 32, for this long */
+#define ANALYTICS_BLACK_SHARE       0.98
+#define ANALYTICS_BLACK_DURATION    (250 * GST_MSECOND)
+
+/* Frozen: mean absolute difference below this, for this long */
+#define ANALYTICS_FROZEN_DIFFERENCE 0.5
+#define ANALYTICS_FROZEN_DURATION   (2 * GST_SECOND)
+
+/* How often the markers found are shown, and longest wait for the pipeline, in ms */
+#define ANALYTICS_UPDATE_MS 250
+#define ANALYTICS_TIMEOUT_MS 100
+
+struct FrameStats {
+    qint64 time;                    /* Stream time, in ns */
+    double mean;
+    double dark;                    /* Share of the pixels below 32 */
+    double difference;              /* Mean absolute difference with the previous frame, or -1 */
+    quint32 histogram[ANALYTICS_BINS];
+};
+
+/* One decoded frame, mapped while it or the next one is being analysed */
+struct AnalyticsFrame {
+    GstSample *sample;
+    GstVideoFrame frame;
+    FrameStats stats;
+};
+
+/* Sum of a row of pixels, and of their absolute differences with the previous frame's */
+static void analytics_row(const guint8 *cur, const guint8 *prev, int n, quint64 *sum, quint64 *sad)
+{
+    quint64 s = 0, d = 0;
+    int i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    uint32x4_t vsum = vdupq_n_u32(0), vsad = vdupq_n_u32(0);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t c = vld1q_u8(cur + i);
+        vsum = vpadalq_u16(vsum, vpaddlq_u8(c));
+        if (prev != NULL)
+            vsad = vpadalq_u16(vsad, vpaddlq_u8(vabdq_u8(c, vld1q_u8(prev + i))));
+    }
+    uint64x2_t s2 = vpaddlq_u32(vsum), d2 = vpaddlq_u32(vsad);
+    s = vgetq_lane_u64(s2, 0) + vgetq_lane_u64(s2, 1);
+    d = vgetq_lane_u64(d2, 0) + vgetq_lane_u64(d2, 1);
+#elif defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128(), vsum = zero, vsad = zero;
+    for (; i + 16 <= n; i += 16) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cur + i));
+        vsum = _mm_add_epi64(vsum, _mm_sad_epu8(c, zero));
+        if (prev != NULL)
+            vsad = _mm_add_epi64(vsad, _mm_sad_epu8(c, _mm_loadu_si128(reinterpret_cast<const __m128i *>(prev + i))));
+    }
+    quint64 s2[2], d2[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(s2), vsum);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(d2), vsad);
+    s = s2[0] + s2[1];
+    d = d2[0] + d2[1];
+#endif
+    for (; i < n; i++) {
+        s += cur[i];
+        if (prev != NULL)
+            d += cur[i] > prev[i] ? cur[i] - prev[i] : prev[i] - cur[i];
+    }
+    *sum += s;
+    *sad += d;
+}
+
+/* The statistics of one frame, computed on a worker */
+class FrameJob : public QRunnable
+{
+public:
+    FrameJob(AnalyticsFrame *frame, AnalyticsFrame *previous)
+        : frame(frame), previous(previous) {}
+
+    void run() override
+    {
+        /* The pool is ours: its threads stay in the idle class once there */
+        static thread_local bool idle = false;
+        if (!idle) {
+            background_idle_cpu();
+            idle = true;
+        }
+
+        GstVideoFrame *cur = &frame->frame;
+        int width = GST_VIDEO_FRAME_WIDTH(cur), height = GST_VIDEO_FRAME_HEIGHT(cur);
+        int stride = GST_VIDEO_FRAME_PLANE_STRIDE(cur, 0);
+        const guint8 *pixels = static_cast<const guint8 *>(GST_VIDEO_FRAME_PLANE_DATA(cur, 0));
+        const guint8 *before = NULL;
+        int beforeStride = 0;
+        if (previous != NULL && GST_VIDEO_FRAME_WIDTH(&previous->frame) == width &&
+            GST_VIDEO_FRAME_HEIGHT(&previous->frame) == height) {
+            before = static_cast<const guint8 *>(GST_VIDEO_FRAME_PLANE_DATA(&previous->frame, 0));
+            beforeStride = GST_VIDEO_FRAME_PLANE_STRIDE(&previous->frame, 0);
+        }
+
+        /* Four partial histograms, so that equal neighbours do not wait on each other */
+        quint32 histograms[4][ANALYTICS_BINS];
+        quint64 sum = 0, sad = 0;
+        memset(histograms, 0, sizeof(histograms));
+        for (int y = 0; y < height; y++) {
+            const guint8 *row = pixels + y * stride;
+            analytics_row(row, before != NULL ? before + y * beforeStride : NULL, width, &sum, &sad);
+            int x = 0;
+            for (; x + 4 <= width; x += 4) {
+                histograms[0][row[x] >> 3]++;
+                histograms[1][row[x + 1] >> 3]++;
+                histograms[2][row[x + 2] >> 3]++;
+                histograms[3][row[x + 3] >> 3]++;
+            }
+            for (; x < width; x++)
+                histograms[0][row[x] >> 3]++;
+        }
+
+        FrameStats *stats = &frame->stats;
+        double pixelCount = double(width) * height;
+        for (int b = 0; b < ANALYTICS_BINS; b++)
+            stats->histogram[b] = histograms[0][b] + histograms[1][b] + histograms[2][b] + histograms[3][b];
+        stats->mean = sum / pixelCount;
+        /* Bins of 8 levels: the first four are 0 to 31 */
+        stats->dark = (stats->histogram[0] + stats->histogram[1] + stats->histogram[2] + stats->histogram[3]) / pixelCount;
+        stats->difference = before != NULL ? sad / pixelCount : -1;
+    }
+
+private:
+    AnalyticsFrame *frame;
+    AnalyticsFrame *previous;
+};
+
+/* Runs of black and frozen frames, and the last scene change, while scanning the frames in order */
+struct AnalyticsScan {
+    qint64 lastScene;
+    qint64 blackStart;
+    bool blackMarked;
+    qint64 frozenStart;
+    bool frozenMarked;
+    bool havePrevious;
+    quint32 histogram[ANALYTICS_BINS];
+
+    AnalyticsScan()
+        : lastScene(-qint64(ANALYTICS_SCENE_MIN_GAP)), blackStart(-1), blackMarked(false)
+        , frozenStart(-1), frozenMarked(false), havePrevious(false) {}
+
+    void scan(const FrameStats &stats, double pixelCount, QVector<TimelineMarker> *markers)
+    {
+        bool black = stats.dark >= ANALYTICS_BLACK_SHARE;
+        if (!black) {
+            blackStart = -1;
+        } else if (blackStart < 0) {
+            blackStart = stats.time;
+            blackMarked = false;
+        }
+        if (black && !blackMarked && stats.time - blackStart >= qint64(ANALYTICS_BLACK_DURATION)) {
+            markers->append(TimelineMarker{blackStart, TimelineMarker::Black});
+            blackMarked = true;
+        }
+
+        bool frozen = !black && stats.difference >= 0 && stats.difference < ANALYTICS_FROZEN_DIFFERENCE;
+        if (!frozen) {
+            frozenStart = -1;
+        } else if (frozenStart < 0) {
+            frozenStart = stats.time;
+            frozenMarked = false;
+        }
+        if (frozen && !frozenMarked && stats.time - frozenStart >= qint64(ANALYTICS_FROZEN_DURATION)) {
+            markers->append(TimelineMarker{frozenStart, TimelineMarker::Frozen});
+            frozenMarked = true;
+        }
+
+        if (havePrevious && !black && stats.difference > ANALYTICS_SCENE_DIFFERENCE &&
+            stats.time - lastScene >= qint64(ANALYTICS_SCENE_MIN_GAP)) {
+            quint64 distance = 0;
+            for (int b = 0; b < ANALYTICS_BINS; b++)
+                distance += stats.histogram[b] > histogram[b] ? stats.histogram[b] - histogram[b]
+                                                              : histogram[b] - stats.histogram[b];
+            if (distance / (2 * pixelCount) > ANALYTICS_SCENE_HISTOGRAM) {
+                markers->append(TimelineMarker{stats.time, TimelineMarker::SceneChange});
+                lastScene = stats.time;
+            }
+        }
+        memcpy(histogram, stats.histogram, sizeof(histogram));
+        havePrevious = true;
+    }
+};
+
+static const char *const marker_names[] = { "scene", "black", "frozen" };
+
+VideoAnalyzer::VideoAnalyzer(const QString &cacheDir, QObject *parent)
+    : BackgroundFileWorker(cacheDir, ".markers", parent)
+{
+    /* One CPU is left to this thread, which decodes and scans */
+    workers.setMaxThreadCount(qMax(QThread::idealThreadCount() - 1, 1));
+}
+
+VideoAnalyzer::~VideoAnalyzer()
+{
+    stop();
+}
+
+void VideoAnalyzer::analyze(const QString &fileName)
+{
+    request(fileName);
+}
+
+QVector<TimelineMarker> VideoAnalyzer::markers()
+{
+    QMutexLocker locker(&mutex);
+    return current;
+}
+
+void VideoAnalyzer::clear()
+{
+    current.clear();
+}
+
+/* A line per marker, "<position in ns> scene|black|frozen", after the identity of the file */
+bool VideoAnalyzer::loadCache(const QString &fileName, QVector<TimelineMarker> *result)
+{
+    QFileInfo info(fileName);
+    QFile file(cachePath(fileName));
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    QTextStream in(&file);
+    if (in.readLine() != ANALYTICS_MAGIC ||
+        in.readLine() != QString("%1 %2").arg(info.size()).arg(info.lastModified().toMSecsSinceEpoch()))
+        return false;
+    while (!in.atEnd()) {
+        QStringList fields = in.readLine().split(' ');
+        if (fields.size() != 2)
+            continue;
+        for (int type = 0; type < 3; type++) {
+            if (fields.at(1) == marker_names[type])
+                result->append(TimelineMarker{fields.at(0).toLongLong(), TimelineMarker::Type(type)});
+        }
+    }
+    return true;
+}
+
+void VideoAnalyzer::saveCache(const QString &fileName, const QVector<TimelineMarker> &result)
+{
+    QFileInfo info(fileName);
+    QString path = cachePath(fileName);
+    QFile file(path + ".new");
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        return;
+
+    QTextStream out(&file);
+    out << ANALYTICS_MAGIC << "\n" << info.size() << " " << info.lastModified().toMSecsSinceEpoch() << "\n";
+    foreach (const TimelineMarker &marker, result)
+        out << marker.position << " " << marker_names[marker.type] << "\n";
+    out.flush();
+    file.close();
+    QFile::remove(path);
+    file.rename(path);
+}
+
+static void analytics_release(AnalyticsFrame *frame)
+{
+    gst_video_frame_unmap(&frame->frame);
+    gst_sample_unref(frame->sample);
+    delete frame;
+}
+
+void VideoAnalyzer::process(const QString &fileName, int seenGeneration)
+{
+    QVector<TimelineMarker> result;
+    if (loadCache(fileName, &result)) {
+        publish(&current, result, seenGeneration);
+        return;
+    }
+
+    /* Video only, scaled down to luma, as fast as it decodes */
+    GstElement *playbin = gst_element_factory_make("playbin", NULL);
+    GstElement *sinkBin = gst_parse_bin_from_description(
+        "videoscale add-borders=false ! videoconvert ! "
+        "video/x-raw,format=GRAY8,width=" G_STRINGIFY(ANALYTICS_WIDTH) ",height=" G_STRINGIFY(ANALYTICS_HEIGHT) " ! "
+        "appsink name=frames sync=false max-buffers=32", TRUE, NULL);
+    if (playbin == NULL || sinkBin == NULL) {
+        if (playbin) gst_object_unref(playbin);
+        if (sinkBin) gst_object_unref(sinkBin);
+        return;
+    }
+    GstElement *appsink = gst_bin_get_by_name(GST_BIN(sinkBin), "frames");
+    gchar *uri = gst_filename_to_uri(fileName.toLocal8Bit().constData(), NULL);
+    /* flags 1: video only */
+    g_object_set(playbin, "uri", uri, "video-sink", sinkBin, "flags", 1, NULL);
+    g_free(uri);
+    GstBus *bus = gst_element_get_bus(playbin);
+    gst_bus_set_sync_handler(bus, background_bus_sync_handler, NULL, NULL);
+    gst_element_set_state(playbin, GST_STATE_PLAYING);
+
+    const int batchSize = ANALYTICS_BATCH * workers.maxThreadCount();
+    QVector<AnalyticsFrame *> batch;
+    AnalyticsFrame *previous = NULL;
+    AnalyticsScan scanner;
+    qint64 firstTime = -1, lastTime = -1;
+    int frames = 0;
+    bool complete = false;
+    QElapsedTimer clock, sinceUpdate;
+    clock.start();
+    sinceUpdate.start();
+
+    while (!abandoned(seenGeneration)) {
+        GstSample *sample = gst_app_sink_try_pull_sample(GST_APP_SINK(appsink), ANALYTICS_TIMEOUT_MS * GST_MSECOND);
+        bool end = false;
+        if (sample == NULL) {
+            GstMessage *error = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+            if (error != NULL) {
+                gst_message_unref(error);
+                break;
+            }
+            end = gst_app_sink_is_eos(GST_APP_SINK(appsink));
+            if (!end)
+                continue;
+        } else {
+            GstVideoInfo info;
+            GstBuffer *buffer = gst_sample_get_buffer(sample);
+            AnalyticsFrame *frame = new AnalyticsFrame;
+            frame->sample = sample;
+            if (!GST_BUFFER_PTS_IS_VALID(buffer) || !gst_video_info_from_caps(&info, gst_sample_get_caps(sample)) ||
+                !gst_video_frame_map(&frame->frame, &info, buffer, GST_MAP_READ)) {
+                gst_sample_unref(sample);
+                delete frame;
+                continue;
+            }
+            frame->stats.time = gst_segment_to_stream_time(gst_sample_get_segment(sample), GST_FORMAT_TIME,
+                                                           GST_BUFFER_PTS(buffer));
+            batch.append(frame);
+        }
+
+        if (batch.size() < batchSize && !end)
+            continue;
+
+        /* Statistics in parallel, then the scan in order */
+        for (int i = 0; i < batch.size(); i++)
+            workers.start(new FrameJob(batch.at(i), i > 0 ? batch.at(i - 1) : previous));
+        workers.waitForDone();
+        for (int i = 0; i < batch.size(); i++) {
+            const FrameStats &stats = batch.at(i)->stats;
+            scanner.scan(stats, double(ANALYTICS_WIDTH) * ANALYTICS_HEIGHT, &result);
+            if (firstTime < 0)
+                firstTime = stats.time;
+            lastTime = stats.time;
+        }
+        frames += batch.size();
+
+        /* The last frame stays mapped, the next batch compares its first frame with it */
+        if (!batch.isEmpty()) {
+            if (previous != NULL)
+                analytics_release(previous);
+            previous = batch.takeLast();
+            foreach (AnalyticsFrame *frame, batch)
+                analytics_release(frame);
+            batch.clear();
+        }
+
+        if (end) {
+            complete = true;
+            break;
+        }
+        if (sinceUpdate.elapsed() >= ANALYTICS_UPDATE_MS) {
+            publish(&current, result, seenGeneration);
+            sinceUpdate.restart();
+        }
+    }
+
+    foreach (AnalyticsFrame *frame, batch)
+        analytics_release(frame);
+    if (previous != NULL)
+        analytics_release(previous);
+    gst_element_set_state(playbin, GST_STATE_NULL);
+    gst_object_unref(appsink);
+    gst_object_unref(bus);
+    gst_object_unref(playbin);
+
+    if (complete) {
+        saveCache(fileName, result);
+        publish(&current, result, seenGeneration);
+        double seconds = clock.nsecsElapsed() / 1e9;
+        emit analyzed(frames, seconds, seconds > 0 && lastTime > firstTime ? (lastTime - firstTime) / 1e9 / seconds : 0);
+    }
+}
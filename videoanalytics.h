@@ -0,0 +1,65 @@
+#ifndef VIDEOANALYTICS_H
+#define VIDEOANALYTICS_H
+
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+#include "backgroundworker.h"
+
+/* A point of interest on the timeline */
+struct TimelineMarker {
+    enum Type { SceneChange, Black, Frozen };
+
+    qint64 position;                /* Stream time, in ns */
+    Type type;
+};
+
+/* Finds scene changes, black and frozen pictures in local files, for
+ * incident review.
+ *
+ * A pipeline of its own decodes the video faster than real time, scaled
+ * down to 160x90 luma, into an appsink. Frames are handed out in batches to
+ * a pool of workers, which compute the mean luma, a 32 bin histogram and the
+ * mean absolute difference with the previous frame (NEON on ARM, SSE2 on
+ * x86); the results are then scanned in order:
+ *
+ *   - scene change: the histogram moves by more than a threshold and the
+ *     picture changes, at most one a second;
+ *   - black: nearly all pixels below 32 for a quarter of a second;
+ *   - frozen: the picture does not change for two seconds.
+ *
+ * Like the waveform, everything runs in the idle scheduling classes. The
+ * markers of a file are stored in cacheDir once the pass is complete, and
+ * the pass is skipped for files already indexed. */
+class VideoAnalyzer : public BackgroundFileWorker
+{
+    Q_OBJECT
+
+public:
+    VideoAnalyzer(const QString &cacheDir, QObject *parent = 0);
+    ~VideoAnalyzer();
+
+    /* Abandons the current file for this one; an empty name or a URI that is
+     * not a local file just stops */
+    void analyze(const QString &fileName);
+
+    /* Found so far in the current file */
+    QVector<TimelineMarker> markers();
+
+signals:
+    /* The pass over a file ended, with its throughput */
+    void analyzed(int frames, double seconds, double realtime);
+
+protected:
+    void process(const QString &fileName, int seenGeneration);
+    void clear();
+
+private:
+    bool loadCache(const QString &fileName, QVector<TimelineMarker> *result);
+    void saveCache(const QString &fileName, const QVector<TimelineMarker> &result);
+
+    QThreadPool workers;
+    QVector<TimelineMarker> current;
+};
+
+#endif // VIDEOANALYTICS_H
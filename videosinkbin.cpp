@@ -0,0 +1,635 @@
+#include "videosinkbin.h"
+#include <gst/video/video.h>
+#include <string.h>
+
+#define VIDEO_SINK_BIN_STATE "qtgsplayer-video-sink-bin"
+
+/* Frames preallocated in our pool; the decoder adds what it keeps for reference */
+#define VIDEO_SINK_BIN_POOL_MIN 4
+
+/* Shared by the GUI thread (window size) and the streaming thread (stream size) */
+typedef struct _VideoSinkBinState {
+  GMutex lock;
+  GstElement *capsfilter;
+  gint window_width;
+  gint window_height;
+  gint video_width;
+  gint video_height;
+  gint par_n;
+  gint par_d;
+  GstCaps *applied;
+
+  /* Formats the sink takes without conversion, queried once it is open */
+  GstElement *sink;
+  GstCaps *native;
+
+  /* Per session statistics, see video_sink_bin_take_stats() */
+  VideoSinkBinStats stats;
+  gint64 convert_start;           /* Only touched by the streaming thread */
+  gint64 scale_start;
+
+  /* While the video is not visible the decoder is fed nothing but gaps */
+  gint visible;
+  gint resync;                    /* Waiting for a keyframe after becoming visible */
+  GstClockTime last_gap;          /* Only touched by the streaming thread */
+
+  /* Frame pools handed out, until their statistics have been taken for the last time */
+  GList *pools;
+
+  /* Load shedding, see video_sink_bin_set_load_shedding() */
+  guint shrink;
+  gint decimate;
+  guint64 decimate_count;         /* Only touched by the streaming thread */
+} VideoSinkBinState;
+
+static void video_sink_bin_state_free (gpointer user_data)
+{
+  VideoSinkBinState *state = (VideoSinkBinState *) user_data;
+  g_mutex_clear (&state->lock);
+  gst_caps_replace (&state->applied, NULL);
+  gst_caps_replace (&state->native, NULL);
+  g_list_free_full (state->pools, gst_object_unref);
+  g_free (state);
+}
+
+static VideoSinkBinState *video_sink_bin_get_state (GstElement *bin)
+{
+  return (VideoSinkBinState *) g_object_get_data (G_OBJECT (bin), VIDEO_SINK_BIN_STATE);
+}
+
+/* Largest even size inside the window, shrunk when shedding load, with the
+ * display aspect ratio of the stream; no constraint at all when the stream
+ * already fits. */
+static GstCaps *video_sink_bin_target_caps (VideoSinkBinState *state)
+{
+  gint width, height, window_width, window_height;
+  gdouble aspect;
+
+  /* Without a window yet the stream itself is the bound, which only matters when shrinking */
+  window_width = state->window_width > 0 ? state->window_width : state->video_width;
+  window_height = state->window_height > 0 ? state->window_height : state->video_height;
+  if (window_width <= 0 || window_height <= 0 ||
+      state->video_width <= 0 || state->video_height <= 0)
+    return gst_caps_new_empty_simple ("video/x-raw");
+  window_width >>= state->shrink;
+  window_height >>= state->shrink;
+
+  aspect = (gdouble) state->video_width * state->par_n / ((gdouble) state->video_height * state->par_d);
+  width = window_width;
+  height = (gint) (width / aspect);
+  if (height > window_height)
+  {
+    height = window_height;
+    width = (gint) (height * aspect);
+  }
+  width &= ~1;
+  height &= ~1;
+
+  if (width < 2 || height < 2 || width >= state->video_width || height >= state->video_height)
+    return gst_caps_new_empty_simple ("video/x-raw");
+  return gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT, width, "height", G_TYPE_INT, height, NULL);
+}
+
+/* Setting new caps on the capsfilter makes it request a renegotiation upstream */
+static void video_sink_bin_update (VideoSinkBinState *state)
+{
+  GstCaps *caps;
+  GstElement *capsfilter;
+
+  g_mutex_lock (&state->lock);
+  caps = video_sink_bin_target_caps (state);
+  if (state->applied != NULL && gst_caps_is_equal (caps, state->applied))
+  {
+    g_mutex_unlock (&state->lock);
+    gst_caps_unref (caps);
+    return;
+  }
+  gst_caps_replace (&state->applied, caps);
+  capsfilter = (GstElement *) gst_object_ref (state->capsfilter);
+  g_mutex_unlock (&state->lock);
+
+  g_object_set (capsfilter, "caps", caps, NULL);
+  gst_object_unref (capsfilter);
+  gst_caps_unref (caps);
+}
+
+static GstPadProbeReturn video_sink_bin_caps_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  VideoSinkBinState *state = (VideoSinkBinState *) user_data;
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstCaps *caps;
+  GstStructure *structure;
+  gint width, height, par_n = 1, par_d = 1;
+  (void) pad;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+    return GST_PAD_PROBE_OK;
+
+  gst_event_parse_caps (event, &caps);
+  structure = gst_caps_get_structure (caps, 0);
+  if (!gst_structure_get_int (structure, "width", &width) ||
+      !gst_structure_get_int (structure, "height", &height))
+    return GST_PAD_PROBE_OK;
+  gst_structure_get_fraction (structure, "pixel-aspect-ratio", &par_n, &par_d);
+
+  g_mutex_lock (&state->lock);
+  state->video_width = width;
+  state->video_height = height;
+  state->par_n = par_n > 0 ? par_n : 1;
+  state->par_d = par_d > 0 ? par_d : 1;
+  g_mutex_unlock (&state->lock);
+
+  video_sink_bin_update (state);
+  return GST_PAD_PROBE_OK;
+}
+
+/* The formats the sink accepts, with everything but the format dropped.
+ * xvimagesink only knows what the XVideo port supports once it is in READY,
+ * before that the template caps are all we would get, so nothing is cached. */
+static GstCaps *video_sink_bin_native_formats (VideoSinkBinState *state)
+{
+  GstCaps *caps, *formats;
+  GstPad *pad;
+
+  g_mutex_lock (&state->lock);
+  if (state->native != NULL)
+  {
+    caps = gst_caps_ref (state->native);
+    g_mutex_unlock (&state->lock);
+    return caps;
+  }
+  g_mutex_unlock (&state->lock);
+
+  if (GST_STATE (state->sink) < GST_STATE_READY)
+    return NULL;
+
+  pad = gst_element_get_static_pad (state->sink, "sink");
+  caps = gst_pad_query_caps (pad, NULL);
+  gst_object_unref (pad);
+
+  formats = gst_caps_new_empty ();
+  for (guint i = 0; i < gst_caps_get_size (caps); i++)
+  {
+    GstStructure *structure = gst_structure_copy (gst_caps_get_structure (caps, i));
+    if (!gst_structure_has_field (structure, "format"))
+    {
+      gst_structure_free (structure);
+      continue;
+    }
+    gst_structure_remove_fields (structure, "width", "height", "framerate", "pixel-aspect-ratio", NULL);
+    formats = gst_caps_merge_structure (formats, structure);
+  }
+  gst_caps_unref (caps);
+
+  if (gst_caps_is_empty (formats))
+  {
+    gst_caps_unref (formats);
+    return NULL;
+  }
+
+  g_mutex_lock (&state->lock);
+  if (state->native == NULL)
+  {
+    GST_DEBUG_OBJECT (state->sink, "accepts %" GST_PTR_FORMAT, formats);
+    state->native = gst_caps_ref (formats);
+  }
+  g_mutex_unlock (&state->lock);
+  return formats;
+}
+
+/* Offers a frame pool sized from the negotiated caps in place of the plain
+ * system memory pool videoscale and videoconvert propose while they work, or
+ * when nothing proposed any. Pools of the sink itself (XVideo, DMA, ...) are
+ * what makes display without a copy possible and are kept. */
+static void video_sink_bin_propose_pool (VideoSinkBinState *state, GstQuery *query)
+{
+  GstCaps *caps;
+  GstVideoInfo info;
+  GstBufferPool *pool = NULL;
+  GstStructure *config;
+  guint min = 0, max = 0;
+  gboolean replace = FALSE;
+
+  if (gst_query_get_n_allocation_pools (query) > 0)
+  {
+    gst_query_parse_nth_allocation_pool (query, 0, &pool, NULL, &min, &max);
+    replace = pool == NULL || G_OBJECT_TYPE (pool) == GST_TYPE_VIDEO_BUFFER_POOL;
+    if (pool != NULL)
+      gst_object_unref (pool);
+    if (!replace)
+      return;
+  }
+  gst_query_parse_allocation (query, &caps, NULL);
+  if (caps == NULL || !gst_video_info_from_caps (&info, caps))
+    return;
+
+  min = MAX (min, VIDEO_SINK_BIN_POOL_MIN);
+  pool = frame_pool_new ();
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, GST_VIDEO_INFO_SIZE (&info), min, max);
+  if (gst_query_find_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL))
+    gst_buffer_pool_config_add_option (config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+  if (!gst_buffer_pool_set_config (pool, config))
+  {
+    gst_object_unref (pool);
+    return;
+  }
+  if (replace)
+    gst_query_set_nth_allocation_pool (query, 0, pool, GST_VIDEO_INFO_SIZE (&info), min, max);
+  else
+    gst_query_add_allocation_pool (query, pool, GST_VIDEO_INFO_SIZE (&info), min, max);
+
+  g_mutex_lock (&state->lock);
+  state->pools = g_list_prepend (state->pools, pool);
+  state->stats.pools++;
+  g_mutex_unlock (&state->lock);
+}
+
+/* Caps queries from the decoder are answered by videoconvert, which accepts
+ * everything and does not care about the order. Move the formats the sink
+ * takes natively to the front so that a decoder able to output several formats
+ * (I420, NV12, ...) picks one of them and videoconvert stays in passthrough. */
+static gboolean video_sink_bin_sink_query (GstPad *pad, GstObject *parent, GstQuery *query)
+{
+  VideoSinkBinState *state;
+  GstCaps *result, *native, *preferred;
+
+  if (!gst_proxy_pad_query_default (pad, parent, query))
+    return FALSE;
+  if (parent == NULL || (state = video_sink_bin_get_state (GST_ELEMENT (parent))) == NULL)
+    return TRUE;
+  if (GST_QUERY_TYPE (query) == GST_QUERY_ALLOCATION)
+  {
+    video_sink_bin_propose_pool (state, query);
+    return TRUE;
+  }
+  if (GST_QUERY_TYPE (query) != GST_QUERY_CAPS || (native = video_sink_bin_native_formats (state)) == NULL)
+    return TRUE;
+
+  gst_query_parse_caps_result (query, &result);
+  if (result == NULL || gst_caps_is_any (result))
+  {
+    gst_caps_unref (native);
+    return TRUE;
+  }
+
+  preferred = gst_caps_intersect_full (native, result, GST_CAPS_INTERSECT_FIRST);
+  gst_caps_unref (native);
+  if (gst_caps_is_empty (preferred))
+  {
+    gst_caps_unref (preferred);
+    return TRUE;
+  }
+  preferred = gst_caps_merge (preferred, gst_caps_ref (result));
+  gst_query_set_caps_result (query, preferred);
+  gst_caps_unref (preferred);
+  return TRUE;
+}
+
+static void video_sink_bin_copy_format (GstCaps *caps, gchar *format, gsize size)
+{
+  const gchar *name = gst_structure_get_string (gst_caps_get_structure (caps, 0), "format");
+  g_strlcpy (format, name != NULL ? name : "", size);
+}
+
+/* What enters and what leaves videoconvert tells whether frames get converted */
+static GstPadProbeReturn video_sink_bin_convert_caps_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  VideoSinkBinState *state = (VideoSinkBinState *) user_data;
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstCaps *caps;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+    return GST_PAD_PROBE_OK;
+
+  gst_event_parse_caps (event, &caps);
+  g_mutex_lock (&state->lock);
+  if (GST_PAD_DIRECTION (pad) == GST_PAD_SINK)
+    video_sink_bin_copy_format (caps, state->stats.decoded_format, sizeof (state->stats.decoded_format));
+  else
+    video_sink_bin_copy_format (caps, state->stats.display_format, sizeof (state->stats.display_format));
+  if (state->stats.decoded_format[0] != '\0' && state->stats.display_format[0] != '\0' &&
+      strcmp (state->stats.decoded_format, state->stats.display_format) != 0)
+    state->stats.converted = TRUE;
+  g_mutex_unlock (&state->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* The time between a buffer entering an element and the result leaving it is
+ * what the element cost for that frame; both happen on the same streaming thread */
+static GstPadProbeReturn video_sink_bin_timing_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  VideoSinkBinState *state = (VideoSinkBinState *) user_data;
+  GstElement *element = GST_PAD_PARENT (pad);
+  gboolean convert = g_str_equal (GST_OBJECT_NAME (element), "convert");
+  gint64 *start = convert ? &state->convert_start : &state->scale_start;
+  gint64 now = g_get_monotonic_time ();
+  (void) info;
+
+  if (GST_PAD_DIRECTION (pad) == GST_PAD_SINK)
+  {
+    *start = now;
+    return GST_PAD_PROBE_OK;
+  }
+  if (*start == 0)
+    return GST_PAD_PROBE_OK;
+
+  g_mutex_lock (&state->lock);
+  if (convert)
+  {
+    state->stats.convert_frames++;
+    state->stats.convert_time += (now - *start) * GST_USECOND;
+  }
+  else
+  {
+    state->stats.scale_frames++;
+    state->stats.scale_time += (now - *start) * GST_USECOND;
+  }
+  g_mutex_unlock (&state->lock);
+  *start = 0;
+  return GST_PAD_PROBE_OK;
+}
+
+/* Lets one frame in state->decimate through; the sink keeps showing the last one */
+static GstPadProbeReturn video_sink_bin_decimate_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  VideoSinkBinState *state = (VideoSinkBinState *) user_data;
+  gint decimate = g_atomic_int_get (&state->decimate);
+  (void) pad;
+  (void) info;
+
+  if (decimate <= 1 || state->decimate_count++ % decimate == 0)
+    return GST_PAD_PROBE_OK;
+
+  g_mutex_lock (&state->lock);
+  state->stats.decimated_frames++;
+  g_mutex_unlock (&state->lock);
+  return GST_PAD_PROBE_DROP;
+}
+
+static void video_sink_bin_add_timing_probes (GstElement *element, VideoSinkBinState *state)
+{
+  static const gchar *const names[] = { "sink", "src" };
+
+  for (guint i = 0; i < G_N_ELEMENTS (names); i++)
+  {
+    GstPad *pad = gst_element_get_static_pad (element, names[i]);
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, video_sink_bin_timing_probe, state, NULL);
+    gst_object_unref (pad);
+  }
+}
+
+static GstElement *video_sink_bin_make_sink (void)
+{
+  static const gchar *const fallbacks[] = { "xvimagesink", "ximagesink", "autovideosink" };
+  const gchar *name = g_getenv ("QTGSPLAYER_VIDEOSINK");
+  GstElement *sink;
+
+  if (name != NULL && *name != '\0')
+  {
+    sink = gst_element_factory_make (name, "videosink");
+    if (sink != NULL)
+      return sink;
+    g_printerr ("Video sink %s could not be created.\n", name);
+  }
+  for (guint i = 0; i < G_N_ELEMENTS (fallbacks); i++)
+  {
+    sink = gst_element_factory_make (fallbacks[i], "videosink");
+    if (sink != NULL)
+      return sink;
+  }
+  return NULL;
+}
+
+GstElement *video_sink_bin_new (void)
+{
+  GstElement *bin, *scale, *capsfilter, *convert, *sink;
+  GstPad *pad, *ghost;
+  VideoSinkBinState *state;
+
+  scale = gst_element_factory_make ("videoscale", "downscale");
+  capsfilter = gst_element_factory_make ("capsfilter", "downscale-caps");
+  convert = gst_element_factory_make ("videoconvert", "convert");
+  sink = video_sink_bin_make_sink ();
+  if (!scale || !capsfilter || !convert || !sink)
+  {
+    g_printerr ("Not all video sink elements could be created, using the default sink.\n");
+    if (scale) gst_object_unref (scale);
+    if (capsfilter) gst_object_unref (capsfilter);
+    if (convert) gst_object_unref (convert);
+    if (sink) gst_object_unref (sink);
+    return NULL;
+  }
+
+  bin = gst_bin_new ("video-sink-bin");
+  gst_bin_add_many (GST_BIN (bin), scale, capsfilter, convert, sink, NULL);
+  if (!gst_element_link_many (scale, capsfilter, convert, sink, NULL))
+  {
+    g_printerr ("Video sink elements could not be linked, using the default sink.\n");
+    gst_object_unref (bin);
+    return NULL;
+  }
+
+  state = g_new0 (VideoSinkBinState, 1);
+  g_mutex_init (&state->lock);
+  state->capsfilter = capsfilter;
+  state->sink = sink;
+  state->par_n = state->par_d = 1;
+  state->visible = TRUE;
+  state->last_gap = GST_CLOCK_TIME_NONE;
+  g_object_set_data_full (G_OBJECT (bin), VIDEO_SINK_BIN_STATE, state, video_sink_bin_state_free);
+
+  pad = gst_element_get_static_pad (convert, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, video_sink_bin_convert_caps_probe, state, NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (convert, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, video_sink_bin_convert_caps_probe, state, NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (scale, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, video_sink_bin_decimate_probe, state, NULL);
+  gst_object_unref (pad);
+  video_sink_bin_add_timing_probes (scale, state);
+  video_sink_bin_add_timing_probes (convert, state);
+
+  pad = gst_element_get_static_pad (scale, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, video_sink_bin_caps_probe, state, NULL);
+  ghost = gst_ghost_pad_new ("sink", pad);
+  gst_pad_set_query_function (ghost, video_sink_bin_sink_query);
+  gst_element_add_pad (bin, ghost);
+  gst_object_unref (pad);
+  return bin;
+}
+
+void video_sink_bin_set_window_size (GstElement *bin, gint width, gint height)
+{
+  VideoSinkBinState *state = video_sink_bin_get_state (bin);
+  if (state == NULL)
+    return;
+
+  g_mutex_lock (&state->lock);
+  state->window_width = width;
+  state->window_height = height;
+  g_mutex_unlock (&state->lock);
+  video_sink_bin_update (state);
+}
+
+static GstPadProbeReturn video_sink_bin_decoder_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  GstElement *bin = GST_ELEMENT (user_data);
+  VideoSinkBinState *state = video_sink_bin_get_state (bin);
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstElement *decoder;
+  GstCaps *caps;
+  GstStructure *structure;
+  gint width, height, window_width, window_height, lowres = 0;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS || state == NULL)
+    return GST_PAD_PROBE_OK;
+
+  gst_event_parse_caps (event, &caps);
+  structure = gst_caps_get_structure (caps, 0);
+  if (!gst_structure_get_int (structure, "width", &width) ||
+      !gst_structure_get_int (structure, "height", &height))
+    return GST_PAD_PROBE_OK;
+
+  g_mutex_lock (&state->lock);
+  window_width = state->window_width >> state->shrink;
+  window_height = state->window_height >> state->shrink;
+  g_mutex_unlock (&state->lock);
+  if (window_width <= 0 || window_height <= 0)
+    return GST_PAD_PROBE_OK;
+
+  /* 1 is half, 2 is quarter resolution; the decoder clamps it to what the codec supports */
+  while (lowres < 2 && (width >> (lowres + 1)) >= window_width && (height >> (lowres + 1)) >= window_height)
+    lowres++;
+
+  /* The caps event has not reached the decoder yet, so this applies before the codec is opened */
+  decoder = gst_pad_get_parent_element (pad);
+  if (decoder != NULL)
+  {
+    g_object_set (decoder, "lowres", lowres, NULL);
+    gst_object_unref (decoder);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* Sits on the decoder input. Hidden: compressed buffers are dropped before they
+ * cost anything and replaced by gaps, so the sink keeps prerolling and the audio
+ * and the clock go on. Visible again: delta units are dropped until the next
+ * keyframe, which is marked DISCONT so the decoder restarts cleanly from it. */
+static GstPadProbeReturn video_sink_bin_suspend_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  VideoSinkBinState *state = video_sink_bin_get_state (GST_ELEMENT (user_data));
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTime pts;
+
+  if (state == NULL)
+    return GST_PAD_PROBE_OK;
+
+  if (g_atomic_int_get (&state->visible))
+  {
+    if (!g_atomic_int_get (&state->resync))
+      return GST_PAD_PROBE_OK;
+    if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+    {
+      buffer = gst_buffer_make_writable (buffer);
+      GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
+      GST_PAD_PROBE_INFO_DATA (info) = buffer;
+      g_atomic_int_set (&state->resync, FALSE);
+      state->last_gap = GST_CLOCK_TIME_NONE;
+      return GST_PAD_PROBE_OK;
+    }
+  }
+
+  g_mutex_lock (&state->lock);
+  state->stats.suspended_buffers++;
+  g_mutex_unlock (&state->lock);
+
+  /* Buffers come in decoding order, only gaps moving forward are sent */
+  pts = GST_BUFFER_PTS (buffer);
+  if (GST_CLOCK_TIME_IS_VALID (pts) &&
+      (!GST_CLOCK_TIME_IS_VALID (state->last_gap) || pts > state->last_gap))
+  {
+    state->last_gap = pts;
+    gst_pad_send_event (pad, gst_event_new_gap (pts, GST_BUFFER_DURATION (buffer)));
+  }
+  return GST_PAD_PROBE_DROP;
+}
+
+void video_sink_bin_setup_decoder (GstElement *bin, GstElement *decoder)
+{
+  GstPad *pad;
+
+  if (bin == NULL)
+    return;
+  pad = gst_element_get_static_pad (decoder, "sink");
+  if (pad == NULL)
+    return;
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, video_sink_bin_suspend_probe,
+      gst_object_ref (bin), gst_object_unref);
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (decoder), "lowres"))
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, video_sink_bin_decoder_probe,
+        gst_object_ref (bin), gst_object_unref);
+  gst_object_unref (pad);
+}
+
+void video_sink_bin_set_load_shedding (GstElement *bin, guint shrink, guint decimate)
+{
+  VideoSinkBinState *state = bin != NULL ? video_sink_bin_get_state (bin) : NULL;
+  if (state == NULL)
+    return;
+
+  g_atomic_int_set (&state->decimate, (gint) decimate);
+  g_mutex_lock (&state->lock);
+  if (state->shrink == shrink)
+  {
+    g_mutex_unlock (&state->lock);
+    return;
+  }
+  state->shrink = shrink;
+  g_mutex_unlock (&state->lock);
+  video_sink_bin_update (state);
+}
+
+void video_sink_bin_set_visible (GstElement *bin, gboolean visible)
+{
+  VideoSinkBinState *state = bin != NULL ? video_sink_bin_get_state (bin) : NULL;
+  if (state == NULL || g_atomic_int_get (&state->visible) == !!visible)
+    return;
+
+  if (visible)
+    g_atomic_int_set (&state->resync, TRUE);
+  g_atomic_int_set (&state->visible, !!visible);
+}
+
+gboolean video_sink_bin_is_resyncing (GstElement *bin)
+{
+  VideoSinkBinState *state = bin != NULL ? video_sink_bin_get_state (bin) : NULL;
+  return state != NULL && g_atomic_int_get (&state->resync);
+}
+
+gboolean video_sink_bin_take_stats (GstElement *bin, VideoSinkBinStats *stats)
+{
+  VideoSinkBinState *state = bin != NULL ? video_sink_bin_get_state (bin) : NULL;
+  if (state == NULL)
+    return FALSE;
+
+  g_mutex_lock (&state->lock);
+  /* Pools only we still hold are done with: fold them in a last time and drop them */
+  for (GList *l = state->pools; l != NULL;)
+  {
+    GList *next = l->next;
+    GstBufferPool *pool = GST_BUFFER_POOL (l->data);
+    frame_pool_take_stats (pool, &state->stats.pool);
+    if (GST_OBJECT_REFCOUNT_VALUE (pool) == 1 && !gst_buffer_pool_is_active (pool))
+    {
+      gst_object_unref (pool);
+      state->pools = g_list_delete_link (state->pools, l);
+    }
+    l = next;
+  }
+  *stats = state->stats;
+  memset (&state->stats, 0, sizeof (state->stats));
+  g_mutex_unlock (&state->lock);
+  return stats->decoded_format[0] != '\0';
+}
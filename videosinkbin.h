@@ -0,0 +1,69 @@
+#ifndef VIDEOSINKBIN_H
+#define VIDEOSINKBIN_H
+
+#include <gst/gst.h>
+#include "framepool.h"
+
+/* The video sink handed to playbin:
+ *
+ *   videoscale ! capsfilter ! videoconvert ! xvimagesink
+ *
+ * The capsfilter limits the frame size to the size of the video window, so
+ * that frames larger than what can be shown are scaled down once, before
+ * anything else touches them, instead of being converted at full size and
+ * scaled by the sink. Smaller frames pass through untouched. The actual sink
+ * can be chosen with QTGSPLAYER_VIDEOSINK.
+ *
+ * Caps queries coming from the decoder are answered with the formats the sink
+ * displays natively first (I420, YV12, NV12, ... through XVideo), so decoders
+ * that can produce one of them do and videoconvert is left in passthrough.
+ *
+ * Allocation queries are answered with a pool of ours (see framepool.h)
+ * unless the sink offers its own, so that decoded frames are recycled in
+ * page aligned slabs rather than allocated per frame. */
+GstElement *video_sink_bin_new (void);
+
+/* What happened to the frames of one session */
+typedef struct _VideoSinkBinStats {
+  gchar decoded_format[16];       /* Format negotiated with the decoder */
+  gchar display_format[16];       /* Format handed to the sink */
+  gboolean converted;             /* videoconvert had to convert the frames */
+  guint64 convert_frames;
+  GstClockTime convert_time;      /* Spent in videoconvert, passthrough included */
+  guint64 scale_frames;
+  GstClockTime scale_time;        /* Spent in videoscale */
+  guint64 suspended_buffers;      /* Not decoded because the video was hidden */
+  guint64 decimated_frames;       /* Dropped to shed load, see below */
+  guint pools;                    /* Frame pools offered to the decoder */
+  FramePoolStats pool;
+} VideoSinkBinStats;
+
+/* Size, in device pixels, of the window the video is shown in. Changing it
+ * renegotiates the scaling caps on the fly. */
+void video_sink_bin_set_window_size (GstElement *bin, gint width, gint height);
+
+/* Called from playbin's element-setup for video decoders. Installs the probe
+ * that suspends decoding while hidden and, where the decoder can decode at a
+ * reduced resolution (avdec_* "lowres"), asks for it when the window is at
+ * least twice smaller than the stream. This is decided once, when the stream
+ * starts; the scaling caps keep following the window. */
+void video_sink_bin_setup_decoder (GstElement *bin, GstElement *decoder);
+
+/* Load shedding for the QoS controller (see qoscontrol.h): the scaling target
+ * is divided by 2^shrink, renegotiated on the fly, and only one frame in
+ * decimate goes on to conversion and display. A shrunk target also lowers the
+ * "lowres" asked from decoders for the streams started afterwards. */
+void video_sink_bin_set_load_shedding (GstElement *bin, guint shrink, guint decimate);
+
+/* Stops decoding video while nothing of it can be seen; audio keeps playing.
+ * When the video becomes visible again decoding resumes at the next keyframe. */
+void video_sink_bin_set_visible (GstElement *bin, gboolean visible);
+
+/* Visible again, but still waiting for a keyframe */
+gboolean video_sink_bin_is_resyncing (GstElement *bin);
+
+/* Copies the statistics gathered since the last call and starts over.
+ * Returns FALSE when no video went through the bin. */
+gboolean video_sink_bin_take_stats (GstElement *bin, VideoSinkBinStats *stats);
+
+#endif // VIDEOSINKBIN_H
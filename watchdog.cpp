@@ -0,0 +1,78 @@
+#include "watchdog.h"
+
+#define WATCHDOG_STEPS 3
+
+StallWatchdog::StallWatchdog(PlayerMetrics *metrics, int timeoutMs, QObject *parent)
+    : QThread(parent)
+    , metrics(metrics)
+    , timeoutMs(timeoutMs)
+    , armed(false)
+    , quitting(false)
+    , generation(0)
+{
+}
+
+StallWatchdog::~StallWatchdog()
+{
+    quitting = true;
+    wait();
+}
+
+void StallWatchdog::setArmed(bool armed)
+{
+    this->armed = armed;
+}
+
+void StallWatchdog::reset()
+{
+    generation++;
+}
+
+void StallWatchdog::run()
+{
+    /* Checking four times per timeout keeps the detection within 25% of it */
+    int tickMs = qMax(timeoutMs / 4, 50);
+    int seenGeneration = -1;
+    gint64 lastActivity = 0;
+    gint64 since = 0;           /* Start of the current measurement, in us */
+    gint64 stallStart = 0;
+    int step = 0;
+
+    while (!quitting) {
+        msleep(tickMs);
+        gint64 now = g_get_monotonic_time();
+        gint64 activity = metrics->lastSinkActivity;
+
+        if (generation != seenGeneration) {
+            seenGeneration = generation;
+            step = 0;
+        }
+
+        /* Not expected to play: restart the measurement, but keep the escalation so
+         * that a rebuild that stalls again goes on to the next step */
+        bool watching = armed && metrics->state == GST_STATE_PLAYING && metrics->bufferingPercent >= 100;
+        if (!watching) {
+            lastActivity = activity;
+            since = now;
+            continue;
+        }
+
+        if (activity != lastActivity) {
+            lastActivity = activity;
+            since = now;
+            if (step > 0)
+                emit recovered(step, (now - stallStart) / 1000);
+            step = 0;
+            continue;
+        }
+
+        /* Each step gets a full timeout to show an effect before the next one */
+        if (step < WATCHDOG_STEPS && now - since >= gint64(timeoutMs) * 1000) {
+            if (step == 0)
+                stallStart = since;
+            step++;
+            since = now;
+            emit stalled(step, (now - stallStart) / 1000);
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <atomic>
+#include <QThread>
+#include "metrics.h"
+
+/* Notices PLAYING pipelines whose sinks stopped receiving data (a wedged
+ * decoder, a source stuck on a network share) without relying on the GUI
+ * thread, which may be the thing that is stuck.
+ *
+ * The sink probes stamp every buffer and gap in PlayerMetrics; this thread
+ * wakes up a few times per second and compares. Once nothing arrived for
+ * timeoutMs it emits stalled() with step 1, then 2, then 3 if each action
+ * taken did not bring the data back within another timeoutMs, and
+ * recovered() as soon as data flows again. Signals are queued to the GUI. */
+class StallWatchdog : public QThread
+{
+    Q_OBJECT
+
+public:
+    StallWatchdog(PlayerMetrics *metrics, int timeoutMs, QObject *parent = 0);
+    ~StallWatchdog();
+
+    /* Only watched while armed and the pipeline is PLAYING and not buffering */
+    void setArmed(bool armed);
+
+    /* A new item: forget the escalation reached so far */
+    void reset();
+
+signals:
+    void stalled(int step, qint64 stalledMs);
+    void recovered(int step, qint64 stalledMs);
+
+protected:
+    void run();
+
+private:
+    PlayerMetrics *metrics;
+    int timeoutMs;
+    std::atomic<bool> armed;
+    std::atomic<bool> quitting;
+    std::atomic<int> generation;    /* Bumped by reset() */
+};
+
+#endif // WATCHDOG_H
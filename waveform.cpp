@@ -0,0 +1,334 @@
+#include "waveform.h"
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <math.h>
+#include <string.h>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#define WAVEFORM_MAGIC      "QWF1"
+
+/* How often the progress is shown, and saved */
+#define WAVEFORM_UPDATE_MS  250
+#define WAVEFORM_SAVE_MS    2000
+
+/* Longest wait for the pipeline to preroll or to hand over a sample, in ms */
+#define WAVEFORM_TIMEOUT_MS 100
+
+struct WaveformCacheHeader {
+    char magic[4];
+    quint32 buckets;
+    quint32 filled;
+    quint32 reserved;
+    qint64 size;                    /* Of the file, to notice it changed */
+    qint64 mtime;
+    qint64 duration;                /* In ns */
+};
+
+/* Min, max and sum of squares of n samples, folded into the running values */
+static void waveform_accumulate(const float *samples, int n, float *min, float *max, double *sumSquares)
+{
+    float lo = *min, hi = *max, squares = 0;
+    int i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    if (n >= 4) {
+        float32x4_t vlo = vdupq_n_f32(lo), vhi = vdupq_n_f32(hi), vsq = vdupq_n_f32(0);
+        for (; i + 4 <= n; i += 4) {
+            float32x4_t v = vld1q_f32(samples + i);
+            vlo = vminq_f32(vlo, v);
+            vhi = vmaxq_f32(vhi, v);
+            vsq = vmlaq_f32(vsq, v, v);
+        }
+        float32x2_t l = vpmin_f32(vget_low_f32(vlo), vget_high_f32(vlo));
+        float32x2_t h = vpmax_f32(vget_low_f32(vhi), vget_high_f32(vhi));
+        float32x2_t s = vadd_f32(vget_low_f32(vsq), vget_high_f32(vsq));
+        lo = vget_lane_f32(vpmin_f32(l, l), 0);
+        hi = vget_lane_f32(vpmax_f32(h, h), 0);
+        squares = vget_lane_f32(vpadd_f32(s, s), 0);
+    }
+#elif defined(__SSE__)
+    if (n >= 4) {
+        __m128 vlo = _mm_set1_ps(lo), vhi = _mm_set1_ps(hi), vsq = _mm_setzero_ps();
+        for (; i + 4 <= n; i += 4) {
+            __m128 v = _mm_loadu_ps(samples + i);
+            vlo = _mm_min_ps(vlo, v);
+            vhi = _mm_max_ps(vhi, v);
+            vsq = _mm_add_ps(vsq, _mm_mul_ps(v, v));
+        }
+        float l[4], h[4], s[4];
+        _mm_storeu_ps(l, vlo);
+        _mm_storeu_ps(h, vhi);
+        _mm_storeu_ps(s, vsq);
+        lo = qMin(qMin(l[0], l[1]), qMin(l[2], l[3]));
+        hi = qMax(qMax(h[0], h[1]), qMax(h[2], h[3]));
+        squares = s[0] + s[1] + s[2] + s[3];
+    }
+#endif
+    for (; i < n; i++) {
+        lo = qMin(lo, samples[i]);
+        hi = qMax(hi, samples[i]);
+        squares += samples[i] * samples[i];
+    }
+    *min = lo;
+    *max = hi;
+    *sumSquares += squares;
+}
+
+WaveformBuilder::WaveformBuilder(const QString &cacheDir, QObject *parent)
+    : BackgroundFileWorker(cacheDir, ".peaks", parent)
+{
+}
+
+WaveformBuilder::~WaveformBuilder()
+{
+    stop();
+}
+
+void WaveformBuilder::build(const QString &fileName)
+{
+    request(fileName);
+}
+
+WaveformPeaks WaveformBuilder::peaks()
+{
+    QMutexLocker locker(&mutex);
+    return current;
+}
+
+void WaveformBuilder::clear()
+{
+    current = WaveformPeaks();
+}
+
+bool WaveformBuilder::loadCache(const QString &fileName, qint64 *duration, WaveformPeaks *result)
+{
+    QFileInfo info(fileName);
+    QFile file(cachePath(fileName));
+    WaveformCacheHeader header;
+
+    if (!file.open(QIODevice::ReadOnly) ||
+        file.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, WAVEFORM_MAGIC, 4) != 0 || header.buckets != WAVEFORM_BUCKETS ||
+        header.filled > WAVEFORM_BUCKETS || header.size != info.size() ||
+        header.mtime != info.lastModified().toMSecsSinceEpoch())
+        return false;
+
+    QVector<float> values(3 * WAVEFORM_BUCKETS);
+    qint64 bytes = values.size() * sizeof(float);
+    if (file.read(reinterpret_cast<char *>(values.data()), bytes) != bytes)
+        return false;
+    result->min = values.mid(0, WAVEFORM_BUCKETS);
+    result->max = values.mid(WAVEFORM_BUCKETS, WAVEFORM_BUCKETS);
+    result->rms = values.mid(2 * WAVEFORM_BUCKETS, WAVEFORM_BUCKETS);
+    result->filled = header.filled;
+    *duration = header.duration;
+    return true;
+}
+
+/* Written aside and renamed, so that a crash leaves the previous version */
+void WaveformBuilder::saveCache(const QString &fileName, qint64 duration, const WaveformPeaks &result)
+{
+    QFileInfo info(fileName);
+    QString path = cachePath(fileName);
+    QFile file(path + ".new");
+    WaveformCacheHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WAVEFORM_MAGIC, 4);
+    header.buckets = WAVEFORM_BUCKETS;
+    header.filled = result.filled;
+    header.size = info.size();
+    header.mtime = info.lastModified().toMSecsSinceEpoch();
+    header.duration = duration;
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return;
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(result.min.constData()), WAVEFORM_BUCKETS * sizeof(float));
+    file.write(reinterpret_cast<const char *>(result.max.constData()), WAVEFORM_BUCKETS * sizeof(float));
+    file.write(reinterpret_cast<const char *>(result.rms.constData()), WAVEFORM_BUCKETS * sizeof(float));
+    file.close();
+    QFile::remove(path);
+    file.rename(path);
+}
+
+/* Waits for one of the types, polling for a newer request. FALSE on an error or when abandoned. */
+static bool waveform_wait(GstBus *bus, GstMessageType type, const std::atomic<int> &generation, int seenGeneration)
+{
+    while (generation == seenGeneration) {
+        GstMessage *msg = gst_bus_timed_pop_filtered(bus, WAVEFORM_TIMEOUT_MS * GST_MSECOND,
+                                                     GstMessageType(type | GST_MESSAGE_ERROR));
+        if (msg == NULL)
+            continue;
+        bool ok = GST_MESSAGE_TYPE(msg) != GST_MESSAGE_ERROR;
+        gst_message_unref(msg);
+        return ok;
+    }
+    return false;
+}
+
+void WaveformBuilder::process(const QString &fileName, int seenGeneration)
+{
+    WaveformPeaks result;
+    qint64 duration = -1;
+
+    if (loadCache(fileName, &duration, &result)) {
+        publish(&current, result, seenGeneration);
+        if (result.filled == WAVEFORM_BUCKETS)
+            return;
+    } else {
+        result.min.fill(0, WAVEFORM_BUCKETS);
+        result.max.fill(0, WAVEFORM_BUCKETS);
+        result.rms.fill(0, WAVEFORM_BUCKETS);
+        result.filled = 0;
+    }
+
+    /* Audio only, mixed down to mono floats, as fast as it decodes */
+    GstElement *playbin = gst_element_factory_make("playbin", NULL);
+    GstElement *sinkBin = gst_parse_bin_from_description(
+        "audioconvert ! audio/x-raw,format=F32LE,channels=1,layout=interleaved ! "
+        "appsink name=peaks sync=false max-buffers=8", TRUE, NULL);
+    if (playbin == NULL || sinkBin == NULL) {
+        if (playbin) gst_object_unref(playbin);
+        if (sinkBin) gst_object_unref(sinkBin);
+        return;
+    }
+    GstElement *appsink = gst_bin_get_by_name(GST_BIN(sinkBin), "peaks");
+    gchar *uri = gst_filename_to_uri(fileName.toLocal8Bit().constData(), NULL);
+    /* flags 2: audio only */
+    g_object_set(playbin, "uri", uri, "audio-sink", sinkBin, "flags", 2, NULL);
+    g_free(uri);
+    GstBus *bus = gst_element_get_bus(playbin);
+    gst_bus_set_sync_handler(bus, background_bus_sync_handler, NULL, NULL);
+
+    gst_element_set_state(playbin, GST_STATE_PAUSED);
+    bool ok = waveform_wait(bus, GST_MESSAGE_ASYNC_DONE, generation, seenGeneration);
+    gint64 queried = -1;
+    if (ok && gst_element_query_duration(playbin, GST_FORMAT_TIME, &queried) && queried > 0) {
+        /* A partial cache of another duration is of no use */
+        if (result.filled > 0 && queried != duration) {
+            result.min.fill(0);
+            result.max.fill(0);
+            result.rms.fill(0);
+            result.filled = 0;
+        }
+        duration = queried;
+        if (result.filled > 0) {
+            guint64 start = gst_util_uint64_scale(result.filled, duration, WAVEFORM_BUCKETS);
+            ok = gst_element_seek_simple(playbin, GST_FORMAT_TIME,
+                                         GstSeekFlags(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE), start) &&
+                 waveform_wait(bus, GST_MESSAGE_ASYNC_DONE, generation, seenGeneration);
+        }
+    } else {
+        ok = false;
+    }
+
+    if (ok) {
+        gst_element_set_state(playbin, GST_STATE_PLAYING);
+
+        int bucket = -1;
+        float accMin = 0, accMax = 0;
+        double accSquares = 0;
+        qint64 accCount = 0;
+        QElapsedTimer sinceUpdate, sinceSave;
+        sinceUpdate.start();
+        sinceSave.start();
+
+        while (!abandoned(seenGeneration)) {
+            GstSample *sample = gst_app_sink_try_pull_sample(GST_APP_SINK(appsink),
+                                                             WAVEFORM_TIMEOUT_MS * GST_MSECOND);
+            if (sample == NULL) {
+                GstMessage *error = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+                if (error != NULL) {
+                    gst_message_unref(error);
+                    break;
+                }
+                if (gst_app_sink_is_eos(GST_APP_SINK(appsink))) {
+                    /* Whatever is left, silence included, is known now */
+                    if (bucket >= result.filled && accCount > 0) {
+                        result.min[bucket] = accMin;
+                        result.max[bucket] = accMax;
+                        result.rms[bucket] = sqrt(accSquares / accCount);
+                    }
+                    result.filled = WAVEFORM_BUCKETS;
+                    break;
+                }
+                continue;
+            }
+
+            GstBuffer *buffer = gst_sample_get_buffer(sample);
+            const GstSegment *segment = gst_sample_get_segment(sample);
+            GstStructure *structure = gst_caps_get_structure(gst_sample_get_caps(sample), 0);
+            gint rate = 0;
+            GstMapInfo map;
+            guint64 pts = GST_CLOCK_TIME_NONE;
+            gst_structure_get_int(structure, "rate", &rate);
+            if (GST_BUFFER_PTS_IS_VALID(buffer))
+                pts = gst_segment_to_stream_time(segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+            if (rate <= 0 || !GST_CLOCK_TIME_IS_VALID(pts) || !gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+                gst_sample_unref(sample);
+                continue;
+            }
+
+            const float *samples = reinterpret_cast<const float *>(map.data);
+            int n = map.size / sizeof(float), i = 0;
+            while (i < n) {
+                guint64 time = pts + gst_util_uint64_scale_int(i, GST_SECOND, rate);
+                int b = qMin(int(gst_util_uint64_scale(time, WAVEFORM_BUCKETS, duration)), WAVEFORM_BUCKETS - 1);
+                int end = n;
+                if (b < WAVEFORM_BUCKETS - 1) {
+                    guint64 next = gst_util_uint64_scale(b + 1, duration, WAVEFORM_BUCKETS);
+                    end = qBound(i + 1, int(gst_util_uint64_scale_int_ceil(next - pts, rate, GST_SECOND)), n);
+                }
+                if (b != bucket) {
+                    /* The bucket before is complete */
+                    if (bucket >= result.filled && accCount > 0) {
+                        result.min[bucket] = accMin;
+                        result.max[bucket] = accMax;
+                        result.rms[bucket] = sqrt(accSquares / accCount);
+                        result.filled = bucket + 1;
+                    }
+                    bucket = b;
+                    accMin = samples[i];
+                    accMax = samples[i];
+                    accSquares = 0;
+                    accCount = 0;
+                }
+                if (b >= result.filled) {
+                    waveform_accumulate(samples + i, end - i, &accMin, &accMax, &accSquares);
+                    accCount += end - i;
+                }
+                i = end;
+            }
+            gst_buffer_unmap(buffer, &map);
+            gst_sample_unref(sample);
+
+            if (sinceUpdate.elapsed() >= WAVEFORM_UPDATE_MS) {
+                publish(&current, result, seenGeneration);
+                sinceUpdate.restart();
+            }
+            if (sinceSave.elapsed() >= WAVEFORM_SAVE_MS) {
+                saveCache(fileName, duration, result);
+                sinceSave.restart();
+            }
+        }
+    }
+
+    gst_element_set_state(playbin, GST_STATE_NULL);
+    gst_object_unref(appsink);
+    gst_object_unref(bus);
+    gst_object_unref(playbin);
+
+    if (duration > 0 && result.filled > 0) {
+        saveCache(fileName, duration, result);
+        publish(&current, result, seenGeneration);
+    }
+}
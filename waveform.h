@@ -0,0 +1,59 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+#include <QString>
+#include <QVector>
+#include "backgroundworker.h"
+
+/* Buckets of a waveform, whatever the length of the file */
+#define WAVEFORM_BUCKETS 2048
+
+/* Overview of the audio of a file, in WAVEFORM_BUCKETS equal slices of its
+ * duration. Samples are in [-1, 1], mixed down to mono. */
+struct WaveformPeaks {
+    QVector<float> min;
+    QVector<float> max;
+    QVector<float> rms;
+    int filled;                     /* Buckets computed so far, from the start */
+
+    WaveformPeaks() : filled(0) {}
+    bool isEmpty() const { return filled == 0; }
+};
+
+/* Computes the waveform of local files in the background.
+ *
+ * The audio is decoded by a pipeline of its own into an appsink, as fast as
+ * the CPU allows but with every thread of it, and this one, in the idle CPU
+ * and I/O scheduling classes, so that it only ever uses what playback leaves.
+ * Min, max and RMS per bucket are accumulated with NEON (SSE on x86) kernels.
+ * updated() is emitted a few times a second as buckets fill in.
+ *
+ * Results are cached in cacheDir per file, also while incomplete: a file
+ * opened again starts where the last run stopped. */
+class WaveformBuilder : public BackgroundFileWorker
+{
+    Q_OBJECT
+
+public:
+    WaveformBuilder(const QString &cacheDir, QObject *parent = 0);
+    ~WaveformBuilder();
+
+    /* Abandons the current file for this one; an empty name or a URI that is
+     * not a local file just stops */
+    void build(const QString &fileName);
+
+    /* What is known of the current file so far */
+    WaveformPeaks peaks();
+
+protected:
+    void process(const QString &fileName, int seenGeneration);
+    void clear();
+
+private:
+    bool loadCache(const QString &fileName, qint64 *duration, WaveformPeaks *result);
+    void saveCache(const QString &fileName, qint64 duration, const WaveformPeaks &result);
+
+    WaveformPeaks current;
+};
+
+#endif // WAVEFORM_H
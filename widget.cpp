@@ -1,9 +1,104 @@
 #include "widget.h"
 #include <QDebug>
 #include <QFileDialog>
-#include <QMessageBox>
 #include <QToolButton>
 #include <QStyle>
+#include <QCoreApplication>
+#include <QDir>
+#include <QShortcut>
+#include <QStandardPaths>
+#include <QSocketNotifier>
+#include <QUrl>
+#include <QWindow>
+#include <QThreadPool>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <math.h>
+#include <algorithm>
+#include "trace.h"
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+/* Do not resume clips that were stopped this close to their end */
+#define RESUME_TAIL (5 * GST_SECOND)
+
+/* How long to wait for a keyframe after the video becomes visible before seeking to one */
+#define RESYNC_TIMEOUT_MS 1000
+
+/* Seconds stopped before the pipeline is shut down, unless QTGSPLAYER_IDLE_TIMEOUT says otherwise */
+#define IDLE_TIMEOUT_DEFAULT 300
+
+/* Milliseconds without data at the sinks before the watchdog steps in, unless QTGSPLAYER_STALL_TIMEOUT says otherwise */
+#define STALL_TIMEOUT_DEFAULT 5000
+
+/* Page cache budget, shared by the upcoming files, unless QTGSPLAYER_PREFETCH_BYTES says otherwise */
+#define PREFETCH_BYTES_DEFAULT (8 * 1024 * 1024)
+#define PREFETCH_ITEMS         2
+
+static const char *const stall_actions[] = { "flush seek", "pipeline rebuild", "skip to the next item" };
+
+/* Automatic A/V offset correction: how often, from which offset, and up to how much in total */
+#define AV_CORRECT_INTERVAL_MS  10000
+#define AV_CORRECT_THRESHOLD_MS 15
+#define AV_CORRECT_MAX          (500 * GST_MSECOND)
+
+/* Audio and subtitle switches slower than this are counted as slow, in us */
+#define TRACK_SWITCH_TARGET_US  100000
+
+/* Rebuilds tried for one failure, and playback time after which a new failure starts over */
+#define RECOVERY_MAX_ATTEMPTS   5
+#define RECOVERY_STABLE_MS      30000
+
+/* This function is called from the streaming threads for every message posted on the bus.
+ * Messages are left on the bus; we only wake up the GUI thread so that the interesting ones
+ * are handled right away instead of on the next queryTimer tick. */
+static GstBusSyncReply bus_sync_handler (GstBus *bus, GstMessage *msg, gpointer user_data)
+{
+  CustomData *data = (CustomData *)user_data;
+  Q_UNUSED(bus);
+
+  metrics_count_message (data->metrics, data->playbin2, msg);
+  qos_control_message (data->qos, msg);
+  track_switch_message (data->tracks, msg);
+
+  switch (GST_MESSAGE_TYPE (msg))
+  {
+    case GST_MESSAGE_STREAM_STATUS:
+      /* Must be handled in the thread posting it: the task is about to start */
+      task_pools_stream_status (data->task_pools, msg);
+      gst_message_unref (msg);
+      return GST_BUS_DROP;
+    case GST_MESSAGE_ERROR:
+    case GST_MESSAGE_EOS:
+    case GST_MESSAGE_ASYNC_DONE:
+      QMetaObject::invokeMethod (data->owner, "slotBusMessage", Qt::QueuedConnection);
+      break;
+    case GST_MESSAGE_STATE_CHANGED:
+      if (GST_MESSAGE_SRC (msg) == GST_OBJECT (data->playbin2))
+        QMetaObject::invokeMethod (data->owner, "slotBusMessage", Qt::QueuedConnection);
+      break;
+    default:
+      break;
+  }
+  return GST_BUS_PASS;
+}
+
+/* This function is called by playbin for every element it creates, before the element
+ * leaves the NULL state, including the ones inside sub-bins. */
+static void element_setup_cb (GstElement *playbin, GstElement *element, CustomData *data)
+{
+  Q_UNUSED(playbin);
+  metrics_element_setup (data->metrics, element);
+  av_sync_element_setup (data->av_sync, element);
+  live_mode_element_setup (data->live, element);
+  qos_control_element_setup (data->qos, element);
+  track_switch_element_setup (data->tracks, element);
+  decoder_threads_element_setup (element, live_mode_is_active (data->live));
+
+  if (element_has_klass (element, "Decoder") && element_has_klass (element, "Video"))
+    video_sink_bin_setup_decoder (data->video_sink, element);
+}
 
 void Widget::handle_message (CustomData *data, GstMessage *msg)
 {
@@ -16,15 +111,23 @@ void Widget::handle_message (CustomData *data, GstMessage *msg)
       gst_message_parse_error (msg, &err, &debug_info);
       qCritical() << "Error received from element " << QString(GST_OBJECT_NAME (msg->src)) << ":" << QString(err->message);
       qCritical() << "Debugging information:" << QString(debug_info);
-      g_clear_error (&err);
-      g_free (debug_info);
+      emit errorOccurred(QString(err->message));
+      openClock.invalidate();
       if(queryTimer->isActive())
       {
           queryTimer->stop();
       }
+      handle_error (data, err);
+      g_clear_error (&err);
+      g_free (debug_info);
       break;
     case GST_MESSAGE_EOS:
       qInfo ("End-Of-Stream reached.\n");
+      emit endOfStream();
+      if (watchdog != NULL)
+      {
+        watchdog->setArmed(false);
+      }
       if(queryTimer->isActive())
       {
           queryTimer->stop();
@@ -34,22 +137,88 @@ void Widget::handle_message (CustomData *data, GstMessage *msg)
     case GST_MESSAGE_DURATION:
       data->duration = GST_CLOCK_TIME_NONE;
       break;
+    case GST_MESSAGE_ASYNC_DONE:
+      emit asyncDone();
+      if (openClock.isValid ())
+      {
+        /* The first preroll of a file is its first frame at the sinks */
+        gint64 elapsed = openClock.nsecsElapsed () / 1000;
+        openClock.invalidate ();
+        metrics.opens[openPrefetched]++;
+        metrics.openLatencySum[openPrefetched] += elapsed;
+        metrics.openLatencyLast = elapsed;
+        qInfo () << "Open to first frame:" << elapsed / 1000 << "ms" << (openPrefetched ? "(prefetched)" : "(cold)");
+
+        /* Now that the current file is going, warm up the next ones */
+        if (prefetcher != NULL)
+          prefetcher->prefetch (playlist.upcoming (PREFETCH_ITEMS));
+      }
+      if (data->resume_audio >= 0 || data->resume_text >= 0)
+      {
+        /* Remembered tracks: playbin only has the streams of the new file once prerolled */
+        if (data->resume_audio >= 0)
+          track_switch_select (data->tracks, data->playbin2, TRACK_AUDIO, data->resume_audio);
+        if (data->resume_text >= 0)
+          track_switch_select (data->tracks, data->playbin2, TRACK_TEXT, data->resume_text);
+        data->resume_audio = data->resume_text = -1;
+      }
+      if (!tracksChosen)
+      {
+        /* The streams are known once prerolled */
+        tracksChosen = true;
+        select_preferred_tracks (data);
+      }
+      if (data->resume_position > 0)
+      {
+        /* Prerolled in PAUSED: jump to the saved position before anything is played */
+        gint64 position = data->resume_position;
+        data->resume_position = -1;
+        data->resume_seeking = gst_element_seek_simple (data->playbin2, GST_FORMAT_TIME,
+            GstSeekFlags(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE), position);
+        if (!data->resume_seeking)
+        {
+          g_printerr ("Resume seek failed, playing from the start.\n");
+          gst_element_set_state (data->playbin2, GST_STATE_PLAYING);
+        }
+      }
+      else if (data->resume_seeking)
+      {
+        /* The resume seek has prerolled, now start playing for the first time */
+        data->resume_seeking = FALSE;
+        gst_element_set_state (data->playbin2, GST_STATE_PLAYING);
+      }
+      break;
     case GST_MESSAGE_STATE_CHANGED:
     {
       GstState old_state, new_state, pending_state;
       gst_message_parse_state_changed (msg, &old_state, &new_state, &pending_state);
-      qInfo() << "GST_MESSAGE_STATE_CHANGED is called!!!";
       if (GST_MESSAGE_SRC (msg) == GST_OBJECT (data->playbin2))
       {
-        g_print ("Pipeline state changed from %s to %s:\n",gst_element_state_get_name (old_state), gst_element_state_get_name (new_state));
+        TRACE_INFO ("pipeline.state-changed", old_state, new_state);
+        emit stateChanged(new_state);
 
         /* Remember whether we are in the PLAYING state or not */
         data->playing = (data->playbin2->current_state == GST_STATE_PLAYING);
 
+        /* Also catches live sources opened by other paths than the play button */
+        if (new_state >= GST_STATE_PAUSED && !live_mode_is_active (data->live) &&
+            gst_element_get_state (data->playbin2, NULL, NULL, 0) == GST_STATE_CHANGE_NO_PREROLL)
+          enter_live_mode (data);
+
+        if (data->playing && recoveryClock.isValid())
+        {
+          gint64 elapsed = recoveryClock.nsecsElapsed() / 1000;
+          recoveryClock.invalidate();
+          lastRecovery.start();
+          metrics.recoveriesSucceeded++;
+          metrics.recoveryTimeLast = elapsed;
+          TRACE_INFO ("recovery.done", recoveryAttempt, elapsed);
+          qInfo("Recovered after %d attempt(s) in %.0f ms", recoveryAttempt, elapsed / 1000.0);
+        }
+
         if (data->playing)
         {
           /* We just moved to PLAYING. Check if seeking is possible */
-           qInfo() << "data->playing is called!!";
           GstQuery *query;
           gint64 start, end;
           query = gst_query_new_seeking (GST_FORMAT_TIME);
@@ -57,25 +226,24 @@ void Widget::handle_message (CustomData *data, GstMessage *msg)
           {
             gst_query_parse_seeking (query, NULL, &data->seek_enabled, &start, &end);
             if (data->seek_enabled) {
-              g_print ("Seeking is ENABLED from %" GST_TIME_FORMAT " to %" GST_TIME_FORMAT "\n",
-                  GST_TIME_ARGS (start), GST_TIME_ARGS (end));
+              TRACE_INFO ("seeking.enabled", start, end);
             }
             else
             {
-              g_print ("Seeking is DISABLED for this stream.\n");
+              TRACE_INFO ("seeking.disabled", 0, 0);
             }
           }
           else
           {
-            g_printerr ("Seeking query failed.");
+            TRACE_WARNING ("seeking.query-failed", 0, 0);
           }
           gst_query_unref (query);
         }
       }
     } break;
     default:
-      /* We should not reach here */
-      g_printerr ("Unexpected message received.\n");
+      /* Tags, stream status, QoS and the like: nothing to do on the GUI thread */
+      GST_LOG ("Unhandled %s message from %s", GST_MESSAGE_TYPE_NAME (msg), GST_MESSAGE_SRC_NAME (msg));
       break;
   }
   gst_message_unref (msg);
@@ -86,17 +254,136 @@ Widget::Widget(QWidget *parent)
 {
     data = new CustomData;
     muteFlag = true;
+    videoVisible = true;
+    idleReleased = false;
 
     /* Initialize our data structure */
     memset (data, 0, sizeof (CustomData));
     data->duration = GST_CLOCK_TIME_NONE;
+    data->resume_position = -1;
+    data->resume_audio = data->resume_text = -1;
+    data->rate = 1.0;
+    data->owner = this;
+    data->metrics = &metrics;
+    metrics_reset(&metrics);
+
+    data->av_sync = av_sync_new();
+    data->live = live_mode_new();
+    data->task_pools = task_pools_new();
+    data->qos = qos_control_new();
+    data->tracks = track_switch_new();
+    pipelineClock = NULL;
+    avSyncOverlay = false;
+    avSyncCorrect = qgetenv("QTGSPLAYER_AV_CORRECT") == "1";
+
+    recovering = false;
+    recoveryAttempt = 0;
+    recoveryPosition = -1;
+    recoveryAudio = recoveryText = -1;
+    tracksChosen = false;
+
+    sessionCpuStart = 0;
+    sessionRssPeak = 0;
+    sessionAudioOnly = false;
+    for(int i = 0; i < 2; i++)
+    {
+        modeCpuSeconds[i] = modeWallSeconds[i] = modeRssPeakSum[i] = 0;
+        modeSessions[i] = 0;
+    }
 
-    /* Create the elements */
-    data->playbin2 = gst_element_factory_make ("playbin", "playbin2");
+    resumeStore.open(ResumeStore::defaultPath());
 
-    if (!data->playbin2)
+    /* Optionally export the counters, e.g. QTGSPLAYER_METRICS=9101 */
+    metricsServer = NULL;
+    QString metricsAddress = QString::fromLocal8Bit(qgetenv("QTGSPLAYER_METRICS"));
+    if(!metricsAddress.isEmpty())
+    {
+        metricsServer = new MetricsServer(&metrics, this);
+        metricsServer->listen(metricsAddress);
+    }
+
+    /* Resizes are coalesced so that dragging the window does not renegotiate on every step */
+    resizeTimer = new QTimer(this);
+    resizeTimer->setSingleShot(true);
+    resizeTimer->setInterval(200);
+    connect(resizeTimer,SIGNAL(timeout()),this,SLOT(slotApplyVideoSize()));
+
+    resyncTimer = new QTimer(this);
+    resyncTimer->setSingleShot(true);
+    resyncTimer->setInterval(RESYNC_TIMEOUT_MS);
+    connect(resyncTimer,SIGNAL(timeout()),this,SLOT(slotResyncVideo()));
+
+    /* Stopped for long enough, drop to NULL so that decoders, sinks and pools are freed; 0 disables it */
+    bool idleOk = false;
+    int idleTimeout = qgetenv("QTGSPLAYER_IDLE_TIMEOUT").toInt(&idleOk);
+    if(!idleOk || idleTimeout < 0)
+    {
+        idleTimeout = IDLE_TIMEOUT_DEFAULT;
+    }
+    idleTimer = new QTimer(this);
+    idleTimer->setSingleShot(true);
+    idleTimer->setInterval(idleTimeout * 1000);
+    connect(idleTimer,SIGNAL(timeout()),this,SLOT(slotIdleRelease()));
+
+    /* Watch the data flow at the sinks from its own thread; 0 disables it */
+    watchdog = NULL;
+    bool stallOk = false;
+    int stallTimeout = qgetenv("QTGSPLAYER_STALL_TIMEOUT").toInt(&stallOk);
+    if(!stallOk || stallTimeout < 0)
+    {
+        stallTimeout = STALL_TIMEOUT_DEFAULT;
+    }
+    if(stallTimeout > 0)
+    {
+        watchdog = new StallWatchdog(&metrics, stallTimeout, this);
+        connect(watchdog,SIGNAL(stalled(int,qint64)),this,SLOT(slotStalled(int,qint64)));
+        connect(watchdog,SIGNAL(recovered(int,qint64)),this,SLOT(slotStallRecovered(int,qint64)));
+        watchdog->start();
+    }
+
+    /* Read the next files ahead while the current one plays; 0 disables it */
+    prefetcher = NULL;
+    openPrefetched = false;
+    bool prefetchOk = false;
+    qint64 prefetchBytes = qgetenv("QTGSPLAYER_PREFETCH_BYTES").toLongLong(&prefetchOk);
+    if(!prefetchOk || prefetchBytes < 0)
+    {
+        prefetchBytes = PREFETCH_BYTES_DEFAULT;
+    }
+    if(prefetchBytes > 0)
+    {
+        prefetcher = new Prefetcher(&metrics, prefetchBytes, this);
+        prefetcher->start(QThread::IdlePriority);
+    }
+
+    /* Audio overview behind the slider, QTGSPLAYER_WAVEFORM=1 */
+    waveform = NULL;
+    if(qgetenv("QTGSPLAYER_WAVEFORM") == "1")
+    {
+        waveform = new WaveformBuilder(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/waveforms", this);
+        connect(waveform,SIGNAL(updated()),this,SLOT(slotWaveformUpdated()));
+        waveform->start(QThread::IdlePriority);
+    }
+
+    /* Scene change, black and frozen picture markers, QTGSPLAYER_ANALYTICS=1; ] and [ jump between them */
+    analyzer = NULL;
+    if(qgetenv("QTGSPLAYER_ANALYTICS") == "1")
+    {
+        analyzer = new VideoAnalyzer(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/markers", this);
+        connect(analyzer,SIGNAL(updated()),this,SLOT(slotMarkersUpdated()));
+        connect(analyzer,SIGNAL(analyzed(int,double,double)),this,SLOT(slotAnalyzed(int,double,double)));
+        analyzer->start(QThread::IdlePriority);
+        QShortcut *nextMarker = new QShortcut(QKeySequence(Qt::Key_BracketRight), this);
+        nextMarker->setContext(Qt::ApplicationShortcut);
+        connect(nextMarker,SIGNAL(activated()),this,SLOT(slotNextMarker()));
+        QShortcut *previousMarker = new QShortcut(QKeySequence(Qt::Key_BracketLeft), this);
+        previousMarker->setContext(Qt::ApplicationShortcut);
+        connect(previousMarker,SIGNAL(activated()),this,SLOT(slotPreviousMarker()));
+    }
+
+    /* Create the elements */
+    if (!create_pipeline(data))
     {
-      qWarning("Not all elements could be created.\n");
       return ;
     }
 
@@ -105,32 +392,402 @@ Widget::Widget(QWidget *parent)
 
     /* Create the GUI */
     createUi(data);
+    connect(renderWnd,SIGNAL(currentChanged(int)),this,SLOT(slotUpdateVideoVisibility()));
 
-    /* Instruct the bus to emit signals for each received message, and connect to the interesting signals */
-    bus = gst_element_get_bus (data->playbin2);
     queryTimer = new QTimer;
     connect(queryTimer,SIGNAL(timeout()),this,SLOT(slotTimerout()));
+
+    /* Optionally accept commands from a supervisor, e.g. QTGSPLAYER_CONTROL=/run/qtgsplayer.sock */
+    remoteControl = NULL;
+    QString controlPath = QString::fromLocal8Bit(qgetenv("QTGSPLAYER_CONTROL"));
+    if(!controlPath.isEmpty())
+    {
+        remoteControl = new RemoteControl(&metrics, this);
+        connect(remoteControl,SIGNAL(play()),this,SLOT(slotPlay()));
+        connect(remoteControl,SIGNAL(pause()),this,SLOT(slotPause()));
+        connect(remoteControl,SIGNAL(stop()),this,SLOT(slotStop()));
+        connect(remoteControl,SIGNAL(next()),this,SLOT(slotNext()));
+        connect(remoteControl,SIGNAL(previous()),this,SLOT(slotPrevious()));
+        connect(remoteControl,SIGNAL(changeVolume(int)),this,SLOT(slotChangeVolume(int)));
+        connect(remoteControl,SIGNAL(changeMuting(bool)),this,SLOT(slotChangeMuting(bool)));
+        connect(remoteControl,SIGNAL(changeRate(qreal)),this,SLOT(slotChangeRate(qreal)));
+        connect(remoteControl,SIGNAL(seek(qint64)),this,SLOT(slotSeek(qint64)));
+        connect(remoteControl,SIGNAL(open(QString)),this,SLOT(slotOpen(QString)));
+        connect(remoteControl,SIGNAL(changeAudioOnly(bool)),this,SLOT(slotSetAudioOnly(bool)));
+        connect(remoteControl,SIGNAL(selectAudioTrack(int)),this,SLOT(slotSelectAudioTrack(int)));
+        connect(remoteControl,SIGNAL(selectSubtitleTrack(int)),this,SLOT(slotSelectSubtitleTrack(int)));
+        connect(this,SIGNAL(stateChanged(int)),remoteControl,SLOT(notifyState(int)));
+        connect(this,SIGNAL(endOfStream()),remoteControl,SLOT(notifyEndOfStream()));
+        connect(this,SIGNAL(errorOccurred(QString)),remoteControl,SLOT(notifyError(QString)));
+        remoteControl->listen(controlPath);
+    }
+
+    /* Video wall: QTGSPLAYER_SYNC=leader:PORT on one player, follower:ADDRESS:PORT on the others */
+    netSync = NULL;
+    QStringList syncSpec = QString::fromLocal8Bit(qgetenv("QTGSPLAYER_SYNC")).split(':');
+    if(syncSpec.size() >= 2 && (syncSpec.at(0) == "leader" || syncSpec.at(0) == "follower"))
+    {
+        bool leader = syncSpec.at(0) == "leader";
+        QString host = leader ? QString() : syncSpec.mid(1, syncSpec.size() - 2).join(':');
+        netSync = new NetSync(this, &metrics, leader ? NetSync::Leader : NetSync::Follower,
+                              host, syncSpec.last().toUShort(), this);
+        if(!netSync->start())
+        {
+            delete netSync;
+            netSync = NULL;
+        }
+    }
+
+    /* Trace dumps are requested with F12 or with SIGUSR1 */
+    QShortcut *traceShortcut = new QShortcut(QKeySequence(Qt::Key_F12), this);
+    traceShortcut->setContext(Qt::ApplicationShortcut);
+    connect(traceShortcut,SIGNAL(activated()),this,SLOT(slotTraceDump()));
+
+    /* F10 shows the A/V sync figures in place of the stream information */
+    QShortcut *avSyncShortcut = new QShortcut(QKeySequence(Qt::Key_F10), this);
+    avSyncShortcut->setContext(Qt::ApplicationShortcut);
+    connect(avSyncShortcut,SIGNAL(activated()),this,SLOT(slotToggleAvSyncOverlay()));
+
+    /* A and S step through the audio tracks and the subtitle tracks, then subtitles off */
+    QShortcut *audioTrackShortcut = new QShortcut(QKeySequence(Qt::Key_A), this);
+    audioTrackShortcut->setContext(Qt::ApplicationShortcut);
+    connect(audioTrackShortcut,SIGNAL(activated()),this,SLOT(slotNextAudioTrack()));
+    QShortcut *subtitleTrackShortcut = new QShortcut(QKeySequence(Qt::Key_S), this);
+    subtitleTrackShortcut->setContext(Qt::ApplicationShortcut);
+    connect(subtitleTrackShortcut,SIGNAL(activated()),this,SLOT(slotNextSubtitleTrack()));
+    int traceFd = trace_install_signal_handler();
+    if(traceFd >= 0)
+    {
+        QSocketNotifier *traceNotifier = new QSocketNotifier(traceFd, QSocketNotifier::Read, this);
+        connect(traceNotifier,SIGNAL(activated(int)),this,SLOT(slotTraceDump()));
+    }
+
+    /* Last, so that the threads started above do not inherit the GUI's CPUs and scheduling */
+    task_pools_isolate_gui(data->task_pools);
 }
 
-void Widget::slotTimerout()
+void Widget::slotTraceDump()
 {
-    GstMessage *msg;
-    msg = gst_bus_timed_pop_filtered (data->bus, GST_CLOCK_TIME_NONE,
-        GstMessageType(GST_MESSAGE_STATE_CHANGED | GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_DURATION));
+    trace_acknowledge_signal();
+    QString path = QString::fromLocal8Bit(qgetenv("QTGSPLAYER_TRACE_FILE"));
+    if(path.isEmpty())
+    {
+        path = QDir::tempPath() + QString("/qtgsplayer-%1.trace").arg(QCoreApplication::applicationPid());
+    }
+    long events = trace_dump(QFile::encodeName(path).constData());
+    if(events < 0)
+    {
+        qWarning() << "Could not write trace dump to" << path;
+        return;
+    }
+    qInfo() << "Wrote" << events << "trace events to" << path;
+}
+
+/* Create playbin and connect it to the bus handling and the instrumentation.
+ * Only the new elements are touched, so this also runs on the recovery threads. */
+static GstElement *build_pipeline (CustomData *data)
+{
+  GstElement *playbin, *video_sink;
+  GstBus *pipeline_bus;
+
+  playbin = gst_element_factory_make ("playbin", "playbin2");
+  if (!playbin)
+    return NULL;
+
+  g_signal_connect (playbin, "element-setup", G_CALLBACK (element_setup_cb), data);
+
+  /* Scale in the pipeline to the window size rather than in the sink */
+  video_sink = video_sink_bin_new ();
+  if (video_sink)
+    g_object_set (playbin, "video-sink", video_sink, NULL);
+
+  /* Wake up the GUI thread for the interesting messages, they are handled in process_bus() */
+  pipeline_bus = gst_element_get_bus (playbin);
+  gst_bus_set_sync_handler (pipeline_bus, bus_sync_handler, data, NULL);
+  gst_object_unref (pipeline_bus);
+  return playbin;
+}
+
+bool Widget::create_pipeline(CustomData *data)
+{
+    GstElement *playbin = build_pipeline (data);
+    if (!playbin)
+    {
+      qWarning("Not all elements could be created.\n");
+      return false;
+    }
+    attach_pipeline (data, playbin);
+    return true;
+}
+
+/* Make playbin the pipeline everything else works with */
+void Widget::attach_pipeline(CustomData *data, GstElement *playbin)
+{
+    data->playbin2 = playbin;
+    /* The sink bin is owned by playbin */
+    g_object_get (playbin, "video-sink", &data->video_sink, NULL);
+    if (data->video_sink)
+    {
+      gst_object_unref (data->video_sink);
+    }
+    bus = gst_element_get_bus (playbin);
+    data->bus = bus;
+    if (pipelineClock != NULL)
+    {
+      gst_pipeline_use_clock (GST_PIPELINE (playbin), pipelineClock);
+    }
+}
+
+void Widget::setPipelineClock(GstClock *clock)
+{
+    if (clock != NULL)
+    {
+      gst_object_ref (clock);
+    }
+    if (pipelineClock != NULL)
+    {
+      gst_object_unref (pipelineClock);
+    }
+    pipelineClock = clock;
+    if (clock != NULL && data != NULL && data->playbin2 != NULL)
+    {
+      gst_pipeline_use_clock (GST_PIPELINE (data->playbin2), clock);
+    }
+    else if (data != NULL && data->playbin2 != NULL)
+    {
+      gst_pipeline_auto_clock (GST_PIPELINE (data->playbin2));
+    }
+}
+
+/* Transient errors rebuild the pipeline and resume, the others stop playback */
+void Widget::handle_error(CustomData *data, GError *err)
+{
+    RecoveryClass errorClass = recovery_classify (err);
+    if (errorClass == RecoveryTransient)
+    {
+      metrics.errorsTransient++;
+    }
+    else
+    {
+      metrics.errorsFatal++;
+    }
+
+    /* More errors from the pipeline being replaced */
+    if (recovering)
+    {
+      return;
+    }
+    if (errorClass == RecoveryFatal)
+    {
+      give_up (data, QString (err->message));
+      return;
+    }
+    start_recovery (data, QString (err->message));
+}
+
+void Widget::start_recovery(CustomData *data, const QString &reason)
+{
+    if (recovering || uri == "")
+    {
+      return;
+    }
+    /* A failure after a good stretch of playback is a new failure */
+    if (lastRecovery.isValid() && lastRecovery.elapsed() > RECOVERY_STABLE_MS)
+    {
+      recoveryAttempt = 0;
+      lastRecovery.invalidate();
+    }
+    if (recoveryAttempt >= RECOVERY_MAX_ATTEMPTS)
+    {
+      metrics.recoveriesFailed++;
+      give_up (data, reason);
+      return;
+    }
+
+    recovering = true;
+    if (!recoveryClock.isValid())
+    {
+      recoveryClock.start();
+    }
+    queryTimer->stop();
+    resyncTimer->stop();
+
+    /* Resume from the last buffer that reached a sink; a failed rebuild keeps the earlier position */
+    gint64 position = metrics.position;
+    if (position > 0)
+    {
+      recoveryPosition = position;
+    }
+    g_object_get (data->playbin2, "current-audio", &recoveryAudio, "current-text", &recoveryText, NULL);
+
+    int delay = recovery_backoff_ms (recoveryAttempt);
+    recoveryAttempt++;
+    metrics.recoveries++;
+    TRACE_WARNING ("recovery.start", recoveryAttempt, delay);
+    qWarning() << "Recovering from" << reason << "- attempt" << recoveryAttempt << "in" << delay << "ms";
+
+    QByteArray location = uri.toUtf8();
+    gint flags;
+    g_object_get (data->playbin2, "flags", &flags, NULL);
+    QThreadPool::globalInstance()->start(new PipelineRebuild(this, delay, [data, location, flags]() -> GstElement * {
+        /* A pool thread started by the GUI thread, with its CPUs */
+        task_pools_release_self (data->task_pools);
+        GstElement *playbin = build_pipeline (data);
+        if (playbin == NULL)
+        {
+          return NULL;
+        }
+        g_object_set (playbin, "uri", location.constData(), "flags", flags, NULL);
+        if (gst_element_set_state (playbin, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE)
+        {
+          gst_element_set_state (playbin, GST_STATE_NULL);
+          gst_object_unref (playbin);
+          return NULL;
+        }
+        return playbin;
+    }));
+}
+
+/* The replacement pipeline is in READY: swap it in and resume where playback stopped */
+void Widget::slotRecoveryReady(void *pipeline)
+{
+    GstElement *playbin = (GstElement *) pipeline;
+    recovering = false;
+    if (data == NULL)
+    {
+      if (playbin)
+      {
+        QThreadPool::globalInstance()->start(new PipelineDisposal(playbin));
+      }
+      return;
+    }
+    if (playbin == NULL)
+    {
+      start_recovery (data, "the pipeline could not be rebuilt");
+      return;
+    }
+
+    /* Another file was opened meanwhile, on the old pipeline */
+    gchar *location = NULL;
+    g_object_get (playbin, "uri", &location, NULL);
+    bool stale = uri != QString::fromUtf8 (location);
+    g_free (location);
+    if (stale)
+    {
+      QThreadPool::globalInstance()->start(new PipelineDisposal(playbin));
+      playButtonClicked (NULL, data);
+      return;
+    }
+
+    /* The broken pipeline is shut down off the GUI thread, it may take a while to let go */
+    GstElement *broken = data->playbin2;
+    gst_bus_set_sync_handler (data->bus, NULL, NULL, NULL);
+    gst_object_unref (data->bus);
+    attach_pipeline (data, playbin);
+    QThreadPool::globalInstance()->start(new PipelineDisposal(broken));
+
+    realize_cb (displayWnd, data);
+    slotApplyVideoSize ();
+    video_sink_bin_set_visible (data->video_sink, videoVisible);
+
+    /* Same path as reopening the file, with the tracks and position of the broken pipeline */
+    gboolean audioOnly = data->audio_only;
+    restore_resume_state (data);
+    data->audio_only = audioOnly;
+    data->rate = 1.0;
+    if (recoveryAudio >= 0)
+    {
+      data->resume_audio = recoveryAudio;
+    }
+    if (recoveryText >= 0)
+    {
+      data->resume_text = recoveryText;
+    }
+    if (recoveryPosition > 0)
+    {
+      data->resume_position = recoveryPosition;
+    }
+    apply_play_flags (data);
+    playButtonClicked (NULL, data);
+}
+
+/* Nothing more to try: stop and say why instead of blocking a kiosk with a dialog */
+void Widget::give_up(CustomData *data, const QString &reason)
+{
+    qCritical() << "Giving up on" << uri << ":" << reason;
+    TRACE_ERROR ("recovery.give-up", recoveryAttempt, 0);
+    recoveryClock.invalidate();
+    recoveryAttempt = 0;
+    recoveryPosition = -1;
+    stopButtonClicked (NULL, data);
+    data->streams_list->setText (mediaLabel + " — " + tr("Cannot play: %1").arg(reason));
+}
 
-    /* Parse message */
-    if (msg != NULL)
+/* Handle all the pending messages without ever blocking the GUI thread */
+void Widget::process_bus(CustomData *data)
+{
+    GstMessage *msg;
+    while ((msg = gst_bus_pop_filtered (data->bus,
+        GstMessageType(GST_MESSAGE_STATE_CHANGED | GST_MESSAGE_ERROR | GST_MESSAGE_EOS |
+                       GST_MESSAGE_DURATION | GST_MESSAGE_ASYNC_DONE))) != NULL)
     {
-       qInfo() << "msg != NULL";
+       TRACE_DEBUG ("bus.message", GST_MESSAGE_TYPE (msg), 0);
+       guint64 cpu = metrics_thread_cpu_time ();
        handle_message (data, msg);
+       metrics_add_cost (metrics.busDispatchCount, metrics.busDispatchCpuSum, metrics.busDispatchCpuMax,
+                         metrics_thread_cpu_time () - cpu);
+    }
+}
+
+void Widget::slotBusMessage()
+{
+    if(data == NULL)
+    {
+        return;
     }
+    process_bus(data);
+}
+
+void Widget::slotTimerout()
+{
+    TRACE_SCOPE ("refresh");
+    guint64 cpu = metrics_thread_cpu_time();
+    process_bus(data);
     refresh_ui(data);
+    if(sessionClock.isValid())
+    {
+        sessionRssPeak = qMax(sessionRssPeak, metrics_resident_bytes());
+    }
     expose_cb(displayWnd,NULL,data);
     analyze_streams(data);
+    show_av_sync_stats(data);
+    correct_av_offset(data);
+    adapt_quality(data);
+    report_track_switch(data);
+    metrics.decoderThreads = decoder_threads_in_use();
+    DecoderThreadsChoice choice;
+    if(decoder_threads_take_choice(&choice))
+    {
+        qInfo("Decoder threads: %s %dx%d, %u thread(s) of %u wanted (%s), %s; %u of %u budgeted threads in use",
+              choice.decoder, choice.width, choice.height, choice.threads, choice.wanted,
+              choice.measured ? "benchmarked" : "default rule", choice.type, choice.in_use, choice.budget);
+    }
+    guint64 roleCpu[TASK_ROLES];
+    task_pools_get_role_cpu(data->task_pools, roleCpu);
+    for(int role = 0; role < TASK_ROLES; role++)
+    {
+        metrics.threadCpu[role] = roleCpu[role];
+    }
+    metrics_add_cost(metrics.refreshCount, metrics.refreshCpuSum, metrics.refreshCpuMax,
+                     metrics_thread_cpu_time() - cpu);
 }
 
 Widget::~Widget()
 {
+    if(pipelineClock != NULL)
+    {
+        gst_object_unref(pipelineClock);
+    }
 }
 
 void Widget::closeEvent(QCloseEvent *)
@@ -140,6 +797,7 @@ void Widget::closeEvent(QCloseEvent *)
         queryTimer->stop();
     }
     delete_event_cb(NULL,NULL,data);
+    resumeStore.close();
 
     /* Free resources */
     gst_element_set_state (data->playbin2, GST_STATE_NULL);
@@ -147,6 +805,11 @@ void Widget::closeEvent(QCloseEvent *)
 
     if(data != NULL)
     {
+        av_sync_free (data->av_sync);
+        live_mode_free (data->live);
+        task_pools_free (data->task_pools);
+        qos_control_free (data->qos);
+        track_switch_free (data->tracks);
         delete data;
         data = NULL;
     }
@@ -168,19 +831,30 @@ void Widget::playButtonClicked(QPushButton *button, CustomData *data)
 {
    Q_UNUSED(button);
    GstStateChangeReturn ret;
-   ret = gst_element_set_state (data->playbin2, GST_STATE_PLAYING);
+   if (recovering)
+   {
+     return;
+   }
+   idleTimer->stop();
+   idleReleased = false;
+   /* When resuming, preroll in PAUSED first; the ASYNC_DONE handler seeks and then plays */
+   ret = gst_element_set_state (data->playbin2,
+                                data->resume_position > 0 ? GST_STATE_PAUSED : GST_STATE_PLAYING);
+   if (ret != GST_STATE_CHANGE_FAILURE && !sessionClock.isValid())
+   {
+     sessionAudioOnly = data->audio_only;
+     sessionClock.start();
+     sessionCpuStart = metrics_cpu_time();
+     sessionRssPeak = metrics_resident_bytes();
+   }
+   if (ret == GST_STATE_CHANGE_NO_PREROLL)
+   {
+     enter_live_mode(data);
+   }
    if (ret == GST_STATE_CHANGE_FAILURE)
    {
      g_printerr ("Unable to set the pipeline to the playing state.\n");
-     gst_object_unref (data->playbin2);
-     QMessageBox::information(this,tr("Tips"),tr("Failed to render video!"),1);
-     data->playbin2 = gst_element_factory_make ("playbin", "playbin2");
-     realize_cb(displayWnd,data);
-     if (!data->playbin2)
-     {
-       qWarning("Not all elements could be created.\n");
-       return ;
-     }
+     start_recovery(data, "the pipeline could not be set to playing");
      return;
    }
    else
@@ -189,9 +863,13 @@ void Widget::playButtonClicked(QPushButton *button, CustomData *data)
        {
            queryTimer->start(100*3);
        }
+       if(watchdog != NULL)
+       {
+           watchdog->setArmed(true);
+       }
    }
 
-   g_object_set(G_OBJECT(data->playbin2), "volume", 50*1.0/100, NULL);
+   g_object_set(G_OBJECT(data->playbin2), "volume", volumeSlider->value()*1.0/100, NULL);
    g_object_set(G_OBJECT(data->playbin2), "mute", FALSE, NULL);
 
 }
@@ -200,7 +878,7 @@ void Widget::playButtonClicked(QPushButton *button, CustomData *data)
 void Widget::plauseButtonClicked(QPushButton *button, CustomData *data)
 {
     Q_UNUSED(button);
-    if(uri == "")
+    if(uri == "" || recovering)
     {
         return;
     }
@@ -209,15 +887,7 @@ void Widget::plauseButtonClicked(QPushButton *button, CustomData *data)
     if (ret == GST_STATE_CHANGE_FAILURE)
     {
       g_printerr ("Unable to set the pipeline to the plauseing state.\n");
-      gst_object_unref (data->playbin2);
-      QMessageBox::information(this,tr("Tips"),tr("Failed to pause!"),1);
-      data->playbin2 = gst_element_factory_make ("playbin", "playbin2");
-      realize_cb(displayWnd,data);
-      if (!data->playbin2)
-      {
-        qWarning("Not all elements could be created.\n");
-        return ;
-      }
+      start_recovery(data, "the pipeline could not be paused");
       return;
     }
 }
@@ -233,16 +903,31 @@ void Widget::stopButtonClicked(QPushButton *button, CustomData *data)
     GstStateChangeReturn ret;
     if(data != NULL && data->playbin2 != NULL)
     {
+      if(watchdog != NULL)
+      {
+        watchdog->setArmed(false);
+      }
+      save_resume_state(data);
+      report_video_session(data);
+      report_session_resources(data);
+      report_threads(data);
+      write_av_sync_report(data);
+      data->resume_position = -1;
+      data->resume_seeking = FALSE;
       ret = gst_element_set_state (data->playbin2, GST_STATE_READY);  ;
       if (ret == GST_STATE_CHANGE_FAILURE)
       {
         g_printerr ("Unable to set the pipeline to the stopping state.\n");
-        gst_object_unref (data->playbin2);
+        gst_element_set_state (data->playbin2, GST_STATE_NULL);
         return;
       }
       else
       {
           startBtn->setText("播放");
+          if(idleTimer->interval() > 0)
+          {
+              idleTimer->start();
+          }
       }
     }
 }
@@ -265,16 +950,15 @@ bool Widget::expose_cb(QWidget *widget, QEvent *event, CustomData *data)
 {
     Q_UNUSED(widget);
     Q_UNUSED(event);
-    if(data->playbin2->current_state == GST_STATE_PLAYING)
+    if(data->playbin2->current_state == GST_STATE_PLAYING && !data->audio_only)
     {
-        qInfo() << "expose_cb is called!";
+        TRACE_DEBUG ("expose", data->playbin2->current_state, 0);
         renderWnd->setCurrentIndex(0);
     }
     else if(data->playbin2->current_state == GST_STATE_READY)
     {
         renderWnd->setCurrentIndex(1);
         slider->setValue(0);
-        volumeSlider->setValue(50);
     }
     return false;
 }
@@ -284,7 +968,24 @@ bool Widget::expose_cb(QWidget *widget, QEvent *event, CustomData *data)
 void Widget::slider_cb(CustomData *data)
 {
     double value = data->slider->value();
-    gst_element_seek_simple(data->playbin2,GST_FORMAT_TIME,GstSeekFlags(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT),(gint64)(value * GST_SECOND));
+    seek_to(data,(gint64)(value * GST_SECOND),GstSeekFlags(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT));
+}
+
+/* Seek to position, keeping the current playback rate */
+gboolean Widget::seek_to(CustomData *data, gint64 position, GstSeekFlags flags)
+{
+    /* A live stream only has a now */
+    if(live_mode_is_active(data->live))
+    {
+        return FALSE;
+    }
+    if(data->rate > 0)
+    {
+        return gst_element_seek(data->playbin2, data->rate, GST_FORMAT_TIME, flags,
+                                GST_SEEK_TYPE_SET, position, GST_SEEK_TYPE_END, 0);
+    }
+    return gst_element_seek(data->playbin2, data->rate, GST_FORMAT_TIME, flags,
+                            GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_SET, position);
 }
 
  void Widget::createUi (CustomData *data)
@@ -308,8 +1009,8 @@ void Widget::slider_cb(CustomData *data)
      renderWnd->addWidget(backgroundWnd);
      renderWnd->setCurrentIndex(1);
 
-     slider = new QSlider(Qt::Horizontal);
-     slider->setFixedHeight(15);
+     slider = new TimelineSlider(Qt::Horizontal);
+     slider->setFixedHeight(waveform != NULL ? 32 : 15);
      timeLabel = new QLabel;
      timeLabel->setFixedHeight(15);
      timeLabel->setStyleSheet("background-color: #ffffff;color:black; font-family:\"STXihei\";font-size: 10px;");
@@ -411,42 +1112,270 @@ void Widget::slider_cb(CustomData *data)
 
  void Widget::slotOpenButtonClicked()
  {
+     rearm_pipeline(data);
      QString fileName = QFileDialog::getOpenFileName(this, tr("Please choose video file"), tr("/"));
      qInfo() << "fileName is" << fileName;
      if(fileName == "")
      {
          return;
      }
-     data->streams_list->setText(fileName);
-     uri = "file:///" + fileName;
-     stopButtonClicked(NULL,data);
-     g_object_set(data->playbin2, "uri", uri.toUtf8().data(), NULL);
-     playButtonClicked(NULL,data);
+     openFile(fileName);
  }
 
- void Widget::seek(int seconds)
+ void Widget::openFile(const QString &fileName)
  {
-     Q_UNUSED(seconds);
-     slider_cb(data);
+     playlist.setCurrent(fileName);
+     openUri("file:///" + fileName, fileName, playlist.isAudioOnly());
  }
 
- void Widget::slotPlayButtonClicked()
+ /* audioOnly forces the audio-only mode, which may also have been remembered for the uri;
+  * paused prerolls at the start instead of resuming and playing */
+ void Widget::openUri(const QString &newUri, const QString &label, bool audioOnly, bool paused)
  {
-     qInfo() << "slotPlayButtonClicked is called!!";
-     if(uri == "")
+     mediaLabel = label;
+     data->streams_list->setText(label);
+     stopButtonClicked(NULL,data);
+     uri = newUri;
+     data->rate = 1.0;
+     data->duration = GST_CLOCK_TIME_NONE;
+     metrics.position = -1;
+     av_sync_reset(data->av_sync);
+     live_mode_reset(data->live);
+     qos_control_reset(data->qos, data->video_sink);
+     track_switch_reset(data->tracks);
+     tracksChosen = false;
+     if(waveform != NULL)
      {
-         return;
+         waveform->build(newUri);
+         slider->setWaveform(WaveformPeaks());
      }
-     if(data->playbin2->current_state == GST_STATE_PLAYING)
+     if(analyzer != NULL)
      {
-         plauseButtonClicked(NULL,data);
+         analyzer->analyze(newUri);
+         slider->setMarkers(QVector<TimelineMarker>());
+     }
+     metrics.qosLevel = 0;
+     slider->setEnabled(true);
+     avSyncCorrectClock.invalidate();
+     if(watchdog != NULL)
+     {
+         watchdog->reset();
+     }
+     recoveryClock.invalidate();
+     recoveryAttempt = 0;
+     recoveryPosition = -1;
+     openPrefetched = prefetcher != NULL && prefetcher->isWarm(label);
+     openClock.start();
+     g_object_set(data->playbin2, "uri", uri.toUtf8().data(), NULL);
+     gint flags;
+     g_object_get(data->playbin2, "flags", &flags, NULL);
+     if(track_switch_subtitles_default(data->tracks))
+     {
+         flags |= GST_PLAY_FLAG_TEXT;
      }
      else
      {
-         playButtonClicked(NULL,data);
+         flags &= ~GST_PLAY_FLAG_TEXT;
      }
- }
-
+     g_object_set(data->playbin2, "flags", flags, NULL);
+     restore_resume_state(data);
+     data->audio_only = data->audio_only || audioOnly;
+     apply_play_flags(data);
+     if(paused)
+     {
+         data->resume_position = -1;
+         gst_element_set_state(data->playbin2, GST_STATE_PAUSED);
+         return;
+     }
+     playButtonClicked(NULL,data);
+ }
+
+ void Widget::openPaused(const QString &fileName)
+ {
+     playlist.setCurrent(fileName);
+     openUri("file:///" + fileName, fileName, false, true);
+ }
+
+ bool Widget::seekLikeSlider(qint64 position, GstSeekFlags flags)
+ {
+     return seek_to(data, position, flags);
+ }
+
+ qint64 Widget::queryDuration()
+ {
+     gint64 duration = -1;
+     if(!gst_element_query_duration(data->playbin2, GST_FORMAT_TIME, &duration))
+     {
+         return -1;
+     }
+     return duration;
+ }
+
+ GstElement *Widget::videoSink() const
+ {
+     return data->video_sink;
+ }
+
+ GstElement *Widget::pipeline() const
+ {
+     return data != NULL ? data->playbin2 : NULL;
+ }
+
+ QString Widget::currentUri() const
+ {
+     return uri;
+ }
+
+ void Widget::openPausedUri(const QString &location)
+ {
+     openUri(location, location, false, true);
+ }
+
+ /* The source is live: no preroll, no duration, no seeking, and as little latency as possible */
+ void Widget::enter_live_mode(CustomData *data)
+ {
+     live_mode_enable(data->live, data->playbin2);
+     data->seek_enabled = FALSE;
+     data->duration = GST_CLOCK_TIME_NONE;
+     metrics.duration = -1;
+     slider->setEnabled(false);
+     slider->setValue(0);
+     LiveModeReport report;
+     live_mode_get_report(data->live, &report);
+     qInfo("Live source: latency %d ms, dropping late data", report.configured_ms);
+
+     /* Nothing to resume, and a resume would wait for an ASYNC_DONE that never comes */
+     if(data->resume_position > 0 || data->resume_seeking)
+     {
+         data->resume_position = -1;
+         data->resume_seeking = FALSE;
+         gst_element_set_state(data->playbin2, GST_STATE_PLAYING);
+     }
+ }
+
+ /* Step the decoding quality down while frames come late, and back up once they no longer do */
+ void Widget::adapt_quality(CustomData *data)
+ {
+     QosStep step;
+     if(!qos_control_update(data->qos, data->video_sink, &step))
+     {
+         return;
+     }
+     metrics.qosLevel = step.to;
+     if(step.to > step.from)
+     {
+         metrics.qosStepsDown++;
+         qInfo("QoS: %u late frames, jitter up to %.1f ms, proportion %.2f: decoding quality down to level %d (%s)",
+               step.late, step.jitter / 1e6, step.proportion, step.to, qos_control_level_name(step.to));
+     }
+     else
+     {
+         metrics.qosStepsUp++;
+         qInfo("QoS: no late frames for a while, decoding quality up to level %d (%s), next step up after %u s",
+               step.to, qos_control_level_name(step.to), step.hold_s);
+     }
+     TRACE_INFO ("qos.level", step.to, step.late);
+ }
+
+ /* In place of position and duration: the latency of the pipeline and from capture to display */
+ void Widget::show_live_status(CustomData *data)
+ {
+     LiveModeReport report;
+     live_mode_get_report(data->live, &report);
+     QString text = QString("LIVE");
+
+     GstQuery *query = gst_query_new_latency();
+     if(gst_element_query(data->playbin2, query))
+     {
+         gboolean live;
+         GstClockTime minLatency, maxLatency;
+         gst_query_parse_latency(query, &live, &minLatency, &maxLatency);
+         text += QString("  pipeline %1 ms").arg(minLatency / 1e6, 0, 'f', 0);
+     }
+     gst_query_unref(query);
+
+     if(report.frames > 0)
+     {
+         metrics.liveLatencyLast = gint64(report.latency_last_ms * 1000);
+         text += QString("  glass-to-glass %1 ms (mean %2, max %3)")
+             .arg(report.latency_last_ms, 0, 'f', 0)
+             .arg(report.latency_mean_ms, 0, 'f', 0)
+             .arg(report.latency_max_ms, 0, 'f', 0);
+     }
+     timeLabel->setText(text);
+ }
+
+ /* Only allowed below PAUSED: the video branch is built or not when playbin prerolls */
+ void Widget::apply_play_flags(CustomData *data)
+ {
+     gint flags;
+     g_object_get(data->playbin2, "flags", &flags, NULL);
+     if(data->audio_only)
+     {
+         flags &= ~GST_PLAY_FLAG_VIDEO;
+     }
+     else
+     {
+         flags |= GST_PLAY_FLAG_VIDEO;
+     }
+     g_object_set(data->playbin2, "flags", flags, NULL);
+
+     /* The tags take the place of the video */
+     renderWnd->setCurrentIndex(1);
+     if(!data->audio_only)
+     {
+         data->streams_list->setText(mediaLabel);
+     }
+ }
+
+ /* Switching mode rebuilds the pipeline from READY and resumes at the same position */
+ void Widget::slotSetAudioOnly(bool audioOnly)
+ {
+     if(bool(data->audio_only) == audioOnly)
+     {
+         return;
+     }
+     qInfo() << "Audio-only mode" << (audioOnly ? "on" : "off");
+     data->audio_only = audioOnly;
+     if(uri == "")
+     {
+         apply_play_flags(data);
+         return;
+     }
+     bool wasPlaying = data->playbin2->current_state >= GST_STATE_PAUSED;
+     stopButtonClicked(NULL,data);
+     restore_resume_state(data);
+     data->audio_only = audioOnly;
+     apply_play_flags(data);
+     if(wasPlaying)
+     {
+         playButtonClicked(NULL,data);
+     }
+ }
+
+ void Widget::seek(int seconds)
+ {
+     Q_UNUSED(seconds);
+     slider_cb(data);
+ }
+
+ void Widget::slotPlayButtonClicked()
+ {
+     qInfo() << "slotPlayButtonClicked is called!!";
+     if(uri == "")
+     {
+         return;
+     }
+     if(data->playbin2->current_state == GST_STATE_PLAYING)
+     {
+         plauseButtonClicked(NULL,data);
+     }
+     else
+     {
+         playButtonClicked(NULL,data);
+     }
+ }
+
  void Widget::slotPaluseButtonClicked()
  {
      qInfo() << "slotPaluseButtonClicked!!!";
@@ -483,21 +1412,28 @@ void Widget::slider_cb(CustomData *data)
          startBtn->setText("播放");
      }
 
+     if(live_mode_is_active(data->live))
+     {
+         show_live_status(data);
+         return TRUE;
+     }
+
      if (!GST_CLOCK_TIME_IS_VALID (data->duration))
      {
        if (!gst_element_query_duration (data->playbin2, fmt, &data->duration))
        {
-          qWarning("Could not query current duration.\n");
+          TRACE_WARNING ("refresh.duration-query-failed", 0, 0);
           return FALSE;
        }
        else
        {
          /* Set the range of the slider to the clip duration, in SECONDS */
-          data->slider->setRange(0,(gdouble)data->duration/GST_SECOND);
+          data->slider->setRange(0,playback_slider_range(data->duration));
+          data->metrics->duration = data->duration;
        }
      }
 
-     qInfo() << "the playbin duration is" << QString::number(data->duration);
+     TRACE_DEBUG ("refresh.duration", data->duration, 0);
 
      if(data->playbin2->current_state == GST_STATE_PLAYING )
      {
@@ -509,22 +1445,22 @@ void Widget::slider_cb(CustomData *data)
            gst_query_parse_seeking (query, NULL, &data->seek_enabled, &start, &end);
            if (data->seek_enabled)
            {
-             g_print ("Seeking is ENABLED from %" GST_TIME_FORMAT " to %" GST_TIME_FORMAT "\n",
-                 GST_TIME_ARGS (start), GST_TIME_ARGS (end));
+             TRACE_DEBUG ("refresh.seeking-enabled", start, end);
              if(data->duration != end)
              {
                data->duration = end;
-               slider->setRange(0,(gdouble)data->duration/GST_SECOND);
+               data->metrics->duration = data->duration;
+               slider->setRange(0,playback_slider_range(data->duration));
              }
            }
            else
            {
-             g_print ("Seeking is DISABLED for this stream.\n");
+             TRACE_DEBUG ("refresh.seeking-disabled", 0, 0);
            }
          }
          else
          {
-           g_printerr ("Seeking query failed.");
+           TRACE_WARNING ("refresh.seeking-query-failed", 0, 0);
          }
          gst_query_unref (query);
      }
@@ -534,7 +1470,7 @@ void Widget::slider_cb(CustomData *data)
          gchar *infor;
          infor  = g_strdup_printf("%" GST_TIME_FORMAT " / %" GST_TIME_FORMAT "\r",
                   GST_TIME_ARGS (current), GST_TIME_ARGS (data->duration));
-         if(current == data->duration)
+         if(playback_reached_end(current, data->duration))
          {
              if(queryTimer->isActive())
              {
@@ -545,12 +1481,169 @@ void Widget::slider_cb(CustomData *data)
          timeLabel->setText(QString(infor));
          if(!slider->isSliderDown())
          {
-            slider->setValue(current/GST_SECOND);
+            slider->setValue(playback_slider_value(current));
          }
+         g_free (infor);
+         save_resume_state(data);
      }
      return TRUE;
  }
 
+ /* Log whether the frames of the session that ends had to be converted for the sink, and at what cost */
+ void Widget::report_video_session(CustomData *data)
+ {
+     VideoSinkBinStats stats;
+     if(!video_sink_bin_take_stats(data->video_sink, &stats))
+     {
+         return;
+     }
+     TRACE_INFO ("video.convert-time", stats.convert_time, stats.convert_frames);
+     qInfo("Video session: decoder %s, sink %s, %s; videoconvert %.1f ms over %llu frames (%.3f ms/frame), "
+           "videoscale %.1f ms over %llu frames; %llu buffers not decoded while hidden",
+           stats.decoded_format, stats.display_format,
+           stats.converted ? "converted in software" : "no conversion",
+           stats.convert_time / 1e6, (unsigned long long) stats.convert_frames,
+           stats.convert_frames ? stats.convert_time / 1e6 / stats.convert_frames : 0.0,
+           stats.scale_time / 1e6, (unsigned long long) stats.scale_frames,
+           (unsigned long long) stats.suspended_buffers);
+     if(stats.decimated_frames > 0)
+     {
+         qInfo("Video load shedding: %llu frames decimated", (unsigned long long) stats.decimated_frames);
+     }
+     if(stats.pools > 0)
+     {
+         TRACE_INFO ("video.pool-allocations", stats.pool.allocations, stats.pool.reuses);
+         qInfo("Video frame pool: %u pool(s), %llu frames allocated, %llu reused, peak %.1f MiB",
+               stats.pools, (unsigned long long) stats.pool.allocations,
+               (unsigned long long) stats.pool.reuses, stats.pool.peak_bytes / 1048576.0);
+     }
+ }
+
+ /* Log what the session that ends cost, next to the average of the sessions in the other mode */
+ void Widget::report_session_resources(CustomData *data)
+ {
+     Q_UNUSED(data);
+     if(!sessionClock.isValid())
+     {
+         return;
+     }
+     double wall = sessionClock.nsecsElapsed() / 1e9;
+     double cpu = (metrics_cpu_time() - sessionCpuStart) / 1e9;
+     sessionClock.invalidate();
+     if(wall < 1)
+     {
+         return;
+     }
+
+     int mode = sessionAudioOnly ? 1 : 0;
+     int other = 1 - mode;
+     modeCpuSeconds[mode] += cpu;
+     modeWallSeconds[mode] += wall;
+     modeRssPeakSum[mode] += sessionRssPeak;
+     modeSessions[mode]++;
+
+     QString line = QString("%1 session: %2% CPU over %3 s, peak RSS %4 MiB")
+         .arg(mode ? "Audio-only" : "Video")
+         .arg(100 * cpu / wall, 0, 'f', 1)
+         .arg(wall, 0, 'f', 0)
+         .arg(sessionRssPeak / 1048576.0, 0, 'f', 1);
+     if(modeSessions[other] > 0)
+     {
+         double otherCpu = 100 * modeCpuSeconds[other] / modeWallSeconds[other];
+         double otherRss = modeRssPeakSum[other] / modeSessions[other] / 1048576.0;
+         line += QString("; %1 sessions average %2% CPU, peak RSS %3 MiB")
+             .arg(other ? "audio-only" : "video")
+             .arg(otherCpu, 0, 'f', 1)
+             .arg(otherRss, 0, 'f', 1);
+     }
+     qInfo().noquote() << line;
+ }
+
+ /* CPU time of every streaming thread of the session that ends, busiest first */
+ void Widget::report_threads(CustomData *data)
+ {
+     TaskThreadInfo threads[64];
+     guint count = task_pools_take_threads(data->task_pools, threads, G_N_ELEMENTS(threads));
+     std::sort(threads, threads + count, [](const TaskThreadInfo &a, const TaskThreadInfo &b) {
+         return a.cpu_time > b.cpu_time;
+     });
+     for(guint i = 0; i < count; i++)
+     {
+         qInfo("Thread %-32s %-9s %8.1f ms CPU%s", threads[i].name, task_pools_role_name(threads[i].role),
+               threads[i].cpu_time / 1e6, threads[i].running ? "" : " (ended)");
+     }
+ }
+
+ /* Record the current position, stream selection and volume of the open URI */
+ void Widget::save_resume_state(CustomData *data)
+ {
+     ResumeStore::Entry entry;
+     gint64 position;
+
+     /* While a resume is pending the pipeline position is not meaningful yet */
+     if(uri == "" || data->resume_position > 0 || data->resume_seeking || live_mode_is_active(data->live) ||
+        data->playbin2->current_state < GST_STATE_PAUSED)
+     {
+         return;
+     }
+     if(!gst_element_query_position(data->playbin2, GST_FORMAT_TIME, &position))
+     {
+         return;
+     }
+     entry.position = position;
+     entry.duration = GST_CLOCK_TIME_IS_VALID (data->duration) ? data->duration : -1;
+     g_object_get(data->playbin2, "current-audio", &entry.audio, NULL);
+     entry.text = track_switch_current(data->tracks, data->playbin2, TRACK_TEXT);
+     entry.volume = volumeSlider->value();
+     entry.flags = data->audio_only ? ResumeStore::FlagAudioOnly : 0;
+     if(entry.text < 0 && track_switch_count(data->tracks, data->playbin2, TRACK_TEXT) > 0)
+     {
+         entry.flags |= ResumeStore::FlagSubtitlesOff;
+     }
+     resumeStore.store(uri, entry);
+ }
+
+ /* Apply the saved state of the URI just set on playbin, before it leaves READY */
+ void Widget::restore_resume_state(CustomData *data)
+ {
+     ResumeStore::Entry entry;
+
+     data->resume_position = -1;
+     data->resume_seeking = FALSE;
+     data->resume_audio = data->resume_text = -1;
+     data->audio_only = FALSE;
+     if(!resumeStore.lookup(uri, &entry))
+     {
+         return;
+     }
+
+     data->audio_only = (entry.flags & ResumeStore::FlagAudioOnly) != 0;
+     volumeSlider->setValue(entry.volume);
+     /* The tracks themselves are selected once prerolled, the flags apply to building the pipeline */
+     data->resume_audio = entry.audio;
+     data->resume_text = entry.text;
+     if(entry.text >= 0)
+     {
+         gint flags;
+         g_object_get(data->playbin2, "flags", &flags, NULL);
+         g_object_set(data->playbin2, "flags", flags | GST_PLAY_FLAG_TEXT, NULL);
+     }
+     else if(entry.flags & ResumeStore::FlagSubtitlesOff)
+     {
+         /* Turned off last time: keep the overlay out, whatever QTGSPLAYER_SUBTITLES says */
+         gint flags;
+         g_object_get(data->playbin2, "flags", &flags, NULL);
+         g_object_set(data->playbin2, "flags", flags & ~GST_PLAY_FLAG_TEXT, NULL);
+     }
+     tracksChosen = entry.audio >= 0 || entry.text >= 0 || (entry.flags & ResumeStore::FlagSubtitlesOff);
+
+     /* A clip that was watched to the end starts over */
+     if(entry.position > 0 && (entry.duration <= 0 || entry.position < entry.duration - RESUME_TAIL))
+     {
+         data->resume_position = entry.position;
+     }
+ }
+
  /* Extract metadata from all the streams and write it to the text widget in the GUI */
  void Widget::analyze_streams(CustomData *data)
  {
@@ -560,6 +1653,12 @@ void Widget::slider_cb(CustomData *data)
      guint rate;
      gint n_video, n_audio, n_text;
 
+     if (data->audio_only)
+     {
+       show_audio_metadata (data);
+       return;
+     }
+
      /* Read some properties */
      g_object_get (data->playbin2, "n-video", &n_video, NULL);
      g_object_get (data->playbin2, "n-audio", &n_audio, NULL);
@@ -639,15 +1738,542 @@ void Widget::slider_cb(CustomData *data)
      }
  }
 
+ /* In audio-only mode the text widget shows the tags of the current audio stream, on its one line */
+ void Widget::show_audio_metadata(CustomData *data)
+ {
+     static const char *const fields[][2] = {
+         { GST_TAG_TITLE, "Title" }, { GST_TAG_ARTIST, "Artist" }, { GST_TAG_ALBUM, "Album" },
+         { GST_TAG_GENRE, "Genre" }, { GST_TAG_AUDIO_CODEC, "Codec" }
+     };
+     GstTagList *tags = NULL;
+     gint current = 0;
+     guint bitrate;
+     gchar *str;
+
+     g_object_get (data->playbin2, "current-audio", &current, NULL);
+     g_signal_emit_by_name (data->playbin2, "get-audio-tags", MAX (current, 0), &tags);
+     if (tags == NULL)
+     {
+       return;
+     }
+
+     QString text = mediaLabel;
+     for (size_t i = 0; i < G_N_ELEMENTS (fields); i++)
+     {
+       if (gst_tag_list_get_string (tags, fields[i][0], &str))
+       {
+         text += QString("  %1: %2").arg(fields[i][1]).arg(QString::fromUtf8(str));
+         g_free (str);
+       }
+     }
+     if (gst_tag_list_get_uint (tags, GST_TAG_BITRATE, &bitrate))
+     {
+       text += QString("  Bitrate: %1 kbit/s").arg(bitrate / 1000);
+     }
+     gst_tag_list_unref (tags);
+
+     if (data->streams_list->text() != text)
+     {
+       data->streams_list->setText(text);
+     }
+ }
+
  void Widget::resizeEvent(QResizeEvent *event)
  {
      if(this->width() != 600)
      {
-         this->slider->resize(QSize(this->width() - 100, 15));
+         this->slider->resize(QSize(this->width() - 100, this->slider->height()));
+     }
+     if(resizeTimer != NULL)
+     {
+         resizeTimer->start();
      }
      QWidget::resizeEvent(event);
  }
 
+ void Widget::slotApplyVideoSize()
+ {
+     if(data == NULL || data->video_sink == NULL)
+     {
+         return;
+     }
+     qreal ratio = renderWnd->devicePixelRatioF();
+     video_sink_bin_set_window_size(data->video_sink,
+                                    qRound(renderWnd->width() * ratio),
+                                    qRound(renderWnd->height() * ratio));
+ }
+
+ /* Stopped for a long time: free everything the pipeline holds. playbin keeps its uri, flags,
+  * volume and window handle in NULL, the sink bin keeps the formats it learnt, and stream
+  * selection and position are in the resume store, so the next play is a normal start. */
+ void Widget::slotIdleRelease()
+ {
+     if(data == NULL || data->playbin2->current_state != GST_STATE_READY)
+     {
+         return;
+     }
+     guint64 before = metrics_resident_bytes();
+     gint64 start = g_get_monotonic_time();
+     gst_element_set_state(data->playbin2, GST_STATE_NULL);
+#ifdef __GLIBC__
+     /* Hand the freed heap back to the system, glibc keeps it otherwise */
+     malloc_trim(0);
+#endif
+     guint64 after = metrics_resident_bytes();
+     idleReleased = true;
+     TRACE_INFO ("idle.release", before, after);
+     qInfo("Idle: pipeline released in %.1f ms, RSS %.1f MiB -> %.1f MiB",
+           (g_get_monotonic_time() - start) / 1000.0, before / 1048576.0, after / 1048576.0);
+ }
+
+ /* The sinks got nothing for a while although the pipeline is PLAYING: try cheap things first */
+ void Widget::slotStalled(int step, qint64 stalledMs)
+ {
+     gint64 position = metrics.position;
+     metrics.stallActions[step - 1]++;
+     TRACE_WARNING ("stall", step, stalledMs);
+     qWarning("Stall: no data at the sinks for %lld ms at %.3f s, trying a %s",
+              (long long) stalledMs, position > 0 ? position / 1e9 : 0.0, stall_actions[step - 1]);
+
+     gint64 start = g_get_monotonic_time();
+     switch(step)
+     {
+     case 1:
+         seek_to(data, position > 0 ? position : 0, GstSeekFlags(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT));
+         break;
+     case 2:
+         start_recovery(data, "playback stalled");
+         break;
+     default:
+         if(playlist.next() != "" && playlist.next() != playlist.current())
+         {
+             slotNext();
+         }
+         else
+         {
+             give_up(data, "playback stalled");
+         }
+         break;
+     }
+     qInfo("Stall: %s issued in %.1f ms", stall_actions[step - 1], (g_get_monotonic_time() - start) / 1000.0);
+ }
+
+ void Widget::slotStallRecovered(int step, qint64 stalledMs)
+ {
+     TRACE_INFO ("stall.over", step, stalledMs);
+     qInfo("Stall: data flowing again after %lld ms, following the %s", (long long) stalledMs, stall_actions[step - 1]);
+ }
+
+ void Widget::slotWaveformUpdated()
+ {
+     slider->setWaveform(waveform->peaks());
+ }
+
+ void Widget::slotMarkersUpdated()
+ {
+     slider->setMarkers(analyzer->markers());
+ }
+
+ void Widget::slotAnalyzed(int frames, double seconds, double realtime)
+ {
+     qInfo("Analytics: %d frames in %.1f s, %.0f fps (%.1fx real time), %d markers",
+           frames, seconds, seconds > 0 ? frames / seconds : 0.0, realtime, slider->timelineMarkers().size());
+ }
+
+ void Widget::slotNextMarker()
+ {
+     jump_to_marker(data, 1);
+ }
+
+ void Widget::slotPreviousMarker()
+ {
+     jump_to_marker(data, -1);
+ }
+
+ /* To the next marker after the position, or the last one before it; half a second of
+  * margin lets repeated presses go on to the next one. The seek is accurate: slider_cb()
+  * would round to the second and land on a keyframe, away from the incident. */
+ void Widget::jump_to_marker(CustomData *data, int direction)
+ {
+     const QVector<TimelineMarker> &markers = slider->timelineMarkers();
+     gint64 position = -1;
+     if(markers.isEmpty() || !data->seek_enabled ||
+        !gst_element_query_position(data->playbin2, GST_FORMAT_TIME, &position))
+     {
+         return;
+     }
+
+     const gint64 margin = 500 * GST_MSECOND;
+     gint64 target = -1;
+     foreach(const TimelineMarker &marker, markers)
+     {
+         if(direction > 0 && marker.position > position + margin &&
+            (target < 0 || marker.position < target))
+         {
+             target = marker.position;
+         }
+         else if(direction < 0 && marker.position < position - margin && marker.position > target)
+         {
+             target = marker.position;
+         }
+     }
+     if(target < 0)
+     {
+         return;
+     }
+     slider->setValue(playback_slider_value(target));
+     seek_to(data, target, GstSeekFlags(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE));
+ }
+
+ void Widget::slotNextAudioTrack()
+ {
+     gint count = track_switch_count(data->tracks, data->playbin2, TRACK_AUDIO);
+     if(count > 1)
+     {
+         select_track(data, TRACK_AUDIO, (track_switch_current(data->tracks, data->playbin2, TRACK_AUDIO) + 1) % count);
+     }
+ }
+
+ /* Through the subtitle tracks, then off, then the first one again */
+ void Widget::slotNextSubtitleTrack()
+ {
+     gint count = track_switch_count(data->tracks, data->playbin2, TRACK_TEXT);
+     if(count > 0)
+     {
+         gint next = track_switch_current(data->tracks, data->playbin2, TRACK_TEXT) + 1;
+         select_track(data, TRACK_TEXT, next < count ? next : -1);
+     }
+ }
+
+ void Widget::slotSelectAudioTrack(int index)
+ {
+     select_track(data, TRACK_AUDIO, index);
+ }
+
+ void Widget::slotSelectSubtitleTrack(int index)
+ {
+     select_track(data, TRACK_TEXT, index);
+ }
+
+ /* Switched on the running pipeline, without a seek; see trackswitch.h */
+ void Widget::select_track(CustomData *data, TrackType type, int index)
+ {
+     if(uri == "" || data->playbin2->current_state < GST_STATE_PAUSED ||
+        index == track_switch_current(data->tracks, data->playbin2, type))
+     {
+         return;
+     }
+     const char *kind = type == TRACK_AUDIO ? "Audio" : "Subtitles";
+     if(!track_switch_select(data->tracks, data->playbin2, type, index))
+     {
+         qWarning("%s: no track %d", kind, index);
+         return;
+     }
+     tracksChosen = true;
+     TRACE_INFO ("track.select", type, index);
+
+     gchar *description = track_switch_describe(data->tracks, data->playbin2, type, index);
+     QString text = index < 0 ? QString("%1: %2").arg(kind).arg(description)
+                              : QString("%1 %2/%3: %4").arg(kind).arg(index + 1)
+                                    .arg(track_switch_count(data->tracks, data->playbin2, type)).arg(QString::fromUtf8(description));
+     g_free(description);
+     qInfo() << "Switching to" << text;
+     if(!data->audio_only)
+     {
+         data->streams_list->setText(mediaLabel + "  " + text);
+     }
+ }
+
+ /* QTGSPLAYER_AUDIO_LANGUAGE and QTGSPLAYER_SUBTITLE_LANGUAGE, e.g. "de", for files without remembered tracks */
+ void Widget::select_preferred_tracks(CustomData *data)
+ {
+     static const char *const variables[] = { "QTGSPLAYER_AUDIO_LANGUAGE", "QTGSPLAYER_SUBTITLE_LANGUAGE" };
+     static const TrackType types[] = { TRACK_AUDIO, TRACK_TEXT };
+     for(int i = 0; i < 2; i++)
+     {
+         QByteArray language = qgetenv(variables[i]);
+         if(language.isEmpty())
+         {
+             continue;
+         }
+         gint index = track_switch_find_language(data->tracks, data->playbin2, types[i], language.constData());
+         if(index >= 0)
+         {
+             select_track(data, types[i], index);
+         }
+     }
+ }
+
+ /* Latency of the last switch and whether the video kept going, once it is over */
+ void Widget::report_track_switch(CustomData *data)
+ {
+     TrackSwitchResult result;
+     if(!track_switch_take_result(data->tracks, &result))
+     {
+         return;
+     }
+     metrics.trackSwitches++;
+     if(result.latency_us >= 0)
+     {
+         metrics.trackSwitchLatencyLast = result.latency_us;
+     }
+     metrics.trackSwitchVideoGapLast = qMax<gint64>(result.video_gap_us, 0);
+     if(result.latency_us < 0 || result.latency_us > TRACK_SWITCH_TARGET_US)
+     {
+         metrics.trackSwitchesSlow++;
+     }
+     TRACE_INFO ("track.switched", result.type, result.latency_us);
+
+     const char *method = result.select_streams ? "select-streams" : "pad switch";
+     const char *kind = result.type == TRACK_AUDIO ? "audio" : "subtitle";
+     QString video = result.video_gap_us < 0 ? QString("no video")
+                   : QString("video gap %1 ms, frames every %2 ms").arg(result.video_gap_us / 1000.0, 0, 'f', 1)
+                                                                 .arg(result.frame_interval_us / 1000.0, 0, 'f', 1);
+     if(result.latency_us < 0)
+     {
+         qWarning("Track switch: %s track %d (%s) not seen at the sinks, %s",
+                  kind, result.index, method, qPrintable(video));
+     }
+     else
+     {
+         qInfo("Track switch: %s track %d (%s) in %.1f ms%s, %s", kind, result.index, method,
+               result.latency_us / 1000.0, result.latency_us > TRACK_SWITCH_TARGET_US ? " (slow)" : "", qPrintable(video));
+     }
+ }
+
+ void Widget::slotToggleAvSyncOverlay()
+ {
+     avSyncOverlay = !avSyncOverlay;
+     if(!avSyncOverlay)
+     {
+         data->streams_list->setText(mediaLabel);
+     }
+     show_av_sync_stats(data);
+ }
+
+ static QString late_share(const AvSyncReport &report, int sink)
+ {
+     guint64 late = 0;
+     /* Buckets from "5..20" up: later than a few ms */
+     for(int i = 5; i < AV_SYNC_BUCKETS; i++)
+     {
+         late += report.late[sink][i];
+     }
+     return QString("%1% late, max %2 ms")
+         .arg(report.buffers[sink] ? 100.0 * late / report.buffers[sink] : 0.0, 0, 'f', 1)
+         .arg(report.late_max_ms[sink], 0, 'f', 0);
+ }
+
+ void Widget::show_av_sync_stats(CustomData *data)
+ {
+     if(!avSyncOverlay)
+     {
+         return;
+     }
+     AvSyncReport report;
+     av_sync_get_report(data->av_sync, &report);
+     gint64 avOffset = 0;
+     g_object_get(data->playbin2, "av-offset", &avOffset, NULL);
+
+     QString text = mediaLabel;
+     if(report.offset_valid)
+     {
+         text += QString("  A/V %1 ms, drift %2 ms/h, clock %3 ppm, correction %4 ms")
+             .arg(report.offset_ms, 0, 'f', 1)
+             .arg(report.drift_ms_per_hour, 0, 'f', 1)
+             .arg(report.clock_drift_ppm, 0, 'f', 0)
+             .arg(avOffset / 1e6, 0, 'f', 0);
+     }
+     /* One line: the label is a single row high */
+     text += "  video " + late_share(report, AV_SYNC_VIDEO) + ", audio " + late_share(report, AV_SYNC_AUDIO);
+     if(data->streams_list->text() != text)
+     {
+         data->streams_list->setText(text);
+     }
+ }
+
+ /* One JSON object per session, appended to $QTGSPLAYER_AVSYNC_REPORT */
+ void Widget::write_av_sync_report(CustomData *data)
+ {
+     QString path = QString::fromLocal8Bit(qgetenv("QTGSPLAYER_AVSYNC_REPORT"));
+     AvSyncReport report;
+     av_sync_get_report(data->av_sync, &report);
+     if(path.isEmpty() || report.buffers[AV_SYNC_AUDIO] + report.buffers[AV_SYNC_VIDEO] == 0)
+     {
+         return;
+     }
+     gint64 avOffset = 0;
+     g_object_get(data->playbin2, "av-offset", &avOffset, NULL);
+
+     QJsonObject sinks;
+     static const char *const names[AV_SYNC_SINKS] = { "audio", "video" };
+     for(int i = 0; i < AV_SYNC_SINKS; i++)
+     {
+         QJsonObject histogram;
+         for(int b = 0; b < AV_SYNC_BUCKETS; b++)
+         {
+             histogram.insert(av_sync_bucket_name(b), double(report.late[i][b]));
+         }
+         QJsonObject sink;
+         sink.insert("buffers", double(report.buffers[i]));
+         sink.insert("late_mean_ms", report.late_mean_ms[i]);
+         sink.insert("late_max_ms", report.late_max_ms[i]);
+         sink.insert("lateness_ms", histogram);
+         sinks.insert(names[i], sink);
+     }
+     QJsonObject root;
+     root.insert("uri", uri);
+     root.insert("session_seconds", report.session_seconds);
+     if(report.offset_valid)
+     {
+         root.insert("offset_ms", report.offset_ms);
+     }
+     root.insert("drift_ms_per_hour", report.drift_ms_per_hour);
+     root.insert("clock_drift_ppm", report.clock_drift_ppm);
+     root.insert("av_offset_ms", avOffset / 1e6);
+     root.insert("sinks", sinks);
+
+     QFile file(path);
+     if(!file.open(QIODevice::WriteOnly | QIODevice::Append))
+     {
+         qWarning() << "Could not write the A/V sync report to" << path;
+         return;
+     }
+     file.write(QJsonDocument(root).toJson(QJsonDocument::Compact) + "\n");
+ }
+
+ /* Shift audio against video by the measured offset, a step every AV_CORRECT_INTERVAL_MS at most */
+ void Widget::correct_av_offset(CustomData *data)
+ {
+     if(!avSyncCorrect || !data->playing)
+     {
+         return;
+     }
+     if(avSyncCorrectClock.isValid() && avSyncCorrectClock.elapsed() < AV_CORRECT_INTERVAL_MS)
+     {
+         return;
+     }
+     avSyncCorrectClock.start();
+
+     AvSyncReport report;
+     av_sync_get_report(data->av_sync, &report);
+     if(!report.offset_valid || report.buffers[AV_SYNC_AUDIO] < 100 || report.buffers[AV_SYNC_VIDEO] < 100 ||
+        fabs(report.offset_ms) < AV_CORRECT_THRESHOLD_MS)
+     {
+         return;
+     }
+     /* playsink applies a positive av-offset as the video sink's ts-offset, i.e. it delays the video.
+      * The measured offset already includes the av-offset in place, so only what is left is taken off. */
+     gint64 avOffset = 0;
+     g_object_get(data->playbin2, "av-offset", &avOffset, NULL);
+     gint64 corrected = CLAMP(avOffset - gint64(report.offset_ms * GST_MSECOND), -AV_CORRECT_MAX, AV_CORRECT_MAX);
+     if(corrected == avOffset)
+     {
+         return;
+     }
+     g_object_set(data->playbin2, "av-offset", corrected, NULL);
+     TRACE_INFO ("avsync.correct", avOffset, corrected);
+     qInfo("A/V offset %.1f ms measured, av-offset %.1f ms -> %.1f ms",
+           report.offset_ms, avOffset / 1e6, corrected / 1e6);
+ }
+
+ /* Something suggests a play request is coming: open the devices again ahead of it */
+ void Widget::rearm_pipeline(CustomData *data)
+ {
+     if(!idleReleased || data == NULL)
+     {
+         return;
+     }
+     idleReleased = false;
+     gint64 start = g_get_monotonic_time();
+     gst_element_set_state(data->playbin2, GST_STATE_READY);
+     TRACE_INFO ("idle.rearm", g_get_monotonic_time() - start, 0);
+     idleTimer->start();
+ }
+
+ void Widget::enterEvent(QEvent *event)
+ {
+     rearm_pipeline(data);
+     QWidget::enterEvent(event);
+ }
+
+ void Widget::changeEvent(QEvent *event)
+ {
+     if(event->type() == QEvent::WindowStateChange)
+     {
+         slotUpdateVideoVisibility();
+     }
+     QWidget::changeEvent(event);
+ }
+
+ void Widget::showEvent(QShowEvent *event)
+ {
+     QWidget::showEvent(event);
+     /* The window reports being obscured or unmapped through expose events */
+     if(windowHandle() != NULL)
+     {
+         windowHandle()->installEventFilter(this);
+     }
+     slotUpdateVideoVisibility();
+ }
+
+ void Widget::hideEvent(QHideEvent *event)
+ {
+     QWidget::hideEvent(event);
+     slotUpdateVideoVisibility();
+ }
+
+ bool Widget::eventFilter(QObject *watched, QEvent *event)
+ {
+     if(event->type() == QEvent::Expose && watched == windowHandle())
+     {
+         slotUpdateVideoVisibility();
+     }
+     return QWidget::eventFilter(watched, event);
+ }
+
+ /* Decode video only while some of it can be seen */
+ void Widget::slotUpdateVideoVisibility()
+ {
+     if(data == NULL || data->video_sink == NULL)
+     {
+         return;
+     }
+     /* The background is also shown until the first PLAYING, the video must not be held back then */
+     bool visible = isVisible() && !isMinimized() &&
+                    (windowHandle() == NULL || windowHandle()->isExposed()) &&
+                    (renderWnd->currentIndex() == 0 || data->playbin2->current_state != GST_STATE_PLAYING);
+     if(visible == videoVisible)
+     {
+         return;
+     }
+     videoVisible = visible;
+     TRACE_INFO ("video.visible", visible, 0);
+     video_sink_bin_set_visible(data->video_sink, visible);
+     if(visible && data->playing && data->seek_enabled)
+     {
+         resyncTimer->start();
+     }
+     else
+     {
+         resyncTimer->stop();
+     }
+ }
+
+ /* No keyframe came soon enough after the video became visible: seek to the nearest one ahead */
+ void Widget::slotResyncVideo()
+ {
+     gint64 position;
+     if(!video_sink_bin_is_resyncing(data->video_sink) ||
+        !gst_element_query_position(data->playbin2, GST_FORMAT_TIME, &position))
+     {
+         return;
+     }
+     TRACE_INFO ("video.resync-seek", position, 0);
+     seek_to(data, position,
+             GstSeekFlags(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_AFTER));
+ }
+
  void Widget::slotFullScreen(bool flag)
  {
 
@@ -679,6 +2305,7 @@ void Widget::slider_cb(CustomData *data)
      {
          this->showFullScreen();
      }
+     resizeTimer->start();
  }
 
  void Widget::slotmuteButtonClicked()
@@ -704,6 +2331,95 @@ void Widget::slider_cb(CustomData *data)
  }
 
 
+ void Widget::slotPlay()
+ {
+     if(uri == "")
+     {
+         return;
+     }
+     playButtonClicked(NULL,data);
+ }
+
+ void Widget::slotPause()
+ {
+     plauseButtonClicked(NULL,data);
+ }
+
+ void Widget::slotStop()
+ {
+     stopButtonClicked(NULL,data);
+ }
+
+ void Widget::slotNext()
+ {
+     QString fileName = playlist.next();
+     if(fileName != "")
+     {
+         openFile(fileName);
+     }
+ }
+
+ void Widget::slotPrevious()
+ {
+     QString fileName = playlist.previous();
+     if(fileName != "")
+     {
+         openFile(fileName);
+     }
+ }
+
+ void Widget::slotChangeVolume(int volume)
+ {
+     volumeSlider->setValue(volume);
+     slotVolumeChange(volume);
+ }
+
+ void Widget::slotChangeMuting(bool muting)
+ {
+     muteButton->setIcon(style()->standardIcon(muting ? QStyle::SP_MediaVolumeMuted : QStyle::SP_MediaVolume));
+     g_object_set(G_OBJECT(data->playbin2), "mute", muting, NULL);
+     muteFlag = !muting;
+ }
+
+ void Widget::slotChangeRate(qreal rate)
+ {
+     gint64 position;
+     if(uri == "" || !gst_element_query_position(data->playbin2, GST_FORMAT_TIME, &position))
+     {
+         return;
+     }
+     data->rate = rate;
+     seek_to(data, position, GstSeekFlags(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE));
+ }
+
+ void Widget::slotSeek(qint64 position)
+ {
+     if(uri == "")
+     {
+         return;
+     }
+     seek_to(data, position, GstSeekFlags(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT));
+ }
+
+ /* location is a local path, a file:// URI or any URI playbin understands */
+ void Widget::slotOpen(const QString &location)
+ {
+     QUrl url(location);
+     if(location.startsWith("/"))
+     {
+         openFile(location);
+     }
+     else if(url.isLocalFile())
+     {
+         openFile(url.toLocalFile());
+     }
+     else
+     {
+         openUri(location, location);
+     }
+ }
+
+
 #if 0
  m_audioSink = gst_element_factory_make("autoaudiosink", "audiosink");
        if (m_audioSink) {
@@ -13,8 +13,36 @@
 #include <QCloseEvent>
 #include <QTimer>
 #include <QStackedWidget>
+#include <QElapsedTimer>
 #include "videowidget.h"
 #include "playercontrols.h"
+#include "resumestore.h"
+#include "metrics.h"
+#include "metricsserver.h"
+#include "playlist.h"
+#include "remotecontrol.h"
+#include "videosinkbin.h"
+#include "recovery.h"
+#include "watchdog.h"
+#include "avsync.h"
+#include "playbackstate.h"
+#include "prefetcher.h"
+#include "netsync.h"
+#include "livemode.h"
+#include "taskpool.h"
+#include "qoscontrol.h"
+#include "decoderthreads.h"
+#include "waveform.h"
+#include "videoanalytics.h"
+#include "timelineslider.h"
+#include "trackswitch.h"
+
+/* playbin flags */
+typedef enum {
+  GST_PLAY_FLAG_VIDEO = (1 << 0), /* We want video output */
+  GST_PLAY_FLAG_AUDIO = (1 << 1), /* We want audio output */
+  GST_PLAY_FLAG_TEXT  = (1 << 2)  /* We want subtitle output */
+} GstPlayFlags;
 
 /* Structure to contain all our information, so we can pass it around */
 typedef struct _CustomData {
@@ -27,7 +55,21 @@ typedef struct _CustomData {
   gint64 duration;                /* Duration of the clip, in nanoseconds */
   gboolean playing;              /* Are we in the PLAYING state? */
   gboolean seek_enabled;         /* Is seeking enabled for this media? */
+  gdouble rate;                   /* Current playback rate */
+  gint64 resume_position;         /* Position to seek to once prerolled, or -1 */
+  gboolean resume_seeking;        /* Waiting for the resume seek to complete */
+  gint resume_audio;              /* Tracks to select once prerolled, or -1 */
+  gint resume_text;
+  gboolean audio_only;            /* Play without the video branch */
   GstBus *bus;
+  GstElement *video_sink;         /* Our scaling video sink bin, owned by playbin */
+  PlayerMetrics *metrics;         /* Counters updated from the streaming threads */
+  AvSync *av_sync;                /* A/V sync measurements at the sinks */
+  LiveMode *live;                 /* Low latency settings once the source turns out live */
+  TaskPools *task_pools;          /* Threads of the streaming tasks, per role */
+  QosControl *qos;                /* Decoding quality stepped down under overload */
+  TrackSwitch *tracks;            /* Audio and subtitle track switching */
+  QObject *owner;                 /* Widget woken up by the bus sync handler */
 } CustomData;
 
 class Widget : public QWidget
@@ -39,9 +81,30 @@ public:
     ~Widget();
     bool refresh_ui (CustomData *data);
 
+    /* Run the pipeline, and the ones rebuilt later, on this clock instead of the
+     * one chosen by playbin, e.g. a GstTestClock driven by a harness */
+    void setPipelineClock(GstClock *clock);
+
+    /* Used by the seek benchmark: open without resuming and stay prerolled in
+     * PAUSED, then seek through the same path as the slider */
+    void openPaused(const QString &fileName);
+    bool seekLikeSlider(qint64 position, GstSeekFlags flags);
+    qint64 queryDuration();
+    GstElement *videoSink() const;
+
+    /* Used by the video wall sync, which drives the pipeline and its base time */
+    GstElement *pipeline() const;
+    QString currentUri() const;
+    void openPausedUri(const QString &uri);
+
 protected:
     void closeEvent(QCloseEvent *); // 窗口关闭时候应做的处理,退出应用程序。
     void resizeEvent(QResizeEvent *event);
+    void enterEvent(QEvent *event);
+    void changeEvent(QEvent *event);
+    void showEvent(QShowEvent *event);
+    void hideEvent(QHideEvent *event);
+    bool eventFilter(QObject *watched, QEvent *event);
 
 private slots:
     void slotOpenButtonClicked();
@@ -50,11 +113,47 @@ private slots:
     void slotStopButtonClicked();
     void seek(int seconds);
     void slotTimerout();
+    void slotBusMessage();
+    void slotTraceDump();
+    void slotApplyVideoSize();
+    void slotUpdateVideoVisibility();
+    void slotResyncVideo();
+    void slotIdleRelease();
+    void slotRecoveryReady(void *pipeline);
+    void slotStalled(int step, qint64 stalledMs);
+    void slotStallRecovered(int step, qint64 stalledMs);
+    void slotToggleAvSyncOverlay();
+    void slotWaveformUpdated();
+    void slotMarkersUpdated();
+    void slotAnalyzed(int frames, double seconds, double realtime);
+    void slotNextMarker();
+    void slotPreviousMarker();
+    void slotNextAudioTrack();
+    void slotNextSubtitleTrack();
     void slotmuteButtonClicked();
     void slotVolumeChange(int);
 
+signals:
+    void stateChanged(int state);
+    void endOfStream();
+    void errorOccurred(const QString &message);
+    void asyncDone();
+
 public slots:
     void slotFullScreen(bool flag);
+    void slotPlay();
+    void slotPause();
+    void slotStop();
+    void slotNext();
+    void slotPrevious();
+    void slotChangeVolume(int volume);
+    void slotChangeMuting(bool muting);
+    void slotChangeRate(qreal rate);
+    void slotSeek(qint64 position);
+    void slotOpen(const QString &location);
+    void slotSetAudioOnly(bool audioOnly);
+    void slotSelectAudioTrack(int index);
+    void slotSelectSubtitleTrack(int index);
 
 private:
     void playButtonClicked(QPushButton *button, CustomData *data);
@@ -62,11 +161,38 @@ private:
     void stopButtonClicked(QPushButton *button,CustomData *data);
     void delete_event_cb (QWidget *widget, QEvent *event, CustomData *data);
     bool expose_cb(QWidget *widget, QEvent *event, CustomData *data);
+    bool create_pipeline(CustomData *data);
+    void attach_pipeline(CustomData *data, GstElement *playbin);
+    void handle_error(CustomData *data, GError *err);
+    void start_recovery(CustomData *data, const QString &reason);
+    void give_up(CustomData *data, const QString &reason);
+    gboolean seek_to(CustomData *data, gint64 position, GstSeekFlags flags);
+    void openFile(const QString &fileName);
+    void openUri(const QString &newUri, const QString &label, bool audioOnly = false, bool paused = false);
+    void apply_play_flags(CustomData *data);
+    void show_audio_metadata(CustomData *data);
     void createUi(CustomData *data);
     void slider_cb (CustomData *data);
     void analyze_streams(CustomData *data);
     void realize_cb (QWidget *widget, CustomData *data);
     void handle_message (CustomData *data, GstMessage *msg);
+    void process_bus (CustomData *data);
+    void save_resume_state (CustomData *data);
+    void restore_resume_state (CustomData *data);
+    void report_video_session (CustomData *data);
+    void report_session_resources (CustomData *data);
+    void report_threads (CustomData *data);
+    void rearm_pipeline (CustomData *data);
+    void show_av_sync_stats (CustomData *data);
+    void write_av_sync_report (CustomData *data);
+    void correct_av_offset (CustomData *data);
+    void enter_live_mode (CustomData *data);
+    void show_live_status (CustomData *data);
+    void adapt_quality (CustomData *data);
+    void jump_to_marker (CustomData *data, int direction);
+    void select_track (CustomData *data, TrackType type, int index);
+    void select_preferred_tracks (CustomData *data);
+    void report_track_switch (CustomData *data);
 
 private:
     VideoWidget *displayWnd;
@@ -74,7 +200,7 @@ private:
     QStackedWidget *renderWnd;
     QHBoxLayout *timeLayout;
     QLabel *timeLabel;
-    QSlider *slider;
+    TimelineSlider *slider;
     QLabel *infoLabel;
     QPushButton *openBtn;
     QPushButton *startBtn;
@@ -87,10 +213,57 @@ private:
     QHBoxLayout *buttonLayout;
     CustomData *data;
     QTimer   *queryTimer;
+    QTimer   *resizeTimer;
+    QTimer   *resyncTimer;
+    QTimer   *idleTimer;
     QString  uri;
     GstBus *bus;
+    ResumeStore resumeStore;
+    PlayerMetrics metrics;
+    MetricsServer *metricsServer;
+    RemoteControl *remoteControl;
+    StallWatchdog *watchdog;
+    Prefetcher *prefetcher;
+    WaveformBuilder *waveform;
+    VideoAnalyzer *analyzer;
+    NetSync *netSync;
+    GstClock *pipelineClock;
+    Playlist playlist;
+    QString mediaLabel;
+
+    /* Resource use of the current session, and totals per mode (0 video, 1 audio-only) */
+    QElapsedTimer sessionClock;
+    guint64 sessionCpuStart;
+    guint64 sessionRssPeak;
+    bool sessionAudioOnly;
+    double modeCpuSeconds[2];
+    double modeWallSeconds[2];
+    double modeRssPeakSum[2];
+    int modeSessions[2];
+
+    /* Pipeline rebuilds after transient errors */
+    bool recovering;
+    int recoveryAttempt;
+    QElapsedTimer recoveryClock;    /* Since the error that started the current recovery */
+    QElapsedTimer lastRecovery;     /* Since playback last came back */
+    gint64 recoveryPosition;
+    gint recoveryAudio;
+    gint recoveryText;
+
+    /* Tracks were remembered or chosen for the current file, no language preference applies */
+    bool tracksChosen;
+
+    /* Open to first frame of the current file, reported once it prerolls */
+    QElapsedTimer openClock;
+    bool openPrefetched;
+
+    bool avSyncOverlay;
+    bool avSyncCorrect;             /* QTGSPLAYER_AV_CORRECT=1 */
+    QElapsedTimer avSyncCorrectClock;
 
     bool   muteFlag;
+    bool   videoVisible;
+    bool   idleReleased;
 };
 
 #endif // WIDGET_H